@@ -51,6 +51,14 @@ void testAccBootStrap() {
     // clone the clock for later comparison
     T *clk_flux = _t_clone(clock->flux);
 
+    // and define a process that gets compiled
+    T *code = _t_parse(G_vm->sem,0,"(ADD_INT (PARAM_REF:/2/1) (PARAM_REF:/2/1))");
+    T *signature = __p_make_signature("result",SIGNATURE_STRUCTURE,INTEGER,
+                                      "n",SIGNATURE_STRUCTURE,INTEGER,
+                                      NULL);
+    Process twice = _d_define_process(G_vm->sem,code,"twice","double n",signature,NULL,clock->context);
+    spec_is_true(_sem_get_bytecode(G_vm->sem,twice) != NULL);
+
     // now shut down the vm
     _a_shut_down();
     spec_is_ptr_equal(G_vm,NULL);
@@ -64,6 +72,14 @@ void testAccBootStrap() {
     Xaddr x = {CLOCK_RECEPTOR,1};
     T *ct = _r_get_instance(G_vm->r,x);
     spec_is_false(ct == NULL);
+
+    // and the restored definitions can be looked up
+    spec_is_str_equal(_sem_get_name(G_vm->sem,CLOCK_RECEPTOR),"CLOCK_RECEPTOR");
+    spec_is_str_equal(_sem_get_name(G_vm->sem,ADD_INT),"ADD_INT");
+
+    // bytecode isn't saved so the restored processes get compiled again
+    spec_is_str_equal(_sem_get_name(G_vm->sem,twice),"twice");
+    spec_is_true(_sem_get_bytecode(G_vm->sem,twice) != NULL);
     /* Receptor *cr = __r_get_receptor(ct); */
 
     /* char buf1[1000]; */
@@ -182,7 +198,7 @@ void testAccToken() {
     token1 = _a_gen_token(&i,x,d1);
     token2 = _a_gen_token(&i,x,d2);
 
-    spec_is_str_equal(t2s(i),"(INSTANCE_STORE (INSTANCES (SYMBOL_INSTANCES:TEST_INT_SYMBOL (TEST_INT_SYMBOL:1))) (INSTANCE_TOKENS (LAST_TOKEN:2) (INSTANCE_TOKEN:1 (TOKEN_XADDR:TEST_INT_SYMBOL.1) (DEPENDENCY_HASH:-1641288256)) (INSTANCE_TOKEN:2 (TOKEN_XADDR:TEST_INT_SYMBOL.1) (DEPENDENCY_HASH:1282387645))))");
+    spec_is_str_equal(t2s(i),"(INSTANCE_STORE (INSTANCES (SYMBOL_INSTANCES:TEST_INT_SYMBOL (TEST_INT_SYMBOL:1))) (INSTANCE_TOKENS (LAST_TOKEN:2) (INSTANCE_TOKEN:1 (TOKEN_XADDR:TEST_INT_SYMBOL.1) (DEPENDENCY_HASH:3080032960707415518)) (INSTANCE_TOKEN:2 (TOKEN_XADDR:TEST_INT_SYMBOL.1) (DEPENDENCY_HASH:-8968186296762585427))))");
 
     // test getting back xaddrs from tokens and their dependency
     xx = _a_get_token_xaddr(&i,token1,d1);
@@ -201,7 +217,7 @@ void testAccToken() {
     xx = _a_get_token_xaddr(&i,token1,d3);
     spec_is_true(is_null_xaddr(xx));
     _a_add_dependency(&i,token1,d3);
-    char *with_two_dependencies = "(INSTANCE_STORE (INSTANCES (SYMBOL_INSTANCES:TEST_INT_SYMBOL (TEST_INT_SYMBOL:1))) (INSTANCE_TOKENS (LAST_TOKEN:2) (INSTANCE_TOKEN:1 (TOKEN_XADDR:TEST_INT_SYMBOL.1) (DEPENDENCY_HASH:-1641288256) (DEPENDENCY_HASH:-226474859)) (INSTANCE_TOKEN:2 (TOKEN_XADDR:TEST_INT_SYMBOL.1) (DEPENDENCY_HASH:1282387645))))";
+    char *with_two_dependencies = "(INSTANCE_STORE (INSTANCES (SYMBOL_INSTANCES:TEST_INT_SYMBOL (TEST_INT_SYMBOL:1))) (INSTANCE_TOKENS (LAST_TOKEN:2) (INSTANCE_TOKEN:1 (TOKEN_XADDR:TEST_INT_SYMBOL.1) (DEPENDENCY_HASH:3080032960707415518) (DEPENDENCY_HASH:-4540564231060930567)) (INSTANCE_TOKEN:2 (TOKEN_XADDR:TEST_INT_SYMBOL.1) (DEPENDENCY_HASH:-8968186296762585427))))";
     spec_is_str_equal(t2s(i),with_two_dependencies);
     // check that dependency isn't added in twice
     _a_add_dependency(&i,token1,d3);
@@ -215,13 +231,13 @@ void testAccToken() {
 
     // test deleting a dependency
     _a_delete_dependency(&i,token1,d3);
-    spec_is_str_equal(t2s(i),"(INSTANCE_STORE (INSTANCES (SYMBOL_INSTANCES:TEST_INT_SYMBOL (TEST_INT_SYMBOL:1))) (INSTANCE_TOKENS (LAST_TOKEN:2) (INSTANCE_TOKEN:1 (TOKEN_XADDR:TEST_INT_SYMBOL.1) (DEPENDENCY_HASH:-1641288256)) (INSTANCE_TOKEN:2 (TOKEN_XADDR:TEST_INT_SYMBOL.1) (DEPENDENCY_HASH:1282387645))))");
+    spec_is_str_equal(t2s(i),"(INSTANCE_STORE (INSTANCES (SYMBOL_INSTANCES:TEST_INT_SYMBOL (TEST_INT_SYMBOL:1))) (INSTANCE_TOKENS (LAST_TOKEN:2) (INSTANCE_TOKEN:1 (TOKEN_XADDR:TEST_INT_SYMBOL.1) (DEPENDENCY_HASH:3080032960707415518)) (INSTANCE_TOKEN:2 (TOKEN_XADDR:TEST_INT_SYMBOL.1) (DEPENDENCY_HASH:-8968186296762585427))))");
     xx = _a_get_token_xaddr(&i,token1,d3);
     spec_is_true(is_null_xaddr(xx));
 
     // test deleting a token
     _a_delete_token(&i,token1);
-    spec_is_str_equal(t2s(i),"(INSTANCE_STORE (INSTANCES (SYMBOL_INSTANCES:TEST_INT_SYMBOL (TEST_INT_SYMBOL:1))) (INSTANCE_TOKENS (LAST_TOKEN:2) (INSTANCE_TOKEN:2 (TOKEN_XADDR:TEST_INT_SYMBOL.1) (DEPENDENCY_HASH:1282387645))))");
+    spec_is_str_equal(t2s(i),"(INSTANCE_STORE (INSTANCES (SYMBOL_INSTANCES:TEST_INT_SYMBOL (TEST_INT_SYMBOL:1))) (INSTANCE_TOKENS (LAST_TOKEN:2) (INSTANCE_TOKEN:2 (TOKEN_XADDR:TEST_INT_SYMBOL.1) (DEPENDENCY_HASH:-8968186296762585427))))");
 
     _t_free(token1);
     _t_free(token2);
@@ -37,7 +37,8 @@ Symbol A,B,C,D,E,F,Root;
 jmp_buf G_err;
 
 int main(int argc, const char **argv) {
-    printf("Running all tests...\n\n");
+    G_bench = argc > 1 && !strcmp(argv[1],"--bench");
+    printf(G_bench ? "Running all tests with full size benchmarks...\n\n" : "Running all tests...\n\n");
 
     int err;
     if ((err = setjmp(G_err))) {
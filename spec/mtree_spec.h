@@ -59,6 +59,10 @@ void _walkfn(H h,N *n,void *data,MwalkState *state,Maddr ap) {
     //    sprintf(s,(char *)"%d.%d:%s, ",ac.l,ac.i,(char *) (on->flags &TFLAG_ALLOCATED?on->surface:&on->surface));
     sprintf(s,(char *)"%d.%d, ",h.a.l,h.a.i);
 }
+void _countfn(H h,N *n,void *data,MwalkState *state,Maddr ap) {
+    (*(int *)data)++;
+}
+
 void testCreateTreeNodesM(){
 
     H h,h1,h11,h2,h21,h22,h3;
@@ -272,6 +276,49 @@ void testMTreeWalk() {
     _m_free(h);
     _t_free(t);
     //! [testMTreeWalk]
+
+    // walk an mtree whose leaves were added round-robin across their parents so the
+    // last level isn't in parent order and has to be sorted into the index
+    // (1M nodes when benchmarking)
+    int n = bench_size(1000,30);
+    h = _m_new_root(LINES);
+    int i,j;
+    for(i=0;i<n;i++) _m_newr(h,LINES);
+    for(j=0;j<n-1;j++) {
+        H p = {h.m,{1,0}};
+        for(p.a.i=0;p.a.i<n;p.a.i++) _m_newi(p,TEST_INT_SYMBOL,j);
+    }
+    uint64_t start = monotonic_ns();
+    int count = 0;
+    _m_walk(h,_countfn,&count);
+    uint64_t walk_time = monotonic_ns() - start;
+    spec_is_equal(count,n*n+1);
+
+    start = monotonic_ns();
+    H p = h,c = h;
+    int sum = 0;
+    for(i=1;i<=n;i++) {
+        p.a = _m_child(h,i);
+        for(j=1;j<=n-1;j++) {
+            c.a = _m_child(p,j);
+            sum += *(int *)_m_surface(c);
+        }
+    }
+    uint64_t child_time = monotonic_ns() - start;
+    spec_is_equal(sum,n*(n-1)*(n-2)/2);
+    c.a = _m_child(p,n-2);
+    c.a = _m_next_sibling(c);
+    spec_is_equal(*(int *)_m_surface(c),n-2);
+    spec_is_maddr_equal(_m_next_sibling(c),null_H.a);
+    bench_report("%d node mtree: walking took %ldus, looking up every node by child index %ldus\n",n*n+1,walk_time/1000,child_time/1000);
+    _m_free(h);
+}
+
+// build an mtree from a ttree one node at a time
+H _testBuildM(H parent,T *t) {
+    H h = __m_new(parent,_t_symbol(t),_t_surface(t),_t_size(t),0);
+    DO_KIDS(t,_testBuildM(h,_t_child(t,i)));
+    return h;
 }
 
 void testTreeConvert() {
@@ -326,6 +373,38 @@ void testTreeConvert() {
     _t_free(n);
     _t_free(t);
     //! [testMTreeSerialize]
+
+    // converting in bulk matches building the mtree a node at a time
+    // (on a 101001 node tree when benchmarking)
+    int lines = bench_size(1000,20);
+    t = _t_new_root(LINES);
+    int i,j;
+    for(i=0;i<lines;i++) {
+        T *l = _t_newr(t,LINES);
+        for(j=0;j<100;j++) _t_new_str(l,LINE,"some line of text");
+    }
+    uint64_t start = monotonic_ns();
+    h = _testBuildM(null_H,t);
+    h.a.l = h.a.i = 0;
+    uint64_t node_time = monotonic_ns() - start;
+    S *s = _m_serialize(h.m);
+    _m_free(h);
+
+    start = monotonic_ns();
+    h = _m_new_from_t(t);
+    uint64_t bulk_time = monotonic_ns() - start;
+    S *s1 = _m_serialize(h.m);
+    uint64_t serialize_time = monotonic_ns() - start;
+    spec_is_long_equal(s1->total_size,s->total_size);
+    spec_is_true(!memcmp(s1,s,s->total_size));
+    t1 = _t_new_from_m(h);
+    spec_is_long_equal(_t_hash(G_sem,t1),_t_hash(G_sem,t));
+    _t_free(t1);
+    bench_report("%d node tree to mtree: a node at a time took %ldus, in bulk %ldus (%ldus with serializing)\n",lines*101+1,node_time/1000,bulk_time/1000,serialize_time/1000);
+    _m_free(h);
+    free(s);
+    free(s1);
+    _t_free(t);
 }
 
 void testMTreeSerialize() {
@@ -335,7 +414,7 @@ void testMTreeSerialize() {
     S *s = _m_serialize(h.m);
 
     spec_is_equal(s->magic,h.m->magic);
-    spec_is_equal(s->total_size,929);
+    spec_is_equal(s->total_size,960);
     spec_is_equal(s->levels,h.m->levels);
     spec_is_equal(s->level_offsets[0],0);
     L *l = GET_LEVEL(h);
@@ -398,6 +477,210 @@ void testMTreeSerialize() {
     _m_free(h1);
 }
 
+// repack an image into the unpadded layout mtrees were serialized with before it was versioned
+S *_testMTreeV0Image(S *s) {
+    S *o = malloc(s->total_size);
+    memset(o,0,s->total_size);
+    uint32_t s_size = sizeof(S)+sizeof(uint32_t)*s->levels;
+    memcpy(o,s,s_size);
+    o->version = 0;
+    uint32_t levels_size = 0;
+    Mlevel l;
+    Mindex i,nodes;
+    for(l=0;l<s->levels;l++) {
+        void *sl = (void *)s+SERIALIZED_HEADER_SIZE(s->levels)+s->level_offsets[l];
+        nodes = *(Mindex *)sl;
+        o->level_offsets[l] = levels_size;
+        memcpy((void *)o+s_size+levels_size,sl,sizeof(Mindex));
+        memcpy((void *)o+s_size+levels_size+sizeof(Mindex),sl+SERIALIZED_NODES_OFFSET,SERIALIZED_NODE_SIZE*nodes);
+        levels_size += sizeof(Mindex)+SERIALIZED_NODE_SIZE*nodes;
+    }
+    o->blob_offset = s_size+levels_size;
+    void *blob = (void *)o+o->blob_offset;
+    size_t blob_size = 0;
+    for(l=0;l<s->levels;l++) {
+        void *ol = (void *)o+s_size+o->level_offsets[l];
+        memcpy(&nodes,ol,sizeof(Mindex));
+        for(i=0;i<nodes;i++) {
+            N n;
+            void *on = ol+sizeof(Mindex)+SERIALIZED_NODE_SIZE*i;
+            memcpy(&n,on,SERIALIZED_NODE_SIZE);
+            if (!(n.flags & TFLAG_ALLOCATED)) continue;
+            void *surface = (void *)s+s->blob_offset+*(size_t *)&n.surface;
+            *(size_t *)&n.surface = blob_size;
+            if (n.flags & TFLAG_SURFACE_IS_TREE) {
+                S *os = _testMTreeV0Image(surface);
+                memcpy(blob+blob_size,os,os->total_size);
+                blob_size += os->total_size;
+                free(os);
+            }
+            else {
+                memcpy(blob+blob_size,surface,n.size);
+                blob_size += n.size;
+            }
+            memcpy(on,&n,SERIALIZED_NODE_SIZE);
+        }
+    }
+    o->total_size = o->blob_offset+blob_size;
+    return o;
+}
+
+void testMTreeView() {
+    //! [testMTreeView]
+    T *t = _makeTestHTTPRequestTree(); // GET /groups/5/users.json?sort_by=last_name?page=2 HTTP/1.0
+    H h = _m_new_from_t(t);
+    S *s = _m_serialize(h.m);
+    _m_free(h);
+    S *image = malloc(s->total_size);
+    memcpy(image,s,s->total_size);
+
+    // images record the layout they were serialized with, and ones from a later layout
+    // can't be read
+    spec_is_equal(s->version,SERIALIZED_VERSION);
+    spec_is_true(_m_serialized_ok(s));
+    image->version = SERIALIZED_VERSION+1;
+    spec_is_false(_m_serialized_ok(image));
+    image->version = SERIALIZED_VERSION;
+
+    // a view navigates the serialized image in place
+    h = _m_view(s);
+    spec_is_ptr_equal(h.m->view,s);
+    spec_is_sem_equal(_m_symbol(h),HTTP_REQUEST_LINE);
+    spec_is_equal(_m_children(h),3);
+    H c = {h.m,_m_child(h,2)};
+    spec_is_sem_equal(_m_symbol(c),HTTP_REQUEST_METHOD);
+    spec_is_str_equal((char *)_m_surface(c),"GET");
+    spec_is_true(_m_surface(c) > (void *)s && _m_surface(c) < (void *)s+s->total_size);
+    H v = {h.m,_m_child(h,1)};
+    v.a = _m_child(v,1);
+    spec_is_sem_equal(_m_symbol(v),VERSION_MAJOR);
+    spec_is_equal(*(int *)_m_surface(v),1);
+
+    T *t1 = _t_new_from_m(h);
+    char buf[2000] = {0};
+    char buf1[2000] = {0};
+    __t_dump(G_sem,t,0,buf);
+    __t_dump(G_sem,t1,0,buf1);
+    spec_is_str_equal(buf1,buf);
+
+    S *s1 = _m_serialize(h.m);
+    spec_is_true(!memcmp(s1,s,s->total_size));
+
+    // adding to a view materializes it, leaving handles valid and the image untouched
+    _m_newi(c,TEST_INT_SYMBOL,1);
+    spec_is_ptr_equal(h.m->view,NULL);
+    spec_is_str_equal((char *)_m_surface(c),"GET");
+    spec_is_equal(_m_children(c),1);
+    spec_is_true(!memcmp(s,image,s->total_size));
+    _m_free(h);
+
+    // the serialized nodes are aligned for use in place, but an image that isn't (i.e.
+    // one embedded at an odd offset in some other buffer) gets materialized instead
+    spec_is_equal(s->total_size % SERIALIZED_ALIGN,0);
+    h = _m_view(s);
+    spec_is_equal((uintptr_t)h.m->lP[1].nP % SERIALIZED_ALIGN,0);
+    _m_free(h);
+    char *buffer = malloc(s->total_size+1);
+    memcpy(buffer+1,s,s->total_size);
+    h = _m_view((S *)(buffer+1));
+    free(buffer);
+    spec_is_ptr_equal(h.m->view,NULL);
+    T *t2 = _t_new_from_m(h);
+    buf1[0] = 0;
+    __t_dump(G_sem,t2,0,buf1);
+    spec_is_str_equal(buf1,buf);
+    _t_free(t2);
+    //! [testMTreeView]
+    _m_free(h);
+    _t_free(t1);
+    free(s1);
+
+    // images in the unpadded layout from before it was versioned are copied out rather
+    // than viewed in place, and serializing them again writes the current layout
+    S *v0 = _testMTreeV0Image(s);
+    spec_is_true(v0->total_size < s->total_size);
+    spec_is_true(_m_serialized_ok(v0));
+    h = _m_unserialize(v0);
+    spec_is_ptr_equal(h.m->view,NULL);
+    t2 = _t_new_from_m(h);
+    buf1[0] = 0;
+    __t_dump(G_sem,t2,0,buf1);
+    spec_is_str_equal(buf1,buf);
+    _t_free(t2);
+    s1 = _m_serialize(h.m);
+    spec_is_equal(s1->version,SERIALIZED_VERSION);
+    spec_is_equal(s1->total_size,s->total_size);
+    spec_is_true(!memcmp(s1,s,s->total_size));
+    free(s1);
+    free(v0);
+    _m_free(h);
+    free(s);
+    free(image);
+
+    // views of orthogonal trees, mapped in from a file
+    H h1 = _m_newr(null_H,ADD_INT);
+    _m_newi(h1,TEST_INT_SYMBOL,314);
+    _m_newi(h1,TEST_INT_SYMBOL,1000);
+    H h2 = _m_newt(null_H,TEST_TREE_SYMBOL,h1);
+    h = _m_newt(null_H,TEST_TREE_SYMBOL,h2);
+    s = _m_serialize(h.m);
+    writeFile("web/test.cmt",s,s->total_size);
+    free(s);
+    _m_free(h);
+
+    size_t size;
+    s = mapFile("web/test.cmt",&size);
+    spec_is_long_equal(size,s->total_size);
+    h = _m_view(s);
+    t1 = _t_new_from_m(h);
+    spec_is_str_equal(t2s(t1),"(TEST_TREE_SYMBOL:{(TEST_TREE_SYMBOL:{(process:ADD_INT (TEST_INT_SYMBOL:314) (TEST_INT_SYMBOL:1000))})})");
+    _t_free(t1);
+    v0 = _testMTreeV0Image(s);
+    _m_materialize(h);
+    unmapFile(s,size);
+    t1 = _t_new_from_m(h);
+    spec_is_str_equal(t2s(t1),"(TEST_TREE_SYMBOL:{(TEST_TREE_SYMBOL:{(process:ADD_INT (TEST_INT_SYMBOL:314) (TEST_INT_SYMBOL:1000))})})");
+    _t_free(t1);
+    _m_free(h);
+
+    // including the orthogonal trees in an unpadded image
+    h = _m_view(v0);
+    free(v0);
+    t1 = _t_new_from_m(h);
+    spec_is_str_equal(t2s(t1),"(TEST_TREE_SYMBOL:{(TEST_TREE_SYMBOL:{(process:ADD_INT (TEST_INT_SYMBOL:314) (TEST_INT_SYMBOL:1000))})})");
+    _t_free(t1);
+    _m_free(h);
+
+    // a view of a larger tree matches unserializing it (compared on a 101001 node tree
+    // when benchmarking)
+    int n = bench_size(1000,20);
+    t = _t_new_root(LINES);
+    int i,j;
+    for(i=0;i<n;i++) {
+        T *l = _t_newr(t,LINES);
+        for(j=0;j<100;j++) _t_new_str(l,LINE,"some line of text");
+    }
+    h = _m_new_from_t(t);
+    s = _m_serialize(h.m);
+    _m_free(h);
+    uint64_t start = monotonic_ns();
+    h = _m_unserialize(s);
+    uint64_t unserialize_time = monotonic_ns() - start;
+    _m_free(h);
+    start = monotonic_ns();
+    h = _m_view(s);
+    uint64_t view_time = monotonic_ns() - start;
+    start = monotonic_ns();
+    t1 = _t_new_from_m(h);
+    uint64_t convert_time = monotonic_ns() - start;
+    spec_is_equal(_t_children(t1),n);
+    spec_is_long_equal(_t_hash(G_sem,t1),_t_hash(G_sem,t));
+    bench_report("%d node mtree: unserializing took %ldus, a view %ldus, converting the view to a tree %ldus\n",n*101+1,unserialize_time/1000,view_time/1000,convert_time/1000);
+    _m_free(h);
+    _t_free(t1);
+    _t_free(t);
+    free(s);
+}
 
 void testMTree() {
     testCreateTreeNodesM();
@@ -406,4 +689,5 @@ void testMTree() {
     testMTreeWalk();
     testTreeConvert();
     testMTreeSerialize();
+    testMTreeView();
 }
@@ -274,6 +274,77 @@ void testProcessTranscode() {
     _r_free(r);
 }
 
+// reduce a request line through the semtrex based ascii_chars_2_http_req transcoder
+T *_testSemtrexHTTPRequest(char *line) {
+    T *n = _t_new_root(ascii_chars_2_http_req);
+    T *chars = _t_newr(n,ASCII_CHARS);
+    while (*line) _t_newc(chars,ASCII_CHAR,*line++);
+    T *t = _t_new_root(RUN_TREE);
+    _t_add(t,_t_rclone(n));
+    _t_free(n);
+    spec_is_equal(_p_reduce(G_sem,t),noReductionErr);
+    return t;
+}
+
+void testProcessNativeHTTPRequest() {
+    //! [testProcessNativeHTTPRequest]
+    char *line = "GET /path/to/file.ext?name=joe&age=30 HTTP/1.1";
+    T *t = _p_bytes_2_http_req(line,strlen(line));
+    spec_is_str_equal(t2s(t),"(HTTP_REQUEST (HTTP_REQUEST_METHOD:GET) (HTTP_REQUEST_PATH (HTTP_REQUEST_PATH_SEGMENTS (HTTP_REQUEST_PATH_SEGMENT:path) (HTTP_REQUEST_PATH_SEGMENT:to) (HTTP_REQUEST_PATH_SEGMENT:file.ext))) (HTTP_REQUEST_PATH_QUERY (HTTP_REQUEST_PATH_QUERY_PARAMS (HTTP_REQUEST_PATH_QUERY_PARAM (PARAM_KEY:name) (PARAM_VALUE:joe)) (HTTP_REQUEST_PATH_QUERY_PARAM (PARAM_KEY:age) (PARAM_VALUE:30)))) (HTTP_REQUEST_VERSION (VERSION_MAJOR:1) (VERSION_MINOR:1)))");
+    _t_free(t);
+
+    // a line ending after the version is ignored
+    line = "POST /form HTTP/1.0\r\n";
+    t = _p_bytes_2_http_req(line,strlen(line));
+    spec_is_str_equal(t2s(t),"(HTTP_REQUEST (HTTP_REQUEST_METHOD:POST) (HTTP_REQUEST_PATH (HTTP_REQUEST_PATH_SEGMENTS (HTTP_REQUEST_PATH_SEGMENT:form))) (HTTP_REQUEST_VERSION (VERSION_MAJOR:1) (VERSION_MINOR:0)))");
+    _t_free(t);
+
+    // it's what transcoding to an HTTP_REQUEST uses
+    spec_is_true(_p_get_native_transcoder(G_sem,HTTP_REQUEST) == _p_bytes_2_http_req);
+    spec_is_true(_p_get_native_transcoder(G_sem,HTTP_RESPONSE) == NULL);
+
+    // and anything that isn't a request line doesn't parse, including one with
+    // anything but a line ending after the version
+    char *bad[] = {"GET"," /path HTTP/1.1","GET  /path HTTP/1.1","GET path HTTP/1.1","GET /path?=x HTTP/1.1","GET /path?a HTTP/1.1","GET /path? HTTP/1.1","GET /path?a=1&&b=2 HTTP/1.1","GET /path?a=1&b HTTP/1.1","GET /path HTTP/1","GET /path HTTP/.1","GET /path FTP/1.1","GET /path HTTP/1.1 extra","GET /path HTTP/1.1x","GET /path HTTP/1.1\rjunk"};
+    int i;
+    for(i=0;i<sizeof(bad)/sizeof(char *);i++) {
+        spec_is_ptr_equal(_p_bytes_2_http_req(bad[i],strlen(bad[i])),NULL);
+    }
+    //! [testProcessNativeHTTPRequest]
+
+    // for the HTTP/0.9 lines the semtrex transcoder matches, both build the same tree
+    char *lines[] = {
+        "GET /path/to/file.ext HTTP/0.9",
+        "GET /path/to/file.ext?name=joe&age=30 HTTP/0.9\n",
+        "POST / HTTP/0.9",
+        "GET //a/ HTTP/0.9",
+        "GET /x?k= HTTP/0.9",
+        "GET /x?a=1&b=c=d& HTTP/0.9",
+        "GET /x/?a=b?c HTTP/0.9\n\n",
+        "HEAD /x/y.html?q=/?&r=%20 HTTP/0.9\r\n"
+    };
+    char expected[1000];
+    for(i=0;i<sizeof(lines)/sizeof(char *);i++) {
+        T *s = _testSemtrexHTTPRequest(lines[i]);
+        strcpy(expected,t2s(_t_child(s,1)));
+        _t_free(s);
+        t = _p_bytes_2_http_req(lines[i],strlen(lines[i]));
+        spec_is_str_equal(t2s(t),expected);
+        _t_free(t);
+    }
+
+    // compare request throughput of the two transcoders
+    int reps = bench_size(200,10);
+    line = lines[1];
+    uint64_t start = monotonic_ns();
+    for(i=0;i<reps;i++) _t_free(_testSemtrexHTTPRequest(line));
+    uint64_t semtrex_time = monotonic_ns() - start;
+    start = monotonic_ns();
+    for(i=0;i<reps;i++) _t_free(_p_bytes_2_http_req(line,strlen(line)));
+    uint64_t native_time = monotonic_ns() - start;
+    bench_report("http requests/sec semtrex: %ld native: %ld\n",reps*1000000000L/(semtrex_time+1),reps*1000000000L/(native_time+1));
+}
+
 void testProcessDissolve() {
     T *n = _t_new_root(DISSOLVE);
     spec_is_equal(__p_reduce_sys_proc(0,DISSOLVE,n,0),structureMismatchReductionErr);
@@ -428,6 +499,17 @@ void testProcessCond(){
     spec_is_str_equal(t2s(_t_child(t,1)),"(ASCII_CHAR:'y')");
     _t_free(t);
     _t_free(n);
+
+    // conditions and results that are processes get reduced after being swapped in
+    t = _t_new_root(RUN_TREE);
+    n = _t_parse(G_sem,0,"(COND (CONDITIONS (COND_PAIR (LT_INT (TEST_INT_SYMBOL:3) (TEST_INT_SYMBOL:2)) (TEST_INT_SYMBOL:0)) (COND_PAIR (LT_INT (TEST_INT_SYMBOL:1) (TEST_INT_SYMBOL:2)) (ADD_INT (TEST_INT_SYMBOL:1) (TEST_INT_SYMBOL:2))) (COND_ELSE (TEST_INT_SYMBOL:0))))");
+    c = _t_rclone(n);
+    _t_add(t,c);
+    _p_reduce(G_sem,t);
+
+    spec_is_str_equal(t2s(_t_child(t,1)),"(TEST_INT_SYMBOL:3)");
+    _t_free(t);
+    _t_free(n);
 }
 
 void testProcessSym() {
@@ -559,6 +641,23 @@ void testProcessIntMath() {
     spec_is_str_equal(t2s(n),"(BOOLEAN:1)");
     _t_free(n);
 
+    // results are made by changing a param, which mustn't keep the param's cached hash
+    n = _t_new_root(ADD_INT);
+    _t_newi(n,TEST_INT_SYMBOL,99);
+    _t_newi(n,TEST_INT_SYMBOL,100);
+    _t_hash_cached(G_sem,n);
+    __p_reduce_sys_proc(0,ADD_INT,n,0);
+    spec_is_long_equal(_t_hash_cached(G_sem,n),_t_hash(G_sem,n));
+    _t_free(n);
+
+    n = _t_new_root(GT_INT);
+    _t_newi(n,TEST_INT_SYMBOL,101);
+    _t_newi(n,TEST_INT_SYMBOL,100);
+    _t_hash_cached(G_sem,n);
+    __p_reduce_sys_proc(0,GT_INT,n,0);
+    spec_is_long_equal(_t_hash_cached(G_sem,n),_t_hash(G_sem,n));
+    _t_free(n);
+
 }
 
 void testProcessPath() {
@@ -596,6 +695,16 @@ void testProcessString() {
     spec_is_str_equal(t2s(n),"(TEST_NAME_SYMBOL:Fred Smith)");
     _t_free(n);
 
+    // the concatenation is built in the first string's node, which mustn't keep its cached hash
+    n = _t_new_root(CONCAT_STR);
+    _t_new_str(n,TEST_STR_SYMBOL,"Fred");
+    _t_new_str(n,TEST_STR_SYMBOL,"!");
+    _t_hash_cached(G_sem,n);
+    spec_is_equal(__p_reduce_sys_proc(c,CONCAT_STR,n,r->q),noReductionErr);
+    spec_is_str_equal(t2s(n),"(TEST_STR_SYMBOL:Fred!)");
+    spec_is_long_equal(_t_hash_cached(G_sem,n),_t_hash(G_sem,n));
+    _t_free(n);
+
     // test string to char tree conversion
     n = _t_new_root(EXPAND_STR);
     _t_new_str(n,TEST_STR_SYMBOL,"fish");
@@ -1076,8 +1185,10 @@ void testProcessStream() {
     spec_is_equal(c->state,Block);
 
     // wait for read to complete, after which it should have also unblocked the
-    // context which should thus be ready for reduction again.
-    while(!(st->flags&StreamHasData) && st->flags&StreamAlive ) {sleepms(1);};
+    // context which should thus be ready for reduction again.  (The data arrives
+    // before the reader's callback does the unblocking, so we wait for that.)
+    while(!q->contexts_count && st->flags&StreamAlive ) {sleepms(1);};
+    spec_is_true(st->flags&StreamHasData);
     spec_is_equal(q->contexts_count,1);
 
     spec_is_equal(_p_reduceq(q),noReductionErr);
@@ -1092,7 +1203,7 @@ void testProcessStream() {
     _t_free(n);
     e = _p_addrt2q(q,run_tree);
     spec_is_equal(_p_reduceq(q),noReductionErr);
-    while(!(st->flags&StreamHasData) && st->flags&StreamAlive ) {sleepms(1);};
+    while(!q->contexts_count && st->flags&StreamAlive ) {sleepms(1);};
     spec_is_equal(_p_reduceq(q),noReductionErr);
     spec_is_str_equal(t2s(run_tree),"(RUN_TREE (ASCII_CHARS (ASCII_CHAR:'a') (ASCII_CHAR:'b') (ASCII_CHAR:'c')) (PARAMS))");
 
@@ -1105,7 +1216,7 @@ void testProcessStream() {
     _t_free(n);
     e = _p_addrt2q(q,run_tree);
     spec_is_equal(_p_reduceq(q),noReductionErr);
-    while(!(st->flags&StreamHasData) && st->flags&StreamAlive ) {sleepms(1);};
+    while(!q->contexts_count && st->flags&StreamAlive ) {sleepms(1);};
     spec_is_equal(_p_reduceq(q),noReductionErr);
     spec_is_str_equal(t2s(run_tree),"(RUN_TREE (HTTP_REQUEST (HTTP_REQUEST_METHOD:GET) (HTTP_REQUEST_PATH (HTTP_REQUEST_PATH_SEGMENTS (HTTP_REQUEST_PATH_SEGMENT:path) (HTTP_REQUEST_PATH_SEGMENT:to) (HTTP_REQUEST_PATH_SEGMENT:file.ext))) (HTTP_REQUEST_VERSION (VERSION_MAJOR:0) (VERSION_MINOR:9))) (PARAMS))");
 
@@ -1812,6 +1923,351 @@ void testProcessMulti() {
     //! [testProcessMulti]
 }
 
+void testProcessReduceQuantum() {
+    //! [testProcessReduceQuantum]
+    Receptor *r = _r_new(G_sem,TEST_RECEPTOR);
+    Q *q = r->q;
+
+    T *code = _t_parse(G_sem,0,"(ITERATE (PARAMS) (TEST_INT_SYMBOL:10000) (ADD_INT (TEST_INT_SYMBOL:1) (TEST_INT_SYMBOL:2)))");
+    T *run_tree = __p_build_run_tree(code,0);
+    _t_free(code);
+    _p_addrt2q(q,run_tree);
+
+    // reducing with a 100 microsecond time slice stops once the slice is used up, returning
+    // with the long running process still active after only some of its steps
+    spec_is_equal(__p_reduceq(q,100),noReductionErr);
+    spec_is_equal(q->quanta_used,1);
+    spec_is_equal(q->contexts_count,1);
+    spec_is_ptr_equal(q->completed,NULL);
+    uint64_t steps = q->active->accounts.steps;
+    spec_is_true(steps > 0);
+
+    // subsequent slices pick up where the last one left off until it's done
+    int slices = 1;
+    while (q->contexts_count) {
+        __p_reduceq(q,100);
+        slices++;
+    }
+    spec_is_true(slices > 2);
+    spec_is_true(q->quanta_used >= slices-1);
+    spec_is_ptr_equal(q->active,NULL);
+    spec_is_true(q->completed != NULL);
+    spec_is_equal(q->completed->context->err,noReductionErr);
+    spec_is_true(q->completed->accounts.steps > steps);
+
+    _r_free(r);
+    //! [testProcessReduceQuantum]
+}
+
+void testProcessArena() {
+    //! [testProcessArena]
+    int n = bench_size(20000,2000);
+    char src[200];
+    sprintf(src,"(ITERATE (PARAMS) (TEST_INT_SYMBOL:%d) (ADD_INT (TEST_INT_SYMBOL:1) (MULT_INT (TEST_INT_SYMBOL:2) (TEST_INT_SYMBOL:3))))",n);
+    T *code = _t_parse(G_sem,0,src);
+
+    // elements reduced in a queue build their run nodes in the element's arena
+    Receptor *r = _r_new(G_sem,TEST_RECEPTOR);
+    Q *q = r->q;
+    T *run_tree = __p_build_run_tree(code,0);
+    Qe *e = _p_addrt2q(q,run_tree);
+    Arena *a = e->arena;
+    spec_is_equal(_p_reduceq(q),noReductionErr);
+    spec_is_equal(q->completed->context->err,noReductionErr);
+    spec_is_str_equal(t2s(_t_child(run_tree,1)),"(TEST_INT_SYMBOL:7)");
+
+    // and the nodes freed on each pass of the loop get reused for the next one
+    spec_is_true(a->nodes > n*4);
+    spec_is_true(a->nodes - a->recycled < 100);
+
+    // freeing the queue tears down the run tree along with the arena
+    _r_free(r);
+
+    // compare reducing with and without an arena
+    run_tree = __p_build_run_tree(code,0);
+    uint64_t start = monotonic_ns();
+    spec_is_equal(_p_reduce(G_sem,run_tree),noReductionErr);
+    uint64_t heap_time = monotonic_ns() - start;
+    _t_free(run_tree);
+
+    a = _t_new_arena();
+    run_tree = __p_build_run_tree(code,0);
+    start = monotonic_ns();
+    Arena *prev = _t_use_arena(a);
+    spec_is_equal(_p_reduce(G_sem,run_tree),noReductionErr);
+    _t_use_arena(prev);
+    uint64_t arena_time = monotonic_ns() - start;
+    _t_free_with_arena(run_tree,a);
+    _t_release_arena(a);
+    bench_report("reduction with heap nodes took %ldus, with arena nodes %ldus\n",heap_time/1000,arena_time/1000);
+
+    _t_free(code);
+    //! [testProcessArena]
+}
+
+void testProcessRunTreeCow() {
+    //! [testProcessRunTreeCow]
+    // a process whose false branch is a big chunk of data
+    T *code = _t_parse(G_sem,0,"(IF (PARAM_REF:/2/1) (TEST_INT_SYMBOL:1) (PARAMS))");
+    T *data = _t_child(code,3);
+    int i,j;
+    for(i=0;i<100;i++) {
+        T *c = _t_newr(data,PARAMS);
+        for(j=0;j<100;j++) _t_newi(c,TEST_INT_SYMBOL,i*100+j);
+    }
+    T *signature = __p_make_signature("result",SIGNATURE_PASSTHRU,NULL_STRUCTURE,
+                                      "condition",SIGNATURE_SYMBOL,BOOLEAN,
+                                      NULL);
+    Process p = _d_define_process(G_sem,code,"big if","returns 1 or a lot of data",signature,NULL,TEST_CONTEXT);
+    code = _t_child(_sem_get_def(G_sem,p),ProcessDefCodeIdx);
+
+    // defining the process worked out which parts of its code are just data
+    spec_is_true(data->context.flags & TFLAG_INERT);
+    spec_is_true(code->context.flags & TFLAG_INERT_KNOWN);
+    spec_is_false(code->context.flags & TFLAG_INERT);
+
+    // the run tree's code only gets copied as the reduction reaches it
+    T *params = _t_new_root(PARAMS);
+    _t_newi(params,BOOLEAN,1);
+    T *t = _p_make_run_tree(G_sem,p,params,NULL);
+    spec_is_true(_t_child(t,1)->context.flags & TFLAG_COW);
+    // and looking at it doesn't copy anything
+    spec_is_ptr_equal(_t_child(_t_child(t,1),3),data);
+    spec_is_true(_t_child(t,1)->context.flags & TFLAG_COW);
+    spec_is_equal(_p_reduce(G_sem,t),noReductionErr);
+    spec_is_str_equal(t2s(_t_child(t,1)),"(TEST_INT_SYMBOL:1)");
+    _t_free(t);
+
+    // the data in the false branch doesn't need reducing, but once it's detached as the
+    // result it gets its own copy so that it doesn't depend on the code
+    _t_newi(params,BOOLEAN,0);
+    t = _p_make_run_tree(G_sem,p,params,NULL);
+    spec_is_equal(_p_reduce(G_sem,t),noReductionErr);
+    spec_is_ptr_equal(_t_cow_code(_t_child(t,1)),NULL);
+    spec_is_long_equal(_t_hash(G_sem,_t_child(t,1)),_t_hash(G_sem,data));
+    _t_free(t);
+    //! [testProcessRunTreeCow]
+
+    // compare calling the process when the code is fully copied to when it's shared
+    int reps = bench_size(100,5);
+    T *cond = _t_newi(0,BOOLEAN,1);
+    uint64_t start = monotonic_ns();
+    for(i=0;i<reps;i++) {
+        t = __p_build_run_tree(code,1,cond);
+        _p_reduce(G_sem,t);
+        _t_free(t);
+    }
+    uint64_t copy_time = monotonic_ns() - start;
+    start = monotonic_ns();
+    for(i=0;i<reps;i++) {
+        _t_newi(params,BOOLEAN,1);
+        t = _p_make_run_tree(G_sem,p,params,NULL);
+        _p_reduce(G_sem,t);
+        _t_free(t);
+    }
+    uint64_t cow_time = monotonic_ns() - start;
+    bench_report("calling a 10000 node process: copying the code took %ldus per call, sharing it %ldus\n",copy_time/reps/1000,cow_time/reps/1000);
+    _t_free(cond);
+    _t_free(params);
+}
+
+/**
+ * helper to define a recursive fibonacci process
+ *
+ * @param[in] compile if true the process is defined with _d_define_process and so gets
+ * compiled, otherwise the def is added with __d_define and the process can only be tree reduced
+ * @snippet spec/process_spec.h defFib
+ */
+//! [defFib]
+Process _defFib(bool compile) {
+    // the process calls itself so it has to know the id it's about to be defined with
+    Process fib = {TEST_CONTEXT,SEM_TYPE_PROCESS,_t_children(__sem_get_defs(G_sem,SEM_TYPE_PROCESS,TEST_CONTEXT))+1};
+
+    /* a process that would look something like this in lisp:
+       (defun fib (n) (cond ((< n 2) n) (t (+ (fib (- n 1)) (fib (- n 2))))))
+    */
+    T *f1 = _t_new_root(fib);
+    _t_add(f1,_t_parse(G_sem,0,"(SUB_INT (PARAM_REF:/2/1) (TEST_INT_SYMBOL:1))"));
+    T *f2 = _t_new_root(fib);
+    _t_add(f2,_t_parse(G_sem,0,"(SUB_INT (PARAM_REF:/2/1) (TEST_INT_SYMBOL:2))"));
+    T *code = _t_parse(G_sem,0,"(COND (CONDITIONS (COND_PAIR (LT_INT (PARAM_REF:/2/1) (TEST_INT_SYMBOL:2)) (PARAM_REF:/2/1)) (COND_ELSE (ADD_INT % %))))",f1,f2);
+
+    T *signature = __p_make_signature("result",SIGNATURE_STRUCTURE,INTEGER,
+                                      "n",SIGNATURE_STRUCTURE,INTEGER,
+                                      NULL);
+    if (compile)
+        return _d_define_process(G_sem,code,"fib","compute the nth fibonacci number",signature,NULL,TEST_CONTEXT);
+    return __d_define(G_sem,_d_make_process_def(code,"tree fib","compute the nth fibonacci number",signature,NULL),SEM_TYPE_PROCESS,TEST_CONTEXT);
+}
+//! [defFib]
+
+/**
+ * helper to define a process that computes a fibonacci number some number of times
+ *
+ * @snippet spec/process_spec.h defFibReps
+ */
+//! [defFibReps]
+Process _defFibReps(Process fib,bool compile) {
+    T *f = _t_new_root(fib);
+    _t_add(f,_t_parse(G_sem,0,"(PARAM_REF:/2/2)"));
+    T *code = _t_parse(G_sem,0,"(ITERATE (PARAMS) (PARAM_REF:/2/1) %)",f);
+
+    T *signature = __p_make_signature("result",SIGNATURE_STRUCTURE,INTEGER,
+                                      "reps",SIGNATURE_STRUCTURE,INTEGER,
+                                      "n",SIGNATURE_STRUCTURE,INTEGER,
+                                      NULL);
+    if (compile)
+        return _d_define_process(G_sem,code,"fib reps","compute the nth fibonacci number reps times",signature,NULL,TEST_CONTEXT);
+    return __d_define(G_sem,_d_make_process_def(code,"tree fib reps","compute the nth fibonacci number reps times",signature,NULL),SEM_TYPE_PROCESS,TEST_CONTEXT);
+}
+//! [defFibReps]
+
+// reduce a call to process p with int params, returning the result and how long it took
+char *_testBytecodeCall(Process p,int p1,int p2,uint64_t *elapsed) {
+    T *n = _t_new_root(p);
+    _t_newi(n,TEST_INT_SYMBOL,p1);
+    if (p2 >= 0) _t_newi(n,TEST_INT_SYMBOL,p2);
+    T *t = _t_new_root(RUN_TREE);
+    _t_add(t,_t_rclone(n));
+    uint64_t start = monotonic_ns();
+    spec_is_equal(_p_reduce(G_sem,t),noReductionErr);
+    if (elapsed) *elapsed = monotonic_ns() - start;
+    char *result = t2s(_t_child(t,1));
+    _t_free(t);_t_free(n);
+    return result;
+}
+
+void testProcessBytecode() {
+    //! [testProcessBytecode]
+    // processes that only use compilable instructions get compiled when they are defined
+    Bytecode *b = _sem_get_bytecode(G_sem,G_ifeven);
+    spec_is_true(b != NULL);
+    spec_is_equal(b->inputs,3);
+    spec_is_equal(b->required,3);
+    spec_is_equal(b->len,9);
+    spec_is_equal(b->code[0].op,OpParam);
+    spec_is_equal(b->code[1].op,OpPush);
+    spec_is_equal(b->code[2].op,OpMod);
+    spec_is_equal(b->code[4].op,OpEq);
+    spec_is_equal(b->code[7].op,OpSelect);
+    spec_is_equal(b->code[8].op,OpReturn);
+
+    BytecodeVM *vm = __p_new_vm();
+    T *params = _t_parse(G_sem,0,"(PARAMS (TEST_INT_SYMBOL:99) (TEST_INT_SYMBOL:123) (TEST_INT_SYMBOL:124))");
+    T *t = __p_exec_bytecode(0,G_sem,vm,b,params);
+    spec_is_str_equal(t2s(t),"(TEST_INT_SYMBOL:124)");
+    _t_free(t);
+    _t_free(params);
+
+    // the bytecode only handles int values so for anything else it bails...
+    params = _t_parse(G_sem,0,"(PARAMS (TEST_INT_SYMBOL:98) (TEST_STR_SYMBOL:\"yes\") (TEST_STR_SYMBOL:\"no\"))");
+    spec_is_ptr_equal(__p_exec_bytecode(0,G_sem,vm,b,params),NULL);
+    spec_is_ptr_equal(vm->call,NULL);
+    _t_free(params);
+
+    // ...and calling the process falls back to the tree reducer
+    T *n = _t_new_root(G_ifeven);
+    _t_newi(n,TEST_INT_SYMBOL,98);
+    _t_new_str(n,TEST_STR_SYMBOL,"yes");
+    _t_new_str(n,TEST_STR_SYMBOL,"no");
+    t = _t_new_root(RUN_TREE);
+    _t_add(t,_t_rclone(n));
+    spec_is_equal(_p_reduce(G_sem,t),noReductionErr);
+    spec_is_str_equal(t2s(_t_child(t,1)),"(TEST_STR_SYMBOL:yes)");
+    _t_free(t);
+    _t_free(n);
+
+    // processes that use instructions that can't be compiled are left to the tree reducer
+    T *code = _t_parse(G_sem,0,"(CONCAT_STR (RESULT_SYMBOL:TEST_STR_SYMBOL) (PARAM_REF:/2/1) (TEST_STR_SYMBOL:\"!\"))");
+    T *signature = __p_make_signature("result",SIGNATURE_SYMBOL,TEST_STR_SYMBOL,
+                                      "str",SIGNATURE_SYMBOL,TEST_STR_SYMBOL,
+                                      NULL);
+    Process p = _d_define_process(G_sem,code,"exclaim","add an exclamation mark",signature,NULL,TEST_CONTEXT);
+    spec_is_ptr_equal(_sem_get_bytecode(G_sem,p),NULL);
+
+    // recursive calls between compiled processes all run in the bytecode interpreter
+    Process fib = _defFib(true);
+    Process tree_fib = _defFib(false);
+    spec_is_true(_sem_get_bytecode(G_sem,fib) != NULL);
+    spec_is_ptr_equal(_sem_get_bytecode(G_sem,tree_fib),NULL);
+
+    uint64_t tree_time,bytecode_time;
+    spec_is_str_equal(_testBytecodeCall(tree_fib,10,-1,0),"(TEST_INT_SYMBOL:55)");
+    spec_is_str_equal(_testBytecodeCall(fib,10,-1,0),"(TEST_INT_SYMBOL:55)");
+    spec_is_str_equal(_testBytecodeCall(fib,1,-1,0),"(TEST_INT_SYMBOL:1)");
+    if (G_bench) {
+        _testBytecodeCall(tree_fib,15,-1,&tree_time);
+        _testBytecodeCall(fib,15,-1,&bytecode_time);
+        bench_report("fib(15) tree reduced in %ldus, bytecode in %ldus\n",tree_time/1000,bytecode_time/1000);
+    }
+
+    // count iteration returns the last body value, or the count if the body never ran
+    Process fib_reps = _defFibReps(fib,true);
+    Process tree_fib_reps = _defFibReps(tree_fib,false);
+    spec_is_true(_sem_get_bytecode(G_sem,fib_reps) != NULL);
+
+    spec_is_str_equal(_testBytecodeCall(tree_fib_reps,0,10,0),"(TEST_INT_SYMBOL:0)");
+    spec_is_str_equal(_testBytecodeCall(fib_reps,0,10,0),"(TEST_INT_SYMBOL:0)");
+    int reps = bench_size(20,2);
+    spec_is_str_equal(_testBytecodeCall(tree_fib_reps,reps,10,&tree_time),"(TEST_INT_SYMBOL:55)");
+    spec_is_str_equal(_testBytecodeCall(fib_reps,reps,10,&bytecode_time),"(TEST_INT_SYMBOL:55)");
+    bench_report("%d iterations of fib(10) tree reduced in %ldus, bytecode in %ldus\n",reps,tree_time/1000,bytecode_time/1000);
+
+    // runs are limited to a budget of instructions after which they get suspended...
+    params = _t_parse(G_sem,0,"(PARAMS (TEST_INT_SYMBOL:100) (TEST_INT_SYMBOL:10))");
+    t = __p_exec_bytecode(0,G_sem,vm,_sem_get_bytecode(G_sem,fib_reps),params);
+    spec_is_ptr_equal(t,NULL);
+    spec_is_ptr_equal(vm->call,params);
+    spec_is_equal(vm->yields,1);
+
+    // ...and can be resumed until they are done
+    while (!t && vm->call) t = __p_exec_bytecode(0,G_sem,vm,NULL,params);
+    spec_is_str_equal(t2s(t),"(TEST_INT_SYMBOL:55)");
+    spec_is_true(vm->yields > 1);
+    spec_is_ptr_equal(vm->call,NULL);
+    _t_free(t);
+    _t_free(params);
+    __p_free_vm(vm);
+
+    // so a long running compiled call in a queue gives up the worker at the end of its time slice
+    Receptor *r = _r_new(G_sem,TEST_RECEPTOR);
+    n = _t_new_root(fib_reps);
+    _t_newi(n,TEST_INT_SYMBOL,1000);
+    _t_newi(n,TEST_INT_SYMBOL,10);
+    t = __p_build_run_tree(n,0);
+    _t_free(n);
+    _p_addrt2q(r->q,t);
+    spec_is_equal(__p_reduceq(r->q,100),noReductionErr);
+    spec_is_equal(r->q->contexts_count,1);
+    spec_is_true(r->q->active->context->vm->yields > 0);
+    spec_is_true(r->q->active->context->vm->call != NULL);
+    spec_is_equal(_p_reduceq(r->q),noReductionErr);
+    spec_is_str_equal(t2s(_t_child(t,1)),"(TEST_INT_SYMBOL:55)");
+    _r_free(r);
+    //! [testProcessBytecode]
+
+    // processes defined at run time with DEF_PROCESS are compiled too
+    r = _r_new(G_sem,TEST_RECEPTOR);
+    T *def = _t_parse(r->sem,0,"(DEF_PROCESS (PROCESS_DEFINITION (PROCESS_NAME (ENGLISH_LABEL:\"count up\")) (PROCESS_INTENTION:\"add one to n, n times\") (ITERATE (PARAMS) (PARAM_REF:/2/1) (ADD_INT (PARAM_REF:/2/1) (TEST_INT_SYMBOL:1))) (PROCESS_SIGNATURE (OUTPUT_SIGNATURE (SIGNATURE_LABEL (ENGLISH_LABEL:\"result\")) (SIGNATURE_STRUCTURE:INTEGER)) (INPUT_SIGNATURE (SIGNATURE_LABEL (ENGLISH_LABEL:\"n\")) (SIGNATURE_STRUCTURE:INTEGER)))))");
+    spec_is_equal(__p_reduce_sys_proc(0,DEF_PROCESS,def,r->q),noReductionErr);
+    Process count_up = *(Process *)_t_surface(def);
+    _t_free(def);
+    spec_is_true(_sem_get_bytecode(G_sem,count_up) != NULL);
+
+    // and calls to them run in the bytecode interpreter
+    n = _t_new_root(count_up);
+    _t_newi(n,TEST_INT_SYMBOL,100000);
+    t = __p_build_run_tree(n,0);
+    _t_free(n);
+    _p_addrt2q(r->q,t);
+    spec_is_equal(__p_reduceq(r->q,100),noReductionErr);
+    Qe *e = r->q->active;
+    spec_is_true(e && e->context->vm && e->context->vm->yields > 0);
+    spec_is_equal(_p_reduceq(r->q),noReductionErr);
+    spec_is_str_equal(t2s(_t_child(t,1)),"(TEST_INT_SYMBOL:100001)");
+    _r_free(r);
+}
+
 void testRunTreeTemplate() {
 
     T *params = _t_new_root(PARAMS);
@@ -1898,6 +2354,7 @@ void testProcess() {
     testProcessDefine();
     testProcessDo();
     testProcessTranscode();
+    testProcessNativeHTTPRequest();
     testProcessDissolve();
     testProcessSemtrex();
     testProcessFill();
@@ -1932,6 +2389,10 @@ void testProcess() {
     testProcessGetLabel();
     testProcessErrorTrickleUp();
     testProcessMulti();
+    testProcessReduceQuantum();
+    testProcessArena();
+    testProcessRunTreeCow();
+    testProcessBytecode();
     testRunTreeTemplate();
     testProcessContinue();
     testProcessWakeup();
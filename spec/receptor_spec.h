@@ -58,12 +58,115 @@ void testReceptorAddRemoveExpectation() {
     T *e = _t_child(es,1);      // expectation should have been added as first child of expectations
     spec_is_str_equal(_td(r,e),"(EXPECTATION (CARRIER:TEST_INT_SYMBOL) (PATTERN (SEMTREX_SYMBOL_LITERAL (SEMTREX_SYMBOL:TEST_INT_SYMBOL))) (ACTION:NULL_PROCESS) (PARAMS) (END_CONDITIONS (UNLIMITED)))");
 
+    // the expectation's pattern is compiled once and cached
+    Stx *stx = __r_get_expectation_pattern(r,e);
+    Stx *stx2 = __r_get_expectation_pattern(r,e);
+    spec_is_ptr_equal(stx2,stx);
+    _stx_free(stx2);
+    spec_is_equal(HASH_COUNT(r->expectation_patterns),1);
+
     _r_remove_expectation(r,e);
 
     spec_is_str_equal(_td(r,es),"(EXPECTATIONS)");
+    spec_is_equal(HASH_COUNT(r->expectation_patterns),0);
+
+    // but the retained pattern stays usable until it's released
+    T *t = _t_newi(0,dummy,1);
+    spec_is_true(_stx_match(stx,t));
+    _t_free(t);
+    _stx_free(stx);
     _r_free(r);
 }
 
+T *_makeTestExpectation(Receptor *r,Symbol carrier,Symbol root) {
+    T *p = _t_new_root(PATTERN);
+    if (semeq(root,NULL_SYMBOL)) _t_newr(p,SEMTREX_SYMBOL_ANY);
+    else _sl(p,root);
+    T *e = __r_build_expectation(carrier,p,_t_news(0,ACTION,NULL_PROCESS),0,0,NULL,NULL);
+    __r_add_expectation(r,DEFAULT_ASPECT,e);
+    return e;
+}
+
+void testReceptorExpectationDispatch() {
+    //! [testReceptorExpectationDispatch]
+    Receptor *r = _r_new(G_sem,TEST_RECEPTOR);
+    int i,count;
+    T **es;
+
+    T *e1 = _makeTestExpectation(r,TESTING,TEST_INT_SYMBOL);
+    T *e2 = _makeTestExpectation(r,NULL_SYMBOL,TEST_INT_SYMBOL);
+    T *e3 = _makeTestExpectation(r,TESTING,NULL_SYMBOL);
+    T *e4 = _makeTestExpectation(r,TESTING,TEST_STR_SYMBOL);
+    for(i=0;i<50;i++) _makeTestExpectation(r,HTTP_REQUEST,TEST_INT_SYMBOL);
+    T *e5 = _makeTestExpectation(r,TESTING,TEST_INT_SYMBOL);
+
+    // a signal only gets tested against the expectations for its carrier (or any carrier)
+    // whose patterns could match its root symbol, in the order they were added
+    es = __r_expectation_candidates(r,DEFAULT_ASPECT,TESTING,TEST_INT_SYMBOL,&count);
+    spec_is_equal(count,4);
+    spec_is_ptr_equal(es[0],e1);
+    spec_is_ptr_equal(es[1],e2);
+    spec_is_ptr_equal(es[2],e3);
+    spec_is_ptr_equal(es[3],e5);
+    free(es);
+
+    es = __r_expectation_candidates(r,DEFAULT_ASPECT,TESTING,TEST_STR_SYMBOL,&count);
+    spec_is_equal(count,2);
+    spec_is_ptr_equal(es[0],e3);
+    spec_is_ptr_equal(es[1],e4);
+    free(es);
+
+    es = __r_expectation_candidates(r,DEFAULT_ASPECT,HTTP_REQUEST,TEST_INT_SYMBOL,&count);
+    spec_is_equal(count,51);
+    free(es);
+
+    // removed expectations are dropped from the index
+    _r_remove_expectation(r,e3);
+    es = __r_expectation_candidates(r,DEFAULT_ASPECT,TESTING,TEST_INT_SYMBOL,&count);
+    spec_is_equal(count,3);
+    spec_is_ptr_equal(es[2],e5);
+    free(es);
+
+    // and expectations that got into the flux some other way get indexed by reindexing
+    T *p = _t_new_root(PATTERN);
+    _sl(p,TEST_INT_SYMBOL);
+    T *e6 = __r_build_expectation(TESTING,p,_t_news(0,ACTION,NULL_PROCESS),0,0,NULL,NULL);
+    _t_add(__r_get_expectations(r,DEFAULT_ASPECT),e6);
+    __r_reindex_expectations(r);
+    es = __r_expectation_candidates(r,DEFAULT_ASPECT,TESTING,TEST_INT_SYMBOL,&count);
+    spec_is_equal(count,4);
+    spec_is_ptr_equal(es[0],e1);
+    spec_is_ptr_equal(es[3],e6);
+    free(es);
+    _r_free(r);
+
+    // compare delivering signals with the index against testing every expectation
+    int ne = bench_size(500,20),ns = bench_size(100,10);
+    r = _r_new(G_sem,TEST_RECEPTOR);
+    for(i=0;i<ne;i++) _makeTestExpectation(r,HTTP_REQUEST,i%2 ? TEST_INT_SYMBOL : NULL_SYMBOL);
+    ReceptorAddress f = {3};
+    ReceptorAddress t = {4};
+    T *signal = __r_make_signal(f,t,DEFAULT_ASPECT,TESTING,_t_newi(0,TEST_INT_SYMBOL,314),0,0,0);
+    T *expectations = __r_get_expectations(r,DEFAULT_ASPECT);
+    uint64_t start = monotonic_ns();
+    for(i=0;i<ns;i++) {
+        DO_KIDS(expectations,__r_test_expectation(r,_t_child(expectations,i),signal));
+    }
+    uint64_t all_time = monotonic_ns() - start;
+    _t_free(signal);
+
+    start = monotonic_ns();
+    for(i=0;i<ns;i++) {
+        signal = __r_make_signal(f,t,DEFAULT_ASPECT,TESTING,_t_newi(0,TEST_INT_SYMBOL,314),0,0,0);
+        _r_deliver(r,signal);
+    }
+    uint64_t index_time = monotonic_ns() - start;
+    spec_is_equal(_t_children(__r_get_signals(r,DEFAULT_ASPECT)),ns);
+    bench_report("%d signals against %d expectations: testing all took %ldus, delivering with the index %ldus\n",ns,ne,all_time/1000,index_time/1000);
+    _r_free(r);
+    //! [testReceptorExpectationDispatch]
+}
+
 void testReceptorSignal() {
     Receptor *r = _r_new(G_sem,TEST_RECEPTOR);
     T *sc,*signal_contents = _t_newi(0,TEST_INT_SYMBOL,314);
@@ -168,6 +271,116 @@ void testReceptorConversations() {
     _r_free(r);
 }
 
+T *_makeTestPendingResponse(Receptor *r,UUIDt *su,UUIDt *cuuid,bool index) {
+    T *pr = _t_newr(r->pending_responses,PENDING_RESPONSE);
+    _t_new(pr,SIGNAL_UUID,su,sizeof(UUIDt));
+    _t_news(pr,CARRIER,TESTING);
+    T *code = _t_new_root(RUN_TREE);
+    _t_add(pr,__p_build_wakeup_info(code,1));
+    _t_free(code);
+    T *ec = _t_newr(pr,END_CONDITIONS);
+    _t_newi(ec,COUNT,1);
+    if (cuuid) __cid_new(pr,cuuid,0);
+    if (index) __r_index_response(r,pr);
+    return pr;
+}
+
+void testReceptorConversationIndex() {
+    //! [testReceptorConversationIndex]
+    Receptor *r = _r_new(G_sem,TEST_RECEPTOR);
+    int i,count;
+    UUIDt u = __uuid_gen();
+    UUIDt u2 = __uuid_gen();
+    _r_add_conversation(r,0,&u,0,0);
+    T *c2 = _r_add_conversation(r,&u,&u2,0,0);
+
+    // expectations keyed to a conversation are indexed by the conversation's UUID
+    T *p = _t_new_root(PATTERN);
+    _sl(p,TEST_INT_SYMBOL);
+    T *e1 = __r_build_expectation(TESTING,p,_t_news(0,ACTION,NULL_PROCESS),0,0,NULL,__cid_new(0,&u,0));
+    __r_add_expectation(r,DEFAULT_ASPECT,e1);
+    T *e2 = _makeTestExpectation(r,TESTING,TEST_INT_SYMBOL);
+    p = _t_new_root(PATTERN);
+    _sl(p,TEST_INT_SYMBOL);
+    T *e3 = __r_build_expectation(TESTING,p,_t_news(0,ACTION,NULL_PROCESS),0,0,NULL,__cid_new(0,&u2,0));
+    __r_add_expectation(r,DEFAULT_ASPECT,e3);
+
+    T **es = __r_conversation_expectations(r,&u,&count);
+    spec_is_equal(count,1);
+    spec_is_ptr_equal(es[0],e1);
+    free(es);
+    es = __r_conversation_expectations(r,&u2,&count);
+    spec_is_equal(count,1);
+    spec_is_ptr_equal(es[0],e3);
+    free(es);
+
+    // as are pending responses, both by the request signal's UUID and by conversation
+    UUIDt s1 = __uuid_gen();
+    UUIDt s2 = __uuid_gen();
+    UUIDt s3 = __uuid_gen();
+    T *pr1 = _makeTestPendingResponse(r,&s1,&u2,true);
+    T *pr2 = _makeTestPendingResponse(r,&s2,NULL,true);
+    spec_is_ptr_equal(__r_find_pending_response(r,&s1),pr1);
+    spec_is_ptr_equal(__r_find_pending_response(r,&s2),pr2);
+    spec_is_ptr_equal(__r_find_pending_response(r,&s3),NULL);
+
+    // pending responses put in the tree some other way are only found after reindexing
+    T *pr3 = _makeTestPendingResponse(r,&s3,&u,false);
+    spec_is_ptr_equal(__r_find_pending_response(r,&s3),NULL);
+    __r_reindex_conversations(r);
+    spec_is_ptr_equal(__r_find_pending_response(r,&s3),pr3);
+    spec_is_ptr_equal(__r_find_pending_response(r,&s1),pr1);
+    spec_is_ptr_equal(_r_find_conversation(r,&u2),c2);
+
+    // cleaning up a conversation removes everything set up in it and its sub-conversations
+    spec_is_ptr_equal(_r_find_conversation(r,&u2),c2);
+    T *w = __r_cleanup_conversation(r,&u);
+    if (w) _t_free(w);
+    spec_is_ptr_equal(_r_find_conversation(r,&u),NULL);
+    spec_is_ptr_equal(_r_find_conversation(r,&u2),NULL);
+    spec_is_equal(_t_children(__r_get_expectations(r,DEFAULT_ASPECT)),1);
+    spec_is_ptr_equal(_t_child(__r_get_expectations(r,DEFAULT_ASPECT),1),e2);
+    spec_is_ptr_equal(__r_conversation_expectations(r,&u,&count),NULL);
+    spec_is_equal(count,0);
+    spec_is_equal(_t_children(r->pending_responses),1);
+    spec_is_ptr_equal(__r_find_pending_response(r,&s1),NULL);
+    spec_is_ptr_equal(__r_find_pending_response(r,&s2),pr2);
+    spec_is_ptr_equal(__r_find_pending_response(r,&s3),NULL);
+    _r_free(r);
+
+    // compare finding conversations with the index against scanning the conversations
+    int n = bench_size(2000,50);
+    r = _r_new(G_sem,TEST_RECEPTOR);
+    UUIDt *us = malloc(sizeof(UUIDt)*n);
+    for(i=0;i<n;i++) {
+        us[i] = __uuid_gen();
+        _r_add_conversation(r,0,&us[i],0,0);
+    }
+    T *c;
+    int found = 0;
+    uint64_t start = monotonic_ns();
+    for(i=0;i<n;i++) {
+        int j;
+        for(j=1;j<=_t_children(r->conversations);j++) {
+            c = _t_child(r->conversations,j);
+            if (__uuid_equal(&us[i],__cid_getUUID(_t_child(c,ConversationIdentIdx)))) {found++;break;}
+        }
+    }
+    uint64_t scan_time = monotonic_ns() - start;
+    spec_is_equal(found,n);
+    found = 0;
+    start = monotonic_ns();
+    for(i=0;i<n;i++) {
+        if (_r_find_conversation(r,&us[i]) == _t_child(r->conversations,i+1)) found++;
+    }
+    uint64_t index_time = monotonic_ns() - start;
+    spec_is_equal(found,n);
+    bench_report("finding %d conversations: scanning took %ldus, the index %ldus\n",n,scan_time/1000,index_time/1000);
+    free(us);
+    _r_free(r);
+    //! [testReceptorConversationIndex]
+}
+
 extern int G_next_process_id;
 void testReceptorResponseDeliver() {
     Receptor *r = _r_new(G_sem,TEST_RECEPTOR);
@@ -240,9 +453,13 @@ void testReceptorEndCondition() {
 
     until = _t_new_root(END_CONDITIONS);
     _t_newi(until,COUNT,2);
+    TreeHash h = _t_hash_cached(G_sem,until);
     evaluateEndCondition(until,&cleanup,&allow);
     spec_is_false(cleanup);spec_is_true(allow);
     spec_is_str_equal(t2s(until),"(END_CONDITIONS (COUNT:1))");
+    // counting down changes the hash of the end conditions
+    spec_is_true(!_t_hash_equal(h,_t_hash_cached(G_sem,until)));
+    spec_is_long_equal(_t_hash_cached(G_sem,until),_t_hash(G_sem,until));
     evaluateEndCondition(until,&cleanup,&allow);
     spec_is_true(cleanup);spec_is_true(allow);
     spec_is_str_equal(t2s(until),"(END_CONDITIONS (COUNT:0))");
@@ -324,6 +541,10 @@ void testReceptorExpectation() {
     Error err = _r_deliver(r,signal);
     spec_is_equal(err,noDeliveryErr);
 
+    // the expectation's pattern got compiled when the signal was tested against it, and
+    // thrown away when the expectation cleaned itself up after its one match
+    spec_is_equal(HASH_COUNT(r->expectation_patterns),0);
+
     // signal and run_tree should be added and ready on the process queue
     spec_is_equal(r->q->contexts_count,1);
     spec_is_str_equal(_td(r,__r_get_signals(r,DEFAULT_ASPECT)),
@@ -442,6 +663,9 @@ void testReceptorDefMatch() {
     _t_detach_by_idx(t,2);
     spec_is_true(!_r_def_match(r,house_loc,t));
 
+    // the definition's semtrex only got built and compiled the first time
+    spec_is_equal(HASH_COUNT(r->def_patterns),1);
+
     _t_free(stx);
     _t_free(t);
     _t_free(t_lon);
@@ -520,6 +744,11 @@ void testReceptorSerialize() {
     T *s = __r_make_signal(from,to,DEFAULT_ASPECT,TESTING,signal_contents,0,0,0);
     _r_deliver(r,s);
 
+    // and a conversation with a pending response in it
+    UUIDt cu = __uuid_gen(),su = __uuid_gen();
+    _r_add_conversation(r,0,&cu,0,0);
+    _makeTestPendingResponse(r,&su,&cu,true);
+
     _r_serialize(r,&surface,&length);
 
     // serialized receptor is two stacked serialized mtrees, first one for the state tree
@@ -545,6 +774,10 @@ void testReceptorSerialize() {
     spec_is_sem_equal(_t_symbol(ru->pending_signals),PENDING_SIGNALS);
     spec_is_sem_equal(_t_symbol(ru->pending_responses),PENDING_RESPONSES);
 
+    // check that the conversations and pending responses got indexed
+    spec_is_ptr_equal(_r_find_conversation(ru,&cu),_t_child(ru->conversations,1));
+    spec_is_ptr_equal(__r_find_pending_response(ru,&su),_t_child(ru->pending_responses,1));
+
     // check that the unserialized receptor is matched up to the correct definitions in the semtable
     spec_is_sem_equal(_r_get_sem_by_label(ru,"latitude"),lat);
     spec_is_sem_equal(_r_get_sem_by_label(ru,"latlong"),latlong);
@@ -658,11 +891,11 @@ void testReceptorEdgeStream() {
     Q *q = r->q;
     Stream *st = reader_stream;
     spec_is_equal(_p_reduceq(q),noReductionErr);
-    while(!(st->flags&StreamHasData) && st->flags&StreamAlive ) {sleepms(1);};
+    while(q->blocked) {sleepms(1);};
     spec_is_equal(_p_reduceq(q),noReductionErr);
-    while(!(st->flags&StreamHasData) && st->flags&StreamAlive ) {sleepms(1);};
+    while(q->blocked) {sleepms(1);};
     spec_is_equal(_p_reduceq(q),noReductionErr);
-    while(!(st->flags&StreamHasData) && st->flags&StreamAlive ) {sleepms(1);};
+    while(q->blocked) {sleepms(1);};
     spec_is_equal(_p_reduceq(q),noReductionErr);
     //debug_disable(D_STREAM);
     spec_is_false(_st_is_alive(st));
@@ -873,11 +1106,13 @@ void testReceptorClock() {
 void testReceptor() {
     testReceptorCreate();
     testReceptorAddRemoveExpectation();
+    testReceptorExpectationDispatch();
     testReceptorSignal();
     testReceptorSignalDeliver();
     testReceptorResponseDeliver();
     testReceptorDeliverConversation();
     testReceptorConversations();
+    testReceptorConversationIndex();
     testReceptorEndCondition();
     testReceptorExpectation();
     testReceptorDef();
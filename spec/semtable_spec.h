@@ -11,12 +11,14 @@ void testSemTableCreate() {
     //! [testSemTableCreate]
     SemTable *sem = _sem_new();
     spec_is_equal(sem->contexts,0);
-    int idx = _sem_new_context(sem,(T *)1234L);
+    T *d = __r_make_definitions();
+    int idx = _sem_new_context(sem,d);
     spec_is_equal(idx,0);
     spec_is_equal(sem->contexts,1);
     Symbol s = {SYS_CONTEXT,0,0};
-    spec_is_long_equal((long)_sem_context(sem,s)->definitions,1234L);
+    spec_is_ptr_equal(_sem_context(sem,s)->definitions,d);
     _sem_free(sem);
+    _t_free(d);
     //! [testSemTableCreate]
 }
 
@@ -71,6 +73,67 @@ void testSemAddLabel() {
     //! [testSemAddLabel]
 }
 
+typedef struct {
+    SemTable *sem;
+    Context ctx;
+    int n;          ///< how many symbols are going to get defined
+    int bad;        ///< lookups that found something other than what was defined there
+    int misses;     ///< lookups that got there before the definition did
+} SemTableReader;
+
+// look up every symbol in a context as soon as it gets defined
+void *_semTableReader(void *arg) {
+    SemTableReader *rd = arg;
+    char name[20];
+    int i = 1;
+    while (i <= rd->n) {
+        Symbol s = {rd->ctx,SEM_TYPE_SYMBOL,i};
+        T *def = _sem_get_def(rd->sem,s);
+        if (!def) {rd->misses++;continue;}
+        sprintf(name,"s%d",i);
+        if (strcmp(_sem_get_name(rd->sem,s),name) || !semeq(_sem_get_symbol_structure(rd->sem,s),INTEGER)) rd->bad++;
+        i++;
+    }
+    pthread_exit(NULL);
+}
+
+void testSemTableConcurrentDefs() {
+    //! [testSemTableConcurrentDefs]
+    // definitions can be looked up without locking while other threads are adding them
+    int i,readers = 4;
+    T *d = __r_make_definitions();
+    int ctx = _sem_new_context(G_sem,d);
+    SemTableReader rd[readers];
+    pthread_t thread[readers];
+    int n = bench_size(60000,1000);
+    for(i=0;i<readers;i++) {
+        rd[i] = (SemTableReader){G_sem,ctx,n,0,0};
+        pthread_create(&thread[i],0,_semTableReader,&rd[i]);
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char name[20];
+    for(i=1;i<=n;i++) {
+        sprintf(name,"s%d",i);
+        _d_define_symbol(G_sem,INTEGER,name,ctx);
+    }
+    for(i=0;i<readers;i++) {
+        pthread_join(thread[i],NULL);
+        spec_is_equal(rd[i].bad,0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    bench_report("defining %d symbols while %d threads looked each one up took %ldus\n",n,readers,diff_micro(&start,&end));
+
+    Symbol s = {ctx,SEM_TYPE_SYMBOL,n};
+    spec_is_str_equal(_sem_get_name(G_sem,s),name);
+    s.id++;
+    spec_is_ptr_equal(_sem_get_def(G_sem,s),NULL);
+
+    _sem_free_context(G_sem,ctx);
+    _t_free(d);
+    //! [testSemTableConcurrentDefs]
+}
+
 void testSemTable() {
     testSemTableCreate();
     testSemTableGetName();
@@ -78,4 +141,5 @@ void testSemTable() {
     testSemGetSymbolStructure();
     testSemGetByLabel();
     testSemAddLabel();
+    testSemTableConcurrentDefs();
 }
@@ -655,6 +655,31 @@ void testMatchWalk() {
     _t_free(results);
     _t_free(s);
 
+    // walk a sub-tree that isn't at the root
+    //  /TEST_STR_SYMBOL/(.,%<TEST_GROUP_SYMBOL1:sy22>)
+    s = _sl(0,TEST_STR_SYMBOL);
+    sq = _t_newr(s,SEMTREX_SEQUENCE);
+    _t_newr(sq,SEMTREX_SYMBOL_ANY);
+    g = _t_news(_t_newr(sq,SEMTREX_WALK),SEMTREX_GROUP,TEST_GROUP_SYMBOL1);
+    _sl(g,sy22);
+    spec_is_true(_t_matchr(s,t,&results));
+    spec_is_str_equal(t2s(results),"(SEMTREX_MATCH:1 (SEMTREX_MATCH_SYMBOL:TEST_GROUP_SYMBOL1) (SEMTREX_MATCH_PATH:/2/2) (SEMTREX_MATCH_SIBLINGS_COUNT:1))");
+    _t_free(results);
+    _t_free(s);
+
+    // a walk that runs out of nodes falls back to alternatives from before the walk
+    //  /TEST_STR_SYMBOL/(%TEST_INT_SYMBOL|sy1)
+    s = _sl(0,TEST_STR_SYMBOL);
+    T *o = _t_newr(s,SEMTREX_OR);
+    _sl(_t_newr(o,SEMTREX_WALK),TEST_INT_SYMBOL);
+    _sl(o,sy1);
+    spec_is_true(_t_match(s,t));
+    Stx *stx = _stx_compile(s);
+    _stx_set_engine(stx,StxEngineLinear);
+    spec_is_true(_stx_match(stx,t));
+    _stx_free(stx);
+    _t_free(s);
+
     _t_free(t);
 
     // this test is taken from code that broke in semtrex parsing, I think because of the
@@ -668,6 +693,40 @@ void testMatchWalk() {
 
 }
 
+void testMatchDeep() {
+    //! [testMatchDeep]
+    // build a tree that's a chain of 90 nested nodes with the depth as the value
+    int i,d = 90;
+    T *t = _t_newi(0,TEST_INT_SYMBOL,0);
+    T *x = t;
+    for(i=1;i<d;i++) x = _t_newi(x,TEST_INT_SYMBOL,i);
+
+    // find the deepest node by walking
+    //  %<TEST_GROUP_SYMBOL1:TEST_INT_SYMBOL=89>
+    T *s = _t_new_root(SEMTREX_WALK);
+    T *g = _t_news(s,SEMTREX_GROUP,TEST_GROUP_SYMBOL1);
+    _t_newi(_t_newr(g,SEMTREX_VALUE_LITERAL),TEST_INT_SYMBOL,d-1);
+    T *results;
+    spec_is_true(_t_matchr(s,t,&results));
+    T *p = _t_child(results,2);
+    spec_is_equal(_t_path_depth((int *)_t_surface(p)),d-1);
+    _t_free(results);
+    _t_free(s);
+
+    // and by descending all the way down: /TEST_INT_SYMBOL/TEST_INT_SYMBOL/.../<TEST_GROUP_SYMBOL1:.>
+    s = x = _sl(0,TEST_INT_SYMBOL);
+    for(i=2;i<d;i++) x = _sl(x,TEST_INT_SYMBOL);
+    _t_newr(_t_news(x,SEMTREX_GROUP,TEST_GROUP_SYMBOL1),SEMTREX_SYMBOL_ANY);
+    spec_is_true(_t_matchr(s,t,&results));
+    p = _t_child(results,2);
+    spec_is_equal(_t_path_depth((int *)_t_surface(p)),d-1);
+    _t_free(results);
+    _t_free(s);
+
+    _t_free(t);
+    //! [testMatchDeep]
+}
+
 void testMatchNot() {
     T *t = _makeTestTree1();
 
@@ -989,6 +1048,185 @@ void testSemtrexReplace() {
     _t_free(a);
 }
 
+void testSemtrexCompile() {
+    //! [testSemtrexCompile]
+    T *t = _makeTestTree1();
+    T *r1,*r2;
+
+    // a compiled semtrex matches just like the semtrex tree it was compiled from
+    // /TEST_STR_SYMBOL/(.*,<TEST_GROUP_SYMBOL1:sy3>)
+    T *s = _sl(0,TEST_STR_SYMBOL);
+    T *ss = _t_newr(s,SEMTREX_SEQUENCE);
+    _t_newr(_t_newr(ss,SEMTREX_ZERO_OR_MORE),SEMTREX_SYMBOL_ANY);
+    T *sym = _sl(_t_news(ss,SEMTREX_GROUP,TEST_GROUP_SYMBOL1),sy3);
+    Stx *stx = _stx_compile(s);
+    spec_is_true(stx->states > 0);
+    spec_is_true(_stx_match(stx,t));
+    spec_is_true(_t_matchr(s,t,&r1));
+    spec_is_true(_stx_matchr(stx,t,&r2));
+    spec_is_str_equal(t2s(r2),t2s(r1));
+    _t_free(r1);
+    _t_free(r2);
+
+    // and can be used over and over again without recompiling
+    T *t2 = _t_new_root(TEST_INT_SYMBOL);
+    spec_is_false(_stx_match(stx,t2));
+    spec_is_true(_stx_match(stx,t));
+    _stx_free(stx);
+
+    // compiling as a group wraps the whole pattern in a SEMTREX_GROUP for results
+    stx = _stx_compile_group(s,NULL_SYMBOL);
+    spec_is_true(_stx_matchr(stx,t,&r1));
+    spec_is_str_equal(t2s(r1),"(SEMTREX_MATCH:1 (SEMTREX_MATCH_SYMBOL:NULL_SYMBOL) (SEMTREX_MATCH_PATH:/) (SEMTREX_MATCH_SIBLINGS_COUNT:1) (SEMTREX_MATCH:2 (SEMTREX_MATCH_SYMBOL:TEST_GROUP_SYMBOL1) (SEMTREX_MATCH_PATH:/3) (SEMTREX_MATCH_SIBLINGS_COUNT:1)))");
+    _t_free(r1);
+    _stx_free(stx);
+
+    // the shared cache compiles a pattern the first time it sees its content and
+    // re-uses the compiled version for any equivalent pattern tree after that
+    extern int G_stx_cache_entries;
+    int entries = G_stx_cache_entries;
+    spec_is_true(_stx_cached_match(s,t,NULL));
+    spec_is_equal(G_stx_cache_entries,entries+1);
+    T *s2 = _t_clone(s);
+    spec_is_true(_stx_cached_match(s2,t,&r1));
+    spec_is_false(_stx_cached_match(s2,t2,NULL));
+    spec_is_equal(G_stx_cache_entries,entries+1);
+    spec_is_str_equal(t2s(r1),"(SEMTREX_MATCH:1 (SEMTREX_MATCH_SYMBOL:TEST_GROUP_SYMBOL1) (SEMTREX_MATCH_PATH:/3) (SEMTREX_MATCH_SIBLINGS_COUNT:1))");
+    _t_free(r1);
+
+    // but a pattern that differs only in a symbol is a different pattern
+    sym = _t_child(_t_child(_t_child(s2,2),2),1);
+    *(Symbol *)_t_surface(_t_child(sym,1)) = sy21;
+    spec_is_false(_stx_cached_match(s2,t,NULL));
+    spec_is_equal(G_stx_cache_entries,entries+2);
+
+    // when the cache is full it gets emptied and starts filling again
+    extern Stx *__stx_cache_get(T *semtrex);
+    Stx *held = __stx_cache_get(s);
+    T *v = _t_new_root(SEMTREX_VALUE_LITERAL);
+    T *vi = _t_newi(v,TEST_INT_SYMBOL,0);
+    while(G_stx_cache_entries < STX_CACHE_MAX_ENTRIES) {
+        (*(int *)_t_surface(vi))++;
+        _stx_cached_match(v,t,NULL);
+    }
+    (*(int *)_t_surface(vi))++;
+    spec_is_false(_stx_cached_match(v,t,NULL));
+    spec_is_equal(G_stx_cache_entries,1);
+    _t_free(v);
+
+    // and patterns that were in use when the cache was emptied stay usable until released
+    spec_is_true(_stx_match(held,t));
+    _stx_free(held);
+    spec_is_true(_stx_cached_match(s,t,NULL));
+    spec_is_equal(G_stx_cache_entries,2);
+
+    _t_free(s2);
+    _t_free(s);
+    _t_free(t2);
+    _t_free(t);
+    //! [testSemtrexCompile]
+}
+
+void testSemtrexLinear() {
+    //! [testSemtrexLinear]
+    char *req = "GET /path/to/file.ext?name=joe&age=30 HTTP/0.9";
+    T *r1,*r2,*t = makeASCIITree(req);
+
+    // the http request semtrex has repetitions in repetitions so it compiles to the linear engine
+    T *s = _t_news(0,SEMTREX_GROUP,NULL_SYMBOL);
+    _t_add(s,_makeHTTPRequestSemtrex());
+    Stx *stx = _stx_compile(s);
+    spec_is_equal(stx->engine,StxEngineLinear);
+
+    // which finds exactly the same match as the backtracker does
+    spec_is_true(_t_matchr(s,t,&r1));
+    spec_is_true(_stx_matchr(stx,t,&r2));
+    spec_is_str_equal(t2s(r2),t2s(r1));
+    _t_free(r1);
+    _t_free(r2);
+    _stx_free(stx);
+    _t_free(s);
+    _t_free(t);
+
+    // simple patterns stay with the backtracker, but the engine can be chosen per pattern
+    s = parseSemtrex(G_sem,"/ASCII_CHARS/(ASCII_CHAR='a',<TEST_GROUP_SYMBOL1:.*>)");
+    stx = _stx_compile(s);
+    spec_is_equal(stx->engine,StxEngineBacktrack);
+    _stx_set_engine(stx,StxEngineLinear);
+
+    // and because it keeps its alternatives on a growable stack the linear engine isn't
+    // limited in how many siblings a repetition can match (the backtracker's stack stops
+    // at MAX_BRANCH_DEPTH)
+    int i,n = 6000;
+    char *str = malloc(n+1);
+    for(i=0;i<n;i++) str[i] = 'a';
+    str[n] = 0;
+    t = makeASCIITree(str);
+    spec_is_true(_stx_matchr(stx,t,&r1));
+    spec_is_str_equal(t2s(r1),"(SEMTREX_MATCH:1 (SEMTREX_MATCH_SYMBOL:TEST_GROUP_SYMBOL1) (SEMTREX_MATCH_PATH:/2) (SEMTREX_MATCH_SIBLINGS_COUNT:5999))");
+    _t_free(r1);
+    _t_free(t);
+    _stx_free(stx);
+    _t_free(s);
+
+    // nested repetitions that can't match take exponential time to backtrack through but
+    // are linear for the linear engine
+    s = parseSemtrex(G_sem,"/ASCII_CHARS/((ASCII_CHAR='a'+)+,ASCII_CHAR='b')");
+    stx = _stx_compile(s);
+    spec_is_equal(stx->engine,StxEngineLinear);
+
+    int m = bench_size(18,10);
+    str[m] = 0;
+    t = makeASCIITree(str);
+    uint64_t start = monotonic_ns();
+    spec_is_false(_t_match(s,t));
+    uint64_t backtrack_time = monotonic_ns() - start;
+    start = monotonic_ns();
+    spec_is_false(_stx_match(stx,t));
+    uint64_t linear_time = monotonic_ns() - start;
+    bench_report("(a+)+b against %d chars: backtracking took %ldus, linear %ldus\n",m,backtrack_time/1000,linear_time/1000);
+    _t_free(t);
+
+    str[m] = 'a';
+    m = bench_size(2000,200);
+    str[m] = 0;
+    t = makeASCIITree(str);
+    start = monotonic_ns();
+    spec_is_false(_stx_match(stx,t));
+    linear_time = monotonic_ns() - start;
+    bench_report("(a+)+b against %d chars: linear %ldus\n",m,linear_time/1000);
+    _t_free(t);
+
+    _stx_free(stx);
+    _t_free(s);
+    free(str);
+    //! [testSemtrexLinear]
+}
+
+void testSemtrexRootSymbol() {
+    //! [testSemtrexRootSymbol]
+    T *s = parseSemtrex(G_sem,"/<TEST_GROUP_SYMBOL1:TEST_STR_SYMBOL/.*>");
+    spec_is_sem_equal(_stx_root_symbol(s),TEST_STR_SYMBOL);
+    _t_free(s);
+
+    s = parseSemtrex(G_sem,"/TEST_INT_SYMBOL=314");
+    spec_is_sem_equal(_stx_root_symbol(s),TEST_INT_SYMBOL);
+    _t_free(s);
+
+    // patterns that could match more than one root symbol don't have one
+    s = parseSemtrex(G_sem,"/TEST_STR_SYMBOL|TEST_INT_SYMBOL");
+    spec_is_sem_equal(_stx_root_symbol(s),NULL_SYMBOL);
+    _t_free(s);
+
+    s = parseSemtrex(G_sem,"/!TEST_STR_SYMBOL");
+    spec_is_sem_equal(_stx_root_symbol(s),NULL_SYMBOL);
+    _t_free(s);
+
+    s = parseSemtrex(G_sem,"/%TEST_STR_SYMBOL");
+    spec_is_sem_equal(_stx_root_symbol(s),NULL_SYMBOL);
+    _t_free(s);
+    //! [testSemtrexRootSymbol]
+}
 
 void testSemtrex() {
     _stxSetup();
@@ -1006,6 +1244,10 @@ void testSemtrex() {
     testMatchGroupMulti();
     testMatchDescend();
     testMatchWalk();
+    testMatchDeep();
+    testSemtrexCompile();
+    testSemtrexLinear();
+    testSemtrexRootSymbol();
     //testMatchNot();
     testSemtrexParse();
     testSemtrexParseHHTPReq();
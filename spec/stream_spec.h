@@ -8,6 +8,7 @@
 #include "../src/stream.h"
 #include <unistd.h>
 #include <errno.h>
+#include <sys/socket.h>
 
 void testStreamCreate() {
     // test basic stream creation
@@ -112,10 +113,96 @@ void testStreamScan() {
     spec_is_equal(s->unit_start,7);
     spec_is_equal(s->unit_size,3);
 
+    // a first delimiter byte that isn't followed by the rest doesn't count
+    s->buf = "a\r\rb\n";
+    s->bytes_used = strlen(s->buf);
+    __st_init_scan(s);
+    __st_scan(s);
+    spec_is_equal(s->scan_state,StreamScanPartial);
+    spec_is_equal(s->partial,5);
+
+    // a delimiter split across loads is found once the rest arrives
+    s->buf = "x\rcat\r";
+    s->bytes_used = strlen(s->buf);
+    __st_init_scan(s);
+    __st_scan(s);
+    spec_is_equal(s->scan_state,StreamScanPartial);
+    spec_is_equal(s->partial,5);
+    s->buf = "x\rcat\r\ndog";
+    s->bytes_used = strlen(s->buf);
+    __st_scan(s);
+    spec_is_equal(s->scan_state,StreamScanSuccess);
+    spec_is_equal(s->unit_start,0);
+    spec_is_equal(s->unit_size,5);
+
     _st_free(s);
 
 }
 
+// the byte at a time scan that __st_scan used to do, kept as a timing reference
+size_t _testScanBytewise(char *buf,size_t start,size_t len,char *delim,int delim_len) {
+    int chars_matched = 0;
+    size_t i;
+    for(i=start;i<len;i++) {
+        if (buf[i] == delim[chars_matched]) chars_matched++;
+        else chars_matched = (buf[i] == delim[0]) ? 1 : 0;
+        if (chars_matched == delim_len) return i - start - (delim_len -1);
+    }
+    return -1;
+}
+
+void testStreamScanSpeed() {
+    // scan a buffer of CRLF lines (the shape of HTTP headers) unit by unit
+    // (8MB of them when benchmarking)
+    size_t size = bench_size(8*1024*1024,64*1024);
+    char *buf = malloc(size+1);
+    char *line = "Accept-Language: en-US,en;q=0.9\r\n";
+    int line_len = strlen(line);
+    size_t len = 0;
+    int lines = 0;
+    while (len + line_len <= size) {
+        memcpy(&buf[len],line,line_len);
+        len += line_len;
+        lines++;
+    }
+
+    Stream *s = __st_alloc_stream();
+    s->type = 99;
+    s->buf = buf;
+    s->buf_size = size;
+    s->bytes_used = len;
+    s->delim = DELIM_CRLF;
+    s->delim_len = 2;
+
+    uint64_t start = monotonic_ns();
+    int units = 0;
+    size_t sizes = 0;
+    __st_init_scan(s);
+    for(__st_scan(s);s->scan_state == StreamScanSuccess;__st_scan(s)) {
+        units++;
+        sizes += s->unit_size;
+    }
+    uint64_t scan_time = monotonic_ns() - start;
+    spec_is_equal(units,lines);
+    spec_is_long_equal(sizes,(size_t)lines*(line_len-2));
+    spec_is_equal(s->scan_state,StreamScanComplete);
+
+    start = monotonic_ns();
+    int ref_units = 0;
+    size_t pos = 0,l;
+    while ((l = _testScanBytewise(buf,pos,len,DELIM_CRLF,2)) != -1) {
+        ref_units++;
+        pos += l+2;
+    }
+    uint64_t ref_time = monotonic_ns() - start;
+    spec_is_equal(ref_units,lines);
+
+    bench_report("scanned %d CRLF lines in %ld ns (byte at a time: %ld ns)\n",units,scan_time,ref_time);
+    s->buf = NULL;
+    _st_free(s);
+    free(buf);
+}
+
 void testStreamFileLoad() {
     FILE *input;
     //debug_enable(D_STREAM);
@@ -256,6 +343,7 @@ void testStreamWrite() {
 }
 
 void testStreamWriteLine() {
+    //! [testStreamWriteLine]
     char buffer[500] = "x";
     FILE *stream;
     stream = fmemopen(buffer, 500, "r+");
@@ -275,7 +363,88 @@ void testStreamWriteLine() {
     spec_is_equal(_st_writeln(st,"not me"),8);
     spec_is_str_equal(buffer,"fishy\nin the sea\nnot me\r\n");
 
+    // many lines can be gathered into a single write
+    char *lines[] = {"HTTP/1.1 200 OK","Content-Type: text/plain",""};
+    spec_is_equal(_st_writelns(st,lines,3),45);
+    spec_is_str_equal(buffer,"fishy\nin the sea\nnot me\r\nHTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\n");
+
+    _st_free(st);
+    //! [testStreamWriteLine]
+}
+
+void testStreamCork() {
+    //! [testStreamCork]
+    char buffer[500] = "x";
+    FILE *stream;
+    stream = fmemopen(buffer, 500, "r+");
+    Stream *st = _st_new_unix_stream(stream,0);
+
+    // while corked writes just collect in the output buffer
+    _st_cork(st);
+    spec_is_equal(_st_write(st,"fishy",5),5);
+    spec_is_equal(_st_writeln(st," in the sea"),12);
+    spec_is_str_equal(buffer,"x");
+    spec_is_equal(st->obuf_used,17);
+
+    // and go out all at once when uncorked
+    spec_is_equal(_st_uncork(st),17);
+    spec_is_str_equal(buffer,"fishy in the sea\n");
+    spec_is_equal(st->obuf_used,0);
+
+    // writes bigger than the buffer go straight out after what's already buffered
+    _st_cork(st);
+    _st_write(st,"big:",4);
+    char big[STREAM_OUT_BUFFER_SIZE+10];
+    memset(big,'z',sizeof(big));
+    FILE *f = fopen("/dev/null","w");
+    Stream *null = _st_new_unix_stream(f,0);
+    _st_cork(null);
+    spec_is_equal(_st_write(null,"big:",4),4);
+    spec_is_equal(_st_write(null,big,sizeof(big)),sizeof(big));
+    spec_is_equal(null->obuf_used,0);
+
+    // freeing a corked stream sends what's buffered
     _st_free(st);
+    spec_is_str_equal(buffer,"fishy in the sea\nbig:");
+    _st_free(null);
+    //! [testStreamCork]
+}
+
+void testStreamWriteSpeed() {
+    // write an HTTP response style LINES tree out over and over, once gathered into a
+    // single write and once the way it used to be done with a write for every line and delimiter
+    int n = bench_size(10000,100);
+    T *t = _t_newr(0,LINES);
+    _t_new_str(t,LINE,"HTTP/1.1 200 OK");
+    _t_new_str(t,LINE,"Content-Type: text/html");
+    _t_new_str(t,LINE,"Content-Length: 12");
+    _t_new_str(t,LINE,"Server: ceptr");
+    _t_new_str(t,LINE,"");
+    _t_new_str(t,LINE,"<b>hello</b>");
+    FILE *f = fopen("/dev/null","w");
+    Stream *st = _st_new_unix_stream(f,0);
+    st->delim = DELIM_CRLF;
+    st->delim_len = 2;
+    int i,bytes = 0;
+
+    uint64_t start = monotonic_ns();
+    for(i=0;i<n;i++) bytes += _t_write(G_sem,t,st);
+    uint64_t gathered_time = monotonic_ns() - start;
+    spec_is_equal(bytes,n*(15+23+18+13+0+12+6*2));
+
+    start = monotonic_ns();
+    for(i=0;i<n;i++) {
+        DO_KIDS(t,
+                char *s = _t_surface(_t_child(t,i));
+                if (*s) _st_write(st,s,strlen(s));
+                _st_write(st,st->delim,st->delim_len);
+                );
+    }
+    uint64_t each_time = monotonic_ns() - start;
+    bench_report("wrote %d responses gathered in %ld ns (write per line and delimiter: %ld ns)\n",n,gathered_time,each_time);
+
+    _st_free(st);
+    _t_free(t);
 }
 
 
@@ -315,15 +484,185 @@ void testStreamSocket() {
     debug_disable(D_SOCKET+D_STREAM);
 }
 
+#define SLICE_LINES 2000
+#define SLICE_KEPT 100
+void testStreamSlice() {
+    //! [testStreamSlice]
+    // read lines from a reader stream handing each unit to a tree as a slice, keeping
+    // some slices alive while the stream cycles through its ring and compacts its buffer
+    char *data = malloc(SLICE_LINES*20);
+    char line[20];
+    int i;
+    size_t len = 0;
+    for(i=0;i<SLICE_LINES;i++) len += sprintf(&data[len],"line number %05d\n",i);
+    FILE *input = fmemopen(data,len,"r");
+    Stream *st = _st_new_unix_stream(input,1);
+    T *kept[SLICE_KEPT];
+
+    // we do the reads directly rather than through the reader thread to time just the handoff
+    uint64_t start = monotonic_ns();
+    int count = 0;
+    for(__st_stream_read(st);st->flags&StreamHasData;__st_stream_read(st)) {
+        char *slice = _st_data_slice(st);
+        T *t = __t_new_slice(0,TEST_STR_SYMBOL,slice,_st_data_size(st)+1,0);
+        if (count < SLICE_KEPT) kept[count] = t;
+        else _t_free(t);
+        count++;
+        _st_data_consumed(st);
+    }
+    uint64_t slice_time = monotonic_ns() - start;
+    spec_is_equal(count,SLICE_LINES);
+
+    int ok = 0;
+    for(i=0;i<SLICE_KEPT;i++) {
+        sprintf(line,"line number %05d",i);
+        if (!strcmp((char *)_t_surface(kept[i]),line)) ok++;
+    }
+    spec_is_equal(ok,SLICE_KEPT);
+    spec_is_true(kept[0]->context.flags & TFLAG_SLICE);
+
+    // slices are copied when cloned, and given their own surface when it has to be reallocated
+    T *c = _t_clone(kept[1]);
+    spec_is_str_equal(t2s(c),"(TEST_STR_SYMBOL:line number 00001)");
+    spec_is_false(c->context.flags & TFLAG_SLICE);
+    _t_free(c);
+    __t_unslice(kept[2]);
+    spec_is_false(kept[2]->context.flags & TFLAG_SLICE);
+    spec_is_true(kept[2]->context.flags & TFLAG_ALLOCATED);
+    spec_is_str_equal((char *)_t_surface(kept[2]),"line number 00002");
+
+    // the kept slices outlive the stream
+    _st_kill(st);
+    pthread_join(st->pthread,NULL);
+    _st_free(st);
+    spec_is_str_equal(t2s(kept[SLICE_KEPT-1]),"(TEST_STR_SYMBOL:line number 00099)");
+    for(i=0;i<SLICE_KEPT;i++) _t_free(kept[i]);
+
+    // compare with copying each unit into its node
+    input = fmemopen(data,len,"r");
+    st = _st_new_unix_stream(input,1);
+    start = monotonic_ns();
+    count = 0;
+    for(__st_stream_read(st);st->flags&StreamHasData;__st_stream_read(st)) {
+        _st_data(st)[_st_data_size(st)] = 0;
+        _t_free(_t_new(0,TEST_STR_SYMBOL,_st_data(st),_st_data_size(st)+1));
+        count++;
+        _st_data_consumed(st);
+    }
+    uint64_t copy_time = monotonic_ns() - start;
+    spec_is_equal(count,SLICE_LINES);
+    bench_report("read %d lines as slices in %ld ns (copied: %ld ns)\n",SLICE_LINES,slice_time,copy_time);
+    _st_kill(st);
+    pthread_join(st->pthread,NULL);
+    _st_free(st);
+    free(data);
+    //! [testStreamSlice]
+}
+
+int _threadCount() {
+    int threads = 0;
+    char line[256];
+    FILE *f = fopen("/proc/self/status","r");
+    while (fgets(line,sizeof(line),f))
+        if (sscanf(line,"Threads: %d",&threads) == 1) break;
+    fclose(f);
+    return threads;
+}
+
+int G_reactor_reads;
+void testReactorCallback(Stream *st) {
+    __sync_fetch_and_add(&G_reactor_reads,1);
+}
+
+#define REACTOR_STREAMS 500
+void testStreamReactor() {
+    //! [testStreamReactor]
+    // socket streams are all read by the one reactor thread, so opening many
+    // of them doesn't add any threads
+    int fds[REACTOR_STREAMS][2];
+    Stream *st[REACTOR_STREAMS];
+    char buf[100];
+    int i;
+
+    for(i=0;i<REACTOR_STREAMS;i++) {
+        socketpair(AF_UNIX,SOCK_STREAM,0,fds[i]);
+    }
+    // the first socket stream makes sure the reactor is running
+    st[0] = _st_new_socket_stream(fds[0][0]);
+    int threads = _threadCount();
+    for(i=1;i<REACTOR_STREAMS;i++) {
+        st[i] = _st_new_socket_stream(fds[i][0]);
+    }
+    spec_is_equal(_threadCount(),threads);
+    spec_is_true(st[1]->flags&StreamReactor);
+    spec_is_true(st[1]->flags&StreamWaiting);
+
+    uint64_t start = monotonic_ns();
+    G_reactor_reads = 0;
+    for(i=0;i<REACTOR_STREAMS;i++) {
+        st[i]->callback = testReactorCallback;
+        _st_start_read(st[i]);
+        // send the line in two pieces so the reactor has to wait for the rest
+        sprintf(buf,"line %d",i);
+        write(fds[i][1],buf,strlen(buf));
+    }
+    for(i=0;i<REACTOR_STREAMS;i++) {
+        write(fds[i][1],"\n",1);
+    }
+    while(G_reactor_reads < REACTOR_STREAMS) sleepms(1);
+    uint64_t read_time = monotonic_ns() - start;
+    bench_report("reactor read a line from %d streams in %ld ns\n",REACTOR_STREAMS,read_time);
+
+    int ok = 0;
+    for(i=0;i<REACTOR_STREAMS;i++) {
+        sprintf(buf,"line %d",i);
+        if ((st[i]->flags&StreamHasData) && _st_data_size(st[i]) == strlen(buf) && !memcmp(_st_data(st[i]),buf,strlen(buf))) ok++;
+        _st_data_consumed(st[i]);
+    }
+    spec_is_equal(ok,REACTOR_STREAMS);
+    spec_is_equal(_threadCount(),threads);
+
+    // closing the other end finishes a pending read with the stream dead
+    _st_start_read(st[0]);
+    close(fds[0][1]);
+    while(G_reactor_reads < REACTOR_STREAMS+1) sleepms(1);
+    spec_is_false(st[0]->flags&StreamHasData);
+    spec_is_false(_st_is_alive(st[0]));
+
+    // writing to a peer that has stopped reading gives up once the socket has stayed
+    // full for the stream's write timeout
+    st[1]->write_timeout = 10;
+    size_t big_size = 1<<20;
+    char *big = malloc(big_size);
+    memset(big,'x',big_size);
+    spec_is_equal(_st_write(st[1],big,big_size),-1);
+    spec_is_equal(st[1]->err,ETIMEDOUT);
+    free(big);
+
+    // streams can be freed with reads still pending
+    for(i=1;i<REACTOR_STREAMS;i++) {
+        _st_start_read(st[i]);
+        _st_free(st[i]);
+        close(fds[i][1]);
+    }
+    _st_free(st[0]);
+    //! [testStreamReactor]
+}
+
 void testStream() {
     testStreamCreate();
     testStreamAlive();
     testStreamScan();
+    testStreamScanSpeed();
     testStreamFileLoad();
     testStreamRead(1000);
     testStreamRead(10);
     testStreamRead(2);
     testStreamWrite();
     testStreamWriteLine();
+    testStreamCork();
+    testStreamWriteSpeed();
+    testStreamSlice();
     testStreamSocket();
+    testStreamReactor();
 }
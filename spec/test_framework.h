@@ -19,6 +19,12 @@ char failures[MAX_FAILURES][5000];
 char buf1[2000];
 char buf2[2000];
 
+// the benchmarks in the specs only run at full size and report their timings when the
+// specs are run with --bench (see make bench), otherwise they run small as plain specs
+int G_bench = 0;
+#define bench_size(full,small) (G_bench ? (full) : (small))
+#define bench_report(...) if (G_bench) {printf("\n");printf(__VA_ARGS__);}
+
 #define spec_is_true(x) spec_total++;if (x){putchar('.');} else {putchar('F');sprintf(failures[spec_failures++],"%s:%d expected %s to be true",__FUNCTION__,__LINE__,#x);}
 #define spec_is_false(x) spec_total++;if (!(x)){putchar('.');} else {putchar('F');sprintf(failures[spec_failures++],"%s:%d expected %s to be false",__FUNCTION__,__LINE__,#x);}
 #define spec_is_equal(got, expected) spec_total++; {int __got=got;int __ex=expected;if (__ex==__got){putchar('.');} else {putchar('F');sprintf(failures[spec_failures++],"%s:%d expected %s to be %d but was %d",__FUNCTION__,__LINE__,#got,__ex,__got);}}
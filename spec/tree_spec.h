@@ -7,6 +7,8 @@
 #include "../src/ceptr.h"
 #include "../src/receptor.h"
 #include "http_example.h"
+#include "../src/hashfn.h"
+#include <errno.h>
 
 void testCreateTreeNodes() {
     /* test the creation of trees and the various function that give access to created data elements
@@ -357,9 +359,60 @@ void testTreeNodeIndex() {
     spec_is_equal(_t_node_index(_t_child(t,2)),2);
     spec_is_equal(_t_node_index(_t_child(t,3)),3);
     spec_is_equal(_t_node_index(t),0);
+    spec_is_ptr_equal(_t_next_sibling(_t_child(t,1)),_t_child(t,2));
+    spec_is_ptr_equal(_t_next_sibling(_t_child(t,3)),NULL);
+    spec_is_ptr_equal(_t_next_sibling(t),NULL);
 
    _t_free(t);
     //! [testTreeNodeIndex]
+
+    // the indexes are kept up to date as the tree changes
+    t = _t_new_root(ASCII_CHARS);
+    T *a = _t_newc(t,ASCII_CHAR,'a');
+    T *b = _t_newc(t,ASCII_CHAR,'b');
+    T *c = _t_newc(t,ASCII_CHAR,'c');
+    _t_detach_by_ptr(t,a);
+    spec_is_equal(_t_node_index(a),0);
+    spec_is_equal(_t_node_index(b),1);
+    spec_is_equal(_t_node_index(c),2);
+    int p[] = {2,TREE_PATH_TERMINATOR};
+    _t_insert_at(t,p,a);
+    spec_is_str_equal(t2s(t),"(ASCII_CHARS (ASCII_CHAR:'b') (ASCII_CHAR:'a') (ASCII_CHAR:'c'))");
+    spec_is_equal(_t_node_index(a),2);
+    spec_is_equal(_t_node_index(c),3);
+    spec_is_ptr_equal(_t_next_sibling(a),c);
+    T *x = _t_swap(t,3,_t_newc(0,ASCII_CHAR,'x'));
+    spec_is_ptr_equal(x,c);
+    spec_is_equal(_t_node_index(c),0);
+    spec_is_equal(_t_node_index(_t_child(t,3)),3);
+    _t_replace(t,1,c);
+    spec_is_equal(_t_node_index(c),1);
+    spec_is_ptr_equal(_t_next_sibling(c),a);
+    _t_free(t);
+
+    // compare finding the index of children in a wide tree with scanning the parent's children
+    int n = bench_size(100000,2000);
+    t = _t_new_root(SYMBOL_INSTANCES);
+    int i,j;
+    for(i=0;i<n;i++) _t_newi(t,TEST_INT_SYMBOL,i);
+    uint64_t start = monotonic_ns();
+    int scanned = 0;
+    for(i=n-1000;i<n;i++) {
+        x = _t_child(t,i+1);
+        for(j=1;j<=_t_children(t) && _t_child(t,j) != x;j++);
+        if (j == i+1) scanned++;
+    }
+    uint64_t scan_time = monotonic_ns() - start;
+    spec_is_equal(scanned,1000);
+    start = monotonic_ns();
+    int indexed = 0;
+    for(x=_t_child(t,1),i=1;x;x=_t_next_sibling(x),i++) {
+        if (_t_node_index(x) == i) indexed++;
+    }
+    uint64_t index_time = monotonic_ns() - start;
+    spec_is_equal(indexed,n);
+    bench_report("%d wide tree: scanning for 1000 indexes took %ldus, walking all siblings with their indexes %ldus\n",n,scan_time/1000,index_time/1000);
+    _t_free(t);
 }
 
 void testTreeClone() {
@@ -385,6 +438,67 @@ void testTreeClone() {
     //! [testTreeClone]
 }
 
+void testTreeRcloneCow() {
+    //! [testTreeRcloneCow]
+    T *t = _makeTestHTTPRequestTree(); // GET /groups/5/users.json?sort_by=last_name?page=2 HTTP/1.0
+    T *c = _t_rclone_cow(t);
+
+    // only the root gets copied, its children are still those of the original
+    spec_is_true(c->context.flags & TFLAG_COW);
+    spec_is_ptr_equal((T *)c->structure.children,t);
+
+    // reading follows the shared children without copying anything
+    spec_is_ptr_equal(_t_child(c,1),_t_child(t,1));
+    spec_is_equal(_t_children(c),_t_children(t));
+    spec_is_str_equal(t2s(c),t2s(t));
+    spec_is_true(c->context.flags & TFLAG_COW);
+
+    // cached hashing gives the same hash without writing into the shared code
+    spec_is_true(_t_hash_cached(G_sem,c) == _t_hash(G_sem,t));
+    spec_is_true(!(t->context.flags & TFLAG_HASHED));
+    spec_is_true(!(_t_child(t,1)->context.flags & TFLAG_HASHED));
+    spec_is_true(c->context.flags & TFLAG_COW);
+
+    // changing the children copies them, and they in turn share their children
+    _t_newi(c,TEST_INT_SYMBOL,1);
+    spec_is_true(!(c->context.flags & TFLAG_COW));
+    spec_is_equal(_t_children(c),_t_children(t)+1);
+    T *v = _t_child(c,1);
+    spec_is_true(v != _t_child(t,1));
+    spec_is_true(v->context.flags & TFLAG_COW);
+    spec_is_true(v->context.flags & TFLAG_RUN_NODE);
+    _t_free(_t_detach_by_idx(c,_t_children(c)));
+
+    // a copy of a copy-on-write node shares the same code
+    T *vc = _t_rclone(v);
+    spec_is_ptr_equal((T *)vc->structure.children,_t_child(t,1));
+    _t_free(vc);
+
+    // changing a copied child leaves the original alone
+    _t_newi(_t_child(c,2),TEST_INT_SYMBOL,1);
+    spec_is_equal(_t_children(_t_child(c,2)),_t_children(_t_child(t,2))+1);
+    spec_is_true(_t_hash(G_sem,c) != _t_hash(G_sem,t));
+
+    // detaching a node gives it its own copy of everything it was still sharing
+    v = _t_detach_by_idx(c,1);
+    spec_is_ptr_equal(_t_cow_code(v),NULL);
+    spec_is_ptr_equal(_t_cow_code(_t_child(v,1)),NULL);
+    spec_is_str_equal(t2s(v),t2s(_t_child(t,1)));
+    _t_free(v);
+
+    // and so does materializing a whole tree
+    v = _t_rclone_cow(t);
+    _t_materialize(v);
+    spec_is_ptr_equal(_t_cow_code(v),NULL);
+    spec_is_ptr_equal(_t_cow_code(_t_child(_t_child(v,3),1)),NULL);
+    spec_is_str_equal(t2s(v),t2s(t));
+    _t_free(v);
+
+    _t_free(c);
+    _t_free(t);
+    //! [testTreeRcloneCow]
+}
+
 void testTreeReplace() {
     //! [testTreeReplace]
     T *t = _makeTestHTTPRequestTree(); // GET /groups/5/users.json?sort_by=last_name?page=2 HTTP/1.0
@@ -511,6 +625,134 @@ void testTreeDetach() {
     //! [testTreeDetach]
 }
 
+void testTreeMoveChildren() {
+    //! [testTreeMoveChildren]
+    T *t = _t_new_root(ASCII_CHARS);
+    T *f = _t_new_root(ASCII_CHARS);
+    _t_newc(f,ASCII_CHAR,'a');
+    _t_newc(f,ASCII_CHAR,'b');
+
+    // moving onto a tree with no children
+    _t_move_children(t,f);
+    spec_is_str_equal(t2s(t),"(ASCII_CHARS (ASCII_CHAR:'a') (ASCII_CHAR:'b'))");
+    spec_is_str_equal(t2s(f),"(ASCII_CHARS)");
+    spec_is_ptr_equal(_t_parent(_t_child(t,2)),t);
+
+    // moving onto the end of existing children
+    _t_newc(f,ASCII_CHAR,'c');
+    _t_newc(f,ASCII_CHAR,'d');
+    _t_move_children(t,f);
+    spec_is_str_equal(t2s(t),"(ASCII_CHARS (ASCII_CHAR:'a') (ASCII_CHAR:'b') (ASCII_CHAR:'c') (ASCII_CHAR:'d'))");
+    spec_is_equal(_t_node_index(_t_child(t,4)),4);
+    spec_is_equal(_t_children(f),0);
+    _t_free(f);
+    //! [testTreeMoveChildren]
+
+    // detaching from the front keeps the indexes and lets the array be reused
+    T *a = _t_detach_by_idx(t,1);
+    spec_is_equal(_t_node_index(_t_child(t,1)),1);
+    spec_is_ptr_equal(_t_next_sibling(_t_child(t,1)),_t_child(t,2));
+    T *c = _t_detach_by_idx(t,2);
+    spec_is_str_equal(t2s(t),"(ASCII_CHARS (ASCII_CHAR:'b') (ASCII_CHAR:'d'))");
+    spec_is_equal(_t_node_index(_t_child(t,2)),2);
+    _t_add(t,a);
+    _t_add(t,c);
+    spec_is_str_equal(t2s(t),"(ASCII_CHARS (ASCII_CHAR:'b') (ASCII_CHAR:'d') (ASCII_CHAR:'a') (ASCII_CHAR:'c'))");
+    int i;
+    for(i=1;i<=4;i++) {
+        spec_is_equal(_t_node_index(_t_child(t,i)),i);
+    }
+    _t_free(t);
+
+    // compare draining children from the front with draining them from the back
+    int n = bench_size(10000,500);
+    t = _t_new_root(PENDING_SIGNALS);
+    for(i=0;i<n;i++) _t_newi(t,TEST_INT_SYMBOL,i);
+    uint64_t start = monotonic_ns();
+    int in_order = 0;
+    for(i=0;i<n;i++) {
+        T *x = _t_detach_by_idx(t,1);
+        if (*(int *)_t_surface(x) == i) in_order++;
+        _t_free(x);
+    }
+    uint64_t front_time = monotonic_ns() - start;
+    spec_is_equal(in_order,n);
+    for(i=0;i<n;i++) _t_newi(t,TEST_INT_SYMBOL,i);
+    start = monotonic_ns();
+    for(i=n;i>0;i--) _t_free(_t_detach_by_idx(t,i));
+    uint64_t back_time = monotonic_ns() - start;
+    spec_is_equal(_t_children(t),0);
+    bench_report("draining %d children: from the front took %ldus, from the back %ldus\n",n,front_time/1000,back_time/1000);
+    _t_free(t);
+}
+
+void testTreeArena() {
+    //! [testTreeArena]
+    Arena *a = _t_new_arena();
+    spec_is_equal(a->refs,1);
+
+    // without an arena in use run nodes come from the heap
+    T *h = __t_newr(0,TEST_INT_SYMBOL,true);
+    spec_is_false(h->context.flags & TFLAG_ARENA_NODE);
+    _t_free(h);
+
+    Arena *prev = _t_use_arena(a);
+    spec_is_ptr_equal(prev,NULL);
+
+    // but while one is in use, run nodes and their children arrays are carved out of it
+    T *t = __t_newr(0,TEST_ANYTHING_SYMBOL,true);
+    T *c = __t_newi(t,TEST_INT_SYMBOL,1,true);
+    spec_is_true(t->context.flags & TFLAG_ARENA_NODE);
+    spec_is_true(t->context.flags & TFLAG_ARENA_CHILDREN);
+    spec_is_true(c->context.flags & TFLAG_ARENA_NODE);
+    spec_is_equal(a->nodes,2);
+
+    // plain nodes still come from the heap
+    T *p = _t_newr(0,TEST_ANYTHING_SYMBOL);
+    spec_is_false(p->context.flags & TFLAG_ARENA_NODE);
+
+    // freeing an arena node puts it back on the arena's free list for reuse
+    _t_free(_t_detach_by_idx(t,1));
+    c = __t_newi(t,TEST_INT_SYMBOL,2,true);
+    spec_is_equal(a->nodes,3);
+    spec_is_equal(a->recycled,1);
+
+    // growing the children array keeps it in the arena
+    int i;
+    for(i=0;i<TREE_CHILDREN_BLOCK*2;i++) __t_newi(t,TEST_INT_SYMBOL,i,true);
+    spec_is_true(t->context.flags & TFLAG_ARENA_CHILDREN);
+    spec_is_equal(_t_children(t),TREE_CHILDREN_BLOCK*2+1);
+
+    // a node with an allocated surface has to be visited on teardown
+    spec_is_false(t->context.flags & TFLAG_ARENA_MIXED);
+    T *s = __t_new_str(0,TEST_STR_SYMBOL,"a long string surface",true);
+    spec_is_true(s->context.flags & TFLAG_ARENA_MIXED);
+    _t_add(t,s);
+    spec_is_true(t->context.flags & TFLAG_ARENA_MIXED);
+
+    // adding an arena node to a tree that isn't a run tree makes it escape, which
+    // holds a reference to the arena
+    T *e = __t_newr(0,TEST_ANYTHING_SYMBOL,true);
+    __t_newi(e,TEST_INT_SYMBOL,3,true);
+    _t_add(p,e);
+    spec_is_true(e->context.flags & TFLAG_ESCAPED);
+    spec_is_true(_t_child(e,1)->context.flags & TFLAG_ESCAPED);
+    spec_is_true(p->context.flags & TFLAG_ARENA_BELOW);
+    spec_is_equal(a->refs,3);
+
+    _t_use_arena(prev);
+    spec_is_str_equal(t2s(c),"(TEST_INT_SYMBOL:2)");
+
+    // tearing down the run tree only visits the parts the arena can't reclaim
+    // and the escaped nodes stay valid until they are freed themselves
+    _t_free_with_arena(t,a);
+    _t_release_arena(a);
+    spec_is_equal(a->refs,2);
+    spec_is_str_equal(t2s(p),"(TEST_ANYTHING_SYMBOL (TEST_ANYTHING_SYMBOL (TEST_INT_SYMBOL:3)))");
+    _t_free(p);
+    //! [testTreeArena]
+}
+
 void testTreeHash() {
     //! [testTreeHash]
     T *t = _makeTestHTTPRequestTree(); // GET /groups/5/users.json?sort_by=last_name?page=2 HTTP/1.0
@@ -538,6 +780,155 @@ void testTreeHash() {
     //! [testTreeHash]
 }
 
+void testTreeHashCached() {
+    //! [testTreeHashCached]
+    T *t = _makeTestHTTPRequestTree(); // GET /groups/5/users.json?sort_by=last_name?page=2 HTTP/1.0
+    TreeHash h = _t_hash(G_sem,t);
+
+    // plain hashing leaves the nodes alone, so it's safe on shared trees
+    spec_is_false(t->context.flags & TFLAG_HASHED);
+    spec_is_long_equal(_t_hash_cached(G_sem,t),h);
+    spec_is_true(t->context.flags & TFLAG_HASHED);
+
+    // changing the tree through the tree api makes the cached hash stale
+    T *t_version = _t_detach_by_idx(t,1);
+    spec_is_true(!_t_hash_equal(h,_t_hash_cached(G_sem,t)));
+    _t_add(t,t_version);
+    spec_is_long_equal(_t_hash_cached(G_sem,t),_t_hash(G_sem,t));
+
+    // (the version is now the last child so the path is the second one)
+    int p[] = {2,1,2,TREE_PATH_TERMINATOR};
+    T *v = _t_get(t,p);
+    h = _t_hash_cached(G_sem,t);
+    _t_morph(v,_t_child(_t_parent(v),1));
+    spec_is_true(!_t_hash_equal(h,_t_hash_cached(G_sem,t)));
+    spec_is_long_equal(_t_hash_cached(G_sem,t),_t_hash(G_sem,t));
+
+    // as does setting a surface or symbol
+    v = _t_child(t_version,2);
+    h = _t_hash_cached(G_sem,t);
+    int minor = *(int *)_t_surface(v)+1;
+    _t_set_surface(v,&minor,sizeof(int));
+    spec_is_equal(*(int *)_t_surface(v),minor);
+    spec_is_true(!_t_hash_equal(h,_t_hash_cached(G_sem,t)));
+    spec_is_long_equal(_t_hash_cached(G_sem,t),_t_hash(G_sem,t));
+    h = _t_hash_cached(G_sem,t);
+    Symbol minor_sym = _t_symbol(v);
+    _t_set_symbol(v,TEST_INT_SYMBOL);
+    spec_is_true(!_t_hash_equal(h,_t_hash_cached(G_sem,t)));
+    spec_is_long_equal(_t_hash_cached(G_sem,t),_t_hash(G_sem,t));
+    _t_set_symbol(v,minor_sym);
+
+    // setting a surface bigger than a pointer allocates it
+    T *s = _t_new_str(0,TEST_STR_SYMBOL,"x");
+    _t_set_surface(s,"a longer string",16);
+    spec_is_str_equal(t2s(s),"(TEST_STR_SYMBOL:a longer string)");
+    _t_set_surface(s,"y",2);
+    spec_is_str_equal(t2s(s),"(TEST_STR_SYMBOL:y)");
+    _t_free(s);
+
+    // but changes made directly to a surface have to be flagged with _t_touch
+    h = _t_hash_cached(G_sem,t);
+    (*(int *)&v->contents.surface)++;
+    spec_is_long_equal(_t_hash_cached(G_sem,t),h);
+    _t_touch(v);
+    spec_is_true(!_t_hash_equal(h,_t_hash_cached(G_sem,t)));
+    spec_is_long_equal(_t_hash_cached(G_sem,t),_t_hash(G_sem,t));
+
+    _t_free(t);
+    //! [testTreeHashCached]
+
+    // compare rehashing a large tree that has had one leaf changed
+    int n = bench_size(1000,50);
+    t = _t_new_root(PARAMS);
+    int i,j;
+    for(i=0;i<n;i++) {
+        T *c = _t_newr(t,PARAMS);
+        for(j=0;j<100;j++) _t_newi(c,TEST_INT_SYMBOL,i*100+j);
+    }
+    _t_hash_cached(G_sem,t);
+    uint64_t start = monotonic_ns();
+    for(i=0;i<10;i++) {
+        _t_newi(_t_child(t,i*n/10+1),TEST_INT_SYMBOL,i);
+        h = _t_hash(G_sem,t);
+    }
+    uint64_t full_time = monotonic_ns() - start;
+    start = monotonic_ns();
+    for(i=0;i<10;i++) {
+        _t_newi(_t_child(t,i*n/10+2),TEST_INT_SYMBOL,i);
+        h = _t_hash_cached(G_sem,t);
+    }
+    uint64_t cached_time = monotonic_ns() - start;
+    spec_is_long_equal(h,_t_hash(G_sem,t));
+    bench_report("rehashing a %d node tree after adding a node: from scratch took %ldus, with the cache %ldus\n",n*101+1,full_time/10000,cached_time/10000);
+    _t_free(t);
+}
+
+int _cmp_hashes(const void *a,const void *b) {
+    TreeHash x = *(TreeHash *)a, y = *(TreeHash *)b;
+    return (x > y) - (x < y);
+}
+
+// count the adjacent duplicates in a sorted array of hashes
+int _count_collisions(TreeHash *h,int n) {
+    int i,c = 0;
+    qsort(h,n,sizeof(TreeHash),_cmp_hashes);
+    for(i=1;i<n;i++) if (h[i] == h[i-1]) c++;
+    return c;
+}
+
+void testTreeHashCollisions() {
+    // hash lots of different random trees (a million when benchmarking) to check that
+    // none of them collide, and for comparison count how many would have if the hashes
+    // were only 32 bits wide
+    int i,n = bench_size(1<<20,1<<14);
+    TreeHash *h = malloc(sizeof(TreeHash)*n);
+    TreeHash *h32 = malloc(sizeof(TreeHash)*n);
+    T *t = _t_new_root(PARAMS);
+    T *a = _t_newi(t,TEST_INT_SYMBOL,0);
+    T *p = _t_newr(t,PARAMS);
+    T *b = _t_newi(p,TEST_INT_SYMBOL,0);
+    T *c = _t_newi(p,TEST_INT_SYMBOL2,0);
+    T *d = _t_newi64(t,TEST_INT64_SYMBOL,0);
+    srand(1);
+    uint64_t start = monotonic_ns();
+    for(i=0;i<n;i++) {
+        // the counter keeps every tree different
+        *(int *)&a->contents.surface = i;
+        *(int *)&b->contents.surface = rand();
+        *(int *)&c->contents.surface = rand()%10;
+        *(uint64_t *)&d->contents.surface = ((uint64_t)rand()<<32)|rand();
+        h[i] = _t_hash(G_sem,t);
+    }
+    uint64_t tree_time = monotonic_ns() - start;
+    for(i=0;i<n;i++) h32[i] = (uint32_t)h[i];
+    spec_is_equal(_count_collisions(h,n),0);
+    int c32 = _count_collisions(h32,n);
+    // the birthday bound predicts about n^2/2^33, i.e. 128 for a million, but hardly
+    // any for the smaller run
+    if (G_bench) {spec_is_true(c32 > 0 && c32 < 512);}
+    bench_report("hashing %d six node trees took %ldns per tree: 64 bit collisions: 0, 32 bit collisions: %d\n",n,tree_time/n,c32);
+    _t_free(t);
+    free(h);
+    free(h32);
+
+    // raw throughput of the old 32 bit surface hash compared to the 64 bit one
+    int size = 1<<16;
+    char *buf = malloc(size);
+    for(i=0;i<size;i++) buf[i] = rand();
+    uint64_t x = 0;
+    start = monotonic_ns();
+    int reps = bench_size(1000,10);
+    for(i=0;i<reps;i++) x += hashfn(buf,size);
+    uint64_t time32 = monotonic_ns() - start;
+    start = monotonic_ns();
+    for(i=0;i<reps;i++) x += hashfn64(buf,size,i);
+    uint64_t time64 = monotonic_ns() - start;
+    spec_is_true(x != 0);
+    bench_report("hashing 64K surfaces: hashfn %ldMB/s, hashfn64 %ldMB/s\n",(long)(1000L*reps*size/(time32+1)),(long)(1000L*reps*size/(time64+1)));
+    free(buf);
+}
+
 void testUUID() {
     spec_is_long_equal(sizeof(UUIDt),16); //128 bits
     UUIDt u = __uuid_gen();
@@ -549,9 +940,107 @@ void testUUID() {
     // time should be right about now, i.e. within X ms
     spec_is_long_equal(u.time,t);
 
+    // UUIDs made in the same microsecond should still be different
+    UUIDt u1 = __uuid_gen();
+    UUIDt u2 = __uuid_gen();
+    spec_is_true(!__uuid_equal(&u1,&u2));
+
     // @todo something else for the other bits of the UUID.
 }
 
+// a visitor that counts nodes and records the deepest level
+bool _testWalkCount(TreeWalk *w,TreeWalkFrame *f) {
+    int *counts = w->param;
+    counts[0]++;
+    if (_t_walk_level(w,f) > counts[1]) counts[1] = _t_walk_level(w,f);
+    // don't count what's below the path segments
+    return !semeq(_t_symbol(f->t),HTTP_REQUEST_PATH_SEGMENTS);
+}
+
+// a recursive clone to compare the walking one against
+T *_testRecursiveClone(T *t,T *p) {
+    T *nt = _t_size(t) ? _t_new(p,_t_symbol(t),_t_surface(t),_t_size(t)) : _t_newr(p,_t_symbol(t));
+    DO_KIDS(t,_testRecursiveClone(_t_child(t,i),nt));
+    return nt;
+}
+
+typedef struct {
+    T *t;
+    TreeHash clone_hash,unserialized_hash;
+    char *dump,*json;
+} DeepTreeTest;
+
+// works on a deep tree in a thread whose stack is far too small to recurse down it
+void *_testDeepTreeThread(void *arg) {
+    DeepTreeTest *d = arg;
+    T *c = _t_clone(d->t);
+    d->clone_hash = _t_hash(G_sem,c);
+    size_t l;
+    void *surface,*s;
+    _t_serialize(G_sem,c,&surface,&l);
+    s = surface;
+    T *u = _t_unserialize(G_sem,&surface,&l,0);
+    d->unserialized_hash = _t_hash(G_sem,u);
+    free(s);
+    __t_dump(G_sem,u,0,d->dump);
+    _t2json(G_sem,u,0,d->json);
+    _t_free(u);
+    _t_free(c);
+    return NULL;
+}
+
+void testTreeWalk() {
+    //! [testTreeWalk]
+    T *t = _makeTestHTTPRequestTree(); // GET /groups/5/users.json?sort_by=last_name?page=2 HTTP/1.0
+    int counts[2] = {0,0};
+    _t_walk(t,_testWalkCount,NULL,counts);
+    spec_is_equal(counts[0],18);
+    spec_is_equal(counts[1],5);
+    _t_free(t);
+    //! [testTreeWalk]
+
+    // clone, hash, serialize and dump a tree too deep to recurse down on a small stack
+    int i,depth = 20000;
+    T *p = t = _t_new_root(LINES);
+    for(i=1;i<depth;i++) p = _t_newr(p,LINES);
+    _t_newi(p,TEST_INT_SYMBOL,1);
+    DeepTreeTest d = {t,0,0,malloc(depth*10),malloc(depth*100)};
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr,256*1024);
+    spec_is_equal(pthread_create(&thread,&attr,_testDeepTreeThread,&d),0);
+    pthread_join(thread,NULL);
+    pthread_attr_destroy(&attr);
+    TreeHash h = _t_hash(G_sem,t);
+    spec_is_long_equal(d.clone_hash,h);
+    spec_is_long_equal(d.unserialized_hash,h);
+    spec_is_long_equal(strlen(d.dump),depth*8+19);
+    d.dump[depth*7+21] = 0;
+    spec_is_str_equal(d.dump+depth*7-14,"(LINES (LINES (TEST_INT_SYMBOL:1)))");
+    spec_is_ptr_equal(strstr(d.json,"\"surface\":1}]}]}"),strstr(d.json,"\"surface\""));
+    free(d.dump);
+    free(d.json);
+    _t_free(t);
+
+    // compare the walk to plain recursion on a wide tree
+    int n = bench_size(1000,50),reps = bench_size(10,1);
+    t = _t_new_root(PARAMS);
+    for(i=0;i<n;i++) {
+        T *c = _t_newr(t,PARAMS);
+        int j;
+        for(j=0;j<100;j++) _t_newi(c,TEST_INT_SYMBOL,i*100+j);
+    }
+    uint64_t start = monotonic_ns();
+    for(i=0;i<reps;i++) _t_free(_testRecursiveClone(t,0));
+    uint64_t recursive_time = monotonic_ns() - start;
+    start = monotonic_ns();
+    for(i=0;i<reps;i++) _t_free(_t_clone(t));
+    uint64_t walk_time = monotonic_ns() - start;
+    bench_report("cloning and freeing a %d node wide tree: recursively took %ldus, by walking %ldus\n",n*101+1,recursive_time/reps/1000,walk_time/reps/1000);
+    _t_free(t);
+}
+
 void testTreeSerialize() {
     //! [testTreeSerialize]
     char buf[2000] = {0};
@@ -568,6 +1057,8 @@ void testTreeSerialize() {
     __t_dump(G_sem,t1,0,buf1);
 
     spec_is_str_equal(buf1,buf);
+    // the buffer is allocated once at exactly the serialized size
+    spec_is_long_equal(_t_serialized_size(G_sem,t,0),(surface-s));
 
     _t_free(t);
     _t_free(t1);
@@ -576,6 +1067,56 @@ void testTreeSerialize() {
     //! [testTreeSerialize]
 }
 
+void testTreeSerializeStream() {
+    //! [testTreeSerializeStream]
+    // a tree with more data than the write buffer holds, and a surface too big for it
+    T *t = _t_new_root(LINES);
+    int i;
+    for(i=0;i<10000;i++) _t_newi(t,TEST_INT_SYMBOL,i);
+    char big[3*SERIALIZE_BUFFER_SIZE];
+    memset(big,'x',sizeof(big));
+    big[sizeof(big)-1] = 0;
+    _t_new_str(t,TEST_STR_SYMBOL,big);
+    _t_newi(t,TEST_INT_SYMBOL,i);
+
+    size_t l;
+    void *surface;
+    _t_serialize(G_sem,t,&surface,&l);
+
+    char *output_data = NULL;
+    size_t size;
+    FILE *output = open_memstream(&output_data,&size);
+    Stream *st = _st_new_unix_stream(output,0);
+    spec_is_long_equal(_t_serialize_stream(G_sem,t,st),l);
+    spec_is_long_equal(size,l);
+    spec_is_true(!memcmp(output_data,surface,l));
+
+    FILE *f = tmpfile();
+    int fd = fileno(f);
+    spec_is_long_equal(_t_serialize_fd(G_sem,t,fd),l);
+    spec_is_long_equal(lseek(fd,0,SEEK_END),l);
+    lseek(fd,0,SEEK_SET);
+    char *data = malloc(l);
+    spec_is_long_equal(read(fd,data,l),l);
+    void *d = data;
+    T *t1 = _t_unserialize(G_sem,&d,&l,0);
+    spec_is_long_equal(_t_hash(G_sem,t1),_t_hash(G_sem,t));
+
+    // a bad file descriptor is reported
+    spec_is_long_equal(_t_serialize_fd(G_sem,t,-1),-1);
+    spec_is_equal(errno,EBADF);
+    //! [testTreeSerializeStream]
+    errno = 0;
+
+    free(data);
+    fclose(f);
+    _st_free(st);
+    free(output_data);
+    free(surface);
+    _t_free(t1);
+    _t_free(t);
+}
+
 void testTreeJSON() {
     //! [testTreeJSON]
     char buf[5000] = {0};
@@ -803,15 +1344,22 @@ void testTree() {
     testTreePathSprint();
     testTreePathWalk();
     testTreeClone();
+    testTreeRcloneCow();
     testTreeReplace();
     testTreeSwap();
     testTreeInsertAt();
     testTreeMorph();
     testTreeMorphLowLevel();
     testTreeDetach();
+    testTreeMoveChildren();
+    testTreeArena();
     testTreeHash();
+    testTreeHashCached();
+    testTreeHashCollisions();
     testUUID();
+    testTreeWalk();
     testTreeSerialize();
+    testTreeSerializeStream();
     testTreeJSON();
     testProcessHTML();
     testTreeBuild();
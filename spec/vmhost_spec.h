@@ -28,6 +28,35 @@ void testVMHostCreate() {
     //! [testVMHostCreate]
 }
 
+void testVMHostSelfAddress() {
+    //! [testVMHostSelfAddress]
+    VMHost *v = _v_new();
+    SemTable *sem = v->r->sem;
+    Receptor *r = _r_new(sem,TEST_RECEPTOR);
+    _v_new_receptor(v,v->r,TEST_RECEPTOR,r);
+
+    // signals addressed to "self" get the sender's address filled in
+    ReceptorAddress self = {SELF_RECEPTOR_ADDR};
+    T *s = __r_make_signal(self,self,DEFAULT_ASPECT,TESTING,_t_newi(0,TEST_INT_SYMBOL,314),0,0,0);
+    T *to = _t_getv(s,SignalMessageIdx,MessageHeadIdx,HeadToIdx,TREE_PATH_TERMINATOR);
+    T *from = _t_getv(s,SignalMessageIdx,MessageHeadIdx,HeadFromIdx,TREE_PATH_TERMINATOR);
+    TreeHash th = _t_hash_cached(sem,to);
+    TreeHash fh = _t_hash_cached(sem,from);
+    spec_is_ptr_equal(__v_get_destination(v,r,s),r);
+    spec_is_equal(((ReceptorAddress *)_t_surface(_t_child(to,1)))->addr,r->addr.addr);
+    spec_is_equal(((ReceptorAddress *)_t_surface(_t_child(from,1)))->addr,r->addr.addr);
+
+    // which changes the addresses' hashes
+    spec_is_true(!_t_hash_equal(th,_t_hash_cached(sem,to)));
+    spec_is_long_equal(_t_hash_cached(sem,to),_t_hash(sem,to));
+    spec_is_true(!_t_hash_equal(fh,_t_hash_cached(sem,from)));
+    spec_is_long_equal(_t_hash_cached(sem,from),_t_hash(sem,from));
+
+    _t_free(s);
+    _v_free(v);
+    //! [testVMHostSelfAddress]
+}
+
 /* #define HTTP_SERVER_RECEPTOR_UUID 4321 */
 /* /\** */
 /*  * generate an http server receptor package */
@@ -359,6 +388,173 @@ void testVMHostShell() {
     free(output_data);
 }
 
+void testVMHostScheduler() {
+    //! [testVMHostScheduler]
+    VMHost *v = _v_new();
+    Receptor *r = _r_new(v->sem,TEST_RECEPTOR);
+    Xaddr x = _v_new_receptor(v,v->r,TEST_RECEPTOR,r);
+    _v_activate(v,x);
+
+    // activating a receptor hooks its q up to the vmhost's scheduler
+    spec_is_ptr_equal(r->q->scheduler,&v->scheduler);
+
+    _v_start_vmhost(v);
+    sleepms(100);
+
+    // an idle vmhost sleeps on the scheduler instead of spinning over its receptors
+    // (the stats are kept under the scheduler's lock as the workers update them)
+    pthread_mutex_lock(&v->scheduler.mutex);
+    spec_is_true(v->scheduler.idle_waits <= 2*v->scheduler.workers);
+    uint64_t wakeups = v->scheduler.wakeups;
+    pthread_mutex_unlock(&v->scheduler.mutex);
+
+    // adding a run tree to an active receptor's q wakes the scheduler which reduces it
+    T *n = _t_newr(0,ADD_INT);
+    _t_newi(n,TEST_INT_SYMBOL,2);
+    _t_newi(n,TEST_INT_SYMBOL,3);
+    T *run_tree = __p_build_run_tree(n,0);
+    _t_free(n);
+    _p_addrt2q(r->q,run_tree);
+    sleepms(100);
+
+    pthread_mutex_lock(&v->scheduler.mutex);
+    spec_is_true(v->scheduler.wakeups > wakeups);
+    // and it got woken well before the watchdog timeout would have fired
+    spec_is_true(v->scheduler.max_latency < SCHEDULER_WATCHDOG_MS*1000000LL);
+    pthread_mutex_unlock(&v->scheduler.mutex);
+    pthread_mutex_lock(&r->q->mutex);
+    spec_is_equal(r->q->contexts_count,0);
+    spec_is_ptr_equal(r->q->completed,NULL);
+    pthread_mutex_unlock(&r->q->mutex);
+
+    // killing the vmhost receptor also wakes the scheduler so the thread exits promptly
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    __r_kill(v->r);
+    _v_join_thread(&v->vm_thread);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    spec_is_true(diff_micro(&start,&end) < SCHEDULER_WATCHDOG_MS*1000);
+
+    _v_free(v);
+    //! [testVMHostScheduler]
+}
+
+// reduce a CPU-bound run tree in each of a number of receptors using a given number of
+// workers, returns the elapsed time and how many of the workers picked up any work
+uint64_t _testVMHostWorkerRun(int workers,int receptors,int iterations,int *used) {
+    VMHost *v = _v_new();
+    _v_set_workers(v,workers);
+    spec_is_equal(v->scheduler.workers,workers);
+
+    Receptor *r[receptors];
+    int i,done = 0;
+    char buf[200];
+    sprintf(buf,"(ITERATE (PARAMS) (TEST_INT_SYMBOL:%d) (ADD_INT (TEST_INT_SYMBOL:1) (TEST_INT_SYMBOL:2)))",iterations);
+    for (i=0;i<receptors;i++) {
+        r[i] = _r_new(v->sem,TEST_RECEPTOR);
+        Xaddr x = _v_new_receptor(v,v->r,TEST_RECEPTOR,r[i]);
+        _v_activate(v,x);
+        T *code = _t_parse(v->sem,0,buf);
+        T *run_tree = __p_build_run_tree(code,0);
+        _t_free(code);
+        _p_addrt2q(r[i]->q,run_tree);
+    }
+
+    uint64_t start = monotonic_ns();
+    _v_start_vmhost(v);
+    int tries = 10000;
+    while (done < receptors && tries--) {
+        sleepms(1);
+        for (done=0,i=0;i<receptors;i++) {
+            Q *q = r[i]->q;
+            pthread_mutex_lock(&q->mutex);
+            if (!q->active && !q->blocked && !q->completed) done++;
+            pthread_mutex_unlock(&q->mutex);
+        }
+    }
+    uint64_t elapsed = monotonic_ns() - start;
+    spec_is_equal(done,receptors);
+
+    __r_kill(v->r);
+    _v_join_thread(&v->vm_thread);
+
+    // every receptor's run tree got reduced to completion
+    for (i=0;i<receptors;i++) {
+        spec_is_equal(r[i]->q->contexts_count,0);
+        spec_is_ptr_equal(r[i]->q->active,NULL);
+    }
+    Scheduler *s = &v->scheduler;
+    spec_is_true(s->wakeups >= receptors);
+    for (*used=0,i=0;i<workers;i++) if (s->deques[i].runs) (*used)++;
+
+    _v_free(v);
+    return elapsed;
+}
+
+void testVMHostWorkers() {
+    //! [testVMHostWorkers]
+    // the same load gets reduced by a single worker and by a pool of workers that can
+    // steal receptors from each other
+    int receptors = 8,iterations = bench_size(20000,5000),used;
+    int workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers > 4) workers = 4;
+    uint64_t t1 = _testVMHostWorkerRun(1,receptors,iterations,&used);
+    spec_is_equal(used,1);
+    if (workers > 1) {
+        // with a core for each worker the load gets spread across the pool
+        uint64_t tn = _testVMHostWorkerRun(workers,receptors,iterations,&used);
+        spec_is_true(used > 1);
+        bench_report("%d receptors reduced by 1 worker in %ldus, by %d workers in %ldus\n",receptors,t1/1000,workers,tn/1000);
+    }
+    else {
+        // there's only one core so which workers get to run is up to the OS, just check
+        // that a pool still gets all the work done
+        _testVMHostWorkerRun(4,receptors,iterations,&used);
+        bench_report("%d receptors reduced by 1 worker in %ldus, single core so no spread to check\n",receptors,t1/1000);
+    }
+    //! [testVMHostWorkers]
+}
+
+void testVMHostQuantum() {
+    //! [testVMHostQuantum]
+    VMHost *v = _v_new();
+    _v_set_quantum(v,1000);
+    Receptor *batch = _r_new(v->sem,TEST_RECEPTOR);
+    Receptor *interactive = _r_new(v->sem,TEST_RECEPTOR);
+    _v_activate(v,_v_new_receptor(v,v->r,TEST_RECEPTOR,batch));
+    _v_activate(v,_v_new_receptor(v,v->r,TEST_RECEPTOR,interactive));
+
+    // the batch receptor gets two time slices per turn
+    _v_set_weight(batch,2);
+    spec_is_equal(batch->q->weight,2);
+    spec_is_equal(interactive->q->weight,1);
+
+    T *code = _t_parse(v->sem,0,"(ITERATE (PARAMS) (TEST_INT_SYMBOL:1000000) (ADD_INT (TEST_INT_SYMBOL:1) (TEST_INT_SYMBOL:2)))");
+    T *run_tree = __p_build_run_tree(code,0);
+    _t_free(code);
+    _p_addrt2q(batch->q,run_tree);
+
+    _v_start_vmhost(v);
+    sleepms(10);
+
+    // work for the interactive receptor gets done while the batch receptor is still busy
+    code = _t_parse(v->sem,0,"(ADD_INT (TEST_INT_SYMBOL:1) (TEST_INT_SYMBOL:2))");
+    run_tree = __p_build_run_tree(code,0);
+    _t_free(code);
+    _p_addrt2q(interactive->q,run_tree);
+    sleepms(50);
+
+    spec_is_ptr_equal(interactive->q->active,NULL);
+    spec_is_ptr_equal(interactive->q->completed,NULL);
+    spec_is_equal(batch->q->contexts_count,1);
+    spec_is_true(v->scheduler.preemptions > 0);
+
+    __r_kill(v->r);
+    _v_join_thread(&v->vm_thread);
+    _v_free(v);
+    //! [testVMHostQuantum]
+}
+
 void testVMHostSerialize() {
     G_vm = _v_new();
     _v_instantiate_builtins(G_vm);
@@ -385,9 +581,13 @@ void testVMHostSerialize() {
 }
 void testVMHost() {
     testVMHostCreate();
+    testVMHostSelfAddress();
     //testVMHostLoadReceptorPackage();
     //testVMHostInstallReceptor();
     //testVMHostActivateReceptor();
     testVMHostShell();
+    testVMHostScheduler();
+    testVMHostWorkers();
+    testVMHostQuantum();
     //   testVMHostSerialize();
 }
@@ -41,11 +41,12 @@ void __a_serializet(T *t,char *name) {
 T *__a_unserializet(char *dir_path,char *name) {
     char fn[1000];
     __a_vm_fn(fn,dir_path,name);
-    S *s = readFile(fn,0);
-    H h = _m_unserialize(s);
-    free(s);
+    size_t size;
+    S *s = mapFile(fn,&size);
+    H h = _m_view(s);
     T *t = _t_new_from_m(h);
     _m_free(h);
+    unmapFile(s,size);
     return t;
 }
 
@@ -74,6 +75,7 @@ void _a_boot(char *dir_path) {
     else {
         char fn[1000];
         void *buffer;
+        size_t size;
         // unserialize the semtable base tree
         SemTable *sem = _sem_new();
         T *t = __a_unserializet(dir_path,SEM_FN);
@@ -87,7 +89,7 @@ void _a_boot(char *dir_path) {
             T *p = _t_child(paths,i);
             if (semeq(RECEPTOR_PATH,_t_symbol(p))) {
                 T *x = _t_get(t,(int *)_t_surface(p));
-                sem->stores[i-1].definitions = x;
+                _sem_restore_context(sem,i-1,x);
             }
         }
         _t_free(paths);
@@ -95,18 +97,17 @@ void _a_boot(char *dir_path) {
 
         // unserialize all of the vmhost's instantiated receptors and other instances
         __a_vmfn(fn,dir_path);
-        buffer = readFile(fn,0);
+        buffer = mapFile(fn,&size);
 
         Receptor *r = _r_unserialize(sem,buffer);
         G_vm = __v_init(r,sem);
-        free(buffer);
+        unmapFile(buffer,size);
 
         // unserialize other vmhost state data
         S *s;
         __a_vm_state_fn(fn,dir_path);
-        s = readFile(fn,0);
-        H h = _m_unserialize(s);
-        free(s);
+        s = mapFile(fn,&size);
+        H h = _m_view(s);
 
         H hars; hars.m=h.m; hars.a = _m_child(h,1); // first child is ACTIVE_RECEPTORS
         H har; har.m=h.m;
@@ -117,6 +118,7 @@ void _a_boot(char *dir_path) {
             _v_activate(G_vm,*(Xaddr *)_m_surface(har));
         }
         _m_free(h);
+        unmapFile(s,size);
     }
     G_vm->dir = dir_path;
 
@@ -327,7 +329,7 @@ void _a_serialize_instances(Instances *i,char *file) {
 }
 
 void __a_unserialize_instances(SemTable *sem,Instances *instances,S *s) {
-    H h = _m_unserialize(s);
+    H h = _m_view(s);
     T *t = _t_new_from_m(h);
 
     _m_free(h);
@@ -350,27 +352,13 @@ void __a_unserialize_instances(SemTable *sem,Instances *instances,S *s) {
 }
 
 void _a_unserialize_instances(SemTable *sem,Instances *instances,char *file) {
-    FILE *ofp;
-
-    ofp = fopen(file, "r");
-    if (ofp == NULL) {
-        raise_error("Can't open input file %s!\n",file);
-    }
-    else {
-        Mmagic magic;
-        fread(&magic, 1,sizeof(magic), ofp);
-        // @todo check magic value
-        size_t total_size;
-        fread(&magic, 1,sizeof(magic), ofp);
-        S *s = malloc(total_size);
-        s->magic = magic;
-        s->total_size = total_size;
-        size_t read_size = total_size-sizeof(Mmagic)-sizeof(total_size);
-        fread(&s->levels,1,read_size,ofp);
-        fclose(ofp);
-        __a_unserialize_instances(sem,instances,s);
-        free(s);
+    size_t size;
+    S *s = mapFile(file,&size);
+    if (size < sizeof(S) || !_m_serialized_ok(s)) {
+        raise_error("%s isn't a serialized instances file",file);
     }
+    __a_unserialize_instances(sem,instances,s);
+    unmapFile(s,size);
 }
 
 T *__a_get_tokens(Instances *instances) {
@@ -396,7 +384,7 @@ T *_a_gen_token(Instances *instances,Xaddr x,T *dependency) {
 
     // cheat and add the token xaddr and dependency as leaves of the last token here in the store
     _t_new(t,TOKEN_XADDR,&x,sizeof(Xaddr));
-    _t_newi(t,DEPENDENCY_HASH,_t_hash(G_sem,dependency));
+    _t_newi64(t,DEPENDENCY_HASH,_t_hash(G_sem,dependency));
 
     return result;
 }
@@ -442,7 +430,7 @@ void _a_add_dependency(Instances *instances,T *token,T *dependency) {
         T *t = __a_find_token(tokens,*(uint64_t *)_t_surface(token));
         if (t) {
             if (!__a_find_dependency(t,dependency))
-                _t_newi(t,DEPENDENCY_HASH,_t_hash(G_sem,dependency));
+                _t_newi64(t,DEPENDENCY_HASH,_t_hash(G_sem,dependency));
             return;
         }
     }
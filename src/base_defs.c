@@ -1179,7 +1179,7 @@ void base_defs(SemTable *sem) {
   sY(SYS_CONTEXT,INSTANCE_TOKENS,TUPLE_OF_LAST_TOKEN_AND_ZERO_OR_MORE_OF_INSTANCE_TOKEN);
   sTs(SYS_CONTEXT,TUPLE_OF_INSTANCES_AND_ZERO_OR_ONE_OF_INSTANCE_TOKENS,sT_SEQ(2,sT_SYM(INSTANCES),sT_QMRK(sT_SYM(INSTANCE_TOKENS))));
   sY(SYS_CONTEXT,INSTANCE_STORE,TUPLE_OF_INSTANCES_AND_ZERO_OR_ONE_OF_INSTANCE_TOKENS);
-  sY(SYS_CONTEXT,DEPENDENCY_HASH,INTEGER);
+  sY(SYS_CONTEXT,DEPENDENCY_HASH,INTEGER64);
   sY(SYS_CONTEXT,TOKEN_XADDR,XADDR);
   sY(SYS_CONTEXT,ENGLISH_LABEL,CSTRING);
   sY(SYS_CONTEXT,SPANISH_LABEL,CSTRING);
@@ -65,7 +65,7 @@ int main(int argc, const char **argv) {
 
     _v_start_vmhost(G_vm);
 
-    while (G_vm->r->state == Alive) {
+    while (__r_alive(G_vm->r)) {
         sleepms(100);
     };
 
@@ -13,6 +13,7 @@
 // NOTE: the actual values of the types matter because they must match the order they show
 // up in the definition trees
 enum SemanticTypes {SEM_TYPE_STRUCTURE=1,SEM_TYPE_SYMBOL,SEM_TYPE_PROCESS,SEM_TYPE_RECEPTOR,SEM_TYPE_PROTOCOL};
+#define SEM_TYPES SEM_TYPE_PROTOCOL
 #define is_symbol(s) ((s).semtype == SEM_TYPE_SYMBOL)
 #define is_process(s) ((s).semtype == SEM_TYPE_PROCESS)
 #define is_structure(s) ((s).semtype == SEM_TYPE_STRUCTURE)
@@ -54,23 +55,39 @@ typedef struct N {
 
 typedef struct L {
     Mindex nodes;
+    Mindex capacity;      ///< how many nodes nP has room for
     N *nP;
+    // child index for the level, built on demand and thrown away when the level or its parents change
+    Mindex *first;        ///< the children of parent i are at positions first[i] to first[i+1]-1, NULL if not built
+    Mindex *order;        ///< node indexes by position, NULL when the nodes are already in parent order
+    Mindex *rank;         ///< position of each node, NULL when the nodes are already in parent order
 } L;
 
 typedef struct M {
     Mmagic magic;
     Mlevel levels;
+    Mlevel capacity;      ///< how many levels lP has room for
     L *lP;
+    struct S *view;       ///< serialized image whose nodes lP points into, NULL unless a read-only view
 } M;
 
 // node entries are fixed size but the surface when serialized is an offset
 // in the blob not a pointer
 #define SERIALIZED_NODE_SIZE (sizeof(N)-sizeof(void *)+sizeof(size_t))
-#define SERIALIZED_LEVEL_SIZE(l) (sizeof(Mindex)+SERIALIZED_NODE_SIZE*l->nodes)
-#define SERIALIZED_HEADER_SIZE(levels) (sizeof(S)+sizeof(uint32_t)*(levels))
+// the header, the nodes of each level, orthogonal tree images in the blob, and the whole
+// image are padded to the alignment of N, so the nodes of an aligned image can be used in place
+#define SERIALIZED_ALIGN _Alignof(N)
+#define SERIALIZED_PAD(x) (((x)+SERIALIZED_ALIGN-1) & ~(SERIALIZED_ALIGN-1))
+#define SERIALIZED_NODES_OFFSET SERIALIZED_PAD(sizeof(Mindex))
+#define SERIALIZED_LEVEL_SIZE(l) (SERIALIZED_NODES_OFFSET+SERIALIZED_NODE_SIZE*l->nodes)
+#define SERIALIZED_HEADER_SIZE(levels) SERIALIZED_PAD(sizeof(S)+sizeof(uint32_t)*(levels))
+// layout version of serialized mtrees.  Images from before the padding was added have
+// no version, which leaves 0 where it goes (the serializer always zeroed the header)
+#define SERIALIZED_VERSION 1
 
 typedef struct S {
     Mmagic magic;
+    uint32_t version;
     size_t total_size;
     Mlevel levels;
     uint32_t blob_offset;
@@ -97,18 +114,33 @@ enum treeImplementations {ptrImpl=0xfffffffe,matrixImpl=0xffffffff};
 // ** types for pointer trees
 typedef struct Tstruct {
     uint32_t child_count;
+    uint32_t index;       ///< the node's slot in its parent's children array (0 for a root)
     struct T *parent;
-    struct T **children;
+    struct T **children;  ///< the first child, just after the array's ChildrenHeader
 } Tstruct;
 
+/**
+ * Bookkeeping kept in the slot in front of a node's first child.
+ *
+ * Children arrays work like a deque: detaching the first child just moves the
+ * header up a slot, so the array holds offset dead slots in front of the header
+ */
+typedef struct ChildrenHeader {
+    uint32_t offset;      ///< how many children have been popped off the front of the array
+    uint32_t class;       ///< size class, the array has TREE_CHILDREN_BLOCK<<class slots
+} ChildrenHeader;
+
 typedef struct Tcontents {
     Symbol symbol;
     size_t size;
     void *surface;
 } Tcontents;
 
+typedef uint64_t TreeHash;
+
 typedef struct Tcontext {
     uint32_t flags;
+    TreeHash hash;        ///< the node's hash, valid when TFLAG_HASHED is set
 } Tcontext;
 
 /**
@@ -136,12 +168,61 @@ typedef struct rT {
     uint32_t cur_child;
 } rT;
 
+// ** types for explicit-stack tree walks (see _t_walk)
+#define TREE_WALK_STACK 64           ///< frames a walk can use before it has to go to the heap
+
+/**
+ * The state of a node being visited during a tree walk
+ */
+typedef struct TreeWalkFrame {
+    T *t;                 ///< the node
+    int i;                ///< the child being visited (0 before the first one)
+    int c;                ///< how many children will be visited
+    void *data;           ///< the visitor's data for the node (i.e. the copy of it in a clone)
+} TreeWalkFrame;
+
+/**
+ * A walk over a tree using an explicit stack of frames instead of recursion
+ */
+typedef struct TreeWalk {
+    TreeWalkFrame *frames;    ///< the frames from the root to the current node
+    int depth;                ///< index of the current node's frame
+    int size;                 ///< number of available frames
+    void *param;              ///< the visitor's parameter
+    TreeWalkFrame stack[TREE_WALK_STACK];
+} TreeWalk;
+
+/// visitor called for each node of a walk, on the way down it returns false to skip the node's children
+typedef bool (*TreeVisitor)(TreeWalk *w,TreeWalkFrame *f);
+
+// ** types for run-tree arenas
+#define ARENA_CHILDREN_CLASSES 8     ///< children arrays up to this size class get recycled
+
+typedef struct ArenaBlock ArenaBlock;
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t size;
+    size_t used;
+    char mem[];
+};
+
+/**
+ * A pointer-bump region that run-tree nodes get carved out of while their process is being
+ * reduced so that tearing the run tree down is a single release instead of a free per node
+ */
+typedef struct Arena {
+    int refs;                ///< one for the owner plus one for every node that escaped the arena
+    ArenaBlock *blocks;      ///< chain of blocks the pointer-bump allocations come from
+    void *free_nodes;        ///< node slots freed during reduction, ready for reuse
+    void *free_children[ARENA_CHILDREN_CLASSES]; ///< freed children arrays by size class
+    int nodes;               ///< count of node allocations served from the arena
+    int recycled;            ///< how many of those came off the free list
+} Arena;
+
 // macro helper to get at the cur_child element of a run-tree node when given a regular
 // node (does the casting to make code look cleaner)
 #define rt_cur_child(tP) (((rT *)tP)->cur_child)
 
-typedef uint32_t TreeHash;
-
 // ** types for labels
 typedef uint32_t Label;
 
@@ -168,6 +249,8 @@ struct ConversationState {
 
 // ** types for processing
 // run-tree context
+typedef struct BytecodeVM BytecodeVM;
+
 typedef struct R R;
 struct R {
     int id;           ///< the process id this context exists in
@@ -181,12 +264,14 @@ struct R {
     R *callee;        ///< a pointer to the context we've invoked
     T *sem_map;       ///< semantic map in effect for this context
     ConversationState *conversation;  ///< record of the conversation state active in this context frame
+    BytecodeVM *vm;   ///< interpreter state for compiled calls made from this context (allocated on first use)
 };
 
 // ** structure to hold in process accounting
 typedef struct Accounting Accounting;
 struct Accounting {
     uint64_t elapsed_time;
+    uint64_t steps;          ///< number of reduction steps taken
 };
 
 // Processing Queue element
@@ -194,6 +279,7 @@ typedef struct Qe Qe;
 struct Qe {
     int id;
     R *context;
+    Arena *arena;           ///< where run-tree nodes built while reducing this element come from
     Accounting accounts;
     Qe *next;
     Qe *prev;
@@ -205,8 +291,40 @@ typedef struct ReceptorAddress {
 
 typedef struct Receptor Receptor;
 
-// Processing Queue structure
 typedef struct Q Q;
+
+// deque of runnable processing queues belonging to one worker of the scheduler's thread pool
+typedef struct RunDeque {
+    Q **qs;          ///< ring buffer of queues
+    int size;        ///< allocated slots in the ring
+    int head;        ///< index of the oldest entry
+    int count;       ///< number of queues waiting
+    uint64_t runs;   ///< number of queues picked up by this deque's worker
+} RunDeque;
+
+#define MAX_WORKERS 64
+
+// Scheduler that processing queues notify when they become runnable
+typedef struct Scheduler Scheduler;
+struct Scheduler {
+    pthread_mutex_t mutex;   ///< guards the deques and the queues' sched_state
+    pthread_cond_t cv;
+    int queued;              ///< total number of queues waiting in the deques
+    int workers;             ///< number of worker deques in use
+    int next;                ///< round-robin deque for notifications from outside the pool
+    uint64_t quantum;        ///< time slice (us) per weight that a worker reduces a queue for before moving on (0 for unlimited)
+    RunDeque deques[MAX_WORKERS];
+    uint64_t wakeups;        ///< number of times a worker picked up a runnable queue
+    uint64_t steals;         ///< number of those pick-ups taken from another worker's deque
+    uint64_t preemptions;    ///< number of times a queue was put back because it used up its time slice
+    uint64_t idle_waits;     ///< number of times a worker went to sleep for lack of work
+    uint64_t total_latency;  ///< summed runnable to pick-up latency (ns)
+    uint64_t max_latency;    ///< worst runnable to pick-up latency (ns)
+};
+
+enum QSchedStates {QIdle=0,QQueued,QRunning,QRerun};
+
+// Processing Queue structure
 struct Q {
     Receptor *r;         ///< back-pointer to receptor in which this Q is running (for defs and more)
     int contexts_count;  ///< number of active processes
@@ -214,11 +332,38 @@ struct Q {
     Qe *completed;       ///< completed processes (pending cleanup)
     Qe *blocked;         ///< blocked processes
     pthread_mutex_t mutex;
+    Scheduler *scheduler;///< scheduler to notify when this queue becomes runnable (NULL if none)
+    int sched_state;     ///< QSchedStates value, only a worker in the QRunning state may reduce the queue
+    uint64_t runnable_at;///< monotonic time (ns) at which the queue was last put in a deque
+    int weight;          ///< priority weight, i.e. how many of the scheduler's quanta this queue gets per turn
+    int quanta_used;     ///< number of times reducing stopped because the time slice was used up
 };
 
 // SemTable structures
+typedef struct Bytecode Bytecode;
+typedef struct DefEntry {
+    T *def;
+    Bytecode *bytecode;   ///< compiled process code (NULL where not compiled)
+} DefEntry;
+
+#define DEF_INDEX_FIRST_CHUNK 64  ///< entries in an index's first chunk, each chunk after that is twice as big
+#define DEF_INDEX_CHUNKS 11       ///< enough chunks to hold every SemanticAddr
+
+/**
+ * The definitions of one semantic type in a context, indexed by semantic address
+ *
+ * the index is append only: entries never move once they are added and count is only
+ * advanced (with release ordering) after the entry it covers has been filled in, so
+ * definitions can be looked up without taking the semtable's lock
+ */
+typedef struct DefIndex {
+    DefEntry *chunks[DEF_INDEX_CHUNKS];
+    int count;
+} DefIndex;
+
 typedef struct ContextStore {
     T *definitions;
+    DefIndex index[SEM_TYPES]; ///< lock-free lookup of the definitions by semantic type
     //LabelTable table;    ///< the label table for this context?
 } ContextStore;
 
@@ -227,9 +372,85 @@ typedef struct ContextStore {
 typedef struct SemTable {
     int contexts;
     ContextStore stores[MAX_CONTEXTS];
+    pthread_mutex_t lock;   ///< held to add definitions, labels and bytecode (lookups don't take it)
+    T **retired;            ///< label trees replaced while readers may still have been using them
+    int retired_count;
 } SemTable;
 
 
+typedef struct UUIDt {
+    uint64_t data;
+    uint64_t time;
+} UUIDt;
+
+// ** types for caching compiled semtrex patterns
+typedef struct Stx Stx;
+
+/**
+ * An element in a receptor's table of compiled expectation patterns
+ */
+typedef struct expectation_pattern {
+    T *expectation;          ///< the expectation the pattern belongs to
+    Stx *stx;                ///< the compiled pattern (NULL until the first time it's needed)
+    Symbol aspect;           ///< the aspect the expectation is on
+    Symbol carrier;          ///< the carrier the expectation listens for
+    Symbol root;             ///< the symbol a signal must have to match the pattern (NULL_SYMBOL if any)
+    uint32_t seq;            ///< the order of the expectation on its aspect
+    int generation;          ///< marks entries found when rebuilding the dispatch index
+    UT_hash_handle hh;       ///< makes this structure hashable using the uthash library
+} expectation_pattern;
+typedef expectation_pattern *ExpectationPatterns;
+
+/**
+ * The expectations on an aspect that listen for the same carrier and root symbol
+ */
+typedef struct expectation_bucket {
+    struct {
+        Symbol aspect;
+        Symbol carrier;
+        Symbol root;
+    } key;
+    expectation_pattern **entries;  ///< the expectations in the order they are on the aspect
+    int count;
+    int size;
+    UT_hash_handle hh;       ///< makes this structure hashable using the uthash library
+} expectation_bucket;
+typedef expectation_bucket *ExpectationIndex;
+
+/**
+ * An element in a receptor's table of compiled symbol definition semtrexes
+ */
+typedef struct def_pattern {
+    Symbol symbol;           ///< the symbol whose definition the pattern matches
+    Stx *stx;                ///< the compiled pattern
+    UT_hash_handle hh;       ///< makes this structure hashable using the uthash library
+} def_pattern;
+typedef def_pattern *DefPatterns;
+
+// ** types for indexing a receptor's conversation state by UUID
+
+/**
+ * An element in a receptor's UUID keyed table of conversations or pending responses
+ */
+typedef struct uuid_entry {
+    UUIDt uuid;              ///< the conversation or request signal UUID
+    T *t;                    ///< the CONVERSATION or PENDING_RESPONSE with that UUID
+    UT_hash_handle hh;       ///< makes this structure hashable using the uthash library
+} uuid_entry;
+typedef uuid_entry *UUIDIndex;
+
+/**
+ * The trees (expectations or pending responses) that were set up in a conversation
+ */
+typedef struct uuid_list {
+    UUIDt uuid;              ///< the conversation UUID
+    T **items;
+    int count;
+    int size;
+    UT_hash_handle hh;       ///< makes this structure hashable using the uthash library
+} uuid_list;
+typedef uuid_list *UUIDListIndex;
+
 // ** types for receptors
 enum ReceptorStates {Alive=0,Dead};
 
@@ -251,16 +472,23 @@ struct Receptor {
     pthread_mutex_t pending_signals_mutex;
     pthread_mutex_t pending_responses_mutex;
     Instances instances; ///< the instances store
+    pthread_mutex_t instances_mutex; ///< held while using the instances store as other threads (i.e. the clock) set instances
     Q *q;                ///< process queue
+    T *inbox;            ///< signals waiting to be delivered by whichever worker next runs this receptor
+    pthread_mutex_t inbox_mutex;
     int state;           ///< state information about the receptor that the vmhost manages
     T *edge;             ///< data store for edge receptors
+    ExpectationPatterns expectation_patterns; ///< compiled patterns of the expectations in the flux
+    ExpectationIndex expectation_index; ///< expectations bucketed for dispatching signals
+    uint32_t expectation_seq;  ///< sequence counter for ordering the dispatch index
+    DefPatterns def_patterns; ///< compiled semtrexes for matching symbol definitions
+    pthread_mutex_t patterns_mutex;
+    UUIDIndex conversation_index;   ///< conversations and sub-conversations by their UUID
+    UUIDIndex response_index;       ///< pending responses by the UUID of the request signal
+    UUIDListIndex conversation_expectations; ///< expectations keyed to a conversation by its UUID
+    UUIDListIndex conversation_responses;    ///< pending responses to requests sent in a conversation
 };
 
-typedef struct UUIDt {
-    uint64_t data;
-    uint64_t time;
-} UUIDt;
-
 // aspects appear on either side of the membrane
 enum AspectType {EXTERNAL_ASPECT=0,INTERNAL_ASPECT};
 typedef Symbol Aspect;  //aspects are identified by a semantic Symbol identifier
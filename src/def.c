@@ -13,6 +13,7 @@
 #include "stream.h"
 #include "def.h"
 #include "semtrex.h"
+#include "process.h"
 char __d_extra_buf[100];
 
 int semeq(SemanticID s1,SemanticID s2) {
@@ -26,10 +27,40 @@ SemanticAddr  _d_get_def_addr(T *def) {
     return _t_node_index(def);
 }
 
-SemanticID _d_define(SemTable *sem,T *def,SemanticType semtype,Context c) {
+// add a definition to the semtable without compiling process code
+SemanticID __d_define(SemTable *sem,T *def,SemanticType semtype,Context c) {
+    // work out what's inert in process code while the definition is still private
+    if (semtype == SEM_TYPE_PROCESS) {
+        T *code = _t_child(def,ProcessDefCodeIdx);
+        if (code) __p_mark_inert(code);
+    }
+    pthread_mutex_lock(&sem->lock);
     T *definitions = __sem_get_defs(sem,semtype,c);
     _t_add(definitions,def);
     SemanticID sid = {c,semtype,_d_get_def_addr(def)};
+    // publish the definition for lookups only once it's complete
+    __sem_index_def(&__sem_context(sem,c)->index[semtype-1],def);
+    pthread_mutex_unlock(&sem->lock);
+    return sid;
+}
+
+/**
+ * add a definition to the semtable
+ *
+ * @param[in] sem the semantic table to add the definition to
+ * @param[in] def the definition
+ * @param[in] semtype the semantic type of the definition
+ * @param[in] c the context in which to define it
+ * @returns the semantic id of the new definition
+ * @note process code is also compiled to bytecode if it only uses the compilable instructions (see _p_compile)
+ */
+SemanticID _d_define(SemTable *sem,T *def,SemanticType semtype,Context c) {
+    SemanticID sid = __d_define(sem,def,semtype,c);
+    // compile the code now so calls don't have to be tree reduced
+    if (semtype == SEM_TYPE_PROCESS) {
+        Bytecode *b = _p_compile(sem,sid);
+        if (b) _sem_set_bytecode(sem,sid,b);
+    }
     return sid;
 }
 
@@ -37,16 +68,14 @@ SemanticID _d_define(SemTable *sem,T *def,SemanticType semtype,Context c) {
 void __d_validate_symbol(SemTable *sem,Symbol s,char *n) {
     if (!is_symbol(s)) raise_error("Bad symbol in %s def: semantic type not SEM_TYPE_SYMBOL",n);
     if (is_sys_symbol(s) && (s.id == 0)) return; // NULL_SYMBOL ok
-    T *symbols = _sem_get_defs(sem,s);
-    if (!_t_child(symbols,s.id)) raise_error("Bad symbol in %s def: definition not found in context",n);
+    if (!_sem_get_def(sem,s)) raise_error("Bad symbol in %s def: definition not found in context",n);
 }
 
 // internal check to see if a structure is valid
 void __d_validate_structure(SemTable *sem,Structure s,char *n) {
     if (!is_structure(s)) raise_error("Bad structure in %s def: semantic type not SEM_TYPE_STRUCTURE",n);
     if (is_sys_structure(s) && (s.id == 0)) return; // NULL_STRUCTURE ok
-    T *structures = _sem_get_defs(sem,s);
-    if(s.id && !_t_child(structures,s.id)) {raise_error("Unknown structure <%d.%d.%d> in declaration of %s",s.context,s.semtype,s.id,n);}
+    if(s.id && !_sem_get_def(sem,s)) {raise_error("Unknown structure <%d.%d.%d> in declaration of %s",s.context,s.semtype,s.id,n);}
 }
 
 // this is used to reset the structure of a symbol that has been pre declared as NULL_SYMBOL
@@ -57,7 +86,7 @@ void __d_set_symbol_structure(T *symbols,Symbol sym,Structure s) {
     T * structure_def = _t_child(t,SymbolDefStructureIdx);
     if (!semeq(NULL_STRUCTURE,*(Symbol *)_t_surface(structure_def)))
         raise_error("Symbol already defined");
-    *(Symbol *)_t_surface(structure_def) = s;
+    _t_set_surface(structure_def,&s,sizeof(Structure));
 }
 
 // this is used to set the structure definition of a declared but undefined strcture
@@ -217,7 +246,6 @@ size_t _sys_structure_size(int id,void *surface) {
  */
 size_t _d_get_structure_size(SemTable *sem,Structure s,void *surface) {
     size_t size = 0;
-    T *structures = _sem_get_defs(sem,s);
 
     if (is_sys_structure(s)) {
         size = _sys_structure_size(s.id,surface);
@@ -226,7 +254,7 @@ size_t _d_get_structure_size(SemTable *sem,Structure s,void *surface) {
         }
     }
     else {
-        T *structure = _t_child(structures,s.id);
+        T *structure = _sem_get_def(sem,s);
         T *parts = _t_child(structure,2);
         if (semeq(_t_symbol(parts),STRUCTURE_SEQUENCE)) {
             DO_KIDS(parts,
@@ -262,7 +290,7 @@ void __d_tsig(SemTable *sem,T *code, T *tsig,TreeHash *hashes) {
             T *sc = _t_detach_by_idx(c,i);
             __d_tsig(sem,sc,tsig,hashes);
             _t_free(sc);
-            _t_hash(sem,c);
+            h = _t_hash(sem,c);
         }
         else h = _t_hash(sem,code);
         // check for duplicates
@@ -275,7 +303,7 @@ void __d_tsig(SemTable *sem,T *code, T *tsig,TreeHash *hashes) {
         if (!hashes[i]) {
             hashes[i] = h;
             if (!c) c = _t_clone(code); // clone it if it wasn't cloned above
-            c->contents.symbol = EXPECTED_SLOT;
+            _t_set_symbol(c,EXPECTED_SLOT);
             _t_add(tsig,c);
             c = NULL;
         }
@@ -328,6 +356,7 @@ T *_d_make_process_def(T *code,char *name,char *intention,T *signature,T *link)
  * @param[in] intention a description of what the process intends to do/transform
  * @param[in] signature the signature for the process
  * @returns the process identifier
+ * @note the code is also compiled to bytecode if it only uses the compilable instructions (see _p_compile)
  * @todo this is not thread safe!
  *
  * <b>Examples (from test suite):</b>
@@ -489,7 +518,7 @@ SemanticID __d_define_receptor(SemTable *sem,T *def,Context c) {
 
     // big trick!! put the context number in the surface of the definition so
     // we can get later in _d_get_receptor_address
-    (*(int *)_t_surface(def)) = new_context;
+    _t_set_surface(def,&new_context,sizeof(int));
 
     // account for the one exception where the VMHost is defined inside itself
     // we can't use _d_define because when it tries to look up the newly added
@@ -535,21 +564,15 @@ char *_indent_line(int level,char *buf) {
 }
 
 #include "ansicolor.h"
-#define MAX_LEVEL 100
 T *G_cursor = NULL;
-char * __t_dump(SemTable *sem,T *t,int level,char *buf) {
-    if (!t) return "";
+// write the dump of just the node t (without the closing paren), returns the end of buf
+char *__t_dump_node(SemTable *sem,T *t,char *buf) {
     Symbol s = _t_symbol(t);
     char b[255];
     char tbuf[2000];
     int i;
-    char *c,*obuf;
+    char *c;
     Xaddr x;
-    buf = _indent_line(level,buf);
-
-    if (level > MAX_LEVEL) {
-        raise_error("whoa, MAX_LEVEL exceeded!");
-    }
 
     // use this to mark all run nodes with a %
     /* if (t->context.flags & TFLAG_RUN_NODE) { */
@@ -559,7 +582,6 @@ char * __t_dump(SemTable *sem,T *t,int level,char *buf) {
     /* } */
 
     char *n = _sem_get_name(sem,s);
-    obuf = buf;
     if (t && (t == G_cursor)) {sprintf(buf,KRED);buf += strlen(buf);}
 
     if (is_process(s)) {
@@ -660,10 +682,37 @@ char * __t_dump(SemTable *sem,T *t,int level,char *buf) {
         }
     }
     if (t&&(t == G_cursor)) {sprintf(buf+strlen(buf),KNRM);}
+    return buf+strlen(buf);
+}
+
+struct dump_walk {
+    SemTable *sem;
+    int level;
+    char *buf;           ///< the end of the output so far
+    char *start;         ///< where the root's dump starts, after its indentation
+};
+
+bool __t_dump_pre(TreeWalk *w,TreeWalkFrame *f) {
+    struct dump_walk *dw = w->param;
+    int l = _t_walk_level(w,f);
+    dw->buf = _indent_line(dw->level < 0 ? dw->level-l : dw->level+l,dw->buf);
+    if (f == w->frames) dw->start = dw->buf;
+    dw->buf = __t_dump_node(dw->sem,f->t,dw->buf);
+    return true;
+}
+
+bool __t_dump_post(TreeWalk *w,TreeWalkFrame *f) {
+    struct dump_walk *dw = w->param;
+    *dw->buf++ = ')';
+    *dw->buf = 0;
+    return true;
+}
 
-    DO_KIDS(t,__t_dump(sem,_t_child(t,i),level < 0 ? level-1 : level+1,buf+strlen(buf)));
-    sprintf(buf+strlen(buf),")");
-    return obuf;
+char * __t_dump(SemTable *sem,T *t,int level,char *buf) {
+    if (!t) return "";
+    struct dump_walk dw = {sem,level,buf};
+    _t_walk(t,__t_dump_pre,__t_dump_post,&dw);
+    return dw.start;
 }
 
 /** @}*/
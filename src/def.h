@@ -64,6 +64,7 @@ T *G_cursor; // used in _t_dump to highlight a particular node
 #define SP(r,code,name,intention,signature,link) name = _r_define_process(r,code,"" #name "",intention,signature,link)
 
 int semeq(SemanticID s1,SemanticID s2);
+SemanticID __d_define(SemTable *sem,T *def,SemanticType semtype,Context c);
 SemanticID _d_define(SemTable *sem,T *def,SemanticType semtype,Context c);
 void __d_validate_symbol(SemTable *sem,Symbol s,char *n);
 void __d_validate_structure(SemTable *sem,Structure s,char *n);
@@ -2,6 +2,7 @@
 
 #include "hashfn.h"
 #include <stdio.h>
+#include <string.h>
 #undef get16bits
 #if (defined(__GNUC__) && defined(__i386__)) || defined(__WATCOMC__) || defined(_MSC_VER) || defined (__BORLANDC__) || defined (__TURBOC__)
 #define get16bits(d) (*((const uint16_t *) (d)))
@@ -56,3 +57,58 @@ int rem;
 
     return hash;
 }
+
+// 64 bit word-at-a-time hash in the style of wyhash: the input is read 8 bytes at a
+// time and folded in with 64x64->128 bit multiplies, which gives good avalanching at
+// a few cycles per word.
+
+#define HASH64_P0 0xa0761d6478bd642full
+#define HASH64_P1 0xe7037ed1a0b428dbull
+#define HASH64_P2 0x8ebc6af09c88c6e3ull
+#define HASH64_P3 0x589965cc75374cc3ull
+
+static inline uint64_t __hash64_mix(uint64_t a,uint64_t b) {
+    __uint128_t r = (__uint128_t)a*b;
+    return (uint64_t)r ^ (uint64_t)(r>>64);
+}
+
+static inline uint64_t __hash64_r8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v,p,8);
+    return v;
+}
+
+static inline uint64_t __hash64_r4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v,p,4);
+    return v;
+}
+
+uint64_t hashfn64(const void *data,size_t len,uint64_t seed) {
+    const uint8_t *p = data;
+    size_t i = len;
+    uint64_t a,b;
+
+    seed ^= HASH64_P0;
+    while (i > 16) {
+        seed = __hash64_mix(__hash64_r8(p)^HASH64_P1,__hash64_r8(p+8)^seed);
+        p += 16;
+        i -= 16;
+    }
+    // the last 1-16 bytes are read as two possibly overlapping words
+    if (i > 8) {
+        a = __hash64_r8(p);
+        b = __hash64_r8(p+i-8);
+    }
+    else if (i >= 4) {
+        a = __hash64_r4(p);
+        b = __hash64_r4(p+i-4);
+    }
+    else if (i > 0) {
+        a = ((uint64_t)p[0]<<16) | ((uint64_t)p[i>>1]<<8) | p[i-1];
+        b = 0;
+    }
+    else a = b = 0;
+
+    return __hash64_mix(HASH64_P1^len,__hash64_mix(a^HASH64_P2,b^seed^HASH64_P3));
+}
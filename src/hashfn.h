@@ -1,2 +1,4 @@
 #include <stdint.h>
+#include <stddef.h>
 uint32_t hashfn(const char * data, int len);
+uint64_t hashfn64(const void *data,size_t len,uint64_t seed);
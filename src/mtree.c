@@ -17,42 +17,103 @@
 const H null_H = {0,{NULL_ADDR,NULL_ADDR}};
 
 // low-level function to allocate a new tree level to an mtree
-/// @todo make this not realloc each time?
+// the level table grows geometrically so adding levels one at a time is amortized O(1)
 void __m_add_level(M *m) {
-    if (!m->levels++) {
-        m->lP = malloc(sizeof(L));
+    if (m->levels == m->capacity) {
+        m->capacity = m->capacity ? m->capacity*2 : MTREE_LEVELS_BLOCK;
+        m->lP = realloc(m->lP,sizeof(L)*m->capacity);
     }
-    else {
-        m->lP = realloc(m->lP,sizeof(L)*m->levels);
-    }
-    int i = m->levels-1;
+    int i = m->levels++;
     m->lP[i].nodes = 0;
+    m->lP[i].capacity = 0;
+    m->lP[i].nP = NULL;
+    m->lP[i].first = NULL;
+}
+
+// low-level function to throw away the child index of a level
+void __m_free_index(L *l) {
+    if (l->first) {
+        free(l->first);
+        free(l->order);
+        free(l->rank);
+        l->first = l->order = l->rank = NULL;
+    }
+}
+
+// low-level function to invalidate the child indexes that depend on the nodes of a level:
+// its own, and that of the level below whose parents it holds
+void __m_touch_level(M *m,Mlevel l) {
+    __m_free_index(&m->lP[l]);
+    if (l+1 < m->levels) __m_free_index(&m->lP[l+1]);
+}
+
+/**
+ * low-level function to get the level holding a node's children with its child index built
+ *
+ * The index is a counting sort of the level's live nodes by parent, so building it is O(n)
+ * and afterwards finding a child is O(1).  The usual case is that nodes were added in
+ * parent order (as _m_new_from_t and _m_unserialize do), and then no sort is needed.
+ */
+L *__m_child_level(H h) {
+    M *m = h.m;
+    L *l = &m->lP[h.a.l+1];
+    if (l->first) return l;
+
+    Mindex parents = m->lP[h.a.l].nodes;
+    Mindex *first = calloc(parents+1,sizeof(Mindex));
+    Mindex i,live = 0,last = 0;
+    bool sorted = true;
+    N *n = l->nP;
+    for(i=0;i<l->nodes;i++,n++) {
+        if (n->flags & TFLAG_DELETED) {sorted = false;continue;}
+        if (n->parenti >= parents) raise_error("bad parent index %d at level %d",n->parenti,h.a.l+1);
+        if (n->parenti < last) sorted = false;
+        last = n->parenti;
+        first[n->parenti+1]++;
+        live++;
+    }
+    for(i=0;i<parents;i++) first[i+1] += first[i];
+
+    l->order = l->rank = NULL;
+    if (!sorted) {
+        Mindex *next = malloc(sizeof(Mindex)*parents);
+        memcpy(next,first,sizeof(Mindex)*parents);
+        l->order = malloc(sizeof(Mindex)*(live ? live : 1));
+        l->rank = malloc(sizeof(Mindex)*l->nodes);
+        for(i=0,n=l->nP;i<l->nodes;i++,n++) {
+            if (n->flags & TFLAG_DELETED) l->rank[i] = NULL_ADDR;
+            else {
+                Mindex r = next[n->parenti]++;
+                l->order[r] = i;
+                l->rank[i] = r;
+            }
+        }
+        free(next);
+    }
+    l->first = first;
+    return l;
 }
 
 // low-level function to add c nodes to given level
-/// @todo make this not realloc each time!!
+// the node array grows geometrically so adding nodes one at a time is amortized O(1)
 N *__m_add_nodes(H h,L *l,int c) {
-    N *n;
     Mindex i = l->nodes;
-    if (!i) {
-        size_t s = sizeof(N)*c;
-        l->nP = malloc(s);
-        memset(l->nP,0,s);
-        l->nodes = c;
-    }
-    else {
-        //  size_t os = sizeof(N)*l->nodes;
-        l->nodes += c;
-        size_t ns = sizeof(N)*l->nodes;
-        l->nP = realloc(l->nP,ns);
-        //  memset(l->nP+ns,0,sizeof(N)*c);
-    }
-    n = _GET_NODE(h,l,i);
+    __m_touch_level(h.m,h.a.l);
+    if (i+c > l->capacity) {
+        Mindex capacity = l->capacity ? l->capacity : MTREE_NODES_BLOCK;
+        while (capacity < i+c) capacity *= 2;
+        l->nP = realloc(l->nP,sizeof(N)*capacity);
+        l->capacity = capacity;
+    }
+    l->nodes += c;
+    N *n = _GET_NODE(h,l,i);
+    memset(n,0,sizeof(N)*c);
     return n;
 }
 
 // low level function to initialize a new node under a parent
 void __m_new_init(H parent,H *h,L **l) {
+    if (parent.m->view) _m_materialize(parent);
     h->m = parent.m;
     h->a.l = parent.a.l+1;
 
@@ -74,13 +135,34 @@ void __m_new_init(H parent,H *h,L **l) {
 void __m_new_root(H *h, L **l) {
     M *m = h->m = malloc(sizeof(M));
     m->magic = matrixImpl;
-    m->levels = 0;
+    m->levels = m->capacity = 0;
+    m->lP = NULL;
+    m->view = NULL;
     h->a.l = 0;
     h->a.i = 0;
     __m_add_level(m);
     *l = GET_LEVEL(*h);
 }
 
+// low level function to fill in a new node
+void __m_init_node(N *n,Symbol symbol,void *surface,size_t size,uint32_t flags,Mindex parenti) {
+    n->symbol = symbol;
+    n->size = size;
+    n->parenti = parenti;
+    n->flags = flags;
+    if (size) {
+        if (size <= sizeof(void *)) {
+            memcpy(&n->surface,surface,size);
+        }
+        else {
+            n->flags |= TFLAG_ALLOCATED;
+            n->surface = malloc(size);
+            if (surface)
+                memcpy(n->surface,surface,size);
+        }
+    }
+}
+
 /**
  * Create a new tree node
  *
@@ -103,25 +185,8 @@ H __m_new(H parent,Symbol symbol,void *surface,size_t size,uint32_t flags) {
     }
 
     // add a node
-    N *n,*nl;
-    n = __m_add_nodes(h,l,1);
-
-    n->symbol = symbol;
-    n->size = size;
-    n->parenti = parent.m ? parent.a.i : NULL_ADDR;
-    n->flags = flags;
-    if (size) {
-        if (size <= sizeof(void *)) {
-            memcpy(&n->surface,surface,size);
-        }
-        else {
-            n->flags |= TFLAG_ALLOCATED;
-            n->surface = malloc(size);
-            if (surface)
-                memcpy(n->surface,surface,size);
-        }
-    }
-
+    N *n = __m_add_nodes(h,l,1);
+    __m_init_node(n,symbol,surface,size,flags,parent.m ? parent.a.i : NULL_ADDR);
     return h;
 }
 
@@ -158,13 +223,33 @@ H _m_newi(H parent,Symbol symbol,int surface) {
     return _m_new(parent,symbol,&surface,sizeof(int));
 }
 
-// helper function to recursively traverse a ttree and build an mtree out of it
-// used by _m_new_from_t
-H __mnft(H parent,T *t) {
-    int i, c = _t_children(t);
+struct mnft_walk {
+    M *m;
+};
+
+// counts the nodes at each level so they can be allocated up front
+bool __mnft_count_pre(TreeWalk *w,TreeWalkFrame *f) {
+    M *m = ((struct mnft_walk *)w->param)->m;
+    Mlevel l = _t_walk_level(w,f);
+    if (l == m->levels) __m_add_level(m);
+    m->lP[l].capacity++;
+    return true;
+}
 
-    // clear the allocated flag, because that will get recalculated in __m_new
-    uint32_t flags = t->context.flags & ~TFLAG_ALLOCATED;
+// fills in a node, appending it to its level which keeps each level in parent order
+bool __mnft_pre(TreeWalk *w,TreeWalkFrame *f) {
+    M *m = ((struct mnft_walk *)w->param)->m;
+    T *t = f->t;
+    Mlevel lv = _t_walk_level(w,f);
+    L *l = &m->lP[lv];
+    Mindex i = l->nodes++;
+    N *n = &l->nP[i];
+    Mindex parenti = f == w->frames ? NULL_ADDR : (Mindex)(uintptr_t)f[-1].data;
+    f->data = (void *)(uintptr_t)i;
+
+    // clear the allocated flag, because that will get recalculated in __m_init_node, and
+    // the run-tree arena, hash cache, code sharing and slice flags which only make sense for ttree nodes
+    uint32_t flags = t->context.flags & ~(TFLAG_ALLOCATED+TFLAG_ARENA_MASK+TFLAG_HASHED+TFLAG_SHARE_MASK+TFLAG_SLICE);
     // if the ttree points to a type that has an allocated c structure as its surface
     // it must be copied into the mtree as reference, otherwise it would get freed twice
     // when the mtree is freed
@@ -172,45 +257,59 @@ H __mnft(H parent,T *t) {
     if (flags & (TFLAG_SURFACE_IS_RECEPTOR+TFLAG_SURFACE_IS_SCAPE+TFLAG_SURFACE_IS_CPTR)) flags |= TFLAG_REFERENCE;
     void *surface = _t_surface(t);
     void *sp;
-    H h;
+    memset(n,0,sizeof(N));
 
     if (flags & TFLAG_SURFACE_IS_TREE && !(flags & TFLAG_SURFACE_IS_RECEPTOR)) {
         H sh = _m_new_from_t((T *)surface);
-        h = _m_newt(parent,_t_symbol(t),sh);
+        __m_init_node(n,_t_symbol(t),&sh,sizeof(H),flags,parenti);
     }
     else {
         if (flags & (TFLAG_SURFACE_IS_RECEPTOR+TFLAG_SURFACE_IS_SCAPE+TFLAG_SURFACE_IS_CPTR)) {
             sp = surface;
             surface = &sp;
         }
-        h = __m_new(parent,_t_symbol(t),surface,_t_size(t),flags);
+        __m_init_node(n,_t_symbol(t),surface,_t_size(t),flags,parenti);
     }
     if (flags&TFLAG_RUN_NODE) {
-        // @todo, make this more efficient, ie we shouldn't have to
-        // do an _m_get, instead there should be a way for mtrees to create run_nodes
-        N *n = __m_get(h);
         n->cur_child = ((rT *)t)->cur_child;
     }
-    for(i=1;i<=c;i++) {
-        __mnft(h,_t_child(t,i));
-    }
-    return h;
+    return true;
 }
 
 /**
  * Create a new mtree that is a copy of a ttree
  *
+ * The ttree is walked once to count the nodes on each level, so that every level
+ * can be allocated at its exact size, and then again to fill in the nodes.
+ *
  * @param[in] t pointer to source ttree
  * @returns handle to mtree
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/mtree_spec.h testMTreeSerialize
  */
 H _m_new_from_t(T *t) {
-    H h = null_H;
-    h = __mnft(h,t);
-    h.a.l = 0;
-    h.a.i = 0;
+    H h;
+    L *l;
+    __m_new_root(&h,&l);
+    struct mnft_walk mw = {h.m};
+    _t_walk(t,__mnft_count_pre,NULL,&mw);
+    Mlevel i;
+    for(i=0;i<h.m->levels;i++) {
+        l = &h.m->lP[i];
+        l->nP = malloc(sizeof(N)*l->capacity);
+    }
+    _t_walk(t,__mnft_pre,NULL,&mw);
     return h;
 }
 
+// the surface of a node, which in a view is an offset into the image's blob for allocated surfaces
+void *__m_node_surface(M *m,N *n) {
+    if (!(n->flags & TFLAG_ALLOCATED)) return &n->surface;
+    if (m->view) return m->view->blob_offset + (void *)m->view + *(size_t *)&n->surface;
+    return n->surface;
+}
+
 // mtree walk function for creating ttree nodes
 // used by _t_new_from_m
 void _m_2tfn(H h,N *n,void *data,MwalkState *s,Maddr ap) {
@@ -223,13 +322,15 @@ void _m_2tfn(H h,N *n,void *data,MwalkState *s,Maddr ap) {
 
     if (n->flags & TFLAG_SURFACE_IS_TREE && !(n->flags & TFLAG_SURFACE_IS_RECEPTOR)) {
         if (is_run_node) raise_error("not implemented");
-        nt = _t_newt(t,n->symbol,_t_new_from_m(*(H *)n->surface));
-    }
-    else if (n->flags & TFLAG_ALLOCATED) {
-        nt = __t_new(t,n->symbol,n->surface,n->size,is_run_node);
+        if (h.m->view) {
+            H sh = _m_view(__m_node_surface(h.m,n));
+            nt = _t_newt(t,n->symbol,_t_new_from_m(sh));
+            _m_free(sh);
+        }
+        else nt = _t_newt(t,n->symbol,_t_new_from_m(*(H *)n->surface));
     }
     else {
-        nt = __t_new(t,n->symbol,&n->surface,n->size,is_run_node);
+        nt = __t_new(t,n->symbol,__m_node_surface(h.m,n),n->size,is_run_node);
     }
     nt->context.flags |= (~TFLAG_ALLOCATED)&(n->flags);
 
@@ -282,9 +383,18 @@ size_t _m_size(H h) {return __m_get(h)->size;}
  * @param[in] free_surface boolean to indicate whether to free the surface values
  */
 void __m_free(H h,int free_surface) {
+    // the nodes and surfaces of a view belong to the image
+    if (h.m->view) {
+        int i = h.m->levels;
+        while(i--) __m_free_index(_GET_LEVEL(h,i));
+        free(h.m->lP);
+        free(h.m);
+        return;
+    }
     int i = h.m->levels;
     while(i--) {
         L *l = _GET_LEVEL(h,i);
+        __m_free_index(l);
         Mindex j = l->nodes;
         if (free_surface) {
             while(j--) {
@@ -321,40 +431,20 @@ int _m_children(H h) {
     else if (h.a.l == levels-1) {
         return 0;
     }
-    L *l = _GET_LEVEL(h,h.a.l+1);
-    Mindex c = 0;
-    Mindex i = 0,pi = h.a.i;
-    Mindex max = l->nodes;
-    N *n = &l->nP[0];
-
-    /* this works if nodes are sorted
-       while (i < max && n->parenti != h.a.i) {
-       n++;i++;
-       }
-       while (i < max && n->parenti == h.a.i) {
-       n++;i++;c++;
-       }
-    */
-    while (i < max) {
-        if (!(n->flags & TFLAG_DELETED) && pi == n->parenti) c++;
-        n++;i++;
-    }
-
-    return c;
+    L *l = __m_child_level(h);
+    return l->first[h.a.i+1]-l->first[h.a.i];
 }
 
 /**
  * get the data of a given mtree node
  *
+ * In a view the surface of an orthogonal tree node is its serialized image, which can be passed to _m_view
+ *
  * @param[in] h handle to the node
  * @returns pointer to node's surface
  */
 void * _m_surface(H h) {
-    N *n = __m_get(h);
-    if (n->flags & TFLAG_ALLOCATED)
-        return n->surface;
-    else
-        return &n->surface;
+    return __m_node_surface(h.m,__m_get(h));
 }
 
 /**
@@ -389,53 +479,15 @@ Maddr _m_child(H h,Mindex c) {
     else if (h.a.l == levels-1) {
         return a;
     }
-    a.l = h.a.l+1;
-    L *l = &h.m->lP[a.l];
-    Mindex ci = 0,max = l->nodes;
-    N *n = &l->nP[0];
-    if (c == NULL_ADDR) {
-        a.i = NULL_ADDR;
-        while(ci < max) {
-            if (n->parenti == h.a.i) a.i = ci;
-            ci++;
-            n++;
-        }
-        if (a.i == NULL_ADDR)
-            a.l = NULL_ADDR;
-    }
-    else {
-        a.i = 0;
-        while(a.i < max) {
-            if (n->parenti == h.a.i) ci++;
-            if (ci == c) return a;
-            a.i++;n++;
-        }
-        a.l = NULL_ADDR;
-        a.i = NULL_ADDR;
-    }
-    /* works if nodes are sorted
-    //skip past nodes of children of parents before our parent
-    while (a.i < max && n->parenti < h.a.i) {
-    a.i++;n++;
-    }
+    L *l = __m_child_level(h);
+    Mindex first = l->first[h.a.i],count = l->first[h.a.i+1]-first;
 
     // if you pass in NULL_ADDR for the child,
     // this routine returns the last child address
-    if (c == NULL_ADDR) {
-    while (a.i < max && n->parenti == h.a.i) {
-    a.i++;n++;
-    }
-    a.i--;
-    if (a.i == -1) a.l = NULL_ADDR;
-    }
-    else {
-    if (a.i+c > l->nodes) {
-    raise_error("address too deep!");
-    }
-    a.i += c-1;
-    }
-    */
-
+    if (c == NULL_ADDR) c = count;
+    if (c < 1 || c > count) return a;
+    a.l = h.a.l+1;
+    a.i = l->order ? l->order[first+c-1] : first+c-1;
     return a;
 }
 
@@ -457,21 +509,14 @@ Symbol _m_symbol(H h) {
  * @returns Maddr of next sibling child
  */
 Maddr _m_next_sibling(H h) {
-    L *l = GET_LEVEL(h);
-    int i = h.a.i+1;
-    Maddr r;
-    N *n = GET_NODE(h,l);
-    Mindex pi = n->parenti;
-    while (i<l->nodes) {
-        n++;
-        if (n->parenti == pi) {
-            r.l = h.a.l;
-            r.i = i;
-            return r;
-        }
-        i++;
-    }
-    return null_H.a;
+    // roots don't have siblings
+    if (h.a.l == 0) return null_H.a;
+    H p = {h.m,_m_parent(h)};
+    L *l = __m_child_level(p);
+    Mindex r = l->rank ? l->rank[h.a.i] : h.a.i;
+    if (r == NULL_ADDR || r+1 >= l->first[p.a.i+1]) return null_H.a;
+    Maddr a = {h.a.l,l->order ? l->order[r+1] : r+1};
+    return a;
 }
 
 /**
@@ -486,6 +531,7 @@ Maddr _m_next_sibling(H h) {
  *
  */
 H _m_add(H parent,H h) {
+    if (h.m->view) _m_materialize(h);
     L *pl,*l;
     H r;
     int x = _m_children(parent)+1;
@@ -524,64 +570,28 @@ H _m_add(H parent,H h) {
 void _m_walk(H h,void (*walkfn)(H ,N *,void *,MwalkState *,Maddr),void *user_data) {
     int levels = h.m->levels;
     MwalkState state[levels];
-    int i,root;
-    //    for(i=0;i<levels;i++) {state[i]=0;};
-    Maddr ap = _m_parent(h);
-    root = h.a.l;
-    int done = 0;
+    Mlevel root = h.a.l;
     /// @todo checks to make sure root isn't deleted or null?
-    L *l = GET_LEVEL(h);
-    N *n;
-    int backup,nodes = h.a.i+1; // at root level pretend we are at last node
-    //    raise(SIGINT);
-
-    while(!done) {
-        backup = 0;
-        n = GET_NODE(h,l);
-        // look for child of parent at this level (may be node at current handle address)
-        while ((h.a.i < nodes)  && ((n->flags & TFLAG_DELETED) || (n->parenti != ap.i))) {
-            n++;h.a.i++;
-        };
-
-        // if we got one, then call the walk function
-        if (h.a.i != nodes) {
-            (*walkfn)(h,n,user_data,state,ap);
-            // and go down looking for children
-            if (h.a.l+1 < levels) {
-                state[h.a.l].i = h.a.i;
-                ap = h.a;
-                h.a.l++;
-                h.a.i = 0;
-                l = GET_LEVEL(h);
-                nodes = l->nodes;
-            }
-            else {
-                // if no more levels, then backup if no more nodes
-                if (++h.a.i == nodes)
-                    backup = 1;
-            }
-        }
-        else backup = 1;
-
-        while(backup) {
-            // if current node is at root level we are done
-            if (h.a.l == root) {backup = 0;done = 1;}
-            else {
-                // otherwise move up a level
-                h.a.l--;
-                // new node index is next node at that level from stored state
-                h.a.i = state[h.a.l].i+1;
-                l = GET_LEVEL(h);
-                nodes = l->nodes;
-                // if we still have nodes to check then we have finished backing up otherwise
-                // we'll loop to go back up another level
-                if (h.a.i < nodes) {
-                    backup = 0;
-                    ap.l = h.a.l -1;
-                    ap.i = state[ap.l].i;
-                }
+    (*walkfn)(h,__m_get(h),user_data,state,_m_parent(h));
+    // state[l].i counts how many children of the node being walked at level l have been visited
+    state[root].i = 0;
+
+    for(;;) {
+        if (h.a.l+1 < levels) {
+            L *l = __m_child_level(h);
+            Mindex first = l->first[h.a.i];
+            if (first+state[h.a.l].i < l->first[h.a.i+1]) {
+                Mindex r = first+state[h.a.l].i++;
+                H c = {h.m,{h.a.l+1,l->order ? l->order[r] : r}};
+                (*walkfn)(c,_GET_NODE(c,l,c.a.i),user_data,state,h.a);
+                state[c.a.l].i = 0;
+                h = c;
+                continue;
             }
         }
+        // no more children so back up to the parent
+        if (h.a.l == root) break;
+        h.a = _m_parent(h);
     }
 }
 
@@ -629,8 +639,12 @@ void _m_detatchfn(H oh,N *on,void *data,MwalkState *s,Maddr ap) {
  *
  */
 H _m_detatch(H oh) {
+    if (oh.m->view) _m_materialize(oh);
     struct {M *m;int l;} d = {NULL,oh.a.l};
     _m_walk(oh,_m_detatchfn,&d);
+    // the walk marked the detached nodes deleted
+    Mlevel l;
+    for(l=oh.a.l;l<oh.m->levels;l++) __m_free_index(&oh.m->lP[l]);
     H h = {d.m,{0,0}};
     return h;
 }
@@ -643,6 +657,12 @@ H _m_detatch(H oh) {
  * @returns pointer to newly malloced buffer of serialized tree data
  */
 S *_m_serialize(M *m) {
+    // a view is already serialized
+    if (m->view) {
+        S *s = malloc(m->view->total_size);
+        memcpy(s,m->view,m->view->total_size);
+        return s;
+    }
 
     uint32_t s_size = SERIALIZED_HEADER_SIZE(m->levels);
     uint32_t levels_size = 0;
@@ -667,6 +687,7 @@ S *_m_serialize(M *m) {
     S *s = malloc(total_size);
     memset(s,0,total_size);
     s->magic = m->magic;
+    s->version = SERIALIZED_VERSION;
     s->total_size = total_size;
     s->levels = m->levels;
     s->blob_offset = s_size+levels_size;
@@ -685,7 +706,7 @@ S *_m_serialize(M *m) {
 
         sl->nodes = l->nodes;
 
-        N *sn = sizeof(Mindex)+(void *)sl;
+        N *sn = SERIALIZED_NODES_OFFSET+(void *)sl;
         for(h.a.i=0;h.a.i < l->nodes;h.a.i++) {
             N *n = GET_NODE(h,l);
             *sn = *n;
@@ -698,21 +719,24 @@ S *_m_serialize(M *m) {
             if (n->flags & TFLAG_SURFACE_IS_TREE && !(n->flags & TFLAG_SURFACE_IS_RECEPTOR)) {
                 H sh = *(H *)n->surface;
                 S *ss = _m_serialize(sh.m);
-                *(size_t *)&sn->surface = blob_size;
+                size_t pad = SERIALIZED_PAD(blob_size)-blob_size;
                 // orth tree size wasn't included in the original total size so
                 // we have to realloc the buffer and increase the size
                 // @todo, a better way to do this would have been to serialize the orthogonal
                 //        trees ahead of time in the size calculation loop so as not to have to
                 //        realloc here, instead we could just copy the tree in
-                size_t new_total_size = s->total_size + ss->total_size;
+                size_t new_total_size = s->total_size + pad + ss->total_size;
                 s = realloc(s,new_total_size);
                 s->total_size = new_total_size;
                 // reset pointers into the serialized block because of the realloc:
                 // blob, sl and sn
                 blob = s->blob_offset + (void *)s;
-                sl = (L *) (((void *)s) + s_size + levels_size);
-                sn = sizeof(Mindex)+(void *)sl + SERIALIZED_NODE_SIZE*h.a.i;
+                sl = (L *) (((void *)s) + s_size + s->level_offsets[h.a.l]);
+                sn = SERIALIZED_NODES_OFFSET+(void *)sl + SERIALIZED_NODE_SIZE*h.a.i;
 
+                memset(blob+blob_size,0,pad);
+                blob_size += pad;
+                *(size_t *)&sn->surface = blob_size;
                 memcpy(blob+blob_size,ss,ss->total_size);
                 blob_size+=ss->total_size;
                 free(ss);
@@ -729,36 +753,166 @@ S *_m_serialize(M *m) {
             sn = (N *) (SERIALIZED_NODE_SIZE + ((void*)sn));
         }
     }
+    // pad the end too so that an image appended after this one is aligned
+    size_t padded_size = SERIALIZED_PAD(s->total_size);
+    if (padded_size != s->total_size) {
+        s = realloc(s,padded_size);
+        memset(((void *)s)+s->total_size,0,padded_size-s->total_size);
+        s->total_size = padded_size;
+    }
     return s;
 }
 
 
 /**
- * build mtree from serialized mtree data
+ * check that serialized data is an mtree image _m_view and _m_unserialize can read
  *
- * @params[in] pointer to serialized data
- * @returns handle to new mtree
+ * @param[in] s pointer to serialized data
+ * @returns true if the image has the current layout or the older unpadded one
  *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/mtree_spec.h testMTreeView
  */
-H _m_unserialize(S *s) {
+bool _m_serialized_ok(S *s) {
+    S h;
+    memcpy(&h,s,sizeof(S));
+    return h.magic == matrixImpl && h.version <= SERIALIZED_VERSION;
+}
+
+// offsets of the unpadded layout images had before they were versioned
+#define SERIALIZED_V0_HEADER_SIZE(levels) (sizeof(S)+sizeof(uint32_t)*(levels))
+#define SERIALIZED_V0_NODES_OFFSET sizeof(Mindex)
+
+/**
+ * build an mtree by copying it out of an image in the unpadded layout
+ *
+ * nodes in these images aren't aligned, so they can't be viewed in place and
+ * are read with memcpy instead.  Saving the mtree again writes the current layout.
+ */
+H __m_unserialize_v0(S *s) {
+    S hs;
+    memcpy(&hs,s,sizeof(S));
+    M *m = malloc(sizeof(M));
+    m->magic = hs.magic;
+    m->levels = hs.levels;
+    m->lP = malloc(sizeof(L)*m->levels);
+    m->capacity = m->levels;
+    m->view = NULL;
+    H h = {m,{0,0}};
+    void *blob = hs.blob_offset + (void *)s;
+
+    uint32_t s_size = SERIALIZED_V0_HEADER_SIZE(m->levels);
+    for(h.a.l=0; h.a.l<m->levels; h.a.l++) {
+        uint32_t level_offset;
+        memcpy(&level_offset,((void *)s)+offsetof(S,level_offsets)+sizeof(uint32_t)*h.a.l,sizeof(uint32_t));
+        void *sl = ((void *)s) + s_size + level_offset;
+        L *l = GET_LEVEL(h);
+        memcpy(&l->nodes,sl,sizeof(Mindex));
+        l->nP = malloc(sizeof(N)*l->nodes);
+        l->capacity = l->nodes;
+        l->first = NULL;
+        void *sn = sl+SERIALIZED_V0_NODES_OFFSET;
+        for(h.a.i=0;h.a.i < l->nodes;h.a.i++,sn+=SERIALIZED_NODE_SIZE) {
+            N *n = GET_NODE(h,l);
+            memcpy(n,sn,SERIALIZED_NODE_SIZE);
+            size_t offset = *(size_t *)&n->surface;
+            if (n->flags & TFLAG_SURFACE_IS_TREE && !(n->flags & TFLAG_SURFACE_IS_RECEPTOR)) {
+                if (!(n->flags & TFLAG_ALLOCATED)) {
+                    raise_error("whoa! orthogonal tree handles are supposed to be allocated!");
+                }
+                H sh = _m_unserialize((S *)(blob+offset));
+                n->surface = malloc(sizeof(H));
+                memcpy(n->surface,&sh,sizeof(H));
+            }
+            else if (n->flags & TFLAG_ALLOCATED) {
+                n->surface = malloc(n->size);
+                memcpy(n->surface,blob+offset,n->size);
+            }
+        }
+    }
+    h.a.i = h.a.l = 0;
+    return h;
+}
+
+/**
+ * get a read-only view of serialized mtree data
+ *
+ * The view's nodes are the serialized nodes themselves, so making one costs an allocation
+ * of the level table and nothing per node.  The image must outlive the view, but it is never
+ * written to, so it can be mapped read-only from a file.  Adding to or detaching from a view
+ * first materializes it (see _m_materialize), which leaves existing handles valid.
+ * Nodes can only be used in place if the image is aligned for N (as malloced and mapped
+ * images are), otherwise the view is materialized from an aligned copy of the image.
+ * Images in the older unpadded layout (see _m_serialized_ok) are copied out instead, so the
+ * returned mtree isn't a view, and any other image raises an error.
+ *
+ * @param[in] s pointer to serialized data
+ * @returns handle to the view
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/mtree_spec.h testMTreeView
+ */
+H _m_view(S *s) {
+    if (!_m_serialized_ok(s)) {
+        raise_error("unsupported serialized mtree image (version %d, expected %d)",((S *)s)->version,SERIALIZED_VERSION);
+    }
+    if (!((S *)s)->version) return __m_unserialize_v0(s);
+    if ((uintptr_t)s % SERIALIZED_ALIGN) {
+        size_t total_size;
+        memcpy(&total_size,((void *)s)+offsetof(S,total_size),sizeof(size_t));
+        S *a = malloc(total_size);
+        memcpy(a,s,total_size);
+        H h = _m_view(a);
+        _m_materialize(h);
+        free(a);
+        return h;
+    }
+
     M *m = malloc(sizeof(M));
     m->magic = s->magic;
     m->levels = s->levels;
     m->lP = malloc(sizeof(L)*m->levels);
+    m->capacity = m->levels;
+    m->view = s;
     H h = {m,{0,0}};
-    void *blob = s->blob_offset + (void *)s;
 
+    // serialized nodes have the same layout as N, with the surface replaced by a blob offset
+    _Static_assert(SERIALIZED_NODE_SIZE == sizeof(N),"serialized mtree nodes must be laid out as N");
     uint32_t s_size = SERIALIZED_HEADER_SIZE(m->levels);
     for(h.a.l=0; h.a.l<m->levels; h.a.l++) {
-        L *sl = (L *) (((void *)s) + s_size + ((S *)s)->level_offsets[h.a.l]);
+        void *sl = ((void *)s) + s_size + s->level_offsets[h.a.l];
         L *l = GET_LEVEL(h);
-        l->nodes = sl->nodes;
+        l->nodes = *(Mindex *)sl;
+        l->nP = sl+SERIALIZED_NODES_OFFSET;
+        l->capacity = 0;
+        l->first = NULL;
+    }
+    h.a.l = 0;
+    return h;
+}
+
+/**
+ * copy the nodes and surfaces of a view out of its serialized image
+ *
+ * After this the mtree no longer refers to the image and can be modified.
+ *
+ * @param[in] h handle to any node of the view
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/mtree_spec.h testMTreeView
+ */
+void _m_materialize(H h) {
+    M *m = h.m;
+    if (!m->view) return;
+    for(h.a.l=0; h.a.l<m->levels; h.a.l++) {
+        L *l = GET_LEVEL(h);
+        N *sn = l->nP;
         l->nP = malloc(sizeof(N)*l->nodes);
-        N *sn = sizeof(Mindex)+(void *)sl;
-        for(h.a.i=0;h.a.i < l->nodes;h.a.i++) {
+        l->capacity = l->nodes;
+        for(h.a.i=0;h.a.i < l->nodes;h.a.i++,sn++) {
             N *n = GET_NODE(h,l);
             *n = *sn;
-            void *surface = blob+*(size_t *)&sn->surface;
+            void *surface = __m_node_surface(m,sn);
             if (n->flags & TFLAG_SURFACE_IS_TREE && !(n->flags & TFLAG_SURFACE_IS_RECEPTOR)) {
                 if (!(n->flags & TFLAG_ALLOCATED)) {
                     raise_error("whoa! orthogonal tree handles are supposed to be allocated!");
@@ -771,13 +925,21 @@ H _m_unserialize(S *s) {
                 n->surface = malloc(sn->size);
                 memcpy(n->surface,surface,sn->size);
             }
-            else {
-                memcpy(&n->surface,&sn->surface,sn->size);
-            }
-            sn = (N *) (SERIALIZED_NODE_SIZE + ((void*)sn));
         }
     }
-    h.a.i = h.a.l = 0;
+    m->view = NULL;
+}
+
+/**
+ * build mtree from serialized mtree data
+ *
+ * @params[in] pointer to serialized data
+ * @returns handle to new mtree
+ *
+ */
+H _m_unserialize(S *s) {
+    H h = _m_view(s);
+    _m_materialize(h);
     return h;
 }
 
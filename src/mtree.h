@@ -26,6 +26,9 @@ typedef struct MwalkState {
     } user;
 } MwalkState;
 
+#define MTREE_LEVELS_BLOCK 8     ///< initial size of the level table, which doubles as it fills
+#define MTREE_NODES_BLOCK 8      ///< initial size of a level's node array, which doubles as it fills
+
 H __m_new(H parent,Symbol symbol,void *surface,size_t size,uint32_t flags);
 #define _m_new(parent,symbol,surface,size) __m_new(parent,symbol,surface,size,0)
 #define _m_newt(parent,symbol,h) __m_new(parent,symbol,&(h),sizeof(H),TFLAG_SURFACE_IS_TREE)
@@ -49,6 +52,9 @@ H _m_add(H parent,H h);
 H _m_detatch(H h);
 S * _m_serialize(M *m);
 H _m_unserialize(S *);
+bool _m_serialized_ok(S *s);
+H _m_view(S *s);
+void _m_materialize(H h);
 
 void _m_walk(H h,void (*walkfn)(H ,N *,void *,MwalkState *,Maddr),void *user_data);
 
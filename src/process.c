@@ -79,6 +79,103 @@ void _p_fill_from_match(SemTable *sem,T *t,T *match_results,T *match_tree) {
     _t_free(sem_map);
 }
 
+// add a CSTRING node from len bytes of buf, which must be readable at buf[len]
+static T *__p_new_strn(T *parent,Symbol symbol,char *buf,size_t len) {
+    T *t = __t_new(parent,symbol,buf,len+1,true);
+    ((char *)_t_surface(t))[len] = 0;
+    return t;
+}
+
+// parse a run of decimal digits (at most 9 so they fit in an int)
+static bool __p_parse_digits(char **pP,char *e,int *n) {
+    char *p = *pP;
+    int v = 0;
+    while (p < e && *p >= '0' && *p <= '9' && p-*pP < 9) v = v*10 + (*p++ - '0');
+    if (p == *pP) return false;
+    *n = v;
+    *pP = p;
+    return true;
+}
+
+/**
+ * native transcoder from the bytes of an HTTP request line to an HTTP_REQUEST tree
+ *
+ * builds the same tree as the semtrex based ascii_chars_2_http_req process but without
+ * expanding the line into ASCII_CHARS first.  Unlike that process it accepts any
+ * numeric version (HTTP/1.0 and HTTP/1.1 as well as 0.9).  Only a line ending may
+ * follow the version; any other trailing bytes make the line invalid.
+ *
+ * @param[in] buf bytes of the request line, which must be readable at buf[len]
+ * @param[in] len number of bytes in the request line
+ * @returns HTTP_REQUEST tree or NULL if the bytes aren't a request line
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/process_spec.h testProcessNativeHTTPRequest
+ */
+T *_p_bytes_2_http_req(char *buf,size_t len) {
+    char *p = buf,*e = buf+len,*s;
+    int major,minor;
+
+    while (e > p && (e[-1] == '\n' || e[-1] == '\r')) e--;
+
+    s = memchr(p,' ',e-p);
+    if (!s || s == p) return NULL;
+    T *req = __t_newr(0,HTTP_REQUEST,true);
+    __p_new_strn(req,HTTP_REQUEST_METHOD,p,s-p);
+    p = s+1;
+
+    if (p == e || *p != '/') goto fail;
+    T *segs = __t_newr(__t_newr(req,HTTP_REQUEST_PATH,true),HTTP_REQUEST_PATH_SEGMENTS,true);
+    while (p < e && *p == '/') {
+        s = ++p;
+        while (p < e && *p != '/' && *p != '?' && *p != ' ') p++;
+        __p_new_strn(segs,HTTP_REQUEST_PATH_SEGMENT,s,p-s);
+    }
+
+    if (p < e && *p == '?') {
+        p++;
+        T *params = __t_newr(__t_newr(req,HTTP_REQUEST_PATH_QUERY,true),HTTP_REQUEST_PATH_QUERY_PARAMS,true);
+        do {
+            s = p;
+            while (p < e && *p != '&' && *p != ' ' && *p != '=') p++;
+            if (p == s || p == e || *p != '=') goto fail;
+            T *param = __t_newr(params,HTTP_REQUEST_PATH_QUERY_PARAM,true);
+            __p_new_strn(param,PARAM_KEY,s,p-s);
+            s = ++p;
+            while (p < e && *p != '&' && *p != ' ') p++;
+            __p_new_strn(param,PARAM_VALUE,s,p-s);
+            if (p < e && *p == '&') p++;
+        } while (p < e && *p != ' ');
+    }
+
+    if (e-p < 6 || memcmp(p," HTTP/",6)) goto fail;
+    p += 6;
+    if (!__p_parse_digits(&p,e,&major) || p == e || *p++ != '.' ||
+        !__p_parse_digits(&p,e,&minor) || p != e) goto fail;
+    T *version = __t_newr(req,HTTP_REQUEST_VERSION,true);
+    __t_newi(version,VERSION_MAJOR,major,true);
+    __t_newi(version,VERSION_MINOR,minor,true);
+    return req;
+ fail:
+    _t_free(req);
+    return NULL;
+}
+
+/**
+ * find a native transcoder that can build a to_sym tree straight from raw bytes
+ *
+ * these are checked before any defined transcoding process, both when transcoding
+ * ASCII_CHARS and when a STREAM_READ asks for a non CSTRING result
+ *
+ * @param[in] sem current semantic context
+ * @param[in] to_sym symbol to transcode to
+ * @returns the transcoder or NULL if there isn't one
+ */
+NativeTranscoder _p_get_native_transcoder(SemTable *sem,Symbol to_sym) {
+    if (semeq(HTTP_REQUEST,to_sym)) return _p_bytes_2_http_req;
+    return NULL;
+}
+
 Process _p_get_transcoder(SemTable *sem,Symbol src_sym,Symbol to_sym) {
 
     if (semeq(HTTP_RESPONSE,src_sym) && semeq(LINES,to_sym)) {
@@ -86,8 +183,6 @@ Process _p_get_transcoder(SemTable *sem,Symbol src_sym,Symbol to_sym) {
     }
     else if (semeq(CONTENT_TYPE,src_sym) && semeq(LINE,to_sym))
         return content_type_2_line;
-    else if (semeq(ASCII_CHARS,src_sym) && semeq(HTTP_REQUEST,to_sym))
-        return ascii_chars_2_http_req;
     else {
         Structure src_s = _sem_get_symbol_structure(sem,src_sym);
         Structure to_s = _sem_get_symbol_structure(sem,to_sym);
@@ -108,12 +203,26 @@ int _p_transcode(SemTable *sem, T* src,Symbol to_sym, Structure to_s,T **result)
     debug(D_TRANSCODE,"transcoding a %s to a %s\n",_sem_get_name(sem,_t_symbol(src)),_sem_get_name(sem,to_sym));
     Symbol src_sym = _t_symbol(src);
     T *x;
+    NativeTranscoder nt;
     bool dofree = true;
     int err = noReductionErr;
     if (semeq(to_sym,src_sym)) {
         x = src;
         dofree = false;
     }
+    else if (semeq(ASCII_CHARS,src_sym) && (nt = _p_get_native_transcoder(sem,to_sym))) {
+        size_t l = _t_children(src);
+        char *buf = malloc(l+1);
+        DO_KIDS(src,buf[i-1] = *(char *)_t_surface(_t_child(src,i)));
+        buf[l] = 0;
+        x = nt(buf,l);
+        free(buf);
+        if (!x) {
+            debug(D_TRANSCODE,"native transcoder unable to match\n");
+            _t_free(src);
+            return structureMismatchReductionErr;
+        }
+    }
     else {
         Process p = _p_get_transcoder(sem,src_sym,to_sym);
         if (!semeq(p,NULL_PROCESS)) {
@@ -129,7 +238,7 @@ int _p_transcode(SemTable *sem, T* src,Symbol to_sym, Structure to_s,T **result)
             Structure src_s = _sem_get_symbol_structure(sem,src_sym);
             if (semeq(to_s,src_s)) {
                 x = src;
-                x->contents.symbol = to_sym;
+                _t_set_symbol(x,to_sym);
                 dofree = false;
             }
             else if (semeq(to_s,INTEGER)) {
@@ -289,8 +398,7 @@ int _p_transcode(SemTable *sem, T* src,Symbol to_sym, Structure to_s,T **result)
  * @todo add SIGNATURE_SYMBOL for setting up process signatures by Symbol not just Structure
  */
 Error __p_check_signature(SemTable *sem,Process p,T *code,T *sem_map) {
-    T *processes = _sem_get_defs(sem,p);
-    T *def = _d_get_process_code(processes,p);
+    T *def = _sem_get_def(sem,p);
     T *signature = _t_child(def,ProcessDefSignatureIdx);
     // @todo if there's no signature we should probably fail, but instead we assume everything's ok
     // (sig should always have at least 1 child, the output sig)
@@ -347,8 +455,8 @@ Error __p_check_signature(SemTable *sem,Process p,T *code,T *sem_map) {
             int map_children = _t_children(sem_map);
             if (map_children < c ) return mismatchSemanticMapReductionErr;
 
-            // build up hashes of all the semantic references in our map
-            // @todo cache this someplace so we don't need to do it every time
+            // build up hashes of all the semantic references in our map (these use plain
+            // hashing because the signature and map can be definitions shared between threads)
             TreeHash mapped[map_children];
             int j;
             for(j=1;j<=map_children;j++) {
@@ -415,9 +523,11 @@ Error __p_reduce_sys_proc(R *context,Symbol s,T *code,Q *q) {
         {
             T *t = _t_detach_by_idx(code,1);
             Xaddr xa = *(Xaddr *)_t_surface(t);
+            pthread_mutex_lock(&q->r->instances_mutex);
             T *v = _r_get_instance(q->r,xa);
             if (!v) raise_error("Invalid xaddr in GET");
             x = _t_rclone(v);
+            pthread_mutex_unlock(&q->r->instances_mutex);
             _t_free(t);
             if (s.id == DEL_ID) {
                 _r_delete_instance(q->r,xa);
@@ -476,7 +586,7 @@ Error __p_reduce_sys_proc(R *context,Symbol s,T *code,Q *q) {
                 return structureMismatchReductionErr;
             }
             else {
-                t->contents.symbol = s;
+                _t_set_symbol(t,s);
                 Xaddr xa = _r_new_instance(q->r,t);
                 x = __t_new(0,WHICH_XADDR,&xa,sizeof(Xaddr),1);
             }
@@ -535,13 +645,15 @@ Error __p_reduce_sys_proc(R *context,Symbol s,T *code,Q *q) {
                 }
                 _t_free(cond_pair);
                 _t_free(x);
+                // reset the current child count so the newly added code gets evaluated
+                set_rt_cur_child(q->r,code,0);
                 return Eval;
             }
             else {
                 // cleanup the state before returning.
                 _t_free(state->conditions);
                 free(state);
-                code->contents.size = 0;
+                _t_set_surface(code,NULL,0);
             }
         }
         break;
@@ -555,17 +667,20 @@ Error __p_reduce_sys_proc(R *context,Symbol s,T *code,Q *q) {
     case ADD_INT_ID:
         x = _t_detach_by_idx(code,1);
         c = *(int *)_t_surface(_t_child(code,1));
-        *((int *)&x->contents.surface) = c+*((int *)&x->contents.surface);
+        c = c+*(int *)_t_surface(x);
+        _t_set_surface(x,&c,sizeof(int));
         break;
     case SUB_INT_ID:
         x = _t_detach_by_idx(code,1);
         c = *(int *)_t_surface(_t_child(code,1));
-        *((int *)&x->contents.surface) = *((int *)&x->contents.surface)-c;
+        c = *(int *)_t_surface(x)-c;
+        _t_set_surface(x,&c,sizeof(int));
         break;
     case MULT_INT_ID:
         x = _t_detach_by_idx(code,1);
         c = *(int *)_t_surface(_t_child(code,1));
-        *((int *)&x->contents.surface) = *((int *)&x->contents.surface)*c;
+        c = *(int *)_t_surface(x)*c;
+        _t_set_surface(x,&c,sizeof(int));
         break;
     case DIV_INT_ID:
         x = _t_detach_by_idx(code,1);
@@ -574,7 +689,8 @@ Error __p_reduce_sys_proc(R *context,Symbol s,T *code,Q *q) {
             _t_free(x);
             return divideByZeroReductionErr;
         }
-        *((int *)&x->contents.surface) = *((int *)&x->contents.surface)/c;
+        c = *(int *)_t_surface(x)/c;
+        _t_set_surface(x,&c,sizeof(int));
         break;
     case MOD_INT_ID:
         x = _t_detach_by_idx(code,1);
@@ -583,49 +699,58 @@ Error __p_reduce_sys_proc(R *context,Symbol s,T *code,Q *q) {
             _t_free(x);
             return divideByZeroReductionErr;
         }
-        *((int *)&x->contents.surface) = *((int *)&x->contents.surface)%c;
+        c = *(int *)_t_surface(x)%c;
+        _t_set_surface(x,&c,sizeof(int));
         break;
     case EQ_INT_ID:
         x = _t_detach_by_idx(code,1);
         c = *(int *)_t_surface(_t_child(code,1));
-        *((int *)&x->contents.surface) = *((int *)&x->contents.surface)==c;
-        x->contents.symbol = BOOLEAN;
+        c = *(int *)_t_surface(x)==c;
+        _t_set_surface(x,&c,sizeof(int));
+        _t_set_symbol(x,BOOLEAN);
         break;
     case LT_INT_ID:
         x = _t_detach_by_idx(code,1);
         c = *(int *)_t_surface(_t_child(code,1));
-        *((int *)&x->contents.surface) = *((int *)&x->contents.surface)<c;
-        x->contents.symbol = BOOLEAN;
+        c = *(int *)_t_surface(x)<c;
+        _t_set_surface(x,&c,sizeof(int));
+        _t_set_symbol(x,BOOLEAN);
         break;
     case GT_INT_ID:
         x = _t_detach_by_idx(code,1);
         c = *(int *)_t_surface(_t_child(code,1));
-        *((int *)&x->contents.surface) = *((int *)&x->contents.surface)>c;
-        x->contents.symbol = BOOLEAN;
+        c = *(int *)_t_surface(x)>c;
+        _t_set_surface(x,&c,sizeof(int));
+        _t_set_symbol(x,BOOLEAN);
         break;
     case LTE_INT_ID:
         x = _t_detach_by_idx(code,1);
         c = *(int *)_t_surface(_t_child(code,1));
-        *((int *)&x->contents.surface) = *((int *)&x->contents.surface)<=c;
-        x->contents.symbol = BOOLEAN;
+        c = *(int *)_t_surface(x)<=c;
+        _t_set_surface(x,&c,sizeof(int));
+        _t_set_symbol(x,BOOLEAN);
         break;
     case GTE_INT_ID:
         x = _t_detach_by_idx(code,1);
         c = *(int *)_t_surface(_t_child(code,1));
-        *((int *)&x->contents.surface) = *((int *)&x->contents.surface)>=c;
-        x->contents.symbol = BOOLEAN;
+        c = *(int *)_t_surface(x)>=c;
+        _t_set_surface(x,&c,sizeof(int));
+        _t_set_symbol(x,BOOLEAN);
         break;
     case POP_PATH_ID:
         {
             x = _t_detach_by_idx(code,1);
             T *as = _t_child(code,1);
             T *count = _t_child(code,2);
-            x->contents.symbol = *(Symbol *)_t_surface(as);
+            _t_set_symbol(x,*(Symbol *)_t_surface(as));
             int i = count ? *(int *)_t_surface(count) : 1;
             int *path = (int *)_t_surface(x);
             int d = _t_path_depth(path);
-            if (i>d) path[0] = TREE_PATH_TERMINATOR;
-            else path[d-i] = TREE_PATH_TERMINATOR;
+            d = (i>d) ? 0 : d-i;
+            int popped[d+1];
+            memcpy(popped,path,sizeof(int)*d);
+            popped[d] = TREE_PATH_TERMINATOR;
+            _t_set_surface(x,popped,sizeof(int)*(d+1));
         }
         break;
     case CONTRACT_STR_ID:
@@ -651,43 +776,32 @@ Error __p_reduce_sys_proc(R *context,Symbol s,T *code,Q *q) {
         }
         c = _t_children(code);
 
-        // make sure the surface was allocated and if not, converted to an alloced surface
-        if (c > 0) {
-            if (!(x->context.flags & TFLAG_ALLOCATED)) {
-                str = malloc(x->contents.size);
-                memcpy(str,&x->contents.surface,x->contents.size);
-                x->contents.surface = str;
-                x->context.flags = TFLAG_ALLOCATED+TFLAG_RUN_NODE;
+        {
+            // work out how long the result will be, checking the type of each node
+            int size[c+1],len = 0;
+            for(b=0;b<=c;b++) {
+                T *t = b ? _t_child(code,b) : x;
+                Structure struc = _sem_get_symbol_structure(sem,_t_symbol(t));
+                if (semeq(struc,CSTRING)) size[b] = strlen((char *)_t_surface(t));
+                else if (semeq(struc,CHAR)) size[b] = 1;
+                else {
+                    _t_free(x);
+                    return incompatibleTypeReductionErr;
+                }
+                len += size[b];
             }
-        }
-        // check type the first node
-        Structure struc = _sem_get_symbol_structure(sem,_t_symbol(x));
-        if (semeq(struc,CHAR)) {
-            x->contents.surface = realloc(x->contents.surface,++x->contents.size);
-            ((char *)x->contents.surface)[1] = 0;
-        }
-        else if (!semeq(struc,CSTRING)) {
-            _t_free(x);
-            return incompatibleTypeReductionErr;
-        }
-        /// @todo this would probably be faster with just one total realloc for all children
-        for(b=1;b<=c;b++) {
-            T *t = _t_child(code,b);
-            struc = _sem_get_symbol_structure(sem,_t_symbol(t));
-            str = (char *)_t_surface(t);
-            int size;
-            if (semeq(struc,CSTRING)) size = strlen(str);
-            else if (semeq(struc,CHAR)) size = 1;
-            else {
-                _t_free(x);
-                return incompatibleTypeReductionErr;
+            str = malloc(len+1);
+            len = 0;
+            for(b=0;b<=c;b++) {
+                T *t = b ? _t_child(code,b) : x;
+                memcpy(str+len,_t_surface(t),size[b]);
+                len += size[b];
             }
-            x->contents.surface = realloc(x->contents.surface,x->contents.size+size);
-            memcpy(x->contents.surface+x->contents.size-1,str,size);
-            x->contents.size+=size;
-            *( (char *)x->contents.surface + x->contents.size -1) = 0;
+            str[len] = 0;
+            _t_set_surface(x,str,len+1);
+            _t_set_symbol(x,sy);
+            free(str);
         }
-        x->contents.symbol = sy;
         break;
     case EXPAND_STR_ID:
         {
@@ -913,8 +1027,9 @@ Error __p_reduce_sys_proc(R *context,Symbol s,T *code,Q *q) {
             }
             T *results;
             bool match;
+            // the pattern is rebuilt with every run tree, so use the shared cache of compiled patterns
             if (matchr) {
-                match =_t_matchr(pattern,t,&results);
+                match = _stx_cached_match(pattern,t,&results);
                 if (match) {
                     x = _t_rclone(results);
                     _t_free(results);
@@ -923,7 +1038,7 @@ Error __p_reduce_sys_proc(R *context,Symbol s,T *code,Q *q) {
                 else x = __t_newi(0,BOOLEAN,0,true);
             }
             else {
-                match = _t_match(pattern,t);
+                match = _stx_cached_match(pattern,t,NULL);
                 x = __t_newi(0,BOOLEAN,match,true);
             }
             _t_free(pattern);
@@ -970,13 +1085,27 @@ Error __p_reduce_sys_proc(R *context,Symbol s,T *code,Q *q) {
                     char *c = _st_data(st);
 
                     Structure to_s = _sem_get_symbol_structure(sem,sy);
+                    NativeTranscoder nt;
                     if (semeq(to_s,CSTRING)) {
                         debug(D_STREAM,"creating CSTRING: %s '%.*s'\n",_sem_get_name(sem,sy),(int)l,c);
-                        // @todo fix this to be a flag instruction to __t_new
-                        // currently it only works because that value is the newline in the
-                        // read buffer.
-                        _st_data(st)[l] = 0;
-                        x = __t_new(0,sy,c,l+1,1);
+                        // units too small to be worth a slice just get copied into the node
+                        char *slice = (l+1 > sizeof(void *)) ? _st_data_slice(st) : NULL;
+                        if (slice) x = __t_new_slice(0,sy,slice,l+1,1);
+                        else {
+                            // @todo fix this to be a flag instruction to __t_new
+                            // currently it only works because that value is the newline in the
+                            // read buffer.
+                            _st_data(st)[l] = 0;
+                            x = __t_new(0,sy,c,l+1,1);
+                        }
+                    }
+                    else if ((nt = _p_get_native_transcoder(sem,sy))) {
+                        debug(D_STREAM,"natively transcoding to %s\n",_sem_get_name(sem,sy));
+                        x = nt(c,l);
+                        if (!x) {
+                            _st_data_consumed(st);
+                            return structureMismatchReductionErr;
+                        }
                     }
                     else {
                         debug(D_STREAM,"non CSTRING RESULT_SYMBOL so converting to ASCII_CHARS and transcoding to %s \n",_sem_get_name(sem,sy));
@@ -1017,12 +1146,19 @@ Error __p_reduce_sys_proc(R *context,Symbol s,T *code,Q *q) {
             T *s = _t_detach_by_idx(code,1);
             Stream *st = _t_surface(s);
             _t_free(s);
-            // get the data to write as string
+            // get the data to write as string, if there's more than one thing to write
+            // buffer them so they go out together
+            bool corked = _t_children(code) > 1;
+            if (corked) _st_cork(st);
             while ((s = _t_detach_by_idx(code,1))) {
                 int err = _t_write(sem,s,st);
                 _t_free(s);
-                if (err == 0) return unixErrnoReductionErr;
+                if (err < 0) {
+                    if (corked) _st_uncork(st);
+                    return unixErrnoReductionErr;
+                }
             }
+            if (corked && _st_uncork(st) < 0) return unixErrnoReductionErr;
             /// @todo what should this really return?
             x = __t_news(0,REDUCTION_ERROR_SYMBOL,NULL_SYMBOL,1);
         }
@@ -1042,12 +1178,14 @@ Error __p_reduce_sys_proc(R *context,Symbol s,T *code,Q *q) {
             T *s = _t_detach_by_idx(code,1);
             Stream *st = _t_surface(s);
             _st_kill(st);
-            void *status;
-            int rc;
+            if (_st_has_reader_thread(st)) {
+                void *status;
+                int rc;
 
-            rc = pthread_join(st->pthread, &status);
-            if (rc) {
-                raise_error("ERROR; return code from pthread_join() is %d\n", rc);
+                rc = pthread_join(st->pthread, &status);
+                if (rc) {
+                    raise_error("ERROR; return code from pthread_join() is %d\n", rc);
+                }
             }
             _st_free(st);
             x = __t_newi(0,BOOLEAN,1,true);
@@ -1135,7 +1273,7 @@ Error __p_reduce_sys_proc(R *context,Symbol s,T *code,Q *q) {
                 /// @todo the value returned from the iteration will be what??(what's in x)
                 _t_free(state->code);
                 free(state);
-                code->contents.size = 0;
+                _t_set_surface(code,NULL,0);
             }
             else {
                 _t_free(x);
@@ -1307,13 +1445,7 @@ Error __p_reduce_sys_proc(R *context,Symbol s,T *code,Q *q) {
         // the 'code' node with the contents of the 'x' node that was either detached or produced
         // by the the process that just ran
         __t_free(code);
-        code->structure.child_count = x->structure.child_count;
-        code->structure.children = x->structure.children;
-        code->contents = x->contents;
-        code->context = x->context;
-        // we do have to fixe the parent value of all the children
-        DO_KIDS(code,_t_child(code,i)->structure.parent = code);
-        free(x);
+        __t_absorb(code,x);
         debug(D_STEP,"  to  %s\n",_t2s(sem,code));
     }
     else {
@@ -1332,6 +1464,9 @@ Error __p_reduce_sys_proc(R *context,Symbol s,T *code,Q *q) {
             path[0]++;
         }
         _t_free(x);  // and free the decapitated root!
+        // code is gone, so ascend from the last of the dissolved children instead
+        if (context && context->node_pointer == code)
+            context->node_pointer = _t_child(parent,path[0]-1);
         debug(D_STEP,"  dissolving to  %s\n",_t2s(sem,parent));
 
         //@todo, I think this might cause those children to be evaluated twice which may be a mistake...
@@ -1339,6 +1474,46 @@ Error __p_reduce_sys_proc(R *context,Symbol s,T *code,Q *q) {
     return err;
 }
 
+#define __p_inert_node(s) (!is_process(s) && !semeq(s,PARAM_REF) && !semeq(s,SIGNAL_REF) && !semeq(s,PARAMETER))
+
+/**
+ * flag which nodes of some process code have nothing in them for reduction to do,
+ * and which have SLOTs in them for template filling to do
+ *
+ * this gets done once when the code is defined (see _d_define), before any run tree can
+ * share it, because afterwards the code is read by many reduction threads at once.
+ *
+ * @param[in] code the process code
+ * @returns true if the code is inert
+ */
+bool __p_mark_inert(T *code) {
+    bool inert = __p_inert_node(_t_symbol(code));
+    bool slots = semeq(_t_symbol(code),SLOT);
+    int i,c = _t_children(code);
+    for(i=1;i<=c;i++) {
+        T *t = _t_child(code,i);
+        inert = __p_mark_inert(t) && inert;
+        slots = slots || (t->context.flags & TFLAG_SLOTS);
+    }
+    code->context.flags |= TFLAG_INERT_KNOWN | (inert ? TFLAG_INERT : 0) | (slots ? TFLAG_SLOTS : 0);
+    return inert;
+}
+
+/**
+ * check if there's nothing in a code tree for reduction to do, i.e. it's just data
+ *
+ * uses the flags set by __p_mark_inert, and code that wasn't marked is checked without
+ * writing anything into it
+ */
+bool __p_inert(T *code) {
+    uint32_t f = code->context.flags;
+    if (f & TFLAG_INERT_KNOWN) return f & TFLAG_INERT;
+    bool inert = __p_inert_node(_t_symbol(code));
+    int i,c = _t_children(code);
+    for(i=1;inert && i<=c;i++) inert = __p_inert(_t_child(code,i));
+    return inert;
+}
+
 /**
  * create a run-tree execution context.
  */
@@ -1356,6 +1531,7 @@ R *__p_make_context(T *run_tree,R *caller,int process_id,T *sem_map) {
     context->sem_map = sem_map;
     // copy in the callers conversation context too.
     context->conversation = caller ? caller->conversation : NULL;
+    context->vm = NULL;
     if (caller) caller->callee = context;
     return context;
 }
@@ -1412,12 +1588,96 @@ Qe *__p_find_context(Qe *e,int process_id) {
     return e;
 }
 
+/*****************  run deques for the scheduler's worker pool */
+
+// index of the scheduler worker running on the current thread (-1 if it's not a worker)
+__thread int G_worker = -1;
+
+/**
+ * add a queue to the end of a run deque, growing the ring as needed
+ *
+ * deques are guarded by their scheduler's mutex, which must be locked by the caller
+ */
+void __p_deque_push(RunDeque *d,Q *q) {
+    if (d->count == d->size) {
+        int i,size = d->size ? d->size*2 : 16;
+        Q **qs = malloc(sizeof(Q *)*size);
+        for(i=0;i<d->count;i++) qs[i] = d->qs[(d->head+i)%d->size];
+        free(d->qs);
+        d->qs = qs;
+        d->size = size;
+        d->head = 0;
+    }
+    d->qs[(d->head+d->count++)%d->size] = q;
+}
+
+/**
+ * take the oldest queue from a run deque (used by the deque's own worker so it
+ * services its receptors round-robin)
+ */
+Q *__p_deque_take(RunDeque *d) {
+    if (!d->count) return NULL;
+    Q *q = d->qs[d->head];
+    d->head = (d->head+1)%d->size;
+    d->count--;
+    return q;
+}
+
+/**
+ * steal the newest queue from a run deque (used by idle workers taking work from
+ * a busy one, leaving the owner the queues it will get to soonest)
+ */
+Q *__p_deque_steal(RunDeque *d) {
+    if (!d->count) return NULL;
+    return d->qs[(d->head + --d->count)%d->size];
+}
+
+/**
+ * notify the scheduler (if any) that a queue has become runnable
+ *
+ * an idle queue is pushed onto the current worker's deque (or round-robin onto one
+ * of the deques if called from outside the pool) and a sleeping worker is woken.
+ * If a worker is currently running the queue it gets flagged to be run again instead,
+ * so a queue is never owned by more than one worker at a time.
+ *
+ * @param[in] q the processing q that has work available
+ */
+void __p_mark_runnable(Q *q) {
+    Scheduler *s = q->scheduler;
+    if (!s) return;
+    pthread_mutex_lock(&s->mutex);
+    if (q->sched_state == QIdle) {
+        int w = G_worker;
+        if (w < 0 || w >= s->workers) {
+            w = s->next;
+            s->next = (s->next+1) % s->workers;
+        }
+        q->sched_state = QQueued;
+        q->runnable_at = monotonic_ns();
+        __p_deque_push(&s->deques[w],q);
+        s->queued++;
+        pthread_cond_signal(&s->cv);
+    }
+    else if (q->sched_state == QRunning) q->sched_state = QRerun;
+    pthread_mutex_unlock(&s->mutex);
+}
+
+/**
+ * wake all the scheduler's sleeping workers, i.e. so they notice a shutdown
+ */
+void __p_wake_scheduler(Scheduler *s) {
+    pthread_mutex_lock(&s->mutex);
+    pthread_cond_broadcast(&s->cv);
+    pthread_mutex_unlock(&s->mutex);
+}
+
 // low level unblock. Should be called only when q mutex is locked
 void __p_unblock(Q *q,Qe *e,Error err) {
     __p_dequeue(q->blocked,e);
     __p_enqueue(q->active,e);
     q->contexts_count++;
     e->context->state = err ? err : Eval;
+    __p_mark_runnable(q);
 }
 
 /**
@@ -1476,6 +1736,8 @@ void _p_wakeup(Q *q,T *wakeup, T *with,Error err) {
                 _t_free(with);
                 with = w;
             }
+            // the wakeup value may have been built while reducing some other process
+            _t_escape(with);
             T *t = e->context->node_pointer;
             T *p = _t_parent(t);
             _t_replace(p,_t_node_index(t), with);
@@ -1515,6 +1777,7 @@ Error _p_reduce(SemTable *sem,T *rt) {
     r.sem = sem;
     r.q = &q;
     q.r = &r;
+    q.scheduler = NULL;
 
     while(_p_step(&q, &context) != Done);
     e = context->err;
@@ -1622,6 +1885,7 @@ Error _p_step(Q *q, R **contextP) {
             else context->state = ctx->err;
             // cleanup
             _t_free(ctx->run_tree);
+            if (ctx->vm) __p_free_vm(ctx->vm);
             free(ctx);
             context->callee = 0;
             *contextP = context;
@@ -1699,7 +1963,10 @@ Error _p_step(Q *q, R **contextP) {
             }
             /// @todo what if the replaced parameter is itself a PARAM_REF tree ??
 
-            int count = _t_children(np);
+            // data that's still shared with code that has nothing in it to reduce can be
+            // left as is, so it never gets copied unless something uses it
+            T *shared = _t_cow_code(np);
+            int count = (shared && !is_process(s) && __p_inert(shared)) ? 0 : _t_children(np);
             if (!is_process(s)) {
 
                 // if this node is not a process, i.e. it's data, then either we
@@ -1725,8 +1992,7 @@ Error _p_step(Q *q, R **contextP) {
                         state->phase = EvalCondition;
                         state->code = _t_rclone(np);
                         state->type = IterateTypeUnknown;
-                        *((IterationState **)&np->contents.surface) = state;
-                        np->contents.size = sizeof(IterationState *);
+                        _t_set_surface(np,&state,sizeof(IterationState *));
 
                         // we start in condition phase so throw away the code copy
                         T *x = _t_detach_by_idx(np,3);
@@ -1750,8 +2016,7 @@ Error _p_step(Q *q, R **contextP) {
                         else {
                             state->phase = EvalCondResult;
                         }
-                        *((CondState **)&np->contents.surface) = state;
-                        np->contents.size = sizeof(CondState *);
+                        _t_set_surface(np,&state,sizeof(CondState *));
                     }
                 }
                 else if (semeq(s,CONVERSE)) {
@@ -1786,9 +2051,10 @@ Error _p_step(Q *q, R **contextP) {
                         ConversationState *state = malloc(sizeof(ConversationState));
                         state->converse_pointer = np;  // save the node pointer for later COMPLETEs
                         state->cid = _t_child(c,ConversationIdentIdx);
-                        *((ConversationState **)&np->contents.surface) = state;
-                        np->contents.size = sizeof(ConversationState *);
+                        _t_set_surface(np,&state,sizeof(ConversationState *));
+                        // the node owns the state so it gets freed along with the node
                         np->context.flags |= TFLAG_ALLOCATED;
+                        __t_surface_owned(np);
 
                         // register the conversation with the context linking an existing conversation
                         // to the new one if it exists
@@ -1806,18 +2072,45 @@ Error _p_step(Q *q, R **contextP) {
                         // if it's user defined process then we check the signature and then make
                         // a new run-tree run that process
 
-                        Error e = __p_check_signature(sem,s,np,context->sem_map);
+                        // a compiled run that used up its budget on the last step was already checked
+                        BytecodeVM *vm = context->vm;
+                        bool suspended = vm && vm->call == np;
+                        Error e = suspended ? noReductionErr : __p_check_signature(sem,s,np,context->sem_map);
                         if (e) {
                             context->state = e;
                         }
                         else {
-                            T *run_tree = _p_make_run_tree(sem,s,np,context->sem_map);
-                            context->state = Pushed;
-                            // @todo for now we just are just passing the semantic map from one
-                            // context to the next, but I'm pretty sure we're going to need a way
-                            // for folks to modify this on the fly as processes are called
-                            *contextP = __p_make_context(run_tree,context,context->id,context->sem_map);
-                            debug(D_REDUCE,"New context for %s: %s\n\n",_sem_get_name(sem,s),_t2s(sem,run_tree));
+                            // if the process was compiled we can run the bytecode directly,
+                            // which doesn't need a new context, unless it bails, in which case
+                            // we fall back to reducing a run tree
+                            Bytecode *b = (suspended || context->sem_map) ? NULL : _sem_get_bytecode(sem,s);
+                            T *result = NULL;
+                            if (b || suspended) {
+                                if (!vm) vm = context->vm = __p_new_vm();
+                                result = __p_exec_bytecode(q,sem,vm,b,np);
+                            }
+                            if (result) {
+                                debug(D_REDUCE,"Ran bytecode for %s\n",_sem_get_name(sem,s));
+                                _t_replace(context->parent,context->idx,result);
+                                set_rt_cur_child(q->r,result,RUN_TREE_EVALUATED);
+                                context->node_pointer = result;
+                                context->state = Eval;
+                            }
+                            else if (vm && vm->call == np) {
+                                // the run used up its budget so let the queue check its time
+                                // slice, the run carries on when this node is evaluated again
+                                debug(D_REDUCE,"Yielded bytecode for %s\n",_sem_get_name(sem,s));
+                                context->state = Eval;
+                            }
+                            else {
+                                T *run_tree = _p_make_run_tree(sem,s,np,context->sem_map);
+                                context->state = Pushed;
+                                // @todo for now we just are just passing the semantic map from one
+                                // context to the next, but I'm pretty sure we're going to need a way
+                                // for folks to modify this on the fly as processes are called
+                                *contextP = __p_make_context(run_tree,context,context->id,context->sem_map);
+                                debug(D_REDUCE,"New context for %s: %s\n\n",_sem_get_name(sem,s),_t2s(sem,run_tree));
+                            }
                         }
                     }
                     else {
@@ -1842,10 +2135,7 @@ Error _p_step(Q *q, R **contextP) {
                                 // with the RUN_TREE in it so we don't have store it in the actual tree
                                 int i = _t_node_index(np);
                                 T *p = _t_parent(np);
-                                T *dummy = __t_newr(0,NOOP,true);
-                                p->structure.children[i-1] = dummy;
-                                dummy->structure.parent = p;
-                                np->structure.parent = NULL;
+                                _t_swap(p,i,__t_newr(0,NOOP,true));
                                 *contextP = __p_make_context(np,context,context->id,context->sem_map);
                                 debug(D_REDUCE,"Redoing with a new context for: %s\n\n",_t2s(sem,np));
                             }
@@ -1884,6 +2174,8 @@ Error _p_step(Q *q, R **contextP) {
             context->state = Eval;
         break;
     case Descend:
+        // reduction changes the children so they can't stay shared with the code
+        __t_cow(context->node_pointer);
         context->parent = context->node_pointer;
         rt_check(q->r,context->node_pointer);
         context->idx = ++rt_cur_child(context->node_pointer);
@@ -1975,8 +2267,7 @@ T *_p_make_run_tree(SemTable *sem,Process p,T *params,T *sem_map) {
     if (!is_process(p)) {
         raise_error("not a Process!");
     }
-    T *processes = _sem_get_defs(sem,p);
-    T *code_def = _d_get_process_code(processes,p);
+    T *code_def = _sem_get_def(sem,p);
     T *t = _t_new_root(RUN_TREE);
     T *ps;
 
@@ -1990,15 +2281,13 @@ T *_p_make_run_tree(SemTable *sem,Process p,T *params,T *sem_map) {
         _t_newr(t,PARAMS);
     }
     else {
-        // otherwise we clone the code of the process
-        T *c = _t_rclone(code);
+        // otherwise we clone the code of the process, which stays shared with the
+        // definition until the reduction gets to it
+        T *c = _t_rclone_cow(code);
         _t_add(t,c);
         ps = _t_newr(t,PARAMS);
     }
-    int i,num_params = _t_children(params);
-    for(i=1;i<=num_params;i++) {
-        _t_add(ps,_t_detach_by_idx(params,1));
-    }
+    _t_move_children(ps,params);
 
     if (sem_map) {
         __t_fill_template(t,sem_map,true);
@@ -2006,6 +2295,396 @@ T *_p_make_run_tree(SemTable *sem,Process p,T *params,T *sem_map) {
     return t;
 }
 
+/******************  compiled process code */
+
+int __p_emit(Bytecode *b,int op,int arg,int arg2,SemanticID sem) {
+    if (b->len == b->size) {
+        b->size = b->size ? b->size*2 : 16;
+        b->code = realloc(b->code,b->size*sizeof(Instruction));
+    }
+    Instruction *i = &b->code[b->len];
+    i->op = op;
+    i->arg = arg;
+    i->arg2 = arg2;
+    i->sem = sem;
+    return b->len++;
+}
+
+// values on the bytecode stack are plain ints, so only leaves with an inline int surface can be used
+#define __p_is_int_leaf(t) (!_t_children(t) && _t_size(t) == sizeof(int) && !((t)->context.flags & TFLAG_ALLOCATED))
+
+/**
+ * compile a node of a process's code tree into bytecode
+ *
+ * @param[in] sem current semantic context
+ * @param[inout] b bytecode to add instructions to
+ * @param[in] code the code node to compile
+ * @returns true if the node (and all its children) could be compiled
+ */
+bool __p_compile_node(SemTable *sem,Bytecode *b,T *code) {
+    Symbol s = _t_symbol(code);
+    int i,c = _t_children(code);
+
+    if (!is_process(s)) {
+        if (semeq(s,PARAM_REF)) {
+            // only references to the run tree params are compiled i.e. /2/n
+            int *path = (int *)_t_surface(code);
+            if (_t_path_depth(path) != 2 || path[0] != RunTreeParamsIdx || path[1] < 1) return false;
+            __p_emit(b,OpParam,path[1],0,NULL_SYMBOL);
+            return true;
+        }
+        if (semeq(s,SIGNAL_REF) || semeq(s,PARAMETER) || !__p_is_int_leaf(code)) return false;
+        __p_emit(b,OpPush,*(int *)_t_surface(code),0,s);
+        return true;
+    }
+
+    if (!is_sys_process(s)) {
+        // call to another process, which must have been compiled by the time it gets run
+        for(i=1;i<=c;i++) {
+            if (!__p_compile_node(sem,b,_t_child(code,i))) return false;
+        }
+        __p_emit(b,OpCall,c,0,s);
+        return true;
+    }
+
+    int op;
+    switch(s.id) {
+    case NOOP_ID:
+        return (c == 1) && __p_compile_node(sem,b,_t_child(code,1));
+    case ADD_INT_ID: op = OpAdd; break;
+    case SUB_INT_ID: op = OpSub; break;
+    case MULT_INT_ID: op = OpMult; break;
+    case DIV_INT_ID: op = OpDiv; break;
+    case MOD_INT_ID: op = OpMod; break;
+    case EQ_INT_ID: op = OpEq; break;
+    case LT_INT_ID: op = OpLt; break;
+    case GT_INT_ID: op = OpGt; break;
+    case LTE_INT_ID: op = OpLte; break;
+    case GTE_INT_ID: op = OpGte; break;
+    case IF_ID:
+        // the tree reducer evaluates both branches before choosing, so we do the same
+        if (c != 3) return false;
+        for(i=1;i<=3;i++) {
+            if (!__p_compile_node(sem,b,_t_child(code,i))) return false;
+        }
+        __p_emit(b,OpSelect,0,0,NULL_SYMBOL);
+        return true;
+    case COND_ID:
+        {
+            T *conditions = _t_child(code,1);
+            int j,k = _t_children(conditions);
+            if (c != 1 || !k || !semeq(_t_symbol(_t_child(conditions,k)),COND_ELSE)) return false;
+            int ends[k];
+            for(i=1;i<k;i++) {
+                T *pair = _t_child(conditions,i);
+                if (!semeq(_t_symbol(pair),COND_PAIR) || _t_children(pair) != 2) return false;
+                if (!__p_compile_node(sem,b,_t_child(pair,1))) return false;
+                int skip = __p_emit(b,OpJumpZero,0,0,NULL_SYMBOL);
+                if (!__p_compile_node(sem,b,_t_child(pair,2))) return false;
+                ends[i-1] = __p_emit(b,OpJump,0,0,NULL_SYMBOL);
+                b->code[skip].arg = b->len;
+            }
+            T *e = _t_child(conditions,k);
+            if (_t_children(e) != 1 || !__p_compile_node(sem,b,_t_child(e,1))) return false;
+            for(j=0;j<k-1;j++) b->code[ends[j]].arg = b->len;
+        }
+        return true;
+    case ITERATE_ID:
+        {
+            // only count iteration can be compiled as a condition iteration has no
+            // purpose in side-effect free code and symbol iteration needs the instances
+            if (c != 3 || _t_children(_t_child(code,1))) return false;
+            if (!__p_compile_node(sem,b,_t_child(code,2))) return false;
+            int slot = b->slots++;
+            int begin = __p_emit(b,OpIterBegin,slot,0,NULL_SYMBOL);
+            int body = b->len;
+            if (!__p_compile_node(sem,b,_t_child(code,3))) return false;
+            __p_emit(b,OpIterNext,slot,body,NULL_SYMBOL);
+            b->code[begin].arg2 = b->len;
+        }
+        return true;
+    case GET_ID:
+        {
+            T *x = _t_child(code,1);
+            if (c != 1 || is_process(_t_symbol(x)) || _t_children(x) || _t_size(x) != sizeof(Xaddr)) return false;
+            Xaddr xa = *(Xaddr *)_t_surface(x);
+            __p_emit(b,OpGet,xa.addr,0,xa.symbol);
+        }
+        return true;
+    default:
+        return false;
+    }
+    if (c != 2) return false;
+    if (!__p_compile_node(sem,b,_t_child(code,1)) || !__p_compile_node(sem,b,_t_child(code,2))) return false;
+    __p_emit(b,op,0,0,NULL_SYMBOL);
+    return true;
+}
+
+/**
+ * compile a process's code tree into bytecode
+ *
+ * @param[in] sem current semantic context
+ * @param[in] p process to compile
+ * @returns the compiled Bytecode or NULL if the process uses instructions that can only be tree reduced
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/process_spec.h testProcessBytecode
+ */
+Bytecode *_p_compile(SemTable *sem,Process p) {
+    T *def = _sem_get_def(sem,p);
+    T *code = _t_child(def,ProcessDefCodeIdx);
+    if (semeq(_t_symbol(code),NULL_PROCESS)) return NULL;
+
+    Bytecode *b = malloc(sizeof(Bytecode));
+    memset(b,0,sizeof(Bytecode));
+
+    // cache the input signatures so calls can be checked without walking the def
+    T *signature = _t_child(def,ProcessDefSignatureIdx);
+    int i,sigs = _t_children(signature);
+    b->sigs = malloc(sizeof(InputSig)*(sigs ? sigs : 1));
+    for(i=SignatureOutputSigIdx+1;i<=sigs;i++) {
+        T *s = _t_child(signature,i);
+        if (!semeq(_t_symbol(s),INPUT_SIGNATURE)) {
+            // processes with semantic templates need a sem_map to run
+            _p_free_bytecode(b);
+            return NULL;
+        }
+        T *sig = _t_child(s,InputSigSemVariantsIdx);
+        InputSig *is = &b->sigs[b->inputs++];
+        is->kind = _t_symbol(sig);
+        is->expected = _t_size(sig) ? *(SemanticID *)_t_surface(sig) : NULL_SYMBOL;
+        if (!_t_child(s,InputSigOptionalIdx)) b->required++;
+    }
+
+    if (!__p_compile_node(sem,b,code)) {
+        _p_free_bytecode(b);
+        return NULL;
+    }
+    __p_emit(b,OpReturn,0,0,NULL_SYMBOL);
+    debug(D_REDUCE,"compiled %s into %d instructions\n",_sem_get_name(sem,p),b->len);
+    return b;
+}
+
+void _p_free_bytecode(Bytecode *b) {
+    free(b->code);
+    free(b->sigs);
+    free(b);
+}
+
+// check the values passed to a compiled process the way __p_check_signature does for trees
+bool __p_check_bytecode_params(SemTable *sem,Bytecode *b,StackValue *params,int count) {
+    if (count < b->required || count > b->inputs) return false;
+    int i;
+    for(i=0;i<count;i++) {
+        InputSig *is = &b->sigs[i];
+        if (semeq(is->kind,SIGNATURE_STRUCTURE)) {
+            if (!semeq(is->expected,TREE) && !semeq(_sem_get_symbol_structure(sem,params[i].symbol),is->expected))
+                return false;
+        }
+        else if (semeq(is->kind,SIGNATURE_SYMBOL) || semeq(is->kind,SIGNATURE_PROCESS)) {
+            if (!semeq(is->expected,params[i].symbol)) return false;
+        }
+        else if (!semeq(is->kind,SIGNATURE_ANY)) return false;
+    }
+    return true;
+}
+
+/**
+ * create the interpreter state used to run compiled code
+ */
+BytecodeVM *__p_new_vm() {
+    BytecodeVM *vm = malloc(sizeof(BytecodeVM));
+    vm->size = 64;
+    vm->stack = malloc(vm->size*sizeof(StackValue));
+    vm->frames_size = 16;
+    vm->frames = malloc(vm->frames_size*sizeof(Frame));
+    vm->sp = vm->fp = 0;
+    vm->call = NULL;
+    vm->yields = 0;
+    return vm;
+}
+
+void __p_free_vm(BytecodeVM *vm) {
+    free(vm->stack);
+    free(vm->frames);
+    free(vm);
+}
+
+/**
+ * run compiled process code
+ *
+ * Runs are limited to BYTECODE_BUDGET instructions so that a long loop or deep recursion
+ * can't hold onto a worker past its time slice.  When the budget is used up the run is
+ * saved in the vm and can be resumed by calling again with a NULL bytecode.
+ *
+ * @param[in] q the queue in which the code is being run (for GET)
+ * @param[in] sem current semantic context
+ * @param[in] vm interpreter state to run in
+ * @param[in] b bytecode of the process to run, or NULL to resume the vm's suspended run
+ * @param[in] params the node whose children are the already reduced params for the process,
+ * which must already have been checked against the process's signature
+ * @returns the result as a run node or NULL if the run was suspended (in which case
+ * vm->call is set to params) or the bytecode couldn't handle the params or hit a case it
+ * can't handle (i.e. an error) in which case the process should be tree reduced.
+ *
+ * @note because compiled code is side-effect free, bailing out at any point is safe.
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/process_spec.h testProcessBytecode
+ */
+T *__p_exec_bytecode(Q *q,SemTable *sem,BytecodeVM *vm,Bytecode *b,T *params) {
+    StackValue *stack = vm->stack;
+    int i,size = vm->size,sp,fp;
+    int budget = BYTECODE_BUDGET;
+    Frame *f;
+    T *result = NULL;
+
+#define _grow(n) if (sp+(n) > size) {while (sp+(n) > size) size *= 2; stack = realloc(stack,size*sizeof(StackValue));}
+#define _push(s,v) {_grow(1);stack[sp].symbol = (s);stack[sp++].value = (v);}
+#define _bail() goto done
+
+    vm->call = NULL;
+    if (!b) {
+        sp = vm->sp;
+        fp = vm->fp;
+        f = &vm->frames[fp];
+    }
+    else {
+        int count = _t_children(params);
+        sp = fp = 0;
+        _grow(count+b->slots);
+        for(i=1;i<=count;i++) {
+            T *p = _t_child(params,i);
+            if (!__p_is_int_leaf(p)) _bail();
+            stack[sp].symbol = _t_symbol(p);
+            stack[sp++].value = *(int *)_t_surface(p);
+        }
+        sp += b->slots;
+        f = &vm->frames[0];
+        f->b = b;f->pc = 0;f->base = 0;f->params = count;
+    }
+
+    StackValue x,y,*v;
+    for(;;) {
+        if (!budget--) {
+            vm->sp = sp;
+            vm->fp = fp;
+            vm->call = params;
+            vm->yields++;
+            goto done;
+        }
+        Instruction *in = &f->b->code[f->pc++];
+        switch(in->op) {
+        case OpPush:
+            _push(in->sem,in->arg);
+            break;
+        case OpParam:
+            if (in->arg > f->params) _bail();
+            x = stack[f->base+in->arg-1];
+            _push(x.symbol,x.value);
+            break;
+        case OpAdd:  y = stack[--sp]; stack[sp-1].value += y.value; break;
+        case OpSub:  y = stack[--sp]; stack[sp-1].value -= y.value; break;
+        case OpMult: y = stack[--sp]; stack[sp-1].value *= y.value; break;
+        case OpDiv:
+            y = stack[--sp];
+            if (!y.value) _bail();
+            stack[sp-1].value /= y.value;
+            break;
+        case OpMod:
+            y = stack[--sp];
+            if (!y.value) _bail();
+            stack[sp-1].value %= y.value;
+            break;
+        case OpEq:  y = stack[--sp]; v = &stack[sp-1]; v->value = v->value == y.value; v->symbol = BOOLEAN; break;
+        case OpLt:  y = stack[--sp]; v = &stack[sp-1]; v->value = v->value < y.value; v->symbol = BOOLEAN; break;
+        case OpGt:  y = stack[--sp]; v = &stack[sp-1]; v->value = v->value > y.value; v->symbol = BOOLEAN; break;
+        case OpLte: y = stack[--sp]; v = &stack[sp-1]; v->value = v->value <= y.value; v->symbol = BOOLEAN; break;
+        case OpGte: y = stack[--sp]; v = &stack[sp-1]; v->value = v->value >= y.value; v->symbol = BOOLEAN; break;
+        case OpSelect:
+            sp -= 2;
+            stack[sp-1] = stack[sp-1].value ? stack[sp] : stack[sp+1];
+            break;
+        case OpJumpZero:
+            if (!stack[--sp].value) f->pc = in->arg;
+            break;
+        case OpJump:
+            f->pc = in->arg;
+            break;
+        case OpIterBegin:
+            // the count is the iteration's condition value, which is also the
+            // result if the body never gets run
+            x = stack[sp-1];
+            if (semeq(x.symbol,BOOLEAN) || !semeq(_sem_get_symbol_structure(sem,x.symbol),INTEGER)) _bail();
+            if (x.value <= 0) f->pc = in->arg2;
+            else {
+                sp--;
+                stack[f->base+f->params+in->arg].value = x.value;
+            }
+            break;
+        case OpIterNext:
+            // the last body result is left on the stack as the iteration's result
+            if (--stack[f->base+f->params+in->arg].value > 0) {
+                sp--;
+                f->pc = in->arg2;
+            }
+            break;
+        case OpGet:
+            {
+                Xaddr xa = {in->sem,in->arg};
+                pthread_mutex_lock(&q->r->instances_mutex);
+                T *t = _r_get_instance(q->r,xa);
+                bool ok = t && __p_is_int_leaf(t);
+                Symbol sym;
+                int val;
+                if (ok) {
+                    sym = _t_symbol(t);
+                    val = *(int *)_t_surface(t);
+                }
+                pthread_mutex_unlock(&q->r->instances_mutex);
+                if (!ok) _bail();
+                _push(sym,val);
+            }
+            break;
+        case OpCall:
+            {
+                Bytecode *cb = _sem_get_bytecode(sem,in->sem);
+                if (!cb || fp+1 == BYTECODE_MAX_DEPTH) _bail();
+                int base = sp-in->arg;
+                if (!__p_check_bytecode_params(sem,cb,&stack[base],in->arg)) _bail();
+                if (++fp == vm->frames_size) {
+                    vm->frames_size *= 2;
+                    vm->frames = realloc(vm->frames,vm->frames_size*sizeof(Frame));
+                }
+                f = &vm->frames[fp];
+                f->b = cb;f->pc = 0;f->base = base;f->params = in->arg;
+                _grow(cb->slots);
+                sp += cb->slots;
+            }
+            break;
+        case OpReturn:
+            x = stack[sp-1];
+            if (!fp) {
+                result = __t_newi(0,x.symbol,x.value,true);
+                goto done;
+            }
+            sp = f->base;
+            f = &vm->frames[--fp];
+            stack[sp++] = x;
+            break;
+        default:
+            raise_error("unknown bytecode instruction: %d",in->op);
+        }
+    }
+ done:
+    vm->stack = stack;
+    vm->size = size;
+    return result;
+#undef _grow
+#undef _push
+#undef _bail
+}
+
 /**
  * create a new processing queue
  *
@@ -2019,19 +2698,27 @@ Q *_p_newq(Receptor *r) {
     q->active = NULL;
     q->completed = NULL;
     q->blocked = NULL;
+    q->scheduler = NULL;
+    q->sched_state = QIdle;
+    q->runnable_at = 0;
+    q->weight = 1;
+    q->quanta_used = 0;
     pthread_mutex_init(&(q->mutex), NULL);
     return q;
 }
 
 // clean up a context including its run-trees
-void _p_free_context(R *c) {
+void __p_free_context(R *c,Arena *a) {
     while(c) {
         // free any run_trees that are roots, i.e. assume
         // that a tree in a context that's part of another tree
-        // will get freed elsewhere.
-        if (!_t_parent(c->run_tree))
-            _t_free(c->run_tree);
+        // will get freed elsewhere (see the escaping of such trees in __p_reduceq)
+        if (!_t_parent(c->run_tree)) {
+            if (a) _t_free_with_arena(c->run_tree,a);
+            else _t_free(c->run_tree);
+        }
         R *n = c->caller;
+        if (c->vm) __p_free_vm(c->vm);
         free(c);
         c = n;
     }
@@ -2040,7 +2727,8 @@ void _p_free_context(R *c) {
 // clean up a queue element
 void _p_free_elements(Qe *e) {
     while(e) {
-        _p_free_context(e->context);
+        __p_free_context(e->context,e->arena);
+        _t_release_arena(e->arena);
         Qe *n = e->next;
         free(e);
         e = n;
@@ -2067,16 +2755,19 @@ int G_next_process_id = 0;
  */
 Qe *__p_addrt2q(Q *q,T *run_tree,T *sem_map) {
     Qe *n = malloc(sizeof(Qe));
-    n->id = ++G_next_process_id;
+    n->id = __sync_add_and_fetch(&G_next_process_id,1);
     n->prev = NULL;
     n->context = __p_make_context(run_tree,0,n->id,sem_map);
+    n->arena = _t_new_arena();
     n->accounts.elapsed_time = 0;
+    n->accounts.steps = 0;
     debug(D_LOCK,"addrt2q LOCK\n");
     pthread_mutex_lock(&q->mutex);
     __p_append(q->active,n);
     q->contexts_count++;
     pthread_mutex_unlock(&q->mutex);
     debug(D_LOCK,"addrt2q UNLOCK\n");
+    __p_mark_runnable(q);
 
     return n;
 }
@@ -2124,13 +2815,37 @@ char *__debug_state_str(R *context) {
  * @param[in] q the queue to be processed
  */
 Error _p_reduceq(Q *q) {
+    return __p_reduceq(q,0);
+}
+
+/**
+ * reduce the processes in a queue for at most a time slice
+ *
+ * stepping round-robin through the active processes stops when there are none left
+ * or once the steps taken have used up the quantum, so that a long running process
+ * can't starve other receptors sharing the scheduler.  The caller can tell there's
+ * more to do from q->contexts_count.
+ *
+ * @param[in] q the queue to be processed
+ * @param[in] quantum time budget in microseconds, or 0 to reduce until no processes are active
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/process_spec.h testProcessReduceQuantum
+ */
+Error __p_reduceq(Q *q,uint64_t quantum) {
     debug(D_REDUCE+D_REDUCEV,"Starting reduce:\n");
 
-    Qe *qe = q->active;
     Error next_state;
     struct timespec start, end;
+    uint64_t used = 0;
+    quantum *= 1000;
 
+    // contexts_count and the lists are shared with threads that unblock processes, so
+    // they're only looked at with the q locked, which is dropped around each step
+    pthread_mutex_lock(&q->mutex);
+    Qe *qe = q->active;
     while (q->contexts_count) {
+        pthread_mutex_unlock(&q->mutex);
 #ifdef CEPTR_DEBUG
         if (debugging(D_REDUCEV)) {
             R *context = qe->context;
@@ -2155,9 +2870,13 @@ Error _p_reduceq(Q *q) {
 #endif
 
         clock_gettime(CLOCK_MONOTONIC, &start);
+        Arena *prev_arena = _t_use_arena(qe->arena);
         next_state = _p_step(q, &qe->context); // next state is set in directly in the context
+        _t_use_arena(prev_arena);
         clock_gettime(CLOCK_MONOTONIC, &end);
         qe->accounts.elapsed_time +=  diff_micro(&start, &end);
+        qe->accounts.steps++;
+        used += (end.tv_sec - start.tv_sec)*1000000000LL + end.tv_nsec - start.tv_nsec;
 
 #ifdef CEPTR_DEBUG
         debug(D_REDUCEV,"result state:%s\n\n",__debug_state_str(qe->context));
@@ -2170,6 +2889,10 @@ Error _p_reduceq(Q *q) {
         pthread_mutex_lock(&q->mutex);
         Qe *next = qe->next;
         if (next_state == Done) {
+            // a run tree that lives inside another tree (i.e. a signal) outlives the
+            // queue element so its result can't be left in the element's arena
+            if (_t_parent(qe->context->run_tree)) _t_escape(qe->context->run_tree);
+
             // remove from the round-robin
             __p_dequeue(q->active,qe);
 
@@ -2188,9 +2911,14 @@ Error _p_reduceq(Q *q) {
             q->contexts_count--;
         }
         qe = next ? next : q->active;  // next in round robin or wrap back to first
-        pthread_mutex_unlock(&q->mutex);
-        debug(D_LOCK,"reduce UNLOCK\n");
+        if (quantum && used >= quantum) {
+            debug(D_REDUCE+D_REDUCEV,"Quantum used up\n");
+            q->quanta_used++;
+            break;
+        }
     };
+    pthread_mutex_unlock(&q->mutex);
+    debug(D_LOCK,"reduce UNLOCK\n");
 
     /// @todo figure out what error we should be sending back here, i.e. what if
     // one process ended ok, but one did not.  What's the error?  Probably
@@ -2211,8 +2939,8 @@ void _p_cleanup(Q *q) {
     Qe *e = q->completed;
     while (e) {
         T *ett = _t_child(_t_child(q->r->root,ReceptorInstanceStateIdx),ReceptorElapsedTimeIdx);
-        int *et = (int *)_t_surface(ett);
-        (*et) += e->accounts.elapsed_time;
+        int et = *(int *)_t_surface(ett) + e->accounts.elapsed_time;
+        _t_set_surface(ett,&et,sizeof(int));
         e = e->next;
     }
     _p_free_elements(q->completed);
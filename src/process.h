@@ -37,24 +37,105 @@ typedef struct CondState {
     T *conditions;
 } CondState;
 
+/**
+ * Compiled process code
+ *
+ * Process definitions whose code uses only the pure integer subset of the instruction
+ * set (integer literals, PARAM_REF, the integer math and comparison processes, IF, COND,
+ * count ITERATE, GET, NOOP and calls to other compiled processes) are compiled into a
+ * linear list of instructions for a stack machine.  Anything outside of that subset is
+ * left to the tree reducer.
+ */
+enum BytecodeOps {OpPush,OpParam,OpAdd,OpSub,OpMult,OpDiv,OpMod,OpEq,OpLt,OpGt,OpLte,OpGte,OpSelect,OpJumpZero,OpJump,OpIterBegin,OpIterNext,OpGet,OpCall,OpReturn};
+
+typedef struct Instruction {
+    int op;           ///< BytecodeOps value
+    int arg;          ///< literal value, param index, iteration slot, jump target, xaddr addr or call param count
+    int arg2;         ///< jump target for the iteration instructions
+    SemanticID sem;   ///< literal symbol, xaddr symbol or called process
+} Instruction;
+
+typedef struct InputSig {
+    Symbol kind;      ///< SIGNATURE_STRUCTURE, SIGNATURE_SYMBOL, SIGNATURE_PROCESS or SIGNATURE_ANY
+    SemanticID expected;
+} InputSig;
+
+struct Bytecode {
+    Instruction *code;
+    int len;          ///< number of instructions emitted
+    int size;         ///< number of instructions allocated
+    int slots;        ///< number of iteration counters needed by a call
+    int inputs;       ///< number of input signatures
+    int required;     ///< number of non-optional input signatures
+    InputSig *sigs;
+};
+
+typedef struct StackValue {
+    Symbol symbol;
+    int value;
+} StackValue;
+
+typedef struct Frame {
+    Bytecode *b;
+    int pc;
+    int base;     ///< stack index of the first param
+    int params;   ///< number of params passed
+} Frame;
+
+/**
+ * Interpreter state for running compiled code
+ *
+ * A context keeps one of these for all the compiled calls it makes, so the stack and
+ * frames aren't reallocated for each call, and so that a run that uses up its
+ * instruction budget can be picked up again at the next step.
+ */
+struct BytecodeVM {
+    StackValue *stack;
+    int size;         ///< number of stack values allocated
+    int sp;           ///< saved stack pointer of a suspended run
+    Frame *frames;
+    int frames_size;  ///< number of frames allocated
+    int fp;           ///< saved frame pointer of a suspended run
+    T *call;          ///< call node of the suspended run, or NULL if there isn't one
+    int yields;       ///< number of times runs have used up their budget
+};
+
+#define BYTECODE_MAX_DEPTH 10000
+#define BYTECODE_BUDGET 10000  ///< number of instructions run before yielding back to the queue
+
+/// builds a tree straight from raw bytes, returning NULL if they don't parse
+typedef T *(*NativeTranscoder)(char *buf,size_t len);
+
 T *defaultRequestUntil();
 R *__p_make_context(T *run_tree,R *caller,int process_id,T *sem_map);
 Error _p_step(Q *q, R **contextP);
 void _p_fill_from_match(SemTable *sem,T *t,T *match_results,T *match_tree);
+T *_p_bytes_2_http_req(char *buf,size_t len);
+NativeTranscoder _p_get_native_transcoder(SemTable *sem,Symbol to_sym);
 Error __p_check_signature(SemTable *sem,Process p,T *params,T *sem_map);
 Error __p_reduce_sys_proc(R *context,Symbol s,T *code,Q *q);
+bool __p_mark_inert(T *code);
+bool __p_inert(T *code);
 void _p_enqueue(Qe **listP,Qe *e);
 Qe *__p_find_context(Qe *e,int process_id);
+extern __thread int G_worker;
+void __p_deque_push(RunDeque *d,Q *q);
+Q *__p_deque_take(RunDeque *d);
+Q *__p_deque_steal(RunDeque *d);
+void __p_mark_runnable(Q *q);
+void __p_wake_scheduler(Scheduler *s);
 void __p_unblock(Q *q,Qe *e,Error err);
 Error _p_unblock(Q *q,int id);
 void _p_wakeup(Q *q,T *wakeup, T *with,Error err);
 Error _p_reduce(SemTable *sem,T *run_tree);
 Q *_p_newq(Receptor *r);
 void _p_freeq(Q *q);
-void _p_free_context(R *c);
+void __p_free_context(R *c,Arena *a);
+#define _p_free_context(c) __p_free_context(c,NULL)
 #define _p_addrt2q(q,t) __p_addrt2q(q,t,NULL);
 Qe *__p_addrt2q(Q *q,T *t,T *sem_map);
 Error _p_reduceq(Q *q);
+Error __p_reduceq(Q *q,uint64_t quantum);
 void *_p_reduceq_thread(void *arg);
 T *_p_make_run_tree(SemTable *sem,Process p,T *params,T *sem_map);
 T *__p_build_wakeup_info(T *code_point,int process_id);
@@ -62,5 +143,10 @@ T *__p_build_run_tree(T* code,int num_params,...);
 void _p_cleanup(Q *q);
 #define __p_make_signature(output_label,output_type,output_sem,...) __p_make_form(PROCESS_SIGNATURE,output_label,output_type,output_sem,__VA_ARGS__)
 T *__p_make_form(Symbol sym,char *output_label,Symbol output_type,SemanticID output_sem,...);
+Bytecode *_p_compile(SemTable *sem,Process p);
+void _p_free_bytecode(Bytecode *b);
+BytecodeVM *__p_new_vm();
+void __p_free_vm(BytecodeVM *vm);
+T *__p_exec_bytecode(Q *q,SemTable *sem,BytecodeVM *vm,Bytecode *b,T *params);
 #endif
 /** @}*/
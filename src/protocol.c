@@ -267,8 +267,7 @@ T * _o_unwrap(SemTable *sem,T *def,T *sem_map) {
         T *t = _t_child(d,i);
         if (semeq(_t_symbol(t),INCLUSION)) {
             Protocol p = *(Protocol *)_t_surface(_t_child(t,InclusionPnameIdx));
-            T *ps = _sem_get_defs(sem,p);
-            T *p_def = _o_unwrap(sem,_t_child(ps,p.id),sem_map);  // do the recursive unwrapping
+            T *p_def = _o_unwrap(sem,_sem_get_def(sem,p),sem_map);  // do the recursive unwrapping
             int j,c = _t_children(t);
             T *bindings = NULL;
             for(j=InclusionPnameIdx+1;j<=c;j++) {
@@ -32,7 +32,10 @@ Receptor * __r_init(T *t,SemTable *sem) {
     r->addr.addr = r->context;  //@fixme!! for now these are the same, but this needs to get fixed
     r->sem = sem;
     r->instances = NULL;
+    pthread_mutex_init(&r->instances_mutex, NULL);
     r->q = _p_newq(r);
+    r->inbox = _t_new_root(PENDING_SIGNALS);
+    pthread_mutex_init(&r->inbox_mutex, NULL);
     r->state = Alive;  //@todo, check if this is true on unserialize
 
     T *state = _t_child(t,ReceptorInstanceStateIdx);
@@ -41,6 +44,19 @@ Receptor * __r_init(T *t,SemTable *sem) {
     r->pending_responses = _t_child(state,ReceptorPendingResponsesIdx);
     r->conversations = _t_child(state,ReceptorConversationsIdx);
     r->edge = NULL;
+    r->expectation_patterns = NULL;
+    r->expectation_index = NULL;
+    r->expectation_seq = 0;
+    r->def_patterns = NULL;
+    pthread_mutex_init(&r->patterns_mutex, NULL);
+    r->conversation_index = NULL;
+    r->response_index = NULL;
+    r->conversation_expectations = NULL;
+    r->conversation_responses = NULL;
+    // the tree may already have expectations, conversations and pending responses
+    // in it (i.e. when unserializing)
+    __r_reindex_expectations(r);
+    __r_reindex_conversations(r);
     return r;
 }
 
@@ -169,12 +185,338 @@ void _r_add_expectation(Receptor *r,Aspect aspect,Symbol carrier,T *pattern,T *a
 void __r_add_expectation(Receptor *r,Aspect aspect,T *e) {
     T *a = __r_get_expectations(r,aspect);
     _t_add(a,e);
+    pthread_mutex_lock(&r->patterns_mutex);
+    __r_index_expectation(r,aspect,e);
+    pthread_mutex_unlock(&r->patterns_mutex);
 }
 
-void _r_remove_expectation(Receptor *r,T *expectation) {
-    T *a = _t_parent(expectation);
-    _t_detach_by_ptr(a,expectation);
+/*****************  UUID indexes */
+
+// conversations, pending responses and the expectations and requests scoped to a conversation
+// are all looked up by UUID, so we keep hash tables of them alongside the trees
+
+uuid_entry *__r_uuid_find(UUIDIndex idx,UUIDt *u) {
+    uuid_entry *e;
+    HASH_FIND(hh,idx,u,sizeof(UUIDt),e);
+    return e;
+}
+
+void __r_uuid_add(UUIDIndex *idx,UUIDt *u,T *t) {
+    uuid_entry *e = __r_uuid_find(*idx,u);
+    if (!e) {
+        e = malloc(sizeof(uuid_entry));
+        e->uuid = *u;
+        HASH_ADD(hh,*idx,uuid,sizeof(UUIDt),e);
+    }
+    e->t = t;
+}
+
+void __r_uuid_remove(UUIDIndex *idx,UUIDt *u) {
+    uuid_entry *e = __r_uuid_find(*idx,u);
+    if (e) {
+        HASH_DEL(*idx,e);
+        free(e);
+    }
+}
+
+void __r_uuid_free(UUIDIndex *idx) {
+    uuid_entry *e,*tmp;
+    HASH_ITER(hh,*idx,e,tmp) {
+        HASH_DEL(*idx,e);
+        free(e);
+    }
+}
+
+uuid_list *__r_list_find(UUIDListIndex idx,UUIDt *u) {
+    uuid_list *l;
+    HASH_FIND(hh,idx,u,sizeof(UUIDt),l);
+    return l;
+}
+
+void __r_list_add(UUIDListIndex *idx,UUIDt *u,T *t) {
+    uuid_list *l = __r_list_find(*idx,u);
+    if (!l) {
+        l = malloc(sizeof(uuid_list));
+        l->uuid = *u;
+        l->count = 0;
+        l->size = 4;
+        l->items = malloc(sizeof(T *)*l->size);
+        HASH_ADD(hh,*idx,uuid,sizeof(UUIDt),l);
+    }
+    if (l->count == l->size) {
+        l->size *= 2;
+        l->items = realloc(l->items,sizeof(T *)*l->size);
+    }
+    l->items[l->count++] = t;
+}
+
+// remove a tree from a list, dropping the list when it's empty
+void __r_list_remove(UUIDListIndex *idx,UUIDt *u,T *t) {
+    uuid_list *l = __r_list_find(*idx,u);
+    int i;
+    if (!l) return;
+    for(i=0;i<l->count;i++) {
+        if (l->items[i] == t) {
+            memmove(&l->items[i],&l->items[i+1],sizeof(T *)*(l->count-i-1));
+            l->count--;
+            break;
+        }
+    }
+    if (!l->count) {
+        HASH_DEL(*idx,l);
+        free(l->items);
+        free(l);
+    }
+}
+
+void __r_list_free(UUIDListIndex *idx) {
+    uuid_list *l,*tmp;
+    HASH_ITER(hh,*idx,l,tmp) {
+        HASH_DEL(*idx,l);
+        free(l->items);
+        free(l);
+    }
+}
+
+/*****************  expectation dispatch index */
+
+// the expectations on an aspect are bucketed by their carrier and the root symbol their
+// pattern requires, so that delivering a signal only tests the expectations that could match it
+
+expectation_bucket *__r_get_bucket(Receptor *r,Aspect aspect,Symbol carrier,Symbol root,bool create) {
+    expectation_bucket k,*b;
+    memset(&k.key,0,sizeof(k.key));
+    k.key.aspect = aspect;
+    k.key.carrier = carrier;
+    k.key.root = root;
+    HASH_FIND(hh,r->expectation_index,&k.key,sizeof(k.key),b);
+    if (!b && create) {
+        b = malloc(sizeof(expectation_bucket));
+        b->key = k.key;
+        b->count = 0;
+        b->size = 4;
+        b->entries = malloc(sizeof(expectation_pattern *)*b->size);
+        HASH_ADD(hh,r->expectation_index,key,sizeof(b->key),b);
+    }
+    return b;
+}
+
+// add an expectation to the end of the dispatch index (the patterns mutex must be held)
+void __r_index_expectation(Receptor *r,Aspect aspect,T *expectation) {
+    expectation_pattern *e;
+    HASH_FIND_PTR(r->expectation_patterns,&expectation,e);
+    if (!e) {
+        e = malloc(sizeof(expectation_pattern));
+        e->expectation = expectation;
+        e->stx = NULL;
+        HASH_ADD_PTR(r->expectation_patterns,expectation,e);
+    }
+    T *pattern = _t_child(expectation,ExpectationPatternIdx);
+    e->aspect = aspect;
+    e->carrier = *(Symbol *)_t_surface(_t_child(expectation,ExpectationCarrierIdx));
+    e->root = _stx_root_symbol(_t_child(pattern,1));
+    e->seq = r->expectation_seq++;
+    e->generation = 0;
+    expectation_bucket *b = __r_get_bucket(r,aspect,e->carrier,e->root,true);
+    if (b->count == b->size) {
+        b->size *= 2;
+        b->entries = realloc(b->entries,sizeof(expectation_pattern *)*b->size);
+    }
+    b->entries[b->count++] = e;
+    T *cid = __t_find(expectation,CONVERSATION_IDENT,ExpectationOptionalsIdx);
+    if (cid) __r_list_add(&r->conversation_expectations,__cid_getUUID(cid),expectation);
+}
+
+// remove an expectation from the dispatch index (the patterns mutex must be held)
+void __r_unindex_expectation(Receptor *r,expectation_pattern *e) {
+    expectation_bucket *b = __r_get_bucket(r,e->aspect,e->carrier,e->root,false);
+    int i;
+    if (!b) return;
+    T *cid = __t_find(e->expectation,CONVERSATION_IDENT,ExpectationOptionalsIdx);
+    if (cid) __r_list_remove(&r->conversation_expectations,__cid_getUUID(cid),e->expectation);
+    for(i=0;i<b->count;i++) {
+        if (b->entries[i] == e) {
+            memmove(&b->entries[i],&b->entries[i+1],sizeof(expectation_pattern *)*(b->count-i-1));
+            b->count--;
+            break;
+        }
+    }
+}
+
+void __r_free_index(Receptor *r) {
+    expectation_bucket *b,*tmp;
+    HASH_ITER(hh,r->expectation_index,b,tmp) {
+        HASH_DEL(r->expectation_index,b);
+        free(b->entries);
+        free(b);
+    }
+    __r_list_free(&r->conversation_expectations);
+}
+
+/**
+ * rebuild the dispatch index from the expectations in the flux
+ *
+ * __r_add_expectation and __r_free_expectation keep the index in step with the flux, so
+ * this is only needed when expectations get into the flux some other way, i.e. when a
+ * receptor is initialized from a tree that already has them.
+ *
+ * @param[in] r the receptor
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/receptor_spec.h testReceptorExpectationDispatch
+ */
+void __r_reindex_expectations(Receptor *r) {
+    expectation_pattern *e,*tmp;
+    int i,j;
+    pthread_mutex_lock(&r->patterns_mutex);
+    __r_free_index(r);
+    HASH_ITER(hh,r->expectation_patterns,e,tmp) e->generation = 1;
+    for(j=1;j<=_t_children(r->flux);j++) {
+        T *a = _t_child(r->flux,j);
+        T *es = _t_child(a,aspectExpectationsIdx);
+        for(i=1;i<=_t_children(es);i++) {
+            __r_index_expectation(r,_t_symbol(a),_t_child(es,i));
+        }
+    }
+    // throw away the compiled patterns of expectations that are no longer in the flux
+    HASH_ITER(hh,r->expectation_patterns,e,tmp) {
+        if (e->generation) {
+            HASH_DEL(r->expectation_patterns,e);
+            if (e->stx) _stx_free(e->stx);
+            free(e);
+        }
+    }
+    pthread_mutex_unlock(&r->patterns_mutex);
+}
+
+/**
+ * find the expectations that were keyed to a conversation
+ *
+ * @param[in] r the receptor
+ * @param[in] cuuid the conversation's UUID
+ * @param[out] countP the number of expectations found
+ * @returns a malloced array of the expectations or NULL if there are none
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/receptor_spec.h testReceptorConversationIndex
+ */
+T **__r_conversation_expectations(Receptor *r,UUIDt *cuuid,int *countP) {
+    T **expectations = NULL;
+    pthread_mutex_lock(&r->patterns_mutex);
+    uuid_list *l = __r_list_find(r->conversation_expectations,cuuid);
+    *countP = l ? l->count : 0;
+    if (l) {
+        expectations = malloc(sizeof(T *)*l->count);
+        memcpy(expectations,l->items,sizeof(T *)*l->count);
+    }
+    pthread_mutex_unlock(&r->patterns_mutex);
+    return expectations;
+}
+
+/**
+ * find the expectations on an aspect that a signal could match
+ *
+ * @param[in] r the receptor
+ * @param[in] aspect the aspect the signal is on
+ * @param[in] carrier the signal's carrier
+ * @param[in] root the symbol of the signal's contents
+ * @param[out] countP the number of expectations found
+ * @returns a malloced array of the expectations in the order they are on the aspect
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/receptor_spec.h testReceptorExpectationDispatch
+ */
+T **__r_expectation_candidates(Receptor *r,Aspect aspect,Symbol carrier,Symbol root,int *countP) {
+    expectation_bucket *b[4];
+    int i,n = 0,pos[4] = {0,0,0,0},total = 0;
+
+    pthread_mutex_lock(&r->patterns_mutex);
+
+    // expectations match on their carrier or on any carrier, and on the signal's
+    // root symbol or any root symbol
+    Symbol carriers[2] = {carrier,NULL_SYMBOL};
+    Symbol roots[2] = {root,NULL_SYMBOL};
+    int c,x;
+    for(c=0;c<2;c++) {
+        if (c && semeq(carrier,NULL_SYMBOL)) break;
+        for(x=0;x<2;x++) {
+            if (x && semeq(root,NULL_SYMBOL)) break;
+            expectation_bucket *bk = __r_get_bucket(r,aspect,carriers[c],roots[x],false);
+            if (bk && bk->count) {
+                b[n++] = bk;
+                total += bk->count;
+            }
+        }
+    }
+
+    // merge the buckets back into aspect order
+    T **candidates = malloc(sizeof(T *)*(total+1));
+    for(x=0;x<total;x++) {
+        int min = -1;
+        for(i=0;i<n;i++) {
+            if (pos[i] < b[i]->count && (min < 0 || b[i]->entries[pos[i]]->seq < b[min]->entries[pos[min]]->seq)) min = i;
+        }
+        candidates[x] = b[min]->entries[pos[min]++]->expectation;
+    }
+    pthread_mutex_unlock(&r->patterns_mutex);
+    *countP = total;
+    return candidates;
+}
+
+// check that an expectation hasn't been removed
+bool __r_expectation_live(Receptor *r,T *expectation) {
+    expectation_pattern *e;
+    pthread_mutex_lock(&r->patterns_mutex);
+    HASH_FIND_PTR(r->expectation_patterns,&expectation,e);
+    pthread_mutex_unlock(&r->patterns_mutex);
+    return e != NULL;
+}
+
+// get the compiled pattern of an expectation, compiling it the first time it's needed
+// the pattern is returned retained, so that removing the expectation while it's being
+// matched doesn't free it, and the caller must _stx_free it when done
+Stx *__r_get_expectation_pattern(Receptor *r,T *expectation) {
+    expectation_pattern *e;
+    pthread_mutex_lock(&r->patterns_mutex);
+    HASH_FIND_PTR(r->expectation_patterns,&expectation,e);
+    if (!e) {
+        // the expectation isn't in the flux (or hasn't been indexed yet)
+        e = malloc(sizeof(expectation_pattern));
+        e->expectation = expectation;
+        e->stx = NULL;
+        e->aspect = e->carrier = e->root = NULL_SYMBOL;
+        e->seq = 0;
+        e->generation = 0;
+        HASH_ADD_PTR(r->expectation_patterns,expectation,e);
+    }
+    if (!e->stx) {
+        // wrap the pattern in a group so the match results cover the whole signal
+        T *pattern = _t_child(expectation,ExpectationPatternIdx);
+        e->stx = _stx_compile_group(_t_child(pattern,1),NULL_SYMBOL);
+    }
+    Stx *stx = _stx_retain(e->stx);
+    pthread_mutex_unlock(&r->patterns_mutex);
+    return stx;
+}
+
+// remove an expectation from the flux and free it along with its compiled pattern
+void __r_free_expectation(Receptor *r,T *expectation) {
+    expectation_pattern *e;
+    pthread_mutex_lock(&r->patterns_mutex);
+    HASH_FIND_PTR(r->expectation_patterns,&expectation,e);
+    if (e) {
+        __r_unindex_expectation(r,e);
+        HASH_DEL(r->expectation_patterns,e);
+        if (e->stx) _stx_free(e->stx);
+        free(e);
+    }
+    pthread_mutex_unlock(&r->patterns_mutex);
+    _t_detach_by_ptr(_t_parent(expectation),expectation);
     _t_free(expectation);
+}
+
+void _r_remove_expectation(Receptor *r,T *expectation) {
+    __r_free_expectation(r,expectation);
     // @todo, if there are any processes blocked on this expectation they
     // should actually get cleaned up somehow.  This would mean searching
     // through for them, or something...
@@ -186,7 +528,28 @@ void _r_remove_expectation(Receptor *r,T *expectation) {
 void _r_free(Receptor *r) {
     _t_free(r->root);
     _a_free_instances(&r->instances);
+    pthread_mutex_destroy(&r->instances_mutex);
     if (r->q) _p_freeq(r->q);
+    _t_free(r->inbox);
+    pthread_mutex_destroy(&r->inbox_mutex);
+
+    expectation_pattern *e,*etmp;
+    HASH_ITER(hh,r->expectation_patterns,e,etmp) {
+        HASH_DEL(r->expectation_patterns,e);
+        if (e->stx) _stx_free(e->stx);
+        free(e);
+    }
+    __r_free_index(r);
+    __r_uuid_free(&r->conversation_index);
+    __r_uuid_free(&r->response_index);
+    __r_list_free(&r->conversation_responses);
+    def_pattern *d,*dtmp;
+    HASH_ITER(hh,r->def_patterns,d,dtmp) {
+        HASH_DEL(r->def_patterns,d);
+        _stx_free(d->stx);
+        free(d);
+    }
+    pthread_mutex_destroy(&r->patterns_mutex);
 
     // special cases for cleaning up edge receptor resources that
     // don't get cleaned up the usual way, i.e. socket listener streams
@@ -341,10 +704,20 @@ T * _r_build_def_semtrex(Receptor *r,Symbol s) {
  * @snippet spec/receptor_spec.h testReceptorDefMatch
  */
 int _r_def_match(Receptor *r,Symbol s,T *t) {
-    T *stx = _r_build_def_semtrex(r,s);
-    int result = _t_match(stx,t);
-    _t_free(stx);
-    return result;
+    // definitions don't change, so the semtrex for each symbol only needs compiling once
+    def_pattern *d;
+    pthread_mutex_lock(&r->patterns_mutex);
+    HASH_FIND(hh,r->def_patterns,&s,sizeof(Symbol),d);
+    if (!d) {
+        d = malloc(sizeof(def_pattern));
+        d->symbol = s;
+        T *stx = _r_build_def_semtrex(r,s);
+        d->stx = _stx_compile(stx);
+        _t_free(stx);
+        HASH_ADD(hh,r->def_patterns,symbol,sizeof(Symbol),d);
+    }
+    pthread_mutex_unlock(&r->patterns_mutex);
+    return _stx_match(d->stx,t);
 }
 
 /*****************  receptor instances and xaddrs */
@@ -363,7 +736,10 @@ int _r_def_match(Receptor *r,Symbol s,T *t) {
  * @snippet spec/receptor_spec.h testReceptorInstances
  */
 Xaddr _r_new_instance(Receptor *r,T *t) {
-    return _a_new_instance(&r->instances,t);
+    pthread_mutex_lock(&r->instances_mutex);
+    Xaddr x = _a_new_instance(&r->instances,t);
+    pthread_mutex_unlock(&r->instances_mutex);
+    return x;
 }
 
 /**
@@ -373,6 +749,9 @@ Xaddr _r_new_instance(Receptor *r,T *t) {
  * @param[in] x the xaddr of the instance
  * @returns the instance tree
  *
+ * @note the tree belongs to the store, so if other threads may be setting instances
+ * hold r->instances_mutex for as long as it's being used
+ *
  * <b>Examples (from test suite):</b>
  * @snippet spec/receptor_spec.h testReceptorInstances
  */
@@ -392,7 +771,10 @@ T * _r_get_instance(Receptor *r,Xaddr x) {
  * @snippet spec/receptor_spec.h testReceptorInstances
  */
 T * _r_set_instance(Receptor *r,Xaddr x,T *t) {
-    return _a_set_instance(&r->instances,x,t);
+    pthread_mutex_lock(&r->instances_mutex);
+    T *i = _a_set_instance(&r->instances,x,t);
+    pthread_mutex_unlock(&r->instances_mutex);
+    return i;
 }
 
 /**
@@ -405,14 +787,16 @@ T * _r_set_instance(Receptor *r,Xaddr x,T *t) {
  * @snippet spec/receptor_spec.h testReceptorInstances
  */
 T * _r_delete_instance(Receptor *r,Xaddr x) {
+    pthread_mutex_lock(&r->instances_mutex);
     _a_delete_instance(&r->instances,x);
+    pthread_mutex_unlock(&r->instances_mutex);
 }
 
 /**
  * get the hash of a tree by Xaddr
  */
 TreeHash _r_hash(Receptor *r,Xaddr t) {
-    return _t_hash(r->sem,_r_get_instance(r,t));
+    return _t_hash_cached(r->sem,_r_get_instance(r,t));
 }
 
 /******************  receptor serialization */
@@ -459,7 +843,7 @@ void _r_serialize(Receptor *r,void **surfaceP,size_t *lengthP) {
 Receptor * _r_unserialize(SemTable *sem,void *surface) {
 
     S *s = (S *)surface;
-    H h = _m_unserialize(s);
+    H h = _m_view(s);
 
     T *t = _t_new_from_m(h);
     _m_free(h);
@@ -524,6 +908,8 @@ T* __r_make_signal(ReceptorAddress from,ReceptorAddress to,Aspect aspect,Symbol
     _t_news(h,CARRIER,carrier);
     UUIDt t = __uuid_gen();
     _t_new(e,SIGNAL_UUID,&t,sizeof(UUIDt));
+    // the body may have come from a run tree that's still sharing code
+    if (signal_contents) _t_materialize(signal_contents);
     T *b = _t_newt(m,BODY,signal_contents);
 
     if (in_response_to && until) raise_error("attempt to make signal with both response_uuid and until");
@@ -539,11 +925,14 @@ T* __r_make_signal(ReceptorAddress from,ReceptorAddress to,Aspect aspect,Symbol
 
 // low level send, must be called with pending_signals resource locked!!
 T* __r_send(Receptor *r,T *signal) {
-    _t_add(r->pending_signals,signal);
-
     //@todo for now we return the UUID of the signal as the result.  Perhaps later we return an error condition if delivery to address is known to be impossible, or something like that.
     T *envelope = _t_child(signal,SignalEnvelopeIdx);
-    return _t_rclone(_t_child(envelope,EnvelopeSignalUUIDIdx));
+    T *result = _t_rclone(_t_child(envelope,EnvelopeSignalUUIDIdx));
+
+    _t_add(r->pending_signals,signal);
+    // the sender now has signals waiting for delivery, so let the scheduler know
+    __p_mark_runnable(r->q);
+    return result;
 }
 
 /**
@@ -585,6 +974,7 @@ T* _r_request(Receptor *r,T *signal,Symbol response_carrier,T *code_point,int pr
     if (!ec || !semeq(_t_symbol(ec),END_CONDITIONS)) raise_error("request missing END_CONDITIONS");
     _t_add(pr,_t_clone(ec));
     if (cid) _t_add(pr,_t_clone(cid));
+    __r_index_response(r,pr);
 
     debug(D_SIGNALS,"sending request and adding pending response: %s\n",_td(r,pr));
     //@todo unlock resources
@@ -592,6 +982,38 @@ T* _r_request(Receptor *r,T *signal,Symbol response_carrier,T *code_point,int pr
     return result;
 }
 
+/*****************  pending responses */
+
+void __r_index_response(Receptor *r,T *pr) {
+    __r_uuid_add(&r->response_index,(UUIDt *)_t_surface(_t_child(pr,PendingResponseUUIDIdx)),pr);
+    T *cid = _t_child(pr,PendingResponseConversationIdentIdx);
+    if (cid) __r_list_add(&r->conversation_responses,__cid_getUUID(cid),pr);
+}
+
+/**
+ * find the pending response waiting for a response to a request
+ *
+ * @param[in] r the receptor
+ * @param[in] u the UUID of the request signal
+ * @returns the PENDING_RESPONSE or NULL if there isn't one
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/receptor_spec.h testReceptorConversationIndex
+ */
+T *__r_find_pending_response(Receptor *r,UUIDt *u) {
+    uuid_entry *e = __r_uuid_find(r->response_index,u);
+    return e ? e->t : NULL;
+}
+
+// remove a pending response from the receptor and free it
+void __r_remove_pending_response(Receptor *r,T *pr) {
+    __r_uuid_remove(&r->response_index,(UUIDt *)_t_surface(_t_child(pr,PendingResponseUUIDIdx)));
+    T *cid = _t_child(pr,PendingResponseConversationIdentIdx);
+    if (cid) __r_list_remove(&r->conversation_responses,__cid_getUUID(cid),pr);
+    _t_detach_by_ptr(r->pending_responses,pr);
+    _t_free(pr);
+}
+
 // check if the end condition has been met
 // @todo find the correct home for this function
 void evaluateEndCondition(T *ec,bool *cleanup,bool *allow) {
@@ -603,11 +1025,12 @@ void evaluateEndCondition(T *ec,bool *cleanup,bool *allow) {
         Symbol sym = _t_symbol(c);
         if (semeq(sym,COUNT)) {
             //@todo mutex!!
-            int *cP = (int *)_t_surface(c);
-            if (*cP <= 1) *cleanup = true;
-            if (*cP >= 1) *allow = true;
-            (*cP)--;
-            debug(D_SIGNALS,"decreasing count to: %d\n",*cP);
+            int count = *(int *)_t_surface(c);
+            if (count <= 1) *cleanup = true;
+            if (count >= 1) *allow = true;
+            count--;
+            _t_set_surface(c,&count,sizeof(int));
+            debug(D_SIGNALS,"decreasing count to: %d\n",count);
             break;  // this is final, even if there's a timeout
         }
         else if (semeq(sym,TIMEOUT_AT)) {
@@ -685,19 +1108,19 @@ void __r_test_expectation(Receptor *r,T *expectation,T *signal) {
     T *pattern,*m;
     pattern = _t_child(expectation,ExpectationPatternIdx);
     // if we get a match, create a run tree from the action, using the match and signal as the parameters
-    T *stx = _t_news(0,SEMTREX_GROUP,NULL_SYMBOL);
-    _t_add(stx,_t_clone(_t_child(pattern,1)));
+    Stx *stx = __r_get_expectation_pattern(r,expectation);
     debug(D_SIGNALS,"matching %s\n",_td(q->r,signal_contents));
-    debug(D_SIGNALS,"against %s\n",_td(q->r,stx));
+    debug(D_SIGNALS,"against %s\n",_td(q->r,pattern));
 
     bool matched;
-    matched = _t_matchr(stx,signal_contents,&m);
+    matched = _stx_matchr(stx,signal_contents,&m);
+    _stx_free(stx);
     bool allow;
     bool cleanup;
     evaluateEndCondition(_t_child(expectation,ExpectationEndCondsIdx),&cleanup,&allow);
 
     if (allow && matched) {
-        debug(D_SIGNALS,"got a match on %s\n",_td(q->r,stx));
+        debug(D_SIGNALS,"got a match on %s\n",_td(q->r,pattern));
 
         T *rt=0;
         T *action = _t_child(expectation,ExpectationActionIdx);
@@ -734,8 +1157,6 @@ void __r_test_expectation(Receptor *r,T *expectation,T *signal) {
         debug(D_SIGNALS,"cleaning up %s\n",_td(q->r,expectation));
         _r_remove_expectation(q->r,expectation);
     }
-
-    _t_free(stx);
 }
 
 // what kind of sanatizing do we do of the actual response signal?
@@ -753,46 +1174,38 @@ int __r_deliver_response(Receptor *r,T *response_to,T *signal) {
 
     T *body = _t_getv(signal,SignalMessageIdx,MessageBodyIdx,TREE_PATH_TERMINATOR);
     T *response = (T *)_t_surface(body);
-    T *l;
-    DO_KIDS(r->pending_responses,
-            l = _t_child(r->pending_responses,i);
-            if (__uuid_equal(u,(UUIDt *)_t_surface(_t_child(l,PendingResponseUUIDIdx)))) {
-
-                // get the end conditions so we can see if we should actually respond
-                T *ec = _t_child(l,PendingResponseEndCondsIdx);
-                bool allow;
-                bool cleanup;
-                evaluateEndCondition(ec,&cleanup,&allow);
-
-                if (allow) {
-                    Symbol carrier = *(Symbol *)_t_surface(_t_child(l,PendingResponseCarrierIdx));
-                    T *wakeup = _t_child(l,PendingResponseWakeupIdx);
-                    // now set up the signal so when it's freed below, the body doesn't get freed too
-                    signal->context.flags &= ~TFLAG_SURFACE_IS_TREE;
-                    if (!semeq(carrier,signal_carrier)) {
-                        debug(D_SIGNALS,"response failed carrier check, expecting %s, but got %s!\n",_r_get_symbol_name(r,carrier),_r_get_symbol_name(r,signal_carrier));
-                        //@todo what kind of logging of these kinds of events?
-                        break;
-                    }
-
-                    response = __r_sanatize_response(r,response);
-                    // if the response isn't safe just break
-                    if (!response) {
-                        //@todo figure out if this means we should throw away the pending response too
-                        break;
-                    }
-                    _p_wakeup(r->q,wakeup,response,noReductionErr);
-                }
-
-                if (cleanup) {
-                    debug(D_SIGNALS,"removing pending response: %s\n",_td(r,l));
-                    _t_detach_by_idx(r->pending_responses,i);
-                    //i--;
-                    _t_free(l);
-                }
-                break;
+    T *l = __r_find_pending_response(r,u);
+    if (l) {
+        // get the end conditions so we can see if we should actually respond
+        T *ec = _t_child(l,PendingResponseEndCondsIdx);
+        bool allow;
+        bool cleanup;
+        evaluateEndCondition(ec,&cleanup,&allow);
+
+        if (allow) {
+            Symbol carrier = *(Symbol *)_t_surface(_t_child(l,PendingResponseCarrierIdx));
+            T *wakeup = _t_child(l,PendingResponseWakeupIdx);
+            // now set up the signal so when it's freed below, the body doesn't get freed too
+            signal->context.flags &= ~TFLAG_SURFACE_IS_TREE;
+            if (!semeq(carrier,signal_carrier)) {
+                debug(D_SIGNALS,"response failed carrier check, expecting %s, but got %s!\n",_r_get_symbol_name(r,carrier),_r_get_symbol_name(r,signal_carrier));
+                //@todo what kind of logging of these kinds of events?
+                cleanup = false;
             }
-            );
+            else {
+                response = __r_sanatize_response(r,response);
+                // if the response isn't safe don't wake up
+                //@todo figure out if this means we should throw away the pending response too
+                if (!response) cleanup = false;
+                else _p_wakeup(r->q,wakeup,response,noReductionErr);
+            }
+        }
+
+        if (cleanup) {
+            debug(D_SIGNALS,"removing pending response: %s\n",_td(r,l));
+            __r_remove_pending_response(r,l);
+        }
+    }
     _t_free(signal);
     return noDeliveryErr;
 }
@@ -830,45 +1243,18 @@ T * _r_add_conversation(Receptor *r,UUIDt *parent_u,UUIDt *u,T *until,T *wakeup)
     T *p;
     if (parent_u) {
         p = _r_find_conversation(r,parent_u);
-        p = _t_child(p,ConversationConversationsIdx);
         if (!p) raise_error("parent conversation not found!");
+        p = _t_child(p,ConversationConversationsIdx);
     }
     else p = r->conversations;
     _t_add(p,c);
+    __r_uuid_add(&r->conversation_index,u,c);
     //@todo UNLOCK
     return c;
 }
 
-// finds a conversation searching recursively through sub-conversations
-T *__r_find_conversation(T *conversations, UUIDt *uuid) {
-    T *c,*ci;
-    bool found = false;
-
-    // @todo lock?
-    DO_KIDS(conversations,
-            c = _t_child(conversations,i);
-            UUIDt *u = __cid_getUUID(_t_child(c,ConversationIdentIdx));
-            if (__uuid_equal(uuid,u)) {
-                found = true;
-                break;
-            }
-            T *sub_conversations = _t_child(c,ConversationConversationsIdx);
-            if (_t_children(sub_conversations)) {
-                c = __r_find_conversation(sub_conversations,uuid);
-                if (c) {found = true;break;}
-            }
-            );
-    // @todo unlock
-    return found?c:NULL;
-}
-
-T *_r_find_conversation(Receptor *r, UUIDt *uuid) {
-    // @todo reimplement with semtrex?
-    return __r_find_conversation(r->conversations, uuid);
-}
-
-
 typedef void (*doConversationFn)(T *,void *);
+
 void __r_walk_conversation(T *conversation, doConversationFn fn,void *param) {
     (*fn)(_t_child(conversation,ConversationIdentIdx),param);
 
@@ -877,41 +1263,67 @@ void __r_walk_conversation(T *conversation, doConversationFn fn,void *param) {
         T *c;
         DO_KIDS(conversations,
                 c = _t_child(conversations,i);
-                __r_walk_conversation(c,param,fn);
+                __r_walk_conversation(c,fn,param);
             );
     }
 }
 
+void _indexer(T *cid,void *p) {
+    Receptor *r = (Receptor *)p;
+    __r_uuid_add(&r->conversation_index,__cid_getUUID(cid),_t_parent(cid));
+}
+
+/**
+ * find a conversation or sub-conversation by its UUID
+ *
+ * @param[in] r the receptor
+ * @param[in] uuid the conversation's UUID
+ * @returns the CONVERSATION or NULL if there isn't one
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/receptor_spec.h testReceptorConversations
+ */
+T *_r_find_conversation(Receptor *r, UUIDt *uuid) {
+    uuid_entry *e = __r_uuid_find(r->conversation_index,uuid);
+    return e ? e->t : NULL;
+}
+
+/**
+ * rebuild the conversation and pending response indexes from the receptor's state
+ *
+ * _r_add_conversation, _r_request and the cleanup of conversations and responses keep
+ * the indexes in step with the tree, so this is only needed when conversations or
+ * pending responses get into the tree some other way, i.e. when a receptor is
+ * initialized from a tree that already has them.
+ *
+ * @param[in] r the receptor
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/receptor_spec.h testReceptorConversationIndex
+ */
+void __r_reindex_conversations(Receptor *r) {
+    __r_uuid_free(&r->conversation_index);
+    DO_KIDS(r->conversations,__r_walk_conversation(_t_child(r->conversations,i),_indexer,r));
+    __r_uuid_free(&r->response_index);
+    __r_list_free(&r->conversation_responses);
+    DO_KIDS(r->pending_responses,__r_index_response(r,_t_child(r->pending_responses,i)));
+}
+
 void _cleaner(T *cid,void *p) {
     Receptor *r = (Receptor *)p;
     UUIDt *u = __cid_getUUID(cid);
-    T *e,*ex;
-    int i,j;
-    // remove any pending listeners that were established in the covnersation
-    // @todo implement saving expectations in conversations into a hash
-    // so we don't have to do this ugly n^2 search...
-    for(j=1;j<=_t_children(r->flux);j++) {
-        ex = _t_child(_t_child(r->flux,j),aspectExpectationsIdx);
-        for(i=1;i<=_t_children(ex);i++) {
-            e = _t_child(ex,i);
-            T *cid = __t_find(e,CONVERSATION_IDENT,ExpectationOptionalsIdx);
-            if (cid && __uuid_equal(u,__cid_getUUID(cid))) {
-                _t_detach_by_ptr(ex,e);
-                _t_free(e);
-                i--;
-            }
-        }
-    }
+    int i,count;
+    // remove any pending listeners that were established in the conversation
+    T **expectations = __r_conversation_expectations(r,u,&count);
+    for(i=0;i<count;i++) __r_free_expectation(r,expectations[i]);
+    if (expectations) free(expectations);
+
     // remove any pending response handlers from requests
-    for(i=1;i<=_t_children(r->pending_responses);i++) {
-        e = _t_child(r->pending_responses,i);
-        T *cid = _t_child(e,PendingResponseConversationIdentIdx);
-        if (cid && __uuid_equal(u,__cid_getUUID(cid))) {
-            _t_detach_by_ptr(r->pending_responses,e);
-            _t_free(e);
-            i--;
-        }
+    uuid_list *l;
+    while ((l = __r_list_find(r->conversation_responses,u))) {
+        __r_remove_pending_response(r,l->items[l->count-1]);
     }
+    __r_uuid_remove(&r->conversation_index,u);
 }
 
 // cleans up any pending requests, listens and the conversation record
@@ -1000,14 +1412,18 @@ Error _r_deliver(Receptor *r, T *signal) {
 
         debug(D_SIGNALS,"Delivering: %s\n",_td(r,signal));
         _t_add(as,signal);
-        // walk through all the expectations on the aspect and see if any expectations match this incoming signal
-        T *es = __r_get_expectations(r,aspect);
-        debug(D_SIGNALS,"Testing %d expectations\n",es ? _t_children(es) : 0);
-        T *l;
-        DO_KIDS(es,
-                l = _t_child(es,i);
-                __r_test_expectation(r,l,signal);
-                );
+        // test the expectations on the aspect that could match this incoming signal
+        T *contents = (T *)_t_surface(_t_getv(signal,SignalMessageIdx,MessageBodyIdx,TREE_PATH_TERMINATOR));
+        Symbol carrier = *(Symbol *)_t_surface(_t_child(head,HeadCarrierIdx));
+        int i,count;
+        T **es = __r_expectation_candidates(r,aspect,carrier,_t_symbol(contents),&count);
+        debug(D_SIGNALS,"Testing %d expectations\n",count);
+        for(i=0;i<count;i++) {
+            // testing an expectation can clean up others (i.e. when a conversation ends)
+            if (__r_expectation_live(r,es[i]))
+                __r_test_expectation(r,es[i],signal);
+        }
+        free(es);
     }
     return noDeliveryErr;
 }
@@ -1252,7 +1668,7 @@ void *___clock_thread(void *arg){
     debug(D_CLOCK,"clock started\n");
     int err =0;
     ReceptorAddress self = __r_get_self_address(r);
-    while (r->state == Alive) {
+    while (__r_alive(r)) {
         T *tick =__r_make_tick();
         debug(D_CLOCK,"%s\n",_td(r,tick));
         Xaddr x = {TICK,1};
@@ -1287,7 +1703,9 @@ T * __r_make_timestamp(Symbol s,int delta) {
 }
 
 void __r_kill(Receptor *r) {
-    r->state = Dead;
+    __atomic_store_n(&r->state,Dead,__ATOMIC_RELEASE);
+    // wake the scheduler so it notices the state change
+    if (r->q && r->q->scheduler) __p_wake_scheduler(r->q->scheduler);
     /* pthread_mutex_lock(&shutdownMutex); */
     /* G_shutdown = val; */
     /* pthread_mutex_unlock(&shutdownMutex); */
@@ -31,6 +31,11 @@ T *__r_build_expectation(Symbol carrier,T *pattern,T *action,T *with,T *until,T
 void _r_add_expectation(Receptor *r,Aspect aspect,Symbol carrier,T *pattern,T *action,T *with,T *until, T *using,T *cid);
 void __r_add_expectation(Receptor *r,Aspect aspect,T *e);
 void _r_remove_expectation(Receptor *r,T *expectation);
+Stx *__r_get_expectation_pattern(Receptor *r,T *expectation);
+void __r_index_expectation(Receptor *r,Aspect aspect,T *expectation);
+void __r_reindex_expectations(Receptor *r);
+T **__r_expectation_candidates(Receptor *r,Aspect aspect,Symbol carrier,Symbol root,int *countP);
+T **__r_conversation_expectations(Receptor *r,UUIDt *cuuid,int *countP);
 void _r_free(Receptor *r);
 
 /*****************  receptor symbols, structures, and processes */
@@ -75,6 +80,9 @@ T *__cid_new(T *parent,UUIDt *c,T *topic);
 UUIDt *__cid_getUUID(T *cid);
 T * _r_add_conversation(Receptor *r,UUIDt *parent_u,UUIDt *u,T *until,T *wakeup);
 T *_r_find_conversation(Receptor *r, UUIDt *cuuid);
+void __r_reindex_conversations(Receptor *r);
+void __r_index_response(Receptor *r,T *pr);
+T *__r_find_pending_response(Receptor *r,UUIDt *u);
 T *__r_cleanup_conversation(Receptor *r, UUIDt *cuuid);
 Error _r_deliver(Receptor *r, T *signal);
 
@@ -115,6 +123,8 @@ void *___clock_thread(void *arg);
 #define __r_make_tick() __r_make_timestamp(TICK,00)
 T *__r_make_timestamp(Symbol s,int delta);
 void __r_kill(Receptor *r);
+// check a receptor's state from threads other than the one that kills it
+#define __r_alive(r) (__atomic_load_n(&(r)->state,__ATOMIC_ACQUIRE) == Alive)
 ReceptorAddress __r_get_self_address(Receptor *r);
 
 void __r_dump_instances(Receptor *r);
@@ -58,7 +58,7 @@ void _s_add(Scape *s,TreeHash h,Xaddr x) {
     ScapeData *data = &s->data;
     scape_elem *e;
 
-    HASH_FIND_INT( *data, &h, e );
+    HASH_FIND(hh,*data,&h,sizeof(TreeHash),e);
     if (e) {
     raise_error("allready there!");
     }
@@ -66,7 +66,7 @@ void _s_add(Scape *s,TreeHash h,Xaddr x) {
     e = malloc(sizeof(struct scape_elem));
     e->key = h;
     e->value = x;
-    HASH_ADD_INT(*data,key,e);
+    HASH_ADD(hh,*data,key,sizeof(TreeHash),e);
     }
 }
 
@@ -85,7 +85,7 @@ Xaddr _s_get(Scape *s,TreeHash h) {
     scape_elem *e = 0;
     ScapeData *data = &s->data;
 
-    HASH_FIND_INT( *data, &h, e );
+    HASH_FIND(hh,*data,&h,sizeof(TreeHash),e);
     if (e) return e->value;
     return x;
 }
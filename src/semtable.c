@@ -10,23 +10,109 @@
 
 #include "semtable.h"
 #include "def.h"
+#include "process.h"
 
 SemTable *_sem_new() {
     SemTable * sem= malloc(sizeof(SemTable));
     memset(sem,0,sizeof(SemTable));
+    pthread_mutex_init(&sem->lock,NULL);
     return sem;
 }
 
+// get the entry for the i'th definition in an index, allocating its chunk if asked to
+DefEntry *__sem_index_entry(DefIndex *x,SemanticAddr i,bool alloc) {
+    int p = i-1;
+    int k = 31-__builtin_clz(p/DEF_INDEX_FIRST_CHUNK+1);
+    if (!x->chunks[k]) {
+        if (!alloc) return NULL;
+        x->chunks[k] = calloc(DEF_INDEX_FIRST_CHUNK<<k,sizeof(DefEntry));
+    }
+    return &x->chunks[k][p-DEF_INDEX_FIRST_CHUNK*((1<<k)-1)];
+}
+
+// add a definition to the end of an index (sem->lock must be held if the context is in use)
+void __sem_index_def(DefIndex *x,T *def) {
+    DefEntry *e = __sem_index_entry(x,x->count+1,true);
+    e->def = def;
+    e->bytecode = NULL;
+    __atomic_store_n(&x->count,x->count+1,__ATOMIC_RELEASE);
+}
+
+void __sem_free_index(ContextStore *ctx) {
+    int i,j;
+    DefIndex *x = &ctx->index[SEM_TYPE_PROCESS-1];
+    for(i=1;i<=x->count;i++) {
+        DefEntry *e = __sem_index_entry(x,i,false);
+        if (e->bytecode) _p_free_bytecode(e->bytecode);
+    }
+    for(i=0;i<SEM_TYPES;i++) {
+        x = &ctx->index[i];
+        for(j=0;j<DEF_INDEX_CHUNKS;j++) free(x->chunks[j]);
+    }
+    memset(ctx->index,0,sizeof(ctx->index));
+}
+
+// set the definitions of a context and index the ones already in it (sem->lock must be held)
+void __sem_set_definitions(ContextStore *ctx,T *definitions) {
+    int i,j;
+    __sem_free_index(ctx);
+    //    ctx->table = NULL;
+    ctx->definitions = definitions;
+    for(i=1;i<=SEM_TYPES;i++) {
+        T *defs = _t_child(definitions,i);
+        for(j=1;j<=_t_children(defs);j++) __sem_index_def(&ctx->index[i-1],_t_child(defs,j));
+    }
+}
+
+// compile the processes a context was given with its definitions (see _p_compile)
+void __sem_compile_processes(SemTable *sem,Context c) {
+    DefIndex *x = &sem->stores[c].index[SEM_TYPE_PROCESS-1];
+    int i,count = __atomic_load_n(&x->count,__ATOMIC_ACQUIRE);
+    for(i=1;i<=count;i++) {
+        Process p = {c,SEM_TYPE_PROCESS,i};
+        Bytecode *b = _p_compile(sem,p);
+        if (b) _sem_set_bytecode(sem,p,b);
+    }
+}
+
 int _sem_new_context(SemTable *sem,T *definitions) {
 
     if (sem->contexts >= MAX_CONTEXTS-1) raise_error("no more room in semtable");
-    int idx = sem->contexts++;
-    //    sem->stores[idx].table = NULL;
-    sem->stores[idx].definitions = definitions;
+    pthread_mutex_lock(&sem->lock);
+    int idx = sem->contexts;
+    __sem_set_definitions(&sem->stores[idx],definitions);
+    __atomic_store_n(&sem->contexts,idx+1,__ATOMIC_RELEASE);
+    pthread_mutex_unlock(&sem->lock);
+    __sem_compile_processes(sem,idx);
     return idx;
 }
 
+/**
+ * put back the definitions of a context, i.e. when booting from a serialized semtable
+ *
+ * Bytecode isn't serialized, so the context's processes are compiled again.
+ *
+ * @param[in] sem the semantic table
+ * @param[in] c the context the definitions were in
+ * @param[in] definitions the definitions tree
+ */
+void _sem_restore_context(SemTable *sem,Context c,T *definitions) {
+    if (c >= MAX_CONTEXTS-1) raise_error("no more room in semtable");
+    pthread_mutex_lock(&sem->lock);
+    __sem_set_definitions(&sem->stores[c],definitions);
+    if (c >= sem->contexts) __atomic_store_n(&sem->contexts,c+1,__ATOMIC_RELEASE);
+    pthread_mutex_unlock(&sem->lock);
+    __sem_compile_processes(sem,c);
+}
+
 void _sem_free(SemTable *sem) {
+    int i;
+    for(i=0;i<MAX_CONTEXTS;i++) {
+        __sem_free_index(&sem->stores[i]);
+    }
+    for(i=0;i<sem->retired_count;i++) _t_free(sem->retired[i]);
+    free(sem->retired);
+    pthread_mutex_destroy(&sem->lock);
     free(sem);
 }
 
@@ -36,13 +122,16 @@ ContextStore *__sem_context(SemTable *sem,Context c) {
 
 void _sem_free_context(SemTable *sem,Context c) {
     ContextStore *ctx = __sem_context(sem,c);
+    pthread_mutex_lock(&sem->lock);
     // definition tree belong to the receptors that allocated them so
     // we never free them.
     ctx->definitions = NULL;
     //if (ctx->table) lableTableFree(ctx->table);
+    __sem_free_index(ctx);
 
     if ((c+1) == sem->contexts)
         sem->contexts--;
+    pthread_mutex_unlock(&sem->lock);
 }
 
 char G_ctx_buf[20];
@@ -59,7 +148,8 @@ char *_sem_ctx2s(SemTable *sem,Context c) {
     }
 }
 
-// get the definitions for the semantic type of the semid
+// get the definitions tree for the semantic type of the semid
+// (the caller must hold sem->lock if it looks inside it while other threads may be defining things)
 T *__sem_get_defs(SemTable *sem,SemanticType semtype,Context c) {
     ContextStore *ctx = __sem_context(sem,c);
     if (!ctx->definitions) raise_error("no definitions in context %s",_sem_ctx2s(sem,c));
@@ -68,9 +158,42 @@ T *__sem_get_defs(SemTable *sem,SemanticType semtype,Context c) {
     return defs;
 }
 
+// get the index entry of a definition, or NULL if it hasn't been defined
+DefEntry *__sem_get_entry(SemTable *sem,SemanticType semtype,Context c,SemanticAddr i) {
+    ContextStore *ctx = __sem_context(sem,c);
+    if (!ctx->definitions) raise_error("no definitions in context %s",_sem_ctx2s(sem,c));
+    if (semtype < 1 || semtype > SEM_TYPES) raise_error("no defs for semtype %d in context %s",semtype,_sem_ctx2s(sem,c));
+    DefIndex *x = &ctx->index[semtype-1];
+    if (i < 1 || i > __atomic_load_n(&x->count,__ATOMIC_ACQUIRE)) return NULL;
+    return __sem_index_entry(x,i,false);
+}
+
+T *___sem_get_def(SemTable *sem,SemanticType semtype,Context c,SemanticAddr i) {
+    DefEntry *e = __sem_get_entry(sem,semtype,c,i);
+    return e ? e->def : NULL;
+}
+
+/**
+ * get a definition
+ *
+ * definitions are only ever added, so this doesn't need to lock against threads that are defining things
+ *
+ * @param[in] sem the semantic table
+ * @param[in] semtype the semantic type of the definition
+ * @param[in] c the context of the definition
+ * @param[in] i the semantic address of the definition
+ * @returns the definition or NULL if there isn't one at that address
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/semtable_spec.h testSemTableConcurrentDefs
+ */
 T *__sem_get_def(SemTable *sem,SemanticType semtype,Context c,SemanticAddr i) {
-    T *defs = __sem_get_defs(sem,semtype,c);
-    return _t_child(defs,i);
+    return ___sem_get_def(sem,semtype,c,i);
+}
+
+// get the labels of a definition, which _sem_add_label may replace while we look
+T *__sem_def_labels(T *def) {
+    return __atomic_load_n(&def->structure.children[DefLabelIdx-1],__ATOMIC_ACQUIRE);
 }
 
 /**
@@ -98,11 +221,10 @@ char *_sem_get_name(SemTable *sem,SemanticID s) {
             raise_error("unexpected semantic NULL id!");
         }
     }
-    T *def = _sem_get_def(sem,s);
+    T *def = ___sem_get_def(sem,s.semtype,s.context,s.id);
     char *n = NULL;
     if (def) {
-        int path[] ={DefLabelIdx,1,TREE_PATH_TERMINATOR};
-        T *t = _t_get(def,path);
+        T *t = _t_child(__sem_def_labels(def),1);
         if (!t) raise_error("missing label!");
         n = (char *)_t_surface(t);
     }
@@ -126,10 +248,10 @@ T * _sem_get_label(SemTable *sem,SemanticID s,Symbol label_type) {
     if (s.id == 0) {
         raise_error("semantic NULL have no defs!");
     }
-    T *def = _sem_get_def(sem,s);
+    T *def = ___sem_get_def(sem,s.semtype,s.context,s.id);
     T *label = NULL;
     if (def) {
-        T *labels = _t_child(def,DefLabelIdx);
+        T *labels = __sem_def_labels(def);
         label = _t_find(labels,label_type);
         if (!label) label = _t_child(labels,1);
     }
@@ -147,27 +269,70 @@ T * _sem_get_label(SemTable *sem,SemanticID s,Symbol label_type) {
  * @snippet spec/semtable_spec.h testSemGetByLabel
  */
 void _sem_add_label(SemTable *sem,SemanticID s,Symbol label_type,char *label) {
-    T *def = _sem_get_def(sem,s);
+    pthread_mutex_lock(&sem->lock);
+    T *def = ___sem_get_def(sem,s.semtype,s.context,s.id);
     T *labels  = _t_child(def,DefLabelIdx);
-    _t_new_str(labels,label_type,label);
+
+    // readers may be looking at the labels, so publish an extended copy in their place
+    T *l = _t_clone(labels);
+    _t_new_str(l,label_type,label);
+    l->structure.parent = def;
+    l->structure.index = labels->structure.index;
+    _t_touch(def);
+    __atomic_store_n(&def->structure.children[DefLabelIdx-1],l,__ATOMIC_RELEASE);
+
+    // and hold on to the old ones until the table is freed
+    labels->structure.parent = NULL;
+    sem->retired = realloc(sem->retired,sizeof(T *)*(sem->retired_count+1));
+    sem->retired[sem->retired_count++] = labels;
+    pthread_mutex_unlock(&sem->lock);
 }
 
 Structure _sem_get_symbol_structure(SemTable *sem,Symbol s){
     if (!is_symbol(s)) raise_error("Bad symbol: semantic type not SEM_TYPE_SYMBOL");
-    return __d_get_symbol_structure(_sem_get_defs(sem,s),s);
+    T *def = ___sem_get_def(sem,s.semtype,s.context,s.id);
+    if (!def) raise_error("Bad symbol:%d.%d.%d-- not defined",s.context,s.semtype,s.id);
+    return *(Structure *)_t_surface(_t_child(def,SymbolDefStructureIdx));
+}
+
+/**
+ * store the compiled bytecode for a process
+ *
+ * @param[in] sem the semantic table
+ * @param[in] p the process the bytecode was compiled from
+ * @param[in] b the bytecode, which becomes owned by the semtable
+ */
+void _sem_set_bytecode(SemTable *sem,Process p,Bytecode *b) {
+    pthread_mutex_lock(&sem->lock);
+    DefEntry *e = __sem_get_entry(sem,p.semtype,p.context,p.id);
+    if (!e) raise_error("process %d.%d.%d not defined",p.context,p.semtype,p.id);
+    // bytecode is looked up without the lock, so once set it can't be replaced
+    if (e->bytecode) raise_error("process %d.%d.%d already has bytecode",p.context,p.semtype,p.id);
+    __atomic_store_n(&e->bytecode,b,__ATOMIC_RELEASE);
+    pthread_mutex_unlock(&sem->lock);
+}
+
+/**
+ * get the compiled bytecode for a process
+ *
+ * @param[in] sem the semantic table
+ * @param[in] p the process
+ * @returns the bytecode or NULL if the process wasn't compiled
+ */
+Bytecode *_sem_get_bytecode(SemTable *sem,Process p) {
+    DefEntry *e = __sem_get_entry(sem,p.semtype,p.context,p.id);
+    return e ? __atomic_load_n(&e->bytecode,__ATOMIC_ACQUIRE) : NULL;
 }
 
 // @todo, convert this to hash table label table!!
 bool __sem_get_by_label(SemTable *sem,char *label,SemanticID *sid,Context c) {
     ContextStore *ctx = __sem_context(sem,c);
-    T *d = ctx->definitions;
-    if (!d) raise_error("no definitions in context %s",_sem_ctx2s(sem,c));
+    if (!ctx->definitions) raise_error("no definitions in context %s",_sem_ctx2s(sem,c));
     int i,j;
-    for(i=1;i<=_t_children(d);i++) {
-        T *defs = _t_child(d,i);
-        for(j=1;j<=_t_children(defs);j++) {
-            T *def = _t_child(defs,j);
-            if (strcmp(label,(char *)_t_surface(_t_child(_t_child(def,DefLabelIdx),1)))==0) {
+    T *def;
+    for(i=1;i<=SEM_TYPES;i++) {
+        for(j=1;(def = ___sem_get_def(sem,i,c,j));j++) {
+            if (strcmp(label,(char *)_t_surface(_t_child(__sem_def_labels(def),1)))==0) {
                 sid->semtype = i;
                 sid->id = j;
                 sid->context = c;
@@ -179,11 +344,12 @@ bool __sem_get_by_label(SemTable *sem,char *label,SemanticID *sid,Context c) {
 }
 
 bool _sem_get_by_label(SemTable *sem,char *label,SemanticID *sid) {
-    int i;
+    int i,n = __atomic_load_n(&sem->contexts,__ATOMIC_ACQUIRE);
+    bool found = false;
     if (!strcmp(label,"NULL_SYMBOL")) {*sid = NULL_SYMBOL; return true;}
-    for(i=0;i<sem->contexts;i++)
-        if (__sem_get_by_label(sem,label,sid,i)) return true;
-    return false;
+    for(i=0;!found && i<n;i++)
+        found = __sem_get_by_label(sem,label,sid,i);
+    return found;
 }
 
 /** @}*/
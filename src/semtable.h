@@ -14,6 +14,7 @@
 
 SemTable *_sem_new();
 int _sem_new_context(SemTable *sem,T *definitions);
+void _sem_restore_context(SemTable *sem,Context c,T *definitions);
 void _sem_free(SemTable *sem);
 #define _sem_context(sem,s) __sem_context(sem,(s).context)
 ContextStore *__sem_context(SemTable *sem,Context c);
@@ -22,11 +23,16 @@ void _sem_free_context(SemTable *sem,Context c);
 T *__sem_get_defs(SemTable *st,SemanticType semtype,Context c);
 #define _sem_get_def(sem,s) __sem_get_def(sem,(s).semtype,(s).context,(s).id)
 T *__sem_get_def(SemTable *sem,SemanticType semtype,Context c,SemanticAddr i);
+T *___sem_get_def(SemTable *sem,SemanticType semtype,Context c,SemanticAddr i);
+void __sem_index_def(DefIndex *x,T *def);
+T *__sem_def_labels(T *def);
 char *_sem_get_name(SemTable *sem,SemanticID s);
 T * _sem_get_label(SemTable *sem,SemanticID s,Symbol label_type);
 void _sem_add_label(SemTable *sem,SemanticID s,Symbol label_type,char *label);
 Structure _sem_get_symbol_structure(SemTable *sem,Symbol s);
 bool __sem_get_by_label(SemTable *sem,char *label,SemanticID *s,Context ctx);
 bool _sem_get_by_label(SemTable *sem,char *label,SemanticID *s);
+void _sem_set_bytecode(SemTable *sem,Process p,Bytecode *b);
+Bytecode *_sem_get_bytecode(SemTable *sem,Process p);
 
 #endif
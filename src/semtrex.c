@@ -112,7 +112,8 @@ SState *state(StateType type,int *statesP,int level) {
     return s;
 }
 
-int G_group_id;
+// group ids are handed out while building an FSA, which may be happening on several workers at once
+__thread int G_group_id;
 /**
  * Given a Semtrex tree, build a partial FSA (returned via in as a pointer to the starting state, a list of output states, and a count of the total number of states created).
  */
@@ -365,7 +366,7 @@ void __stx_freeFA2(SState *s) {
  * free the memory allocated by an FSA
  */
 void _stx_freeFA(SState *s) {
-    __stx_freeFA(s,++free_id);
+    __stx_freeFA(s,__sync_add_and_fetch(&free_id,1));
     __stx_freeFA2(s);
 }
 
@@ -401,51 +402,6 @@ int __symbol_set_does_not_contain(T *s,T *t) {
     return 1;
 }
 
-/* advance the cursor according to the instructions in the state*/
-T *__transition(TransitionType transition,T *source_t,int *cursor) {
-    int i;
-    i = 0;
-    char buf[1000];
-    debug(D_STX_MATCH,"transition: cursor %s\n",_t_sprint_path(cursor,buf));
-    while(cursor[i] != TREE_PATH_TERMINATOR) i++;
-//    if (!t) debug(D_STX_MATCH,"transition: t is null\n");
-//    if (!t) return 0;
-    if (transition == TransitionDown) {
-        debug(D_STX_MATCH,"transition: down\n");
-        //@todo add max checking
-        cursor[i++] = 1;
-        cursor[i]= TREE_PATH_TERMINATOR;
-    }
-    else if (isTransitionPop(transition)) {
-        debug(D_STX_MATCH,"transition: popping %d\n",transition);
-        if (i+transition <0) {
-            raise_error("transition: would pop above root!!\n");
-        }
-        i = i+transition;
-        cursor[i] = TREE_PATH_TERMINATOR;
-        i--;
-        // popping always means also moving to next child after the pop
-        if (i >= 0)
-            cursor[i]++;
-    }
-    else if (isTransitionNext(transition)) {
-        debug(D_STX_MATCH,"transition: next\n");
-        i--;
-        if (i >= 0) cursor[i]++;
-        else {
-            // @todo this is weird because we are setting the path to something that
-            // we know will be invalid, but we don't have some true ontological representation
-            // of a "NULL_PATH" which we probably should really have, but that means adding
-            // checks for null path all over the place in tree.c
-            cursor[0] = -2;
-            cursor[1]= TREE_PATH_TERMINATOR;
-        }
-    }
-    T *t = _t_get(source_t,cursor);
-    debug(D_STX_MATCH,"transition: result %s %s\n",_t_sprint_path(cursor,buf),!t ? "NULL":t2s(t));
-    return t;
-}
-
 // helper to see if the surface of given tree nodes matched
 /// @todo move this to tree.c
 int _val_match(T *t,T *t1) {
@@ -463,6 +419,56 @@ int _val_match(T *t,T *t1) {
     return i==0;
 }
 
+// check that a node matches the literal in a StateValue or StateSymbol state
+int __stx_node_matches(SState *s,T *t) {
+    int i,count,matched;
+    T *x;
+    if (s->type == StateSymbol) {
+        if (s->data.symbol.flags & LITERAL_SET) {
+            return (s->data.symbol.flags & LITERAL_NOT) ?
+                __symbol_set_does_not_contain(s->data.symbol.symbols,t) :
+                __symbol_set_contains(s->data.symbol.symbols,t);
+        }
+        matched = semeq(_t_symbol(t),*(Symbol *)_t_surface(s->data.symbol.symbols));
+        return s->data.symbol.flags & LITERAL_NOT ? !matched : matched;
+    }
+
+    T *v = s->data.value.values;
+    count = _t_children(v);
+    if (debugging(D_STX_MATCH)) {
+        char buf[5000];
+        debug(D_STX_MATCH,"  seeking:%s%s\n",s->data.value.flags & LITERAL_NOT ? " ~":"",__t_dump(G_sem,v,0,buf));
+    }
+    Symbol ts = _t_symbol(t);
+    if (s->data.value.flags & LITERAL_NOT) {
+        if (s->data.value.flags & LITERAL_SET) {
+            // all in the set must not match
+            matched = 1;
+            for(i=1;i<=count && matched;i++) {
+                x = _t_child(v,i);
+                matched = !(semeq(ts,_t_symbol(x)) && _val_match(t,x));
+            }
+        }
+        else {
+            matched = !(semeq(ts,_t_symbol(v)) && _val_match(t,v));
+        }
+    }
+    else {
+        if (s->data.value.flags & LITERAL_SET) {
+            // at least one in the set much match
+            matched = 0;
+            for(i=1;i<=count && !matched; i++) {
+                x = _t_child(v,i);
+                matched = semeq(ts,_t_symbol(x)) && _val_match(t,x);
+            }
+        }
+        else {
+            matched = semeq(ts,_t_symbol(v)) && _val_match(t,v);
+        }
+    }
+    return matched;
+}
+
 // convert cpointer SEMTREX_MATCH_CURSOR elements to MATCHED_PATH and SIBLING COUNT elements
 void __fix(T *source_t,T *r) {
     T *m1,*m2;
@@ -516,16 +522,148 @@ void __fix(T *source_t,T *r) {
 
 #define MAX_BRANCH_DEPTH 5000
 #define CURSOR_MAX_DEPTH 100
+#define STX_TRAIL_BLOCK 1024
+
+// a position in the tree being matched, kept as the chain of nodes from the root down to
+// the current node along with the child index taken at each step, so that moving the
+// cursor never requires re-walking the path from the root
+typedef struct StxCursor {
+    int depth;                          ///< depth of the current node (the root is 0)
+    T *nodes[CURSOR_MAX_DEPTH+1];       ///< nodes[depth] is the current node (NULL if off the tree)
+    int idx[CURSOR_MAX_DEPTH];          ///< idx[i] is the child index of nodes[i+1] in nodes[i]
+} StxCursor;
+
+#define __stx_cursor_node(c) ((c)->nodes[(c)->depth])
+
+// move the cursor to the ith child of the current node
+void __stx_cursor_child(StxCursor *c,int i) {
+    if (c->depth >= CURSOR_MAX_DEPTH) {
+        raise_error("cursor max depth exceeded");
+    }
+    T *t = c->nodes[c->depth];
+    c->idx[c->depth++] = i;
+    c->nodes[c->depth] = t ? _t_child(t,i) : NULL;
+}
+
+// move the cursor to the next sibling of the current node
+void __stx_cursor_next(StxCursor *c) {
+    if (!c->depth) {
+        // the root has no siblings so this moves the cursor off the tree
+        __stx_cursor_child(c,-2);
+        return;
+    }
+    T *p = c->nodes[c->depth-1];
+    int i = ++c->idx[c->depth-1];
+    c->nodes[c->depth] = p ? _t_child(p,i) : NULL;
+}
+
+// build a path to the current cursor position (for debugging output)
+int *__stx_cursor_path(StxCursor *c,int *path) {
+    int i;
+    for(i=0;i<c->depth;i++) path[i] = c->idx[i];
+    path[i] = TREE_PATH_TERMINATOR;
+    return path;
+}
+
+/* advance the cursor according to the instructions in the state*/
+T *__transition(TransitionType transition,StxCursor *c) {
+    if (transition == TransitionDown) {
+        debug(D_STX_MATCH,"transition: down\n");
+        __stx_cursor_child(c,1);
+    }
+    else if (isTransitionPop(transition)) {
+        debug(D_STX_MATCH,"transition: popping %d\n",transition);
+        if (c->depth+transition <0) {
+            raise_error("transition: would pop above root!!\n");
+        }
+        c->depth += transition;
+        // popping always means also moving to next child after the pop
+        if (c->depth) __stx_cursor_next(c);
+    }
+    else if (isTransitionNext(transition)) {
+        debug(D_STX_MATCH,"transition: next\n");
+        __stx_cursor_next(c);
+    }
+    T *t = __stx_cursor_node(c);
+    debug(D_STX_MATCH,"transition: result %s\n",!t ? "NULL":t2s(t));
+    return t;
+}
+
+// advance the cursor one step of a post-order walk of the sub-tree at depth base.
+// The first step descends to the left-most leaf, and the walk ends after the sub-tree's
+// root has been visited.
+T *__stx_cursor_walk(StxCursor *c,int base,bool first) {
+    T *t;
+    if (!first) {
+        if (c->depth == base) return NULL;
+        if (_t_children(c->nodes[c->depth-1]) <= c->idx[c->depth-1]) {
+            // no next sibling so the next node is the parent
+            c->depth--;
+            return __stx_cursor_node(c);
+        }
+        __stx_cursor_next(c);
+    }
+    while((t = __stx_cursor_node(c)) && _t_children(t)) __stx_cursor_child(c,1);
+    return t;
+}
+
+// saved cursor positions for backtracking, stored contiguously so that pushing a
+// branch copies only the live part of the cursor
+typedef struct StxTrailEntry {
+    T *node;
+    int idx;
+} StxTrailEntry;
+
+typedef struct StxTrail {
+    StxTrailEntry *entries;
+    int size;
+    int top;
+    StxTrailEntry block[STX_TRAIL_BLOCK];
+} StxTrail;
+
+// save the cursor onto the trail returning its offset
+int __stx_trail_push(StxTrail *tr,StxCursor *c) {
+    int i,o = tr->top;
+    if (o+c->depth+1 > tr->size) {
+        int size = tr->size*2+c->depth+1;
+        if (tr->entries == tr->block) {
+            tr->entries = malloc(sizeof(StxTrailEntry)*size);
+            memcpy(tr->entries,tr->block,sizeof(StxTrailEntry)*o);
+        }
+        else tr->entries = realloc(tr->entries,sizeof(StxTrailEntry)*size);
+        tr->size = size;
+    }
+    StxTrailEntry *e = &tr->entries[o];
+    for(i=0;i<c->depth;i++) {
+        e[i].node = c->nodes[i];
+        e[i].idx = c->idx[i];
+    }
+    e[i].node = c->nodes[i];
+    tr->top = o+c->depth+1;
+    return o;
+}
+
+// restore a cursor that was saved on the trail
+void __stx_trail_restore(StxTrail *tr,int o,int depth,StxCursor *c) {
+    int i;
+    StxTrailEntry *e = &tr->entries[o];
+    for(i=0;i<depth;i++) {
+        c->nodes[i] = e[i].node;
+        c->idx[i] = e[i].idx;
+    }
+    c->nodes[i] = e[i].node;
+    c->depth = depth;
+}
+
 // structure to hold backtracking data for match algorithm
 typedef struct BranchPoint {
-    T *walk_root;
-    int *walk_cursor;
-    int walk_len;
+    T *walk_root;       ///< the root of the sub-tree being walked (NULL if not a walk branch)
+    int walk_base;      ///< the depth of the walk root
+    bool walking;       ///< true once the walk has taken its first step
     SState *s;
     TransitionType transition;
-    int cursor[CURSOR_MAX_DEPTH];
-//    T *cursor;
-//    T *cursor_prev;
+    int trail;          ///< offset of the saved cursor on the trail
+    int cursor_depth;   ///< depth of the saved cursor
     T *match;
     int *r_path;
 } BranchPoint;
@@ -537,9 +675,13 @@ char G_stx_debug_buf[1000];
     if((depth+1)>=MAX_BRANCH_DEPTH) {raise_error("MAX branch depth exceeded");} \
     stack[depth].s = state;                                             \
     stack[depth].transition = t;                                        \
-    _t_pathcpy(stack[depth].cursor,crs);                                \
+    stack[depth].cursor_depth = (crs)->depth;                           \
+    stack[depth].trail = __stx_trail_push(&trail,crs);                  \
     stack[depth].walk_root = w;                                         \
-    if (w) stack[depth].walk_cursor = NULL;                             \
+    if (w) {                                                            \
+        stack[depth].walk_base = (crs)->depth;                          \
+        stack[depth].walking = false;                                   \
+    }                                                                   \
     if (rP) {                                                           \
         if (*rP) {                                                      \
             stack[depth].match = _t_clone(*rP);                         \
@@ -554,38 +696,45 @@ char G_stx_debug_buf[1000];
 #define PUSH_WALK_POINT(state,t,crs,c) _PUSH_BRANCH(state,t,crs,c,c)
 
 #define FAIL {s=0;break;}
-#define TRANSITION(x) if (!t) {FAIL;}; if (!x) {FAIL;}; t=__transition(s->transition,source_t,cursor); s = s->out;
+#define TRANSITION(x) if (!t) {FAIL;}; if (!x) {FAIL;}; t=__transition(s->transition,&cursor); s = s->out;
 
 /**
- * build an FSA from semtrex tree and walk it using a recursive backtracing algorithm to match the tree in t.
+ * walk an FSA using a recursive backtracing algorithm to match the tree in t.
  *
- * @param[in] semtrex tree to use for matching a tree
+ * The position in the source tree is carried as a live cursor (the current node plus the
+ * chain of its ancestors and child indexes) so each step of the match is constant time
+ * regardless of how deep in the source tree the match is.
+ *
+ * @param[in] fa the FSA to walk (which is not modified, so may be shared by concurrent matches)
  * @param[in] source_t tree to match against
  * @param[inout] rP match results tree being built.  (nil if no results needed)
  * @returns 1 or 0 if matched or not
  */
-int __t_match(T *semtrex,T *source_t,T **rP) {
-    int states;
+int __stx_match(SState *fa,T *source_t,T **rP) {
     char buf[5000];
+    int pbuf[CURSOR_MAX_DEPTH+1];
     BranchPoint stack[MAX_BRANCH_DEPTH];
+    StxTrail trail;
+    trail.entries = trail.block;
+    trail.size = STX_TRAIL_BLOCK;
+    trail.top = 0;
 
     int depth = 0;
     T *t = source_t;
-    int matched;
-    T *r = 0,*x;
+    T *r = 0;
     if (rP) *rP = 0;
 
     SgroupOpen *o;
 
-    SState *fa = _stx_makeFA(semtrex,&states);
     SState *s = fa;
 
-    int cursor[100] = {TREE_PATH_TERMINATOR};
+    StxCursor cursor;
+    cursor.depth = 0;
+    cursor.nodes[0] = source_t;
 
     while (s && s != &matchstate) {
-        t = _t_get(source_t,cursor);
         debug(D_STX_MATCH,"IN:%s\n",G_s_str[s->type]);
-        debug(D_STX_MATCH,"  CURSOR: %s\n",_t_sprint_path(cursor,buf));
+        debug(D_STX_MATCH,"  CURSOR: %s\n",_t_sprint_path(__stx_cursor_path(&cursor,pbuf),buf));
         if (s->type == StateGroupOpen) {
             o = &s->data.groupo;
             debug(D_STX_MATCH,"   for %s\n",_sem_get_name(G_sem,o->symbol));
@@ -601,64 +750,14 @@ int __t_match(T *semtrex,T *source_t,T **rP) {
 
         switch(s->type) {
         case StateValue:
-            if (!t) {FAIL;}
-            else {
-                T *v = s->data.value.values;
-
-                if (!t) FAIL;
-                int count = _t_children(v);
-                int i;
-                debug(D_STX_MATCH,"  seeking:%s%s\n",s->data.value.flags & LITERAL_NOT ? " ~":"",__t_dump(G_sem,v,0,buf));
-                Symbol ts = _t_symbol(t);
-                if (s->data.value.flags & LITERAL_NOT) {
-                    if (s->data.value.flags & LITERAL_SET) {
-                        // all in the set must not match
-                        matched = 1;
-                        for(i=1;i<=count && matched;i++) {
-                            x = _t_child(v,i);
-                            matched = !(semeq(ts,_t_symbol(x)) && _val_match(t,x));
-                        }
-                    }
-                    else {
-                        matched = !(semeq(ts,_t_symbol(v)) && _val_match(t,v));
-                    }
-                }
-                else {
-                    if (s->data.value.flags & LITERAL_SET) {
-                        // at least one in the set much match
-                        matched = 0;
-                        for(i=1;i<=count && !matched; i++) {
-                            x = _t_child(v,i);
-                            matched = semeq(ts,_t_symbol(x)) && _val_match(t,x);
-                        }
-                    }
-                    else {
-                        matched = semeq(ts,_t_symbol(v)) && _val_match(t,v);
-                    }
-                }
-
-                if (!matched) FAIL;
-            }
-            t = __transition(s->transition,source_t,cursor);
-            s = s->out;
-            break;
         case StateSymbol:
-            if (s->data.symbol.flags & LITERAL_SET) {
-                TRANSITION((s->data.symbol.flags & LITERAL_NOT) ?
-                           __symbol_set_does_not_contain(s->data.symbol.symbols,t) :
-                           __symbol_set_contains(s->data.symbol.symbols,t));
-            }
-            else {
-                if (!t) FAIL;
-                int matched = semeq(_t_symbol(t),*(Symbol *)_t_surface(s->data.symbol.symbols));
-                TRANSITION(s->data.symbol.flags & LITERAL_NOT ? !matched : matched);
-            }
+            TRANSITION(__stx_node_matches(s,t));
             break;
         case StateAny:
             TRANSITION(1);
             break;
         case StateSplit:
-            PUSH_BRANCH(s->out1,s->transition1,cursor,t);
+            PUSH_BRANCH(s->out1,s->transition1,&cursor,t);
             s = s->out;
             break;
         case StateWalk:
@@ -667,7 +766,7 @@ int __t_match(T *semtrex,T *source_t,T **rP) {
             // it just gets restarted with the cursor advanced one step from the last
             // time through.  This is why we push on the destination state from the walk
             // state instead of on the walk state itself.
-            PUSH_WALK_POINT(s,s->transition,cursor,t);
+            PUSH_WALK_POINT(s,s->transition,&cursor,t);
             break;
         case StateGroupOpen:
             o = &s->data.groupo;
@@ -701,21 +800,16 @@ int __t_match(T *semtrex,T *source_t,T **rP) {
             s = s->out;
             break;
         case StateDescend:
-            t = _t_child(t,1);
-            {
-                int i = 0;
-                //@todo add max checking
-                while(cursor[i] != TREE_PATH_TERMINATOR)i++;
-                cursor[i++] = 1;
-                cursor[i]= TREE_PATH_TERMINATOR;
-            }
+            __stx_cursor_child(&cursor,1);
+            t = __stx_cursor_node(&cursor);
             s = s->out;
             break;
         case StateMatch:
             break;
         }
-        // if we just had a fail see if there is some backtracking we can do
-        if (!s && depth) {
+        // if we just had a fail see if there is some backtracking we can do (an exhausted
+        // walk fails back to whatever alternatives were pending before it)
+        while (!s && depth) {
             --depth;
             debug(D_STX_MATCH,"Fail & backtracking possible\n");
             if (rP) {
@@ -730,28 +824,37 @@ int __t_match(T *semtrex,T *source_t,T **rP) {
             // pop back to the state in the FSA where we failed
             s = stack[depth].s;
 
+            // restore the saved cursor
+            __stx_trail_restore(&trail,stack[depth].trail,stack[depth].cursor_depth,&cursor);
+            trail.top = stack[depth].trail;
+
             T *walk = stack[depth].walk_root;
             if (!walk) {
                 // if this isn't a walk branch then:
-
-                // restore the saved cursor
-                _t_pathcpy(cursor,stack[depth].cursor);
-                t = _t_get(source_t,cursor);
-                debug(D_STX_MATCH,"     popping to--%s %s\n",_t_sprint_path(cursor,buf), t ? t2s(t) : "NULL");
+                t = __stx_cursor_node(&cursor);
+                debug(D_STX_MATCH,"     popping to--%s %s\n",_t_sprint_path(__stx_cursor_path(&cursor,pbuf),buf), t ? t2s(t) : "NULL");
                 debug(D_STX_MATCH,"     running transition:%d\n",stack[depth].transition);
 
                 // run the transition that we saved for
                 // moving to that state that normally would have been run in the TRANSITION macro
-                t = __transition(stack[depth].transition,source_t,cursor);
+                t = __transition(stack[depth].transition,&cursor);
             }
             else {
                 // if it is a walk branch, then take the next step in the walk.
-                t = _t_path_walk(walk,&stack[depth].walk_cursor,&stack[depth].walk_len);
-                // if there is one then restart the branch otherwise we failed
+                t = __stx_cursor_walk(&cursor,stack[depth].walk_base,!stack[depth].walking);
+                // if there is one then restart the branch (re-saving the advanced cursor and
+                // the match state so the walk can continue from here if this step also fails)
+                // otherwise we failed
                 if (t) {
-                    _t_pathcpy(cursor,stack[depth].walk_cursor);
+                    stack[depth].walking = true;
+                    stack[depth].cursor_depth = cursor.depth;
+                    __stx_trail_push(&trail,&cursor);
+                    if (rP && *rP) {
+                        stack[depth].match = _t_clone(*rP);
+                        stack[depth].r_path = _t_get_path(r);
+                    }
                     depth++;
-                    debug(D_STX_MATCH,"     walking to--%s %s\n",_t_sprint_path(cursor,buf), t ? t2s(t) : "NULL");
+                    debug(D_STX_MATCH,"     walking to--%s %s\n",_t_sprint_path(__stx_cursor_path(&cursor,pbuf),buf), t ? t2s(t) : "NULL");
                 }
                 else s = 0;
             }
@@ -769,9 +872,6 @@ int __t_match(T *semtrex,T *source_t,T **rP) {
     }
     // clean up any remaining stack frames
     while (depth--) {
-        if (stack[depth].walk_root) {
-            if (stack[depth].walk_cursor) free(stack[depth].walk_cursor);
-        }
         if (rP) {
             if ((r = stack[depth].match)) {
                 _t_free(r);
@@ -779,7 +879,7 @@ int __t_match(T *semtrex,T *source_t,T **rP) {
             }
         }
     }
-    _stx_freeFA(fa);
+    if (trail.entries != trail.block) free(trail.entries);
     if (s == &matchstate) {
         debug(D_STX_MATCH,"Matched!\n");
         return true;
@@ -787,6 +887,275 @@ int __t_match(T *semtrex,T *source_t,T **rP) {
     return false;
 }
 
+/*****************  Linear time semtrex matching */
+
+#define STX_BLOCK 64
+
+// grow a buffer that starts out as a block on the stack, moving it to the heap as needed
+void *__stx_grow(void *buf,void *block,int *sizeP,int used,size_t elem_size) {
+    int size = *sizeP*2;
+    if (buf == block) {
+        void *b = malloc(elem_size*size);
+        memcpy(b,buf,elem_size*used);
+        buf = b;
+    }
+    else buf = realloc(buf,elem_size*size);
+    *sizeP = size;
+    return buf;
+}
+
+// a (state,position) pair that the linear matcher has already explored
+typedef struct StxVisit {
+    SState *s;
+    void *p;            ///< the node at the position, or its parent if the position is off the tree
+    int idx;            ///< 0 for a node, otherwise the child index of the off-tree position
+    int kind;           ///< entering the state, or starting a walk step at it
+} StxVisit;
+
+enum {StxVisitState,StxVisitWalk};
+
+typedef struct StxVisited {
+    StxVisit *slots;
+    int size;
+    int count;
+    StxVisit block[STX_BLOCK];
+} StxVisited;
+
+uint32_t __stx_visit_hash(StxVisit *v) {
+    uint64_t k = (uintptr_t)v->p ^ ((uintptr_t)v->s << 7) ^ ((uint64_t)(uint32_t)v->idx << 32) ^ v->kind;
+    k *= 0x9E3779B97F4A7C15ULL;
+    return k >> 32;
+}
+
+void __stx_visit_insert(StxVisit *slots,int size,StxVisit *v) {
+    uint32_t i = __stx_visit_hash(v) & (size-1);
+    while (slots[i].s) i = (i+1) & (size-1);
+    slots[i] = *v;
+}
+
+/* mark the state at the cursor's position as explored, returning true if it already was.
+   Positions below a node that is off the tree aren't tracked, but nothing can match there
+   so the matcher never loops in them. */
+bool __stx_visited(StxVisited *vs,SState *s,StxCursor *c,int kind) {
+    StxVisit v = {s,__stx_cursor_node(c),0,kind};
+    if (!v.p) {
+        if (!c->depth || !(v.p = c->nodes[c->depth-1])) return false;
+        v.idx = c->idx[c->depth-1];
+    }
+    uint32_t i = __stx_visit_hash(&v) & (vs->size-1);
+    StxVisit *x;
+    while ((x = &vs->slots[i])->s) {
+        if (x->s == v.s && x->p == v.p && x->idx == v.idx && x->kind == v.kind) return true;
+        i = (i+1) & (vs->size-1);
+    }
+    *x = v;
+    if (++vs->count*2 > vs->size) {
+        int j,size = vs->size*2;
+        StxVisit *slots = calloc(size,sizeof(StxVisit));
+        for(j=0;j<vs->size;j++) {
+            if (vs->slots[j].s) __stx_visit_insert(slots,size,&vs->slots[j]);
+        }
+        if (vs->slots != vs->block) free(vs->slots);
+        vs->slots = slots;
+        vs->size = size;
+    }
+    return false;
+}
+
+// a pending alternative for the linear matcher to try if the current one fails
+typedef struct StxThread {
+    SState *s;
+    TransitionType transition;
+    T *walk_root;       ///< the root of the sub-tree being walked (NULL if not a walk branch)
+    int walk_base;      ///< the depth of the walk root
+    bool walking;       ///< true once the walk has taken its first step
+    int trail;          ///< offset of the saved cursor on the trail
+    int cursor_depth;   ///< depth of the saved cursor
+    int captures;       ///< length of the capture log when the thread was created
+} StxThread;
+
+// a group open or close passed through on the current match path
+typedef struct StxCapture {
+    SState *s;
+    T *t;
+} StxCapture;
+
+// build the SEMTREX_MATCH results tree from the group opens and closes on the match path
+T *__stx_captures2results(StxCapture *captures,int count) {
+    T *r = 0,*results = 0;
+    int i;
+    for(i=0;i<count;i++) {
+        SState *s = captures[i].s;
+        T *t = captures[i].t;
+        if (s->type == StateGroupOpen) {
+            r = _t_newi(r,SEMTREX_MATCH,s->data.groupo.uid);
+            if (!results) results = r;
+            _t_news(r,SEMTREX_MATCH_SYMBOL,s->data.groupo.symbol);
+            _t_new(r,SEMTREX_MATCH_CURSOR,&t,sizeof(t));
+        }
+        else {
+            int pt[2] = {3,TREE_PATH_TERMINATOR};
+            _t_insert_at(r,pt,_t_new(0,SEMTREX_MATCH_CURSOR,&t,sizeof(t)));
+            T *pp = _t_parent(r);
+            if (pp) r = pp;
+        }
+    }
+    return results;
+}
+
+#define PUSH_THREAD(state,tr,w) {                                       \
+        if (depth == stack_size) stack = __stx_grow(stack,stack_block,&stack_size,depth,sizeof(StxThread)); \
+        th = &stack[depth++];                                           \
+        th->s = state;                                                  \
+        th->transition = tr;                                            \
+        th->walk_root = w;                                              \
+        th->walk_base = cursor.depth;                                   \
+        th->walking = false;                                            \
+        th->cursor_depth = cursor.depth;                                \
+        th->trail = __stx_trail_push(&trail,&cursor);                   \
+        th->captures = captures;                                        \
+    }
+
+/**
+ * walk an FSA in time linear in the size of the tree being matched.
+ *
+ * This follows the same alternatives in the same order as __stx_match, so it finds the same
+ * match and the same group results, but it records each (state,position) pair it explores.
+ * Because what can match from any such pair doesn't depend on how the matcher got there,
+ * arriving at one a second time can only fail again, so it's cut off immediately.  This
+ * keeps patterns like nested repetitions from going exponential.  Alternatives are kept on
+ * a growable stack, so long sibling lists can't run out of branch depth, and group matches
+ * are logged and only built into a results tree once a match succeeds.
+ *
+ * @param[in] fa the FSA to walk (which is not modified, so may be shared by concurrent matches)
+ * @param[in] source_t tree to match against
+ * @param[inout] rP match results tree being built.  (nil if no results needed)
+ * @returns 1 or 0 if matched or not
+ */
+int __stx_match_linear(SState *fa,T *source_t,T **rP) {
+    StxThread stack_block[STX_BLOCK],*stack = stack_block,*th;
+    int stack_size = STX_BLOCK,depth = 0;
+    StxCapture capture_block[STX_BLOCK],*capture_log = capture_block;
+    int capture_size = STX_BLOCK,captures = 0;
+    StxVisited visited;
+    visited.slots = visited.block;
+    visited.size = STX_BLOCK;
+    visited.count = 0;
+    memset(visited.block,0,sizeof(visited.block));
+    StxTrail trail;
+    trail.entries = trail.block;
+    trail.size = STX_TRAIL_BLOCK;
+    trail.top = 0;
+
+    if (rP) *rP = 0;
+    SState *s = fa;
+    T *t = source_t;
+    StxCursor cursor;
+    cursor.depth = 0;
+    cursor.nodes[0] = source_t;
+
+    while (s && s != &matchstate) {
+        switch(s->type) {
+        case StateValue:
+        case StateSymbol:
+            TRANSITION(__stx_node_matches(s,t));
+            break;
+        case StateAny:
+            TRANSITION(1);
+            break;
+        case StateSplit:
+            if (__stx_visited(&visited,s,&cursor,StxVisitState)) FAIL;
+            PUSH_THREAD(s->out1,s->transition1,0);
+            s = s->out;
+            break;
+        case StateWalk:
+            if (__stx_visited(&visited,s,&cursor,StxVisitState)) FAIL;
+            s = s->out;
+            // as in __stx_match the walk root is tried first, then the walk thread steps
+            // through the sub-tree every time the branch fails
+            if (t) __stx_visited(&visited,s,&cursor,StxVisitWalk);
+            PUSH_THREAD(s,s->transition,t);
+            break;
+        case StateGroupOpen:
+            if (rP) {
+                if (!t) FAIL;
+                if (captures == capture_size) capture_log = __stx_grow(capture_log,capture_block,&capture_size,captures,sizeof(StxCapture));
+                capture_log[captures].s = s;
+                capture_log[captures++].t = t;
+            }
+            s = s->out;
+            break;
+        case StateGroupClose:
+            if (rP) {
+                if (captures == capture_size) capture_log = __stx_grow(capture_log,capture_block,&capture_size,captures,sizeof(StxCapture));
+                capture_log[captures].s = s;
+                capture_log[captures++].t = t;
+            }
+            s = s->out;
+            break;
+        case StateDescend:
+            __stx_cursor_child(&cursor,1);
+            t = __stx_cursor_node(&cursor);
+            s = s->out;
+            break;
+        case StateMatch:
+            break;
+        default:
+            raise_error("unimplemented state type: %d",s->type);
+        }
+        // on failure resume the most recent pending alternative
+        while (!s && depth) {
+            th = &stack[--depth];
+            __stx_trail_restore(&trail,th->trail,th->cursor_depth,&cursor);
+            trail.top = th->trail;
+            captures = th->captures;
+            s = th->s;
+            if (!th->walk_root) {
+                t = __transition(th->transition,&cursor);
+            }
+            else {
+                // take the next step in the walk that hasn't already been explored
+                do {
+                    t = __stx_cursor_walk(&cursor,th->walk_base,!th->walking);
+                    th->walking = true;
+                } while (t && __stx_visited(&visited,s,&cursor,StxVisitWalk));
+                if (t) {
+                    th->cursor_depth = cursor.depth;
+                    __stx_trail_push(&trail,&cursor);
+                    depth++;
+                }
+                else s = 0;
+            }
+        }
+    }
+
+    if (rP && s && captures) {
+        *rP = __stx_captures2results(capture_log,captures);
+        __fix(source_t,*rP);
+    }
+    if (stack != stack_block) free(stack);
+    if (capture_log != capture_block) free(capture_log);
+    if (visited.slots != visited.block) free(visited.slots);
+    if (trail.entries != trail.block) free(trail.entries);
+    return s == &matchstate;
+}
+
+/**
+ * build an FSA from semtrex tree and match it against the tree in t.
+ *
+ * @param[in] semtrex tree to use for matching a tree
+ * @param[in] source_t tree to match against
+ * @param[inout] rP match results tree being built.  (nil if no results needed)
+ * @returns 1 or 0 if matched or not
+ */
+int __t_match(T *semtrex,T *source_t,T **rP) {
+    int states;
+    SState *fa = _stx_makeFA(semtrex,&states);
+    int matched = __stx_match(fa,source_t,rP);
+    _stx_freeFA(fa);
+    return matched;
+}
+
 /**
  * Match a tree against a semtrex and get back match results
  *
@@ -810,6 +1179,281 @@ int _t_match(T *semtrex,T *t) {
     return __t_match(semtrex,t,NULL);
 }
 
+/**
+ * find the symbol the root of a tree must have for a semtrex to match it
+ *
+ * this is used to decide which patterns a tree can be tested against without running them
+ *
+ * @param[in] semtrex the semtrex pattern tree
+ * @returns the symbol, or NULL_SYMBOL if the semtrex could match trees with different root symbols
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/semtrex_spec.h testSemtrexRootSymbol
+ */
+Symbol _stx_root_symbol(T *semtrex) {
+    Symbol sym = _t_symbol(semtrex);
+    T *v = _t_child(semtrex,1);
+    if (semeq(sym,SEMTREX_GROUP) || semeq(sym,SEMTREX_ONE_OR_MORE)) {
+        return _stx_root_symbol(v);
+    }
+    if (semeq(sym,SEMTREX_SYMBOL_LITERAL) && semeq(_t_symbol(v),SEMTREX_SYMBOL)) {
+        return *(Symbol *)_t_surface(v);
+    }
+    if (semeq(sym,SEMTREX_VALUE_LITERAL) && !semeq(_t_symbol(v),SEMTREX_VALUE_SET)) {
+        return _t_symbol(v);
+    }
+    return NULL_SYMBOL;
+}
+
+/*****************  Compiled semtrex patterns */
+
+// check for repetitions (or walks) inside of repetitions which can make backtracking explode
+bool __stx_repeats_nested(T *semtrex,bool in_repeat) {
+    Symbol sym = _t_symbol(semtrex);
+    bool repeat = semeq(sym,SEMTREX_ZERO_OR_MORE) || semeq(sym,SEMTREX_ONE_OR_MORE) || semeq(sym,SEMTREX_WALK);
+    if (repeat && in_repeat) return true;
+    // value and symbol sets are the literals, not sub-patterns
+    if (semeq(sym,SEMTREX_VALUE_LITERAL) || semeq(sym,SEMTREX_VALUE_LITERAL_NOT)) return false;
+    DO_KIDS(semtrex,if (__stx_repeats_nested(_t_child(semtrex,i),in_repeat || repeat)) return true);
+    return false;
+}
+
+/**
+ * compile a semtrex into an FSA that can be matched any number of times
+ *
+ * @param[in] semtrex the semtrex pattern tree, which isn't needed by the compiled pattern
+ * @returns the compiled pattern
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/semtrex_spec.h testSemtrexCompile
+ */
+Stx *_stx_compile(T *semtrex) {
+    Stx *stx = malloc(sizeof(Stx));
+    stx->states = 0;
+    stx->fa = _stx_makeFA(semtrex,&stx->states);
+    stx->engine = __stx_repeats_nested(semtrex,false) ? StxEngineLinear : StxEngineBacktrack;
+    stx->refs = 1;
+    return stx;
+}
+
+/**
+ * compile a semtrex wrapped in a SEMTREX_GROUP so matches return results for the whole pattern
+ *
+ * @param[in] semtrex the semtrex pattern tree
+ * @param[in] group the symbol of the group
+ * @returns the compiled pattern
+ */
+Stx *_stx_compile_group(T *semtrex,Symbol group) {
+    T *g = _t_news(0,SEMTREX_GROUP,group);
+    _t_add(g,_t_clone(semtrex));
+    Stx *stx = _stx_compile(g);
+    _t_free(g);
+    return stx;
+}
+
+/**
+ * free a compiled semtrex pattern
+ */
+void _stx_free(Stx *stx) {
+    if (__sync_sub_and_fetch(&stx->refs,1)) return;
+    _stx_freeFA(stx->fa);
+    free(stx);
+}
+
+/**
+ * take another reference to a compiled semtrex
+ *
+ * a compiled pattern owned by a shared table can be retained by a thread that's about to
+ * match with it, so that removing it from the table doesn't free it out from under the match.
+ * each retain must be balanced by a call to _stx_free
+ *
+ * @param[in] stx the compiled pattern
+ * @returns stx
+ */
+Stx *_stx_retain(Stx *stx) {
+    __sync_add_and_fetch(&stx->refs,1);
+    return stx;
+}
+
+/**
+ * choose the algorithm used to match a compiled semtrex
+ *
+ * patterns with repetitions nested in repetitions are compiled to use the linear engine,
+ * everything else uses the backtracker unless set otherwise
+ *
+ * @param[in] stx the compiled pattern
+ * @param[in] engine StxEngineBacktrack or StxEngineLinear
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/semtrex_spec.h testSemtrexLinear
+ */
+void _stx_set_engine(Stx *stx,StxEngine engine) {
+    stx->engine = engine;
+}
+
+int __stx_run(Stx *stx,T *t,T **rP) {
+    if (stx->engine == StxEngineLinear) return __stx_match_linear(stx->fa,t,rP);
+    return __stx_match(stx->fa,t,rP);
+}
+
+/**
+ * Match a tree against a compiled semtrex and get back match results
+ *
+ * @param[in] stx the compiled pattern
+ * @param[in] t the tree to match against the pattern
+ * @param[inout] rP a pointer to a T to be filled with a match results tree
+ * @returns 1 or 0 if matched or not
+ */
+int _stx_matchr(Stx *stx,T *t,T **rP) {
+    return __stx_run(stx,t,rP);
+}
+
+/**
+ * Match a tree against a compiled semtrex
+ *
+ * @param[in] stx the compiled pattern
+ * @param[in] t the tree to match against the pattern
+ * @returns 1 or 0 if matched or not
+ */
+int _stx_match(Stx *stx,T *t) {
+    return __stx_run(stx,t,NULL);
+}
+
+// patterns that get compiled from trees that are rebuilt each time they are used
+// (i.e. MATCH operands in run trees) are cached by their content
+typedef struct StxCacheEntry StxCacheEntry;
+struct StxCacheEntry {
+    uint32_t hash;
+    T *semtrex;           ///< copy of the compiled pattern to check hash hits against
+    Stx *stx;
+    StxCacheEntry *next;  ///< other entries with the same hash
+    UT_hash_handle hh;
+};
+
+StxCacheEntry *G_stx_cache = NULL;
+int G_stx_cache_entries = 0;
+pthread_mutex_t G_stx_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+uint32_t __stx_hash(T *t,uint32_t h) {
+    unsigned char *b = (unsigned char *)&t->contents.symbol;
+    int i;
+    for(i=0;i<sizeof(Symbol);i++) h = (h ^ b[i]) * 16777619;
+    size_t l = _t_size(t);
+    if (l && !(t->context.flags & TFLAG_SURFACE_IS_TREE)) {
+        b = _t_surface(t);
+        for(i=0;i<l;i++) h = (h ^ b[i]) * 16777619;
+    }
+    h = (h ^ _t_children(t)) * 16777619;
+    DO_KIDS(t,h = __stx_hash(_t_child(t,i),h));
+    return h;
+}
+
+bool __stx_equal(T *a,T *b) {
+    if (!semeq(_t_symbol(a),_t_symbol(b)) || _t_size(a) != _t_size(b) || _t_children(a) != _t_children(b)) return false;
+    if (_t_size(a) && memcmp(_t_surface(a),_t_surface(b),_t_size(a))) return false;
+    DO_KIDS(a,if (!__stx_equal(_t_child(a,i),_t_child(b,i))) return false);
+    return true;
+}
+
+// empty the shared cache (the cache mutex must be held), patterns that are being matched
+// with are retained by their matchers and get freed when those matches finish
+void __stx_clear_cache() {
+    StxCacheEntry *cur,*tmp,*n;
+    HASH_ITER(hh, G_stx_cache, cur, tmp) {
+        HASH_DEL(G_stx_cache,cur);
+        while(cur) {
+            n = cur->next;
+            _t_free(cur->semtrex);
+            _stx_free(cur->stx);
+            free(cur);
+            cur = n;
+        }
+    }
+    G_stx_cache_entries = 0;
+}
+
+// find the compiled version of a semtrex in the shared cache (the cache mutex must be held)
+StxCacheEntry *__stx_cache_find(T *semtrex,uint32_t h) {
+    StxCacheEntry *e;
+    HASH_FIND_INT(G_stx_cache,&h,e);
+    while(e && !__stx_equal(e->semtrex,semtrex)) e = e->next;
+    return e;
+}
+
+// find or add the compiled version of a semtrex in the shared cache, returning it
+// retained so the caller must _stx_free it when done
+Stx *__stx_cache_get(T *semtrex) {
+    uint32_t h = __stx_hash(semtrex,2166136261u);
+    StxCacheEntry *e,*head;
+    Stx *stx;
+    pthread_mutex_lock(&G_stx_cache_mutex);
+    e = __stx_cache_find(semtrex,h);
+    if (e) stx = _stx_retain(e->stx);
+    pthread_mutex_unlock(&G_stx_cache_mutex);
+    if (e) return stx;
+
+    // compile outside the lock so other patterns can be found in the meantime
+    stx = _stx_compile(semtrex);
+
+    pthread_mutex_lock(&G_stx_cache_mutex);
+    // another thread may have added the same pattern while we were compiling
+    e = __stx_cache_find(semtrex,h);
+    if (e) {
+        _stx_free(stx);
+        stx = _stx_retain(e->stx);
+    }
+    else {
+        // when the cache fills up, start it over rather than letting it grow without bound
+        if (G_stx_cache_entries >= STX_CACHE_MAX_ENTRIES) __stx_clear_cache();
+        e = malloc(sizeof(StxCacheEntry));
+        e->hash = h;
+        e->semtrex = _t_clone(semtrex);
+        e->stx = _stx_retain(stx);
+        HASH_FIND_INT(G_stx_cache,&h,head);
+        if (head) {
+            e->next = head->next;
+            head->next = e;
+        }
+        else {
+            e->next = NULL;
+            HASH_ADD_INT(G_stx_cache,hash,e);
+        }
+        G_stx_cache_entries++;
+    }
+    pthread_mutex_unlock(&G_stx_cache_mutex);
+    return stx;
+}
+
+/**
+ * Match a tree against a semtrex using the shared cache of compiled patterns
+ *
+ * this is for matching with semtrex trees that get rebuilt every time they are used
+ * (like the operands of a MATCH in a run tree) so that the pattern only gets compiled once
+ *
+ * @param[in] semtrex the semtrex pattern tree
+ * @param[in] t the tree to match against the pattern
+ * @param[inout] rP a pointer to a T to be filled with a match results tree (nil if no results needed)
+ * @returns 1 or 0 if matched or not
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/semtrex_spec.h testSemtrexCompile
+ */
+int _stx_cached_match(T *semtrex,T *t,T **rP) {
+    Stx *stx = __stx_cache_get(semtrex);
+    int matched = __stx_run(stx,t,rP);
+    _stx_free(stx);
+    return matched;
+}
+
+/**
+ * free all the patterns in the shared pattern cache
+ */
+void _stx_free_cache() {
+    pthread_mutex_lock(&G_stx_cache_mutex);
+    __stx_clear_cache();
+    pthread_mutex_unlock(&G_stx_cache_mutex);
+}
+
 T *_stx_get_matched_node(Symbol s,T *match_results,T *match_tree,int *sibs) {
     T *m = _t_get_match(match_results,s);
     if (!m) {
@@ -1140,22 +1784,24 @@ void _stxl(T *stxx) {
 
 // temporary function until we get system label table operational
 Symbol get_symbol(char *symbol_name,SemTable *sem) {
-    int ctx;
-    for (ctx=0;ctx<sem->contexts;ctx++) {
+    int ctx,n = __atomic_load_n(&sem->contexts,__ATOMIC_ACQUIRE);
+    Symbol r = NULL_SYMBOL;
+    for (ctx=0;ctx<n && semeq(r,NULL_SYMBOL);ctx++) {
         ContextStore *cs = __sem_context(sem,ctx);
         if (!cs->definitions) continue;
-        T *symbols = __sem_get_defs(sem,SEM_TYPE_SYMBOL,ctx);
-        int i,c = _t_children(symbols);
-        for(i=1;i<=c;i++) {
-            T *t = _t_child(symbols,i);
-            T *c = _t_child(_t_child(t,DefLabelIdx),1);
+        int i;
+        T *t;
+        for(i=1;(t = ___sem_get_def(sem,SEM_TYPE_SYMBOL,ctx,i));i++) {
+            T *c = _t_child(__sem_def_labels(t),1);
             if (!strcmp(symbol_name,(char *)_t_surface(c))) {
-                Symbol r = {ctx,SEM_TYPE_SYMBOL,i};
-                return r;
+                r.context = ctx;
+                r.semtype = SEM_TYPE_SYMBOL;
+                r.id = i;
+                break;
             }
         }
     }
-    return NULL_SYMBOL;
+    return r;
 }
 
 //#define DUMP_TOKENS
@@ -1474,7 +2120,7 @@ T *parseSemtrex(SemTable *sem,char *stx) {
         while (_t_matchr(sxx,tokens,&results)) {
             g = wrap(tokens,results,STX_SET,STX_OS);
             // convert the STX_OS to STX_SET and free the STX_CS
-            g->contents.symbol = STX_SET;
+            _t_set_symbol(g,STX_SET);
             // zap STX_COMMAs
             int cc = _t_children(g);
             T *v = _t_child(g,1);
@@ -1523,7 +2169,7 @@ T *parseSemtrex(SemTable *sem,char *stx) {
             int *path = (int *)_t_surface(_t_child(m,2));
             t = _t_get(tokens,path);
             Symbol val_type = _t_symbol(t);
-            t->contents.symbol = semeq(val_type,STX_EQ) ? SEMTREX_VALUE_LITERAL : SEMTREX_VALUE_LITERAL_NOT;
+            _t_set_symbol(t,semeq(val_type,STX_EQ) ? SEMTREX_VALUE_LITERAL : SEMTREX_VALUE_LITERAL_NOT);
 
             T *p = _t_parent(t);
             T *v = _t_next_sibling(t);
@@ -1534,14 +2180,14 @@ T *parseSemtrex(SemTable *sem,char *stx) {
 
             if (semeq(_t_symbol(v),STX_SET)) {
                 set = v;
-                v->contents.symbol = SEMTREX_VALUE_SET;
+                _t_set_symbol(v,SEMTREX_VALUE_SET);
                 set_count = _t_children(v);
                 v = _t_child(v,1);
                 while(set_count--) {
                     char *symbol_name = (char *)_t_surface(t);
                     Symbol vs = get_symbol(symbol_name,sem);
                     // convert the STX_VAL structure token to the semantic type specified by the value literal
-                    v->contents.symbol = vs;
+                    _t_set_symbol(v,vs);
                     v = _t_next_sibling(v);
                 }
                 _t_add(t,set);
@@ -1551,7 +2197,7 @@ T *parseSemtrex(SemTable *sem,char *stx) {
                 char *symbol_name = (char *)_t_surface(t);
                 Symbol vs = get_symbol(symbol_name,sem);
                 // convert the STX_VAL structure token to the semantic type specified by the value literal
-                v->contents.symbol = vs;
+                _t_set_symbol(v,vs);
                 _t_add(t,v);
             }
 
@@ -1583,7 +2229,7 @@ T *parseSemtrex(SemTable *sem,char *stx) {
         while (_t_matchr(sxx,tokens,&results)) {
             g = wrap(tokens,results,STX_SIBS,STX_OP);
             // convert the STX_OP to STX_SIBS and free the STX_CP
-            g->contents.symbol = STX_SIBS;
+            _t_set_symbol(g,STX_SIBS);
             _t_free(results);
         }
         _t_free(sxx);
@@ -1666,11 +2312,11 @@ T *parseSemtrex(SemTable *sem,char *stx) {
             T *c = _t_get(tokens,path);
             _t_add(c,t);
             if (semeq(_t_symbol(c),STX_PLUS ))
-                c->contents.symbol = SEMTREX_ONE_OR_MORE;
+                _t_set_symbol(c,SEMTREX_ONE_OR_MORE);
             else if (semeq(_t_symbol(c),STX_STAR ))
-                c->contents.symbol = SEMTREX_ZERO_OR_MORE;
+                _t_set_symbol(c,SEMTREX_ZERO_OR_MORE);
             else if (semeq(_t_symbol(c),STX_Q ))
-                c->contents.symbol = SEMTREX_ZERO_OR_ONE;
+                _t_set_symbol(c,SEMTREX_ZERO_OR_ONE);
 
             _t_free(results);
         }
@@ -1701,7 +2347,7 @@ T *parseSemtrex(SemTable *sem,char *stx) {
             _t_detach_by_ptr(parent,c);
             // reatach it to to the morphed STX_NOT
             T *n = _t_child(parent,x);
-            n->contents.symbol = SEMTREX_NOT;
+            _t_set_symbol(n,SEMTREX_NOT);
             _t_add(n,c);
             _t_free(results);
         }
@@ -1781,7 +2427,7 @@ T *parseSemtrex(SemTable *sem,char *stx) {
                     Symbol sy = get_symbol(symbol_name,sem);
                     __t_morph(x,SEMTREX_SYMBOL,&sy,sizeof(Symbol),1);
                     );
-            t->contents.symbol = SEMTREX_SYMBOL_SET;
+            _t_set_symbol(t,SEMTREX_SYMBOL_SET);
             T *x = _t_new_root(not?SEMTREX_SYMBOL_LITERAL_NOT:SEMTREX_SYMBOL_LITERAL);
             _t_detach_by_ptr(parent,t);
             _t_add(x,t);
@@ -1809,7 +2455,7 @@ T *parseSemtrex(SemTable *sem,char *stx) {
             t = _t_get(tokens,path);
             char *symbol_name = (char *)_t_surface(t);
             Symbol sy = get_symbol(symbol_name,sem);
-            t->contents.symbol = semeq(t->contents.symbol,STX_LABEL)?SEMTREX_SYMBOL_LITERAL:SEMTREX_SYMBOL_LITERAL_NOT;
+            _t_set_symbol(t,semeq(t->contents.symbol,STX_LABEL)?SEMTREX_SYMBOL_LITERAL:SEMTREX_SYMBOL_LITERAL_NOT);
             T *ss = _t_news(0,SEMTREX_SYMBOL,sy);
             int pp[2] = {1,TREE_PATH_TERMINATOR};
             _t_insert_at(t,pp,ss);
@@ -1890,7 +2536,7 @@ T *parseSemtrex(SemTable *sem,char *stx) {
             o = _t_child(parent,x);
             _t_add(o,c1);
             _t_add(o,c2);
-            o->contents.symbol = SEMTREX_OR;
+            _t_set_symbol(o,SEMTREX_OR);
             _t_free(results);
         }
         _t_free(sxx);
@@ -1917,7 +2563,7 @@ T *parseSemtrex(SemTable *sem,char *stx) {
             T *c = _t_child(parent,x+1);
             _t_detach_by_ptr(parent,c);
             _t_add(t,c);
-            t->contents.symbol = SEMTREX_WALK;
+            _t_set_symbol(t,SEMTREX_WALK);
 
             _t_free(results);
         }
@@ -1998,7 +2644,7 @@ void __stx_r2fi(SemTable *sem,T *mr,T *mt, T *sem_map) {
 
         // the structures are the same then we can just set the symbol type
         if (semeq(mrs,xs)) {
-            x->contents.symbol = msym;
+            _t_set_symbol(x,msym);
         }
         else {
             // otherwise try embody from match
@@ -93,8 +93,43 @@ struct SState {
 };
 SState *G_cur_stx_state;  // global for highlighting the current state when doing an stx FSA dump
 
+/**
+ * A semtrex compiled into its FSA so that it can be matched many times without being rebuilt
+ */
+struct Stx {
+    SState *fa;         ///< the start state of the FSA
+    int states;         ///< number of states in the FSA
+    int engine;         ///< which matching algorithm to walk the FSA with
+    int refs;           ///< number of holders, the FSA is freed when the last one lets go
+};
+
+/**
+ * The algorithms available for matching a compiled semtrex
+ *
+ * The backtracker is fastest for simple patterns, but can take exponential time on
+ * repetitions nested in repetitions, and has a limited branch depth.  The linear engine
+ * finds the same matches in time linear in the size of the tree being matched.
+ */
+enum StxEngine {StxEngineBacktrack,StxEngineLinear};
+typedef int StxEngine;
+
+/// the number of patterns the shared cache holds before it gets emptied
+#define STX_CACHE_MAX_ENTRIES 1024
+
 SState * _stx_makeFA(T *s,int *statesP);
 void _stx_freeFA(SState *s);
+int __stx_match(SState *fa,T *source_t,T **rP);
+int __stx_match_linear(SState *fa,T *source_t,T **rP);
+Stx *_stx_compile(T *semtrex);
+Stx *_stx_compile_group(T *semtrex,Symbol group);
+void _stx_free(Stx *stx);
+Stx *_stx_retain(Stx *stx);
+void _stx_set_engine(Stx *stx,StxEngine engine);
+int _stx_match(Stx *stx,T *t);
+int _stx_matchr(Stx *stx,T *t,T **rP);
+int _stx_cached_match(T *semtrex,T *t,T **rP);
+void _stx_free_cache();
+Symbol _stx_root_symbol(T *semtrex);
 int _t_match(T *semtrex,T *t);
 int _t_matchr(T *semtrex,T *t,T **r);
 T *_stx_get_matched_node(Symbol s,T *match_results,T *match_tree,int *sibs);
@@ -11,6 +11,8 @@
 
 #include "stream.h"
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -21,6 +23,10 @@
 #include <signal.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 
 #include "process.h"
@@ -39,10 +45,129 @@
 char *DELIM_LF = "\n";
 char *DELIM_CRLF = "\r\n";
 
+/**
+ * allocate a reader block with room for size bytes (plus a null)
+ */
+StreamBlock *__st_new_block(size_t size) {
+    StreamBlock *b;
+    if (sizeof(StreamBlock)+size+1 <= STREAM_BLOCK_SIZE) {
+        b = aligned_alloc(STREAM_BLOCK_SIZE,STREAM_BLOCK_SIZE);
+        b->sliceable = true;
+    }
+    else {
+        b = malloc(sizeof(StreamBlock)+size+1);
+        b->sliceable = false;
+    }
+    b->refs = 1;
+    b->size = size;
+    return b;
+}
+
+void __st_release_block(StreamBlock *b) {
+    if (!__sync_sub_and_fetch(&b->refs,1)) free(b);
+}
+
+/**
+ * move a reader on to the next block in its ring that nobody else is using
+ *
+ * if all the other blocks still have slices out, the next one is let go of
+ * (its slices keep it alive) and replaced with a new block.
+ */
+StreamBlock *__st_next_block(Stream *st,size_t size) {
+    int i,pos;
+    StreamBlock *b;
+    for(i=1;i<=STREAM_RING_BLOCKS;i++) {
+        pos = (st->ring_pos+i) % STREAM_RING_BLOCKS;
+        b = st->ring[pos];
+        if (b && b->refs == 1 && b->size >= size) {
+            st->ring_pos = pos;
+            return b;
+        }
+    }
+    pos = (st->ring_pos+1) % STREAM_RING_BLOCKS;
+    if (st->ring[pos]) __st_release_block(st->ring[pos]);
+    debug(D_STREAM,"new ring block of %ld\n",size);
+    st->ring_pos = pos;
+    return st->ring[pos] = __st_new_block(size);
+}
+
+/**
+ * make room in a full reader buffer
+ *
+ * the units already scanned are dropped by moving the partial unit to the start of
+ * the buffer, or if it has slices out, to the start of another block in the ring.
+ * The buffer only grows if the partial unit fills all of it.
+ * Buffers that weren't set up with a ring (i.e. set by hand) are just doubled.
+ */
 void __st_realloc_reader(Stream *st) {
-    st->buf_size *= 2;
-    debug(D_STREAM,"realloc buffer to %ld\n",st->buf_size);
-    st->buf = realloc(st->buf,st->buf_size+1);  //add 1 for a null
+    StreamBlock *b = st->ring[st->ring_pos];
+    if (!b) {
+        st->buf_size *= 2;
+        debug(D_STREAM,"realloc buffer to %ld\n",st->buf_size);
+        st->buf = realloc(st->buf,st->buf_size+1);  //add 1 for a null
+        return;
+    }
+    size_t shift = (st->scan_state == StreamScanPartial) ? st->unit_start : 0;
+    size_t keep = st->bytes_used - shift;
+    size_t size = shift ? b->size : b->size*2;
+    if (b->refs == 1 && size == b->size) {
+        debug(D_STREAM,"compacting buffer by %ld\n",shift);
+        memmove(b->data,b->data+shift,keep);
+    }
+    else {
+        StreamBlock *nb = __st_next_block(st,size);
+        memcpy(nb->data,b->data+shift,keep);
+        b = nb;
+    }
+    st->buf = b->data;
+    st->buf_size = b->size;
+    st->bytes_used = keep;
+    st->unit_start -= shift;
+    st->partial -= shift;
+}
+
+/**
+ * start a reader's buffer over once it has been completely scanned
+ */
+void __st_reset_reader(Stream *st) {
+    StreamBlock *b = st->ring[st->ring_pos];
+    if (b && b->refs > 1) {
+        b = __st_next_block(st,b->size);
+        st->buf = b->data;
+        st->buf_size = b->size;
+    }
+    st->bytes_used = 0;
+}
+
+// let go of a reader's blocks, any that still have slices out are freed when those are released
+void __st_free_reader_buffer(Stream *st) {
+    int i;
+    for(i=0;i<STREAM_RING_BLOCKS;i++)
+        if (st->ring[i]) __st_release_block(st->ring[i]);
+}
+
+/**
+ * get the current unit as a slice that stays valid after the stream moves on
+ *
+ * the unit is null terminated in place, and the slice holds a reference on its block
+ * until it is released with _st_release_slice.
+ *
+ * @returns the slice, or NULL if the unit isn't in a block that can be sliced
+ * (in which case the caller should copy it)
+ */
+char *_st_data_slice(Stream *st) {
+    StreamBlock *b = st->ring[st->ring_pos];
+    if (!b || !b->sliceable) return NULL;
+    __sync_add_and_fetch(&b->refs,1);
+    _st_data(st)[_st_data_size(st)] = 0;
+    return _st_data(st);
+}
+
+/**
+ * release a slice from _st_data_slice
+ */
+void _st_release_slice(void *slice) {
+    __st_release_block((StreamBlock *)((uintptr_t)slice & ~(uintptr_t)(STREAM_BLOCK_SIZE-1)));
 }
 
 /**
@@ -128,11 +253,15 @@ size_t __st_socket_stream_load(Stream *st) {
 /**
  * scan a stream's buffer for a unit
  *
- * currently a unit simply is defined by a new-line char
- * @todo allow other delimiters, or even simply a length, to mark off a unit.
+ * a unit is terminated by the stream's delimiter.  We use memchr (which libc
+ * vectorizes) to jump to candidates for the delimiter's first byte and then
+ * verify the rest of the delimiter.  If the end of the buffer holds a prefix
+ * of the delimiter the partial scan resumes from that prefix, so delimiters
+ * that get split across loads are still found.
  */
 void __st_scan(Stream *st) {
     int delim_len = st->delim_len;
+    char *delim = st->delim;
     // if this is the initial scan, then setup the unit_start to 0
     if (st->scan_state == StreamScanInitial)
         st->unit_start = 0;
@@ -148,18 +277,27 @@ void __st_scan(Stream *st) {
 
     // set the current read offset taking into account previous partial scans
     size_t i=  (st->scan_state == StreamScanPartial) ? st->partial : st->unit_start;
-
-    int chars_matched = 0;
-    while (i<st->bytes_used) {
-        if (st->buf[i] == st->delim[chars_matched]) chars_matched++;
-        if (chars_matched == delim_len) {
-            st->scan_state = StreamScanSuccess;
-            st->unit_size = i - st->unit_start - (delim_len -1);
+    char *end = st->buf + st->bytes_used;
+    char *p = st->buf + i;
+
+    while ((p = memchr(p,delim[0],end-p))) {
+        size_t left = end-p;
+        if (left >= delim_len) {
+            if (!memcmp(p,delim,delim_len)) {
+                st->scan_state = StreamScanSuccess;
+                st->unit_size = p - st->buf - st->unit_start;
+                return;
+            }
+        }
+        // the buffer ends part way through what may be the delimiter
+        else if (!memcmp(p,delim,left)) {
+            st->partial = p - st->buf;
+            st->scan_state = StreamScanPartial;
             return;
         }
-        i++;
+        p++;
     }
-    st->partial = i;
+    st->partial = st->bytes_used;
     st->scan_state = StreamScanPartial;
 }
 
@@ -204,16 +342,22 @@ void __st_stream_read(Stream *st) {
     else raise_error("unknown stream type");
 
     if (l==0) {
+        // non-blocking sockets just report that there's nothing more to read yet
+        // so we return and let the reactor try again when the socket is readable
+        if (st->type == SocketStream && (st->err == EAGAIN || st->err == EWOULDBLOCK)) {
+            debug(D_STREAM,"load would block. scan state: %s\n",ss2str(st->scan_state));
+            return;
+        }
         debug(D_STREAM,"load return zero, clearing alive bit. scan state: %s\n",ss2str(st->scan_state));
         if (st->scan_state == StreamScanPartial) {
             // treat as successful line
             st->scan_state = StreamScanComplete;
-            st->flags |= StreamHasData;
+            __st_set_flags(st,StreamHasData);
         }
         else if (st->scan_state == StreamScanInitial)
             st->scan_state = StreamScanComplete;
 
-        st->flags &= ~StreamAlive;
+        __st_clear_flags(st,StreamAlive);
         return;
     }
  scan:
@@ -221,7 +365,7 @@ void __st_stream_read(Stream *st) {
     debug(D_STREAM,"scanned with state: %s\n",ss2str(st->scan_state));
     if (st->scan_state == StreamScanSuccess) {
         debug(D_STREAM,"scan value: %.*s\n",(int)_st_data_size(st),_st_data(st));
-        st->flags |= StreamHasData;
+        __st_set_flags(st,StreamHasData);
         return;
     }
     else if (st->scan_state == StreamScanPartial) {
@@ -230,7 +374,7 @@ void __st_stream_read(Stream *st) {
     }
     else if (st->scan_state == StreamScanComplete) {
         debug(D_STREAM,"buffer fully read, reinitialzing buffer\n");
-        st->bytes_used = 0;
+        __st_reset_reader(st);
         goto init;
     }
     raise_error("unknown scan state!");
@@ -243,10 +387,14 @@ void *_st_stream_read(void *arg) {
     do {
         debug(D_STREAM,"wating for read.\n");
         pthread_mutex_lock(&st->mutex);
-        st->flags |= StreamAlive; // don't change the state until the mutex is locked
-        st->flags |= StreamWaiting;
-        pthread_cond_wait(&st->cv, &st->mutex);
-        st->flags &= ~StreamWaiting;
+        __st_set_flags(st,StreamAlive); // don't change the state until the mutex is locked
+        __st_set_flags(st,StreamWaiting);
+        // the read may have already been requested while we were running the callback
+        while (!st->read_requested) {
+            pthread_cond_wait(&st->cv, &st->mutex);
+        }
+        st->read_requested = false;
+        __st_clear_flags(st,StreamWaiting);
 
         if (!(st->flags & StreamHasData) && _st_is_alive(st)) {
             debug(D_STREAM,"starting read.\n");
@@ -267,6 +415,193 @@ void *_st_stream_read(void *arg) {
     pthread_exit(NULL);
 }
 
+/**
+ * the stream reactor: a single thread that waits on an epoll set for all the
+ * socket streams and does their reads, rather than each socket stream blocking
+ * in its own reader thread.
+ */
+typedef struct Reactor {
+    int epfd;
+    int wakefd;            ///< eventfd used to wake the reactor when reads are requested
+    pthread_mutex_t mutex;
+    Stream *ready;         ///< streams that have a read requested and should be tried now
+    Stream *dead;          ///< freed streams waiting for the reactor to let go of them
+    int streams;           ///< count of streams in the reactor, it stops when they are all freed
+    bool running;
+} Reactor;
+
+static Reactor G_reactor = {.epfd = -1,.wakefd = -1,.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+void __st_reactor_wake(Reactor *r) {
+    uint64_t one = 1;
+    if (write(r->wakefd,&one,sizeof(one)) != sizeof(one) && errno != EAGAIN)
+        raise_error("reactor wake failed: %d",errno);
+}
+
+// add a stream to the ready list, must be called with the reactor mutex locked
+void __st_reactor_queue(Reactor *r,Stream *st) {
+    if (st->reactor_queued || (st->flags & StreamFreed) || !st->read_requested) return;
+    st->reactor_queued = true;
+    st->reactor_next = r->ready;
+    r->ready = st;
+}
+
+// try to read a unit without blocking, returns true if the read is finished
+bool __st_reactor_read(Stream *st) {
+    if (!(st->flags & StreamHasData) && _st_is_alive(st)) {
+        debug(D_STREAM,"reactor starting read.\n");
+        __st_stream_read(st);
+    }
+    return (st->flags & StreamHasData) || !_st_is_alive(st);
+}
+
+// reactor thread function
+void *__st_reactor(void *arg) {
+    Reactor *r = (Reactor *) arg;
+    struct epoll_event events[STREAM_REACTOR_EVENTS];
+    Stream *st,*ready,*done,*pending;
+    uint64_t count;
+    int i,n;
+
+    for(;;) {
+        pthread_mutex_lock(&r->mutex);
+        // no callbacks are running now, so nothing else can be using freed streams
+        while ((st = r->dead)) {
+            r->dead = st->reactor_next;
+            r->streams--;
+            __st_free_reader_buffer(st);
+            pthread_mutex_destroy(&st->mutex);
+            pthread_cond_destroy(&st->cv);
+            free(st);
+        }
+        // with no streams left there's nothing to wait for, so let the process
+        // exit and start up again with the next socket stream
+        if (!r->streams) {
+            r->running = false;
+            pthread_mutex_unlock(&r->mutex);
+            debug(D_STREAM,"reactor finished.\n");
+            pthread_exit(NULL);
+        }
+        pthread_mutex_unlock(&r->mutex);
+
+        n = epoll_wait(r->epfd,events,STREAM_REACTOR_EVENTS,-1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            raise_error("epoll_wait failed: %d",errno);
+        }
+
+        pthread_mutex_lock(&r->mutex);
+        for(i=0;i<n;i++) {
+            st = events[i].data.ptr;
+            if (st) __st_reactor_queue(r,st);
+            else if (read(r->wakefd,&count,sizeof(count)) < 0 && errno != EAGAIN)
+                raise_error("reactor wake read failed: %d",errno);
+        }
+        ready = r->ready;
+        r->ready = NULL;
+        pthread_mutex_unlock(&r->mutex);
+
+        // the reads only hold their own stream's lock, so other threads can request
+        // reads and add streams in the meantime.  The streams stay marked as queued
+        // so they can't be put on the ready list again until they're sorted out below
+        done = pending = NULL;
+        while ((st = ready)) {
+            ready = st->reactor_next;
+            pthread_mutex_lock(&st->mutex);
+            bool finished = !(st->flags & StreamFreed) && __st_reactor_read(st);
+            pthread_mutex_unlock(&st->mutex);
+            if (finished) {
+                st->callback_next = done;
+                done = st;
+            }
+            else {
+                st->reactor_next = pending;
+                pending = st;
+            }
+        }
+
+        pthread_mutex_lock(&r->mutex);
+        for(st=done;st;st=st->callback_next) {
+            st->reactor_queued = false;
+            st->read_requested = false;
+            __st_set_flags(st,StreamWaiting);
+        }
+        while ((st = pending)) {
+            pending = st->reactor_next;
+            st->reactor_queued = false;
+            if (st->flags & StreamFreed) continue;
+            struct epoll_event ev = {EPOLLIN|EPOLLRDHUP|EPOLLONESHOT,{.ptr = st}};
+            if (epoll_ctl(r->epfd,EPOLL_CTL_MOD,st->data.socket_stream,&ev))
+                raise_error("couldn't re-arm stream in reactor: %d",errno);
+        }
+        pthread_mutex_unlock(&r->mutex);
+
+        // callbacks run without the lock so they can request the next read
+        while ((st = done)) {
+            done = st->callback_next;
+            if (!(st->flags & StreamFreed) && st->callback) {
+                (st->callback)(st);
+            }
+        }
+    }
+    return NULL;
+}
+
+// get the reactor, creating its epoll set on first use
+Reactor *__st_reactor_get() {
+    Reactor *r = &G_reactor;
+    pthread_mutex_lock(&r->mutex);
+    if (r->epfd == -1) {
+        r->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (r->epfd == -1) raise_error("epoll_create1 failed: %d",errno);
+        r->wakefd = eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+        if (r->wakefd == -1) raise_error("eventfd failed: %d",errno);
+        struct epoll_event ev = {EPOLLIN,{.ptr = NULL}};
+        if (epoll_ctl(r->epfd,EPOLL_CTL_ADD,r->wakefd,&ev))
+            raise_error("couldn't add wake fd to reactor: %d",errno);
+    }
+    pthread_mutex_unlock(&r->mutex);
+    return r;
+}
+
+/**
+ * set up a socket stream as a reader driven by the reactor
+ *
+ * the socket is made non-blocking and registered with the reactor's epoll set,
+ * but disarmed until a read is requested with _st_start_read
+ */
+void __st_start_reactor_reader(Stream *s,size_t reader_buffer_size) {
+    Reactor *r = __st_reactor_get();
+    int fd = s->data.socket_stream;
+
+    s->flags |= StreamReader|StreamReactor|StreamAlive|StreamWaiting;
+    s->ring[0] = __st_new_block(reader_buffer_size);
+    s->buf = s->ring[0]->data;
+    s->buf_size = reader_buffer_size;
+    pthread_mutex_init(&(s->mutex), NULL);
+    pthread_cond_init(&(s->cv), NULL);
+
+    int fl = fcntl(fd,F_GETFL,0);
+    if (fl == -1 || fcntl(fd,F_SETFL,fl|O_NONBLOCK) == -1)
+        raise_error("couldn't make socket non-blocking: %d",errno);
+
+    struct epoll_event ev = {EPOLLONESHOT,{.ptr = s}};
+    pthread_mutex_lock(&r->mutex);
+    if (epoll_ctl(r->epfd,EPOLL_CTL_ADD,fd,&ev))
+        raise_error("couldn't add stream to reactor: %d",errno);
+    r->streams++;
+    if (!r->running) {
+        pthread_t pthread;
+        int rc = pthread_create(&pthread,0,__st_reactor,r);
+        if (rc){
+            raise_error("Error starting reactor thread; return code from pthread_create() is %d\n", rc);
+        }
+        pthread_detach(pthread);
+        r->running = true;
+    }
+    pthread_mutex_unlock(&r->mutex);
+}
+
 // lo level stream allocator function
 Stream *__st_alloc_stream() {
     Stream *s = malloc(sizeof(Stream));
@@ -274,6 +609,7 @@ Stream *__st_alloc_stream() {
     s->flags = StreamCloseOnFree;
     s->delim = DELIM_LF;
     s->delim_len = 1;
+    s->write_timeout = STREAM_WRITE_TIMEOUT;
     return s;
 }
 
@@ -285,7 +621,8 @@ Stream *__st_alloc_stream() {
 void __st_start_reader(Stream *s,size_t reader_buffer_size) {
     s->flags |= StreamReader;
 
-    s->buf = malloc(reader_buffer_size+1);
+    s->ring[0] = __st_new_block(reader_buffer_size);
+    s->buf = s->ring[0]->data;
     s->buf_size = reader_buffer_size;
     pthread_mutex_init(&(s->mutex), NULL);
     pthread_cond_init(&(s->cv), NULL);
@@ -318,14 +655,16 @@ Stream *__st_new_unix_stream(FILE *stream,size_t reader_buffer_size) {
 }
 
 /**
- * create a new stream object of the unix file flavor
+ * create a new stream object of the socket flavor
+ *
+ * socket streams don't get their own reader thread, their reads are done by the reactor
  */
 Stream *_st_new_socket_stream(int sockfd) {
     Stream *s =  __st_alloc_stream();
     s->type = SocketStream;
     s->data.socket_stream = sockfd;
 
-    __st_start_reader(s, DEFAULT_READER_BUFFER_SIZE);
+    __st_start_reactor_reader(s, DEFAULT_READER_BUFFER_SIZE);
 
     return s;
 }
@@ -459,7 +798,7 @@ void _st_close_listener(SocketListener *l) {
 }
 
 /**
- * wake the stream reader thread
+ * wake the stream reader thread, or for socket streams ask the reactor for a read
 */
 void _st_start_read(Stream *st) {
 
@@ -467,8 +806,20 @@ void _st_start_read(Stream *st) {
     // @todo figure out why this didn't work by testing the value of StreamAlive which is
     // also cleared in _st_kill at the same time StreamDying is set.
     if ((st->flags & StreamHasData) && !(st->flags & StreamDying)) {raise_error("stream data hasn't been consumed!");}
+    if (st->flags & StreamReactor) {
+        Reactor *r = __st_reactor_get();
+        debug(D_STREAM,"requesting reactor read\n");
+        pthread_mutex_lock(&r->mutex);
+        st->read_requested = true;
+        __st_clear_flags(st,StreamWaiting);
+        __st_reactor_queue(r,st);
+        pthread_mutex_unlock(&r->mutex);
+        __st_reactor_wake(r);
+        return;
+    }
     debug(D_STREAM,"waking stream reader\n");
     pthread_mutex_lock(&st->mutex);
+    st->read_requested = true;
     pthread_cond_signal(&st->cv);
     pthread_mutex_unlock(&st->mutex);
 }
@@ -478,7 +829,7 @@ void _st_start_read(Stream *st) {
  */
 void _st_data_consumed(Stream *st) {
     debug(D_STREAM,"marking data as read\n");
-    st->flags &= ~StreamHasData;
+    __st_clear_flags(st,StreamHasData);
 }
 
 /**
@@ -493,8 +844,10 @@ void _st_kill(Stream *st) {
         return;
     }
 
-    st->flags &= ~StreamAlive;
-    st->flags |= StreamDying;
+    // anything still buffered has to go out before the stream is shut down
+    if (st->obuf_used) __st_out(st,NULL,0);
+    __st_clear_flags(st,StreamAlive);
+    __st_set_flags(st,StreamDying);
     if (st->type == SocketStream) {
         debug(D_SOCKET,"shutting down socket in st_kill\n");
         shutdown(st->data.socket_stream,SHUT_RDWR);
@@ -502,7 +855,9 @@ void _st_kill(Stream *st) {
     if (st->flags & StreamReader) {
         debug(D_STREAM,"shutting down reader in st_kill\n");
         st->scan_state = StreamScanComplete;
-        if (st->flags & StreamWaiting) {
+        // a pending reactor read will see the shutdown socket as readable, so
+        // there's no reader thread to wake up
+        if (_st_has_reader_thread(st) && (st->flags & StreamWaiting)) {
             _st_start_read(st);
             while(st->flags & StreamWaiting) {sleepms(1);};
         }
@@ -515,6 +870,29 @@ void _st_kill(Stream *st) {
  */
 void _st_free(Stream *st) {
 
+    if (st->obuf_used) __st_out(st,NULL,0);
+    if (st->flags & StreamReactor) {
+        // take the stream out of the reactor before its socket gets closed
+        Reactor *r = __st_reactor_get();
+        pthread_mutex_lock(&r->mutex);
+        epoll_ctl(r->epfd,EPOLL_CTL_DEL,st->data.socket_stream,NULL);
+        // taking the stream's lock waits out a read the reactor may be doing on it
+        pthread_mutex_lock(&st->mutex);
+        __st_set_flags(st,StreamFreed);
+        pthread_mutex_unlock(&st->mutex);
+        // a queued stream is either still on the ready list or being read, in which
+        // case the reactor drops it when it sees it's been freed
+        if (st->reactor_queued) {
+            Stream **p = &r->ready;
+            while (*p && *p != st) p = &(*p)->reactor_next;
+            if (*p) {
+                *p = st->reactor_next;
+                st->reactor_queued = false;
+            }
+        }
+        pthread_mutex_unlock(&r->mutex);
+        _st_kill(st);
+    }
     if (st->flags & StreamCloseOnFree) {
         debug(D_STREAM,"cleaning up stream\n");
 
@@ -526,10 +904,22 @@ void _st_free(Stream *st) {
         //else raise_error("unknown stream type:%d\n",st->type);
     }
     _st_kill(st);
+    free(st->obuf);
+    if (st->flags & StreamReactor) {
+        // the reactor may still be about to report a read on this stream,
+        // so it does the final cleanup
+        Reactor *r = __st_reactor_get();
+        pthread_mutex_lock(&r->mutex);
+        st->reactor_next = r->dead;
+        r->dead = st;
+        pthread_mutex_unlock(&r->mutex);
+        __st_reactor_wake(r);
+        return;
+    }
     //@todo who should clean up the mutexes??
     if (st->flags & StreamReader) {
         debug(D_STREAM,"cleaning up reader\n");
-        free(st->buf);
+        __st_free_reader_buffer(st);
         pthread_mutex_destroy(&st->mutex);
         pthread_cond_destroy(&st->cv);
     }
@@ -537,15 +927,38 @@ void _st_free(Stream *st) {
 }
 
 /**
- * write to a stream
+ * write gathered pieces out to a stream
+ *
+ * sockets get the whole vector in as few sendmsg calls as the kernel allows, unix
+ * streams get it fwritten and then flushed once.  Anything already in the stream's
+ * output buffer goes out first.
  *
+ * @returns the number of bytes written from iov, or -1 on error
  */
-int _st_write(Stream *st,char *buf,size_t len) {
-    int bytes_written;
+int __st_out(Stream *st,struct iovec *iov,int iovcnt) {
+    struct iovec v[STREAM_IOV_MAX+1];
+    int i,n = 0;
+    ssize_t total = 0;
+    ssize_t buffered = st->obuf_used;
+
+    // put the buffered output in front of what's being written
+    if (buffered) {
+        v[n].iov_base = st->obuf;
+        v[n++].iov_len = buffered;
+        st->obuf_used = 0;
+    }
+
     if (st->type == UnixStream) {
         FILE *stream = st->data.unix_stream;
-        bytes_written = fwrite(buf,sizeof(char),len,stream);
-        if (bytes_written > 0) {
+        for(i=0;i<n;i++) {
+            if (fwrite(v[i].iov_base,1,v[i].iov_len,stream) != v[i].iov_len) return -1;
+        }
+        for(i=0;i<iovcnt;i++) {
+            size_t w = fwrite(iov[i].iov_base,1,iov[i].iov_len,stream);
+            total += w;
+            if (w != iov[i].iov_len) break;
+        }
+        if (total+buffered > 0) {
             // reading and restoring the stream position here is due to a bug in the glibc 2.23
             // see: https://sourceware.org/bugzilla/show_bug.cgi?id=20005
             long pos = ftell(stream);
@@ -553,6 +966,7 @@ int _st_write(Stream *st,char *buf,size_t len) {
             if (err) raise_error("got error on flush: %d",errno);
             fseek(stream,pos,SEEK_SET);
         }
+        if (i < iovcnt) return -1;
     }
     else if (st->type == SocketStream) {
 
@@ -564,28 +978,148 @@ int _st_write(Stream *st,char *buf,size_t len) {
             raise_error("couldn't set SO_NOSIGPIPE");
         }
 #endif
-
-        bytes_written = send(st->data.socket_stream,buf,len,MSG_NOSIGNAL);
+        struct msghdr msg;
+        memset(&msg,0,sizeof(msg));
+        while (n || iovcnt) {
+            // top the vector up from iov
+            while (n < STREAM_IOV_MAX && iovcnt) {
+                v[n++] = *iov++;
+                iovcnt--;
+            }
+            msg.msg_iov = v;
+            msg.msg_iovlen = n;
+            ssize_t w = sendmsg(st->data.socket_stream,&msg,MSG_NOSIGNAL);
+            if (w < 0) {
+                // reactor sockets are non-blocking so wait a while for room to send,
+                // but don't hang the writer on a peer that has stopped reading
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    struct pollfd p = {st->data.socket_stream,POLLOUT,0};
+                    int rc = poll(&p,1,st->write_timeout);
+                    if (rc > 0 || (rc < 0 && errno == EINTR)) continue;
+                    st->err = rc ? errno : ETIMEDOUT;
+                    debug(D_STREAM,"socket write gave up waiting to send: %d\n",st->err);
+                    return -1;
+                }
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            // drop what was sent from the front of the vector
+            total += w;
+            for(i=0;i<n && w >= v[i].iov_len;i++) w -= v[i].iov_len;
+            if (i < n) {
+                v[i].iov_base = (char *)v[i].iov_base + w;
+                v[i].iov_len -= w;
+            }
+            memmove(v,&v[i],(n-i)*sizeof(struct iovec));
+            n -= i;
+        }
+        total -= buffered;
     }
     else raise_error("unknown stream type:%d\n",st->type);
-    debug(D_STREAM,"write of '%s' results in %d\n",buf,bytes_written);
+    debug(D_STREAM,"write of %d pieces results in %ld\n",iovcnt,total);
     if (st->flags & StreamCloseAfterOneWrite) {
         _st_kill(st);
     }
-    return bytes_written;
+    return total;
+}
+
+/**
+ * write pieces to a stream, or add them to its output buffer if the stream is corked
+ */
+int __st_writev(Stream *st,struct iovec *iov,int iovcnt) {
+    if (!(st->flags & StreamCorked)) return __st_out(st,iov,iovcnt);
+    int i;
+    ssize_t total = 0;
+    for(i=0;i<iovcnt;i++) {
+        size_t len = iov[i].iov_len;
+        if (st->obuf_used+len > st->obuf_size) {
+            if (st->obuf_used && __st_out(st,NULL,0) < 0) return -1;
+            // too big to buffer so it just goes straight out
+            if (len > st->obuf_size) {
+                if (__st_out(st,&iov[i],1) < 0) return -1;
+                total += len;
+                continue;
+            }
+        }
+        memcpy(st->obuf+st->obuf_used,iov[i].iov_base,len);
+        st->obuf_used += len;
+        total += len;
+    }
+    return total;
+}
+
+/**
+ * start buffering the output of a stream
+ *
+ * writes get collected in the stream's output buffer (only going out if it fills up)
+ * until _st_uncork is called, so that a number of small writes cost one system call
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/stream_spec.h testStreamCork
+ */
+void _st_cork(Stream *st) {
+    if (!st->obuf) {
+        st->obuf_size = STREAM_OUT_BUFFER_SIZE;
+        st->obuf = malloc(st->obuf_size);
+    }
+    __st_set_flags(st,StreamCorked);
+}
+
+/**
+ * write out a stream's buffered output and stop buffering
+ *
+ * @returns the number of bytes written, or -1 on error
+ */
+int _st_uncork(Stream *st) {
+    __st_clear_flags(st,StreamCorked);
+    if (!st->obuf_used) return 0;
+    size_t len = st->obuf_used;
+    return (__st_out(st,NULL,0) < 0) ? -1 : len;
 }
 
+/**
+ * write to a stream
+ *
+ * @returns the number of bytes written, or -1 on error
+ */
+int _st_write(Stream *st,char *buf,size_t len) {
+    struct iovec v = {buf,len};
+    return __st_writev(st,&v,1);
+}
 
 /**
  * write a line to a stream using the delim as the EOL
+ *
+ * the line and the delimiter go out together in one write
  */
 int _st_writeln(Stream *stream,char *str) {
-    int len = strlen(str);
-    int err = 0;
-    if (len) err = _st_write(stream,str,len);
-    if (!len || err > 0) {
-        int e = _st_write(stream,stream->delim,stream->delim_len);
-        if (e > 0) err += e;
+    return _st_writelns(stream,&str,1);
+}
+
+/**
+ * write a number of lines to a stream using the delim as the EOL
+ *
+ * all the lines and their delimiters are gathered into a single write
+ *
+ * @returns the number of bytes written, or -1 on error
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/stream_spec.h testStreamWriteLine
+ */
+int _st_writelns(Stream *stream,char **strs,int count) {
+    struct iovec vec[STREAM_IOV_MAX];
+    struct iovec *v = (count*2 <= STREAM_IOV_MAX) ? vec : malloc(sizeof(struct iovec)*count*2);
+    int i,n = 0;
+    for(i=0;i<count;i++) {
+        size_t len = strlen(strs[i]);
+        if (len) {
+            v[n].iov_base = strs[i];
+            v[n++].iov_len = len;
+        }
+        v[n].iov_base = stream->delim;
+        v[n++].iov_len = stream->delim_len;
     }
+    int err = __st_writev(stream,v,n);
+    if (v != vec) free(v);
     return err;
 }
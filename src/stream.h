@@ -15,12 +15,31 @@
 #include <stdio.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <sys/uio.h>
 
 enum StreamTypes {UnixStream,SocketStream};
-enum {StreamHasData=0x0001,StreamCloseOnFree=0x0002,StreamReader=0x0004,StreamWaiting=0x0008,StreamAlive=0x8000,StreamCloseAfterOneWrite=0x0010,StreamDying=0x0100,StreamLoadByLine=0x0200};
+enum {StreamHasData=0x0001,StreamCloseOnFree=0x0002,StreamReader=0x0004,StreamWaiting=0x0008,StreamAlive=0x8000,StreamCloseAfterOneWrite=0x0010,StreamDying=0x0100,StreamLoadByLine=0x0200,StreamReactor=0x0400,StreamFreed=0x0800,StreamCorked=0x1000};
 
 typedef struct Stream Stream;
 
+#define STREAM_BLOCK_SIZE 4096  ///< size and alignment of the blocks reader streams read into
+#define STREAM_RING_BLOCKS 4    ///< number of blocks a reader stream cycles through
+
+/**
+ * a refcounted block of a reader stream's buffer
+ *
+ * The stream holds a reference on each block in its ring, and each unit handed
+ * out as a slice (see _st_data_slice) holds another until it's released.  A block
+ * that fits in STREAM_BLOCK_SIZE is allocated at that alignment so that a slice
+ * can find its block just from the slice's address.
+ */
+typedef struct StreamBlock {
+    int refs;
+    bool sliceable;     ///< true if the block is STREAM_BLOCK_SIZE aligned
+    size_t size;        ///< bytes available in data, not counting the extra byte for a null
+    char data[];
+} StreamBlock;
+
 typedef void (*hasDataCallbackFn)(Stream *);
 
 enum ScanStates {StreamScanInitial,StreamScanSuccess,StreamScanPartial,StreamScanComplete};
@@ -34,6 +53,7 @@ struct Stream {
     pthread_t pthread;
     pthread_mutex_t mutex;
     pthread_cond_t cv;
+    bool read_requested;    ///< set (under mutex) by _st_start_read so that wakeups aren't lost if the reader isn't yet waiting
     char *buf;
     size_t buf_size;
     size_t bytes_used;
@@ -46,6 +66,15 @@ struct Stream {
     int callback_arg2;
     char *delim;
     int delim_len;
+    StreamBlock *ring[STREAM_RING_BLOCKS]; ///< blocks the reader cycles through, buf is in ring[ring_pos]
+    int ring_pos;
+    char *obuf;             ///< output buffer for writes made while the stream is corked
+    size_t obuf_used;
+    size_t obuf_size;
+    int write_timeout;      ///< ms a write waits for a full non-blocking socket to drain before failing
+    Stream *reactor_next;   ///< link for the reactor's ready and free lists
+    Stream *callback_next;  ///< link for the reactor's list of reads to report
+    bool reactor_queued;    ///< set (under the reactor mutex) from being put on the ready list until the reactor is done with the read
     // hold data for the different types of streams that are implemented
     // for now just unix_streams
     union {
@@ -70,29 +99,47 @@ struct SocketListener {
 char *DELIM_LF;
 char *DELIM_CRLF;
 
-#define DEFAULT_READER_BUFFER_SIZE 1000
+#define DEFAULT_READER_BUFFER_SIZE (STREAM_BLOCK_SIZE-sizeof(StreamBlock)-1)
+#define STREAM_REACTOR_EVENTS 64
+#define STREAM_OUT_BUFFER_SIZE 4096
+#define STREAM_IOV_MAX 64       ///< most pieces handed to the kernel in one vectored write
+#define STREAM_WRITE_TIMEOUT 5000 ///< default ms a write waits for a full non-blocking socket to drain
 #define _st_new_unix_stream(s,r) __st_new_unix_stream(s,r?DEFAULT_READER_BUFFER_SIZE:0)
 Stream *__st_new_unix_stream(FILE *stream,size_t reader_buffer_size);
 Stream *__st_alloc_stream();
+Stream *_st_new_socket_stream(int sockfd);
 size_t __st_unix_stream_load(Stream *st);
 #define __st_init_scan(s) s->scan_state = StreamScanInitial
 #define __st_buf_full(s) (s->bytes_used == s->buf_size)
 
 void __st_scan(Stream *st);
+void __st_stream_read(Stream *st);
 
 SocketListener *_st_new_socket_listener(int port,lisenterConnectionCallbackFn fn,void *callback_arg,char * delim);
 void _st_close_listener(SocketListener *l);
 
 void _st_start_read(Stream *st);
 void _st_data_consumed(Stream *st);
+// flags get changed both by the reader (thread or reactor) and by whoever consumes the data,
+// so once a stream is reading they must be changed atomically
+#define __st_set_flags(st,f) __sync_fetch_and_or(&(st)->flags,f)
+#define __st_clear_flags(st,f) __sync_fetch_and_and(&(st)->flags,~(f))
+#define _st_has_reader_thread(st) (((st)->flags & (StreamReader|StreamReactor)) == StreamReader)
 #define _st_is_alive(st) ((st->flags & StreamAlive) || (st->flags & StreamReader && (st->scan_state != StreamScanComplete)))
 void _st_kill(Stream *st);
 void _st_free(Stream *);
 #define _st_data(st) (&(st)->buf[st->unit_start])
 #define _st_data_size(st) (st)->unit_size
+char *_st_data_slice(Stream *st);
+void _st_release_slice(void *slice);
 
+int __st_out(Stream *st,struct iovec *iov,int iovcnt);
+int __st_writev(Stream *st,struct iovec *iov,int iovcnt);
 int _st_write(Stream *stream,char *buf,size_t len);
 int _st_writeln(Stream *stream,char *buf);
+int _st_writelns(Stream *stream,char **strs,int count);
+void _st_cork(Stream *st);
+int _st_uncork(Stream *st);
 
 #endif
 /** @}*/
@@ -11,6 +11,7 @@
 #include "tree.h"
 #include "def.h"
 #include "receptor.h"
+#include "semtrex.h"
 
 #include "base_defs.h"
 #include <stdarg.h>
@@ -70,6 +71,7 @@ SemTable *def_sys() {
 void sys_free(SemTable *sem) {
     _t_free(_t_root(sem->stores[0].definitions));
     _sem_free(sem);
+    _stx_free_cache();
 }
 
 Context G_ctx;
@@ -85,8 +87,7 @@ T *sT_(SemTable *sem,Symbol sym,int num_params,...){
         if (semeq(_t_symbol(t),STRUCTURE_SYMBOL)) {
             Symbol ss = *(Symbol *)_t_surface(t);
             if (is_structure(ss)) {
-                T *structures = _sem_get_defs(sem,ss);
-                T *st = _t_child(structures,ss.id);
+                T *st = _sem_get_def(sem,ss);
                 if (!st) {
                     raise_error("Structure used in %s definition is undefined!",G_label);
                 }
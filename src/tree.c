@@ -18,25 +18,402 @@
 #include "scape.h"
 #include "util.h"
 #include "debug.h"
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*****************  Run-tree arenas */
+
+/*
+ * Reducing a process creates and throws away run-tree nodes at a high rate, so while a
+ * queue element is being stepped the run nodes it creates (and their children arrays) are
+ * carved out of that element's arena.  Arena nodes carry a back pointer to their arena
+ * just in front of the node, and are marked with TFLAG_ARENA_NODE.
+ *
+ * Nodes freed during reduction go onto the arena's free lists, and when the queue element
+ * is finished the whole run tree goes away with a single _t_release_arena.  Any arena node
+ * that gets attached somewhere that may outlive the element (i.e. under a node that isn't
+ * part of the run tree) is marked TFLAG_ESCAPED and holds a reference on the arena so that
+ * the memory stays valid until that node is freed on its own.  Arena nodes that end up
+ * holding something that must be freed individually (a malloced surface, non-arena or
+ * escaped children) are marked TFLAG_ARENA_MIXED, and TFLAG_ARENA_BELOW marks nodes
+ * that have arena nodes somewhere beneath them, so that both teardown and escaping only
+ * have to visit the parts of a tree that need it.
+ */
+
+__thread Arena *G_arena = NULL;
+
+typedef struct ArenaNode {
+    Arena *arena;
+    rT node;
+} ArenaNode;
+
+#define ARENA_FIRST_BLOCK_SIZE 4096
+#define ARENA_MAX_BLOCK_SIZE 65536
+#define __t_arena(t) (((ArenaNode *)((char *)(t) - offsetof(ArenaNode,node)))->arena)
+#define __t_owns_surface(f) (((f) & (TFLAG_ALLOCATED+TFLAG_SLICE)) || (((f) & (TFLAG_SURFACE_IS_TREE+TFLAG_SURFACE_IS_SCAPE)) && !((f) & TFLAG_REFERENCE)))
+// a node that goes away with arena a without needing to be visited
+#define __t_arena_pure(t,a) ((((t)->context.flags & (TFLAG_ARENA_NODE+TFLAG_ESCAPED+TFLAG_ARENA_MIXED)) == TFLAG_ARENA_NODE) && !__t_owns_surface((t)->context.flags) && __t_arena(t) == (a))
+
+/**
+ * create a new, empty run-tree arena
+ *
+ * @returns the arena with a single reference held by the caller
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/tree_spec.h testTreeArena
+ */
+Arena *_t_new_arena() {
+    Arena *a = calloc(1,sizeof(Arena));
+    a->refs = 1;
+    return a;
+}
+
+/**
+ * drop a reference to an arena, freeing its memory when no references remain
+ *
+ * @param[in] a the arena
+ */
+void _t_release_arena(Arena *a) {
+    if (__sync_sub_and_fetch(&a->refs,1) == 0) {
+        ArenaBlock *b = a->blocks;
+        while (b) {
+            ArenaBlock *n = b->next;
+            free(b);
+            b = n;
+        }
+        free(a);
+    }
+}
+
+/**
+ * set the arena that run nodes created by this thread get allocated from
+ *
+ * @param[in] a the arena to use, or NULL to go back to plain heap allocation
+ * @returns the arena that was previously in use
+ */
+Arena *_t_use_arena(Arena *a) {
+    Arena *prev = G_arena;
+    G_arena = a;
+    return prev;
+}
+
+// pointer bump allocation out of the arena's current block
+void *__t_arena_alloc(Arena *a,size_t size) {
+    ArenaBlock *b = a->blocks;
+    size = (size + 7) & ~7;
+    if (!b || b->used + size > b->size) {
+        size_t s = b ? b->size*2 : ARENA_FIRST_BLOCK_SIZE;
+        if (s > ARENA_MAX_BLOCK_SIZE) s = ARENA_MAX_BLOCK_SIZE;
+        if (s < size) s = size;
+        b = malloc(sizeof(ArenaBlock)+s);
+        b->size = s;
+        b->used = 0;
+        b->next = a->blocks;
+        a->blocks = b;
+    }
+    void *m = b->mem + b->used;
+    b->used += size;
+    return m;
+}
+
+T *__t_alloc_node(bool is_run_node) {
+    Arena *a = G_arena;
+    T *t;
+    if (!is_run_node || !a) {
+        t = malloc(is_run_node ? sizeof(rT) : sizeof(T));
+        t->context.flags = 0;
+        return t;
+    }
+    ArenaNode *n = a->free_nodes;
+    if (n) {
+        a->free_nodes = *(void **)&n->node;
+        a->recycled++;
+    }
+    else n = __t_arena_alloc(a,sizeof(ArenaNode));
+    a->nodes++;
+    n->arena = a;
+    t = (T *)&n->node;
+    t->context.flags = TFLAG_ARENA_NODE;
+    return t;
+}
+
+void __t_release_node(T *t) {
+    uint32_t f = t->context.flags;
+    if (!(f & TFLAG_ARENA_NODE)) free(t);
+    else {
+        Arena *a = __t_arena(t);
+        if (f & TFLAG_ESCAPED) _t_release_arena(a);
+        // only the thread reducing with the arena may touch its free lists, otherwise
+        // the slot is simply left for the arena's release
+        else if (a == G_arena) {
+            *(void **)t = a->free_nodes;
+            a->free_nodes = (ArenaNode *)((char *)t - offsetof(ArenaNode,node));
+        }
+    }
+}
+
+#define __t_children_header(c) ((ChildrenHeader *)((c)-1))
+
+void __t_unhash(T *t);
+
+// the visitor data of a frame's parent, or the walk's param for the root
+#define __t_walk_parent_data(w,f) ((f) == (w)->frames ? (w)->param : (f)[-1].data)
+
+// the arena a node's children array should come from, if any
+Arena *__t_children_arena(T *t,int class) {
+    if ((t->context.flags & (TFLAG_ARENA_NODE+TFLAG_ESCAPED)) != TFLAG_ARENA_NODE || class >= ARENA_CHILDREN_CLASSES) return NULL;
+    Arena *a = __t_arena(t);
+    return (a == G_arena) ? a : NULL;
+}
+
+// allocate a children array of a size class, returning where its first child goes
+T **__t_alloc_children(T *t,Arena *a,int class) {
+    size_t size = sizeof(T *)*(TREE_CHILDREN_BLOCK<<class);
+    T **c;
+    if (!a) {
+        t->context.flags &= ~TFLAG_ARENA_CHILDREN;
+        c = malloc(size);
+    }
+    else {
+        t->context.flags |= TFLAG_ARENA_CHILDREN;
+        c = a->free_children[class];
+        if (c) a->free_children[class] = *(T ***)c;
+        else c = __t_arena_alloc(a,size);
+    }
+    ChildrenHeader *h = (ChildrenHeader *)c;
+    h->offset = 0;
+    h->class = class;
+    return c+1;
+}
+
+// give back a children array given where its first child is
+void __t_release_children(T *t,T **children) {
+    ChildrenHeader *h = __t_children_header(children);
+    int class = h->class;
+    T **c = children - 1 - h->offset;
+    if (!(t->context.flags & TFLAG_ARENA_CHILDREN)) {
+        free(c);
+        return;
+    }
+    t->context.flags &= ~TFLAG_ARENA_CHILDREN;
+    if (__t_children_arena(t,class)) {
+        Arena *a = __t_arena(t);
+        *(T ***)c = a->free_children[class];
+        a->free_children[class] = c;
+    }
+}
+
+// flag a node, and its arena ancestors, as needing a visit when the arena is torn down
+void __t_mark_mixed(T *t) {
+    while (t && (t->context.flags & (TFLAG_ARENA_NODE+TFLAG_ARENA_MIXED)) == TFLAG_ARENA_NODE) {
+        t->context.flags |= TFLAG_ARENA_MIXED;
+        t = t->structure.parent;
+    }
+}
+
+/**
+ * mark a node as owning a surface that must be freed individually
+ *
+ * needs to be called when a surface that gets freed with the node (i.e. an allocated
+ * surface, tree or scape) is set on a node after it has been created.
+ *
+ * @param[in] t the node
+ */
+void __t_surface_owned(T *t) {
+    if (t->context.flags & TFLAG_ARENA_NODE) __t_mark_mixed(t);
+    if ((t->context.flags & (TFLAG_SURFACE_IS_TREE+TFLAG_SURFACE_IS_RECEPTOR+TFLAG_REFERENCE)) == TFLAG_SURFACE_IS_TREE)
+        _t_escape((T *)t->contents.surface);
+}
+
+void __t_escape(T *t,Arena *keep) {
+    uint32_t f = t->context.flags;
+    if (!(f & (TFLAG_ARENA_NODE+TFLAG_ARENA_BELOW))) return;
+    if ((f & (TFLAG_ARENA_NODE+TFLAG_ESCAPED)) == TFLAG_ARENA_NODE) {
+        Arena *a = __t_arena(t);
+        if (a != keep) {
+            t->context.flags |= TFLAG_ESCAPED;
+            __sync_add_and_fetch(&a->refs,1);
+        }
+    }
+    DO_KIDS(t,__t_escape(_t_child(t,i),keep));
+}
+
+/**
+ * make sure that no node of a tree depends on an arena's lifetime
+ *
+ * this needs to be called on any part of a run tree that is handed off to live
+ * past the reduction it was built in, without being added to another tree.
+ *
+ * @param[in] t the tree
+ */
+void _t_escape(T *t) {
+    if (t) __t_escape(t,NULL);
+}
+
+// account for c having been attached under p
+void __t_adopt(T *p,T *c) {
+    uint32_t cf = c->context.flags;
+    uint32_t pf = p->context.flags;
+    if (cf & (TFLAG_ARENA_NODE+TFLAG_ARENA_BELOW)) {
+        // a node being reduced may hold arena nodes of its own element, but anything else
+        // (non run-tree nodes, or nodes already handed off) makes them escape
+        Arena *keep = NULL;
+        if ((pf & (TFLAG_RUN_NODE+TFLAG_ESCAPED)) == TFLAG_RUN_NODE)
+            keep = (pf & TFLAG_ARENA_NODE) ? __t_arena(p) : G_arena;
+        if (!(cf & TFLAG_ARENA_NODE) || (!(cf & TFLAG_ESCAPED) && (!keep || __t_arena(c) != keep)))
+            __t_escape(c,keep);
+        T *n = p;
+        while (n && !(n->context.flags & TFLAG_ARENA_BELOW)) {
+            n->context.flags |= TFLAG_ARENA_BELOW;
+            n = n->structure.parent;
+        }
+    }
+    if ((pf & TFLAG_ARENA_NODE) && !__t_arena_pure(c,__t_arena(p))) __t_mark_mixed(p);
+}
+
+/**
+ * free a tree whose arena nodes are also being released with arena a
+ *
+ * only the parts of the tree that can't be reclaimed by the arena itself are visited
+ *
+ * @param[in] t tree to be freed
+ * @param[in] a the arena that is about to be released
+ */
+void _t_free_with_arena(T *t,Arena *a) {
+    if (__t_arena_pure(t,a)) return;
+    int c = t->structure.child_count;
+    if (c > 0) {
+        while(--c>=0) _t_free_with_arena(t->structure.children[c],a);
+        __t_release_children(t,t->structure.children);
+    }
+    t->structure.child_count = 0;
+    __t_free(t);
+    __t_release_node(t);
+}
+
+/**
+ * replace the contents and children of a node with those of another node and release that node
+ *
+ * this is the arena aware version of copying over the node structure, it keeps
+ * track of where the children array came from and leaves t's allocation flags intact
+ *
+ * @param[in] t the node to be overwritten, whose children and surface must already have been freed
+ * @param[in] r the node to absorb, which becomes invalid
+ */
+void __t_absorb(T *t,T *r) {
+    __t_unhash(t);
+    uint32_t rf = r->context.flags & ~(TFLAG_HASHED+TFLAG_INERT_KNOWN+TFLAG_INERT+TFLAG_SLOTS);
+    uint32_t tf = t->context.flags & (TFLAG_ARENA_NODE+TFLAG_ESCAPED+TFLAG_ARENA_MIXED+TFLAG_ARENA_BELOW);
+    int n = r->structure.child_count;
+    T **c = r->structure.children;
+
+    t->contents = r->contents;
+    t->context.flags = (rf & ~TFLAG_ARENA_MASK) | tf;
+    t->structure.child_count = n;
+    if (n) {
+        int class = __t_children_header(c)->class;
+        if (!(rf & TFLAG_ARENA_CHILDREN))
+            t->structure.children = c;
+        else if ((tf & (TFLAG_ARENA_NODE+TFLAG_ESCAPED)) == TFLAG_ARENA_NODE && !(rf & TFLAG_ESCAPED) && __t_arena(t) == __t_arena(r)) {
+            t->context.flags |= TFLAG_ARENA_CHILDREN;
+            t->structure.children = c;
+        }
+        else {
+            t->structure.children = __t_alloc_children(t,__t_children_arena(t,class),class);
+            memcpy(t->structure.children,c,sizeof(T *)*n);
+            __t_release_children(r,c);
+        }
+        uint32_t offset = __t_children_header(t->structure.children)->offset;
+        DO_KIDS(t,
+                T *k = t->structure.children[i-1];
+                k->structure.parent = t;
+                k->structure.index = offset+i;
+                __t_adopt(t,k);
+                );
+    }
+    // a copy-on-write node's children are still shared so there's nothing to move
+    else if (rf & TFLAG_COW)
+        t->structure.children = c;
+    if (__t_owns_surface(t->context.flags)) __t_surface_owned(t);
+    __t_release_node(r);
+}
 
 /*****************  Node creation */
+
+// a node has changed, so it and its ancestors no longer have a valid cached hash
+void __t_unhash(T *t) {
+    while (t && (t->context.flags & TFLAG_HASHED)) {
+        t->context.flags &= ~TFLAG_HASHED;
+        t = t->structure.parent;
+    }
+}
+
+// renumber the children from the i'th on after they have moved in the children array
+void __t_renumber_children(T *t,int i) {
+    uint32_t offset = __t_children_header(t->structure.children)->offset;
+    int n = t->structure.child_count;
+    for(;i<=n;i++) t->structure.children[i-1]->structure.index = offset+i;
+}
+
+// make room for one more child at the end of a full children array
+void __t_grow_children(T *t) {
+    int n = t->structure.child_count;
+    T **old = t->structure.children;
+    ChildrenHeader *h = __t_children_header(old);
+    if (h->offset >= n) {
+        // more than half the array has been popped off the front, so just slide the children down
+        T **c = old - 1 - h->offset;
+        ChildrenHeader nh = {0,h->class};
+        memmove(c+1,old,sizeof(T *)*n);
+        *(ChildrenHeader *)c = nh;
+        t->structure.children = c+1;
+        __t_renumber_children(t,1);
+        return;
+    }
+    int class = h->class+1;
+    Arena *a = __t_children_arena(t,class);
+    if (!a && !(t->context.flags & TFLAG_ARENA_CHILDREN) && !h->offset) {
+        T **c = realloc(old-1,sizeof(T *)*(TREE_CHILDREN_BLOCK<<class));
+        ((ChildrenHeader *)c)->class = class;
+        t->structure.children = c+1;
+    }
+    else {
+        uint32_t f = t->context.flags;
+        T **nc = __t_alloc_children(t,a,class);
+        memcpy(nc,old,sizeof(T *)*n);
+        uint32_t nf = t->context.flags;
+        t->context.flags = f;
+        __t_release_children(t,old);
+        t->context.flags = nf;
+        t->structure.children = nc;
+        __t_renumber_children(t,1);
+    }
+}
+
 void __t_append_child(T *t,T *c) {
-    if (t->structure.child_count == 0) {
-        t->structure.children = malloc(sizeof(T *)*TREE_CHILDREN_BLOCK);
-    } else if (!(t->structure.child_count % TREE_CHILDREN_BLOCK)){
-        int b = t->structure.child_count/TREE_CHILDREN_BLOCK + 1;
-        t->structure.children = realloc(t->structure.children,sizeof(T *)*(TREE_CHILDREN_BLOCK*b));
+    __t_cow(t);
+    int n = t->structure.child_count;
+    if (n == 0) {
+        t->structure.children = __t_alloc_children(t,__t_children_arena(t,0),0);
+    }
+    else {
+        ChildrenHeader *h = __t_children_header(t->structure.children);
+        if (h->offset+n+1 == (TREE_CHILDREN_BLOCK<<h->class)) __t_grow_children(t);
     }
 
     t->structure.children[t->structure.child_count++] = c;
+    c->structure.index = __t_children_header(t->structure.children)->offset+t->structure.child_count;
+    __t_adopt(t,c);
+    __t_unhash(t);
 }
 
 T * __t_init(T *parent,Symbol symbol,bool is_run_node) {
-    T *t = malloc(is_run_node ? sizeof(rT) : sizeof(T));
+    T *t = __t_alloc_node(is_run_node);
     t->structure.child_count = 0;
+    t->structure.index = 0;
     t->structure.parent = parent;
     t->contents.symbol = symbol;
-    t->context.flags = 0;
     if (is_run_node) {
         ((rT *)t)->cur_child = RUN_TREE_NOT_EVAULATED;
         t->context.flags |= TFLAG_RUN_NODE;
@@ -67,6 +444,7 @@ T * __t_new(T *parent,Symbol symbol,void *surface,size_t size,bool is_run_node)
         else {
             t->context.flags |= TFLAG_ALLOCATED;
             dst = t->contents.surface = malloc(size);
+            __t_surface_owned(t);
         }
         memcpy(dst,surface,size);
     }
@@ -136,6 +514,7 @@ T * _t_newt(T *parent,Symbol symbol,T *surface) {
     t->contents.size = sizeof(T *);
 
     t->context.flags |= TFLAG_SURFACE_IS_TREE;
+    __t_surface_owned(t);
     return t;
 }
 
@@ -172,6 +551,46 @@ T *__t_newr(T *parent,Symbol symbol,bool is_run_node) {
     return __t_new(parent,symbol,0,0,is_run_node);
 }
 
+/**
+ * Create a new tree node whose surface is a slice of a stream's read buffer
+ *
+ * the node takes over the reference the caller got from _st_data_slice, so the
+ * unit isn't copied and the slice gets released when the node is freed.
+ *
+ * @param[in] parent parent node for the node to be created.  Can be 0 if this is a root node
+ * @param[in] symbol semantic symbol for the node to be create
+ * @param[in] slice the slice
+ * @param[in] size size in bytes of the surface
+ * @returns pointer to node allocated on the heap
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/stream_spec.h testStreamSlice
+ */
+T *__t_new_slice(T *parent,Symbol symbol,char *slice,size_t size,bool is_run_node) {
+    T *t = __t_init(parent,symbol,is_run_node);
+    if (is_run_node) t->context.flags |= TFLAG_RUN_NODE;
+    t->context.flags |= TFLAG_SLICE;
+    t->contents.surface = slice;
+    t->contents.size = size;
+    __t_surface_owned(t);
+    return t;
+}
+
+/**
+ * give a node with a slice surface its own copy of it so the surface can be reallocated
+ *
+ * @param[in] t the node
+ */
+void __t_unslice(T *t) {
+    if (t->context.flags & TFLAG_SLICE) {
+        void *slice = t->contents.surface;
+        t->contents.surface = malloc(t->contents.size);
+        memcpy(t->contents.surface,slice,t->contents.size);
+        _st_release_slice(slice);
+        t->context.flags = (t->context.flags & ~TFLAG_SLICE) | TFLAG_ALLOCATED;
+    }
+}
+
 /* create tree node whose surface is a specially allocated c structure,
    i.e. a receptor, scape, or stream, these nodes get cloned as references
    so the c-structure isn't double freed
@@ -181,8 +600,9 @@ T *__t_new_special(T *parent,Symbol symbol,void *s,int flag,bool is_run_node) {
     t->contents.surface = s;
     t->contents.size = sizeof(void *);
 
-    t->context.flags |= flag;
+    t->context.flags |= flag & ~(TFLAG_ARENA_MASK+TFLAG_HASHED+TFLAG_SHARE_MASK);
     if (is_run_node) t->context.flags |= TFLAG_RUN_NODE;
+    if (__t_owns_surface(t->context.flags)) __t_surface_owned(t);
     return t;
 }
 
@@ -264,6 +684,47 @@ void _t_add(T *t,T *c) {
     __t_append_child(t,c);
 }
 
+/**
+ * move all the children of one tree onto the end of another
+ *
+ * when the destination has no children of its own it just takes over the source's
+ * children array, otherwise the children are appended, so either way it's linear in the
+ * number of children rather than detaching them one by one.
+ *
+ * @param[in] t tree onto which the children will be added
+ * @param[in] from tree whose children get moved, which is left with none
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/tree_spec.h testTreeMoveChildren
+ */
+void _t_move_children(T *t,T *from) {
+    __t_cow(t);
+    __t_cow(from);
+    int i,n = from->structure.child_count;
+    if (!n) return;
+    T **c = from->structure.children;
+    int class = __t_children_header(c)->class;
+    if (!t->structure.child_count && !(from->context.flags & TFLAG_ARENA_CHILDREN) && !__t_children_arena(t,class)) {
+        __t_unhash(t);
+        t->context.flags &= ~TFLAG_ARENA_CHILDREN;
+        t->structure.children = c;
+        t->structure.child_count = n;
+        for(i=0;i<n;i++) {
+            c[i]->structure.parent = t;
+            __t_adopt(t,c[i]);
+        }
+    }
+    else {
+        for(i=0;i<n;i++) {
+            c[i]->structure.parent = t;
+            __t_append_child(t,c[i]);
+        }
+        __t_release_children(from,c);
+    }
+    from->structure.child_count = 0;
+    __t_unhash(from);
+}
+
 /**
  * Detatch the specified child from a node and return it
  *
@@ -276,6 +737,7 @@ void _t_add(T *t,T *c) {
  * @snippet spec/tree_spec.h testTreeDetach
  */
 T *_t_detach_by_idx(T *t,int i) {
+    __t_cow(t);
     T *x = _t_child(t,i);
     _t_detach_by_ptr(t,x);
     return x;
@@ -289,22 +751,38 @@ T *_t_detach_by_idx(T *t,int i) {
  * @param[in] c node to search for in child list
  */
 void _t_detach_by_ptr(T *t,T *c) {
-    // search for the child to be removed
-    DO_KIDS(t,
-            if (_t_child(t,i) == c) {
-                // if found remove it by decreasing the child count and shift all the other children down
-                t->structure.child_count--;
-                if (t->structure.child_count == 0) {
-                    free(t->structure.children);
-                }
-                for(;i<_c;i++) {
-                    t->structure.children[i-1] = t->structure.children[i];
-                }
-                break;
-            }
-        );
-
-    if (c) c->structure.parent = 0;
+    if (!c) return;
+    __t_cow(t);
+    __t_unhash(t);
+    // the child knows where it is, so check that it really is one of t's children
+    int i = c->structure.parent == t ? _t_node_index(c) : 0;
+    if (i && _t_child(t,i) == c) {
+        int n = --t->structure.child_count;
+        T **k = t->structure.children;
+        if (n == 0) {
+            __t_release_children(t,k);
+        }
+        else if (i-1 < n-i+1) {
+            // closer to the front, so shift the earlier children up and move the header after them
+            ChildrenHeader h = *__t_children_header(k);
+            h.offset++;
+            memmove(k+1,k,sizeof(T *)*(i-1));
+            t->structure.children = k+1;
+            *__t_children_header(k+1) = h;
+            while(--i) k[i]->structure.index++;
+        }
+        else {
+            // shift the later children down
+            memmove(k+i-1,k+i,sizeof(T *)*(n-i+1));
+            __t_renumber_children(t,i);
+        }
+    }
+    // a node that belongs to some other tree (like the code t was sharing) is left alone
+    else if (c->structure.parent) return;
+    c->structure.parent = 0;
+    c->structure.index = 0;
+    // a detached run tree node can outlive the code its run tree was sharing
+    if (c->context.flags & TFLAG_RUN_NODE) _t_materialize(c);
 }
 
 /**
@@ -323,20 +801,26 @@ void _t_detach_by_ptr(T *t,T *c) {
  * @snippet spec/tree_spec.h testTreeMorphLowLevel
  */
 void __t_morph(T *t,Symbol s,void *surface,size_t size,int allocate) {
+    __t_cow(t);
+    __t_unhash(t);
     t->contents.size = size;
     if (t->context.flags & TFLAG_ALLOCATED) {
         free(t->contents.surface);
     }
+    else if (t->context.flags & TFLAG_SLICE) {
+        _st_release_slice(t->contents.surface);
+    }
 
     if (allocate) {
         t->contents.surface = malloc(size);
         memcpy(t->contents.surface,surface,size);
-        t->context.flags = TFLAG_ALLOCATED; /// @todo Handle the case where the surface of the node to be morphed is itself a tree
+        t->context.flags = (t->context.flags & TFLAG_ARENA_MASK) | TFLAG_ALLOCATED; /// @todo Handle the case where the surface of the node to be morphed is itself a tree
+        __t_surface_owned(t);
     }
     else {
         if (surface)
             memcpy(&t->contents.surface,surface,size);
-        t->context.flags = 0;
+        t->context.flags &= TFLAG_ARENA_MASK;
     }
 
     t->contents.symbol = s;
@@ -355,7 +839,58 @@ void __t_morph(T *t,Symbol s,void *surface,size_t size,int allocate) {
  * @snippet spec/tree_spec.h testTreeMorph
  */
 void _t_morph(T *dst,T *src) {
-    __t_morph(dst,_t_symbol(src),_t_surface(src),_t_size(src),src->context.flags & TFLAG_ALLOCATED);
+    __t_morph(dst,_t_symbol(src),_t_surface(src),_t_size(src),src->context.flags & (TFLAG_ALLOCATED+TFLAG_SLICE));
+}
+
+/**
+ * Change the value of a node's surface
+ *
+ * this is how surfaces should be changed after a node is made, because it also marks
+ * the node's cached hash as stale.  Small values are stored in the node and larger ones
+ * allocated, just as when making a node with __t_new.
+ *
+ * @param[in] t the node, whose surface must be a value (not a tree, receptor etc.)
+ * @param[in] surface the new value (may point into the current surface)
+ * @param[in] size of the new value
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/tree_spec.h testTreeHashCached
+ */
+void _t_set_surface(T *t,void *surface,size_t size) {
+    if (t->context.flags & (TFLAG_SURFACE_IS_TREE+TFLAG_SURFACE_IS_RECEPTOR+TFLAG_SURFACE_IS_SCAPE+TFLAG_SURFACE_IS_CPTR))
+        raise_error("can't set the surface of a node that holds a structure");
+    __t_cow(t);
+    __t_unhash(t);
+    uint32_t f = t->context.flags;
+    void *old = t->contents.surface;
+    if (size > sizeof(void *)) {
+        void *s = malloc(size);
+        memcpy(s,surface,size);
+        t->contents.surface = s;
+        t->context.flags = (f & ~TFLAG_SLICE) | TFLAG_ALLOCATED;
+        __t_surface_owned(t);
+    }
+    else {
+        void *v = NULL;
+        if (size) memcpy(&v,surface,size);
+        t->contents.surface = v;
+        t->context.flags = f & ~(TFLAG_ALLOCATED+TFLAG_SLICE);
+    }
+    t->contents.size = size;
+    if (f & TFLAG_ALLOCATED) free(old);
+    else if (f & TFLAG_SLICE) _st_release_slice(old);
+}
+
+/**
+ * Change a node's symbol (leaving its surface alone) and mark its cached hash as stale
+ *
+ * @param[in] t the node
+ * @param[in] s the new symbol
+ */
+void _t_set_symbol(T *t,Symbol s) {
+    __t_cow(t);
+    __t_unhash(t);
+    t->contents.symbol = s;
 }
 
 /**
@@ -370,11 +905,15 @@ void _t_morph(T *dst,T *src) {
  * @snippet spec/tree_spec.h testTreeReplace
  */
 void _t_replace(T *t,int i,T *r) {
+    __t_cow(t);
     T *c = _t_child(t,i);
     if (!c) {raise_error("tree doesn't have child %d",i);}
     _t_free(c);
+    __t_unhash(t);
     t->structure.children[i-1] = r;
     r->structure.parent = t;
+    r->structure.index = __t_children_header(t->structure.children)->offset+i;
+    __t_adopt(t,r);
 }
 
 /**
@@ -394,13 +933,7 @@ void _t_replace_node(T *t,T *r) {
         raise_error("runnode mismatch");
     }
     __t_free(t);
-    t->contents = r->contents;
-    t->structure.child_count = r->structure.child_count;
-    t->structure.children = r->structure.children;
-    t->context = r->context;
-    free(r);
-    // fix the childrens' parent pointer
-    DO_KIDS(t,_t_child(t,i)->structure.parent = t);
+    __t_absorb(t,r);
 }
 
 /**
@@ -417,14 +950,28 @@ void _t_replace_node(T *t,T *r) {
  */
 T *_t_swap(T *t,int i,T *r) {
     root_check(r);
+    __t_cow(t);
     T *c = _t_child(t,i);
     if (!c) {raise_error("tree doesn't have child %d",i);}
+    __t_unhash(t);
     t->structure.children[i-1] = r;
     r->structure.parent = t;
+    r->structure.index = c->structure.index;
     c->structure.parent = NULL;
+    c->structure.index = 0;
+    __t_adopt(t,r);
     return c;
 }
 
+// the nodes down a path are about to change so they can't still be sharing their children
+void __t_unshare_path(T *t,int *path) {
+    int i;
+    for(i=0;t && path[i] != TREE_PATH_TERMINATOR;i++) {
+        __t_cow(t);
+        t = _t_child(t,path[i]);
+    }
+}
+
 /**
  * Insert a tree at a given tree path position
 
@@ -436,6 +983,7 @@ T *_t_swap(T *t,int i,T *r) {
  * @snippet spec/tree_spec.h testTreeInsertAt
  */
 void _t_insert_at(T *t, int *path, T *i) {
+    __t_unshare_path(t,path);
     T *c = _t_get(t,path);
     int d = _t_path_depth(path)-1;
     if (c) {
@@ -454,10 +1002,12 @@ void _t_insert_at(T *t, int *path, T *i) {
         T **tp = &p->structure.children[l-1];
         while(j--) {
             *tp = *(tp-1);
+            (*tp)->structure.index++;
             tp--;
         }
         // and put the new tree where it belongs
         *tp = i;
+        i->structure.index = __t_children_header(p->structure.children)->offset+path[d];
     }
     else {
         // if path points to one beyond last child, we can simply add it.
@@ -484,23 +1034,13 @@ void _t_insert_at(T *t, int *path, T *i) {
 
 /*****************  Node deletion */
 
-void __t_free_children(T *t) {
-    int c = t->structure.child_count;
-    if (c > 0) {
-        while(--c>=0) {
-            _t_free(t->structure.children[c]);
-        }
-        free(t->structure.children);
-    }
-    t->structure.child_count = 0;
-}
-
-// free everything except the node itself
-void __t_free(T *t) {
-    __t_free_children(t);
+// free what a node's surface points to, if the node owns it
+void __t_free_surface(T *t) {
     if (!(t->context.flags & TFLAG_REFERENCE)) {
         if (t->context.flags & TFLAG_ALLOCATED)
             free(t->contents.surface);
+        else if (t->context.flags & TFLAG_SLICE)
+            _st_release_slice(t->contents.surface);
         else if (t->context.flags & TFLAG_SURFACE_IS_TREE) {
             if (t->context.flags & TFLAG_SURFACE_IS_RECEPTOR)
                 _r_free((Receptor *)t->contents.surface);
@@ -515,6 +1055,36 @@ void __t_free(T *t) {
     }
 }
 
+// don't descend into copy-on-write nodes, their children are someone else's
+bool __t_free_pre(TreeWalk *w,TreeWalkFrame *f) {
+    return !(f->t->context.flags & TFLAG_COW);
+}
+
+// free a node's children array, and the node itself unless it's the root of the walk
+bool __t_free_post(TreeWalk *w,TreeWalkFrame *f) {
+    T *t = f->t;
+    if (t->structure.child_count) {
+        __t_release_children(t,t->structure.children);
+        t->structure.child_count = 0;
+    }
+    if (f != w->frames) {
+        __t_free_surface(t);
+        __t_release_node(t);
+    }
+    return true;
+}
+
+void __t_free_children(T *t) {
+    if (t->structure.child_count > 0)
+        _t_walk(t,__t_free_pre,__t_free_post,NULL);
+}
+
+// free everything except the node itself
+void __t_free(T *t) {
+    __t_free_children(t);
+    __t_free_surface(t);
+}
+
 /**
  * free the memory occupied by a tree
  *
@@ -525,11 +1095,14 @@ void __t_free(T *t) {
  */
 void _t_free(T *t) {
     __t_free(t);
-    free(t);
+    __t_release_node(t);
 }
 
-T *__t_clone(T *t,T *p) {
-    T *nt;
+T *__t_clone(T *t,T *p);
+
+// make a copy of a node under the copy of its parent
+bool __t_clone_pre(TreeWalk *w,TreeWalkFrame *f) {
+    T *nt,*t = f->t,*p = __t_walk_parent_data(w,f);
     uint32_t flags = t->context.flags;
 
     // if the tree points to a type that has an allocated c structure as its surface
@@ -545,13 +1118,18 @@ T *__t_clone(T *t,T *p) {
         nt = _t_newr(p,_t_symbol(t));
     else
         nt = _t_new(p,_t_symbol(t),_t_surface(t),_t_size(t));
-    DO_KIDS(t,__t_clone(_t_child(t,i),nt));
-
+    f->data = nt;
+    return true;
+}
 
-    return nt;
+T *__t_clone(T *t,T *p) {
+    return _t_walk(t,__t_clone_pre,NULL,p);
 }
 
-T *__t_rclone(T *t,T *p) {
+T *__t_rclone(T *t,T *p);
+
+// make a run node copy of just the node t (i.e. without its children) under p
+T *__t_rclone_node(T *t,T *p) {
     T *nt;
     uint32_t flags = t->context.flags;
     if (flags & TFLAG_SURFACE_IS_RECEPTOR) {
@@ -571,10 +1149,46 @@ T *__t_rclone(T *t,T *p) {
     else
         nt = __t_new(p,_t_symbol(t),_t_surface(t),_t_size(t),1);
     ((rT *)nt)->cur_child =  RUN_TREE_NOT_EVAULATED;
-    DO_KIDS(t,__t_rclone(_t_child(t,i),nt));
     return nt;
 }
 
+// make the children of t be shared with those of code until they are needed
+void __t_share_children(T *t,T *code) {
+    if (code->context.flags & TFLAG_COW) code = (T *)code->structure.children;
+    if (code->structure.child_count) {
+        t->context.flags |= TFLAG_COW;
+        t->structure.children = (T **)code;
+    }
+}
+
+// give a copy-on-write node copies of its children, which in turn share theirs
+void __t_materialize(T *t) {
+    T *code = (T *)t->structure.children;
+    t->context.flags &= ~TFLAG_COW;
+    t->structure.children = NULL;
+    int i,c = code->structure.child_count;
+    for(i=0;i<c;i++) {
+        T *k = code->structure.children[i];
+        __t_share_children(__t_rclone_node(k,t),k);
+    }
+}
+
+// make a run node copy of a node under the copy of its parent
+bool __t_rclone_pre(TreeWalk *w,TreeWalkFrame *f) {
+    T *t = f->t;
+    T *nt = f->data = __t_rclone_node(t,__t_walk_parent_data(w,f));
+    // a copy of a copy-on-write node can share the same code
+    if (t->context.flags & TFLAG_COW) {
+        __t_share_children(nt,t);
+        return false;
+    }
+    return true;
+}
+
+T *__t_rclone(T *t,T *p) {
+    return _t_walk(t,__t_rclone_pre,NULL,p);
+}
+
 /**
  * make a copy of a tree
  *
@@ -594,6 +1208,57 @@ T *_t_rclone(T *t) {
     return __t_rclone(t,0);
 }
 
+/**
+ * make a run tree copy of some code whose nodes only get copied as they are changed
+ *
+ * only the root node is copied, the rest of the code stays shared until something
+ * changes a node's children, at which point just those children get copied (sharing
+ * their own children in turn).  Reading the copy (dumping, hashing, matching and so on)
+ * follows the shared children without copying anything.  Reduction copies every node it
+ * descends into, which is all of the process code (both branches of an IF included), so
+ * the only parts that are skipped are the ones that are just data (see __p_inert), and
+ * those only get copied if a process takes them out of the tree as its result.  Filling a
+ * template only copies the parts of the code that have SLOTs in them.
+ *
+ * Anything that changes a node it found by reading a copy-on-write tree must make sure
+ * the node is a copy first, i.e. by reaching it through the tree's modifying functions
+ * (which copy as they go), or with __t_cow or _t_materialize.
+ *
+ * @param[in] t code to clone
+ * @returns T root of the run tree copy
+ *
+ * @note the code must not change or be freed while the copy or any run tree cloned
+ * from it is still around, which is the case for process definitions in a SemTable.
+ * Nodes detached from the copy get materialized (see _t_materialize) so results and
+ * signal bodies taken out of a run tree don't depend on the code.
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/tree_spec.h testTreeRcloneCow
+ */
+T *_t_rclone_cow(T *t) {
+    T *nt = __t_rclone_node(t,0);
+    __t_share_children(nt,t);
+    return nt;
+}
+
+// give a copy-on-write node copies of its children before the walk visits them
+bool __t_materialize_pre(TreeWalk *w,TreeWalkFrame *f) {
+    __t_cow(f->t);
+    return true;
+}
+
+/**
+ * copy any parts of a run tree that are still shared with code
+ *
+ * @param[in] t the tree, which afterwards no longer refers to any code
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/tree_spec.h testTreeRcloneCow
+ */
+void _t_materialize(T *t) {
+    _t_walk(t,__t_materialize_pre,NULL,NULL);
+}
+
 SemanticID _getBuildType(SemTable *sem,SemanticID param,Structure *stP,T **defP) {
     if (is_process(param)) {
         *defP = _sem_get_def(sem,param);
@@ -1024,7 +1689,7 @@ T *__t_find_actual(T *sem_map,Symbol actual_kind,T *replacement_kind) {
     x = _sl(g,actual_kind);
     T *mr;
     debug(D_TREE,"   trying to find a %s in sem_map\n",t2s(replacement_kind));
-    if (_t_matchr(stx,sem_map,&mr)) {
+    if (_stx_cached_match(stx,sem_map,&mr)) {
         result = _stx_get_matched_node(actual_kind,mr,sem_map,NULL);
         debug(D_TREE,"   re-mapping %s ->",t2s(replacement_kind));
         debug(D_TREE,"%s\n",t2s(result));
@@ -1048,6 +1713,11 @@ T *__t_find_actual(T *sem_map,Symbol actual_kind,T *replacement_kind) {
  */
 bool __t_fill_template(T *template, T *sem_map,bool as_run_node) {
     if (!template) return false;
+    // shared code that's known not to have any SLOTs has nothing to fill, otherwise
+    // the node's children are about to change so it needs its own copies
+    T *code = _t_cow_code(template);
+    if (code && (code->context.flags & TFLAG_INERT_KNOWN) && !(code->context.flags & TFLAG_SLOTS)) return false;
+    __t_cow(template);
     debug(D_TREE,"filling template:\n%s\n",__t2s(G_sem,template,INDENT));
     debug(D_TREE,"from sem_map:\n%s\n\n",__t2s(G_sem,sem_map,INDENT));
 
@@ -1165,9 +1835,7 @@ bool __t_fill_template(T *template, T *sem_map,bool as_run_node) {
                     }
                 }
                 if (children) {
-                    T *t;
-                    while(t = _t_detach_by_idx(children,1))
-                        _t_add(r,t);
+                    _t_move_children(r,children);
                     _t_free(children);
                 }
                 if (r) _t_replace_node(template,r);
@@ -1203,6 +1871,8 @@ bool __t_fill_template(T *template, T *sem_map,bool as_run_node) {
  * @returns number of children
  */
 int _t_children(T *t) {
+    // a copy-on-write node reads the same as the code it's sharing
+    if (t->context.flags & TFLAG_COW) t = (T *)t->structure.children;
     return t->structure.child_count;
 }
 
@@ -1213,7 +1883,7 @@ int _t_children(T *t) {
  * @returns pointer to node's surface
  */
 void * _t_surface(T *t) {
-    if (t->context.flags & (TFLAG_ALLOCATED|TFLAG_SURFACE_IS_TREE|TFLAG_SURFACE_IS_SCAPE|TFLAG_SURFACE_IS_CPTR))
+    if (t->context.flags & (TFLAG_ALLOCATED|TFLAG_SLICE|TFLAG_SURFACE_IS_TREE|TFLAG_SURFACE_IS_SCAPE|TFLAG_SURFACE_IS_CPTR))
         return t->contents.surface;
     else
         return &t->contents.surface;
@@ -1247,8 +1917,12 @@ size_t _t_size(T *t) {
  * @param[in] t the node
  * @param[in] i desired child
  * @returns child or NULL if that child doesn't exist
+ *
+ * @note the children of a copy-on-write node are still those of the code it's sharing
+ * (see _t_rclone_cow), so they are only for reading until t gets its own copies.
  */
 T *_t_child(T *t,int i) {
+    if (t->context.flags & TFLAG_COW) t = (T *)t->structure.children;
     if (i>t->structure.child_count || i < 1) return 0;
     return t->structure.children[i-1];
 }
@@ -1280,42 +1954,29 @@ T * _t_root(T *t) {
  *
  * @param[in] t the node
  * @returns the index of the node
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/tree_spec.h testTreeNodeIndex
  */
 int _t_node_index(T *t) {
-    int c;
-    int i;
     T *p = _t_parent(t);
     if (p==0) return 0;
-    c = _t_children(p);
-    for(i=0;i<c;i++) {
-        if (p->structure.children[i] == t) {
-            return i+1;
-        }
-    }
-    return 0;
+    return t->structure.index - __t_children_header(p->structure.children)->offset;
 }
 
 /**
- * Get a tree node's index position
+ * Get a tree node's next sibling
  *
  * @param[in] t the node
- * @returns the index of the node
+ * @returns the next sibling or NULL if t is the last child (or a root)
  *
- * @todo improve algorithm as this is very expensive if called all the time.
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/tree_spec.h testTreeNodeIndex
  */
 T * _t_next_sibling(T *t) {
-    int c;
-    int i;
     T *p = _t_parent(t);
     if (p==0) return 0;
-    c = _t_children(p);
-    for(i=0;i<c;i++) {
-        if (p->structure.children[i] == t) {
-            i++;
-            return i<c ? p->structure.children[i] : 0;
-        }
-    }
-    return 0;
+    return _t_child(p,_t_node_index(t)+1);
 }
 
 /**
@@ -1335,6 +1996,63 @@ T *__t_find(T *t,SemanticID sym,int start_child) {
     return NULL;
 }
 
+/*****************  Tree walking */
+
+/**
+ * walk a tree depth first calling visitors on the way down and back up each node
+ *
+ * the walk keeps its own stack of frames, which starts out on the C stack and moves to
+ * the heap only for deep trees, so walking a tree of any depth doesn't grow the C stack
+ * and costs no function calls beyond the visitors themselves.  A frame pointer is only
+ * valid for the duration of the call it's passed to, but the parent frame of f is f-1.
+ *
+ * @param[in] t the root of the tree to walk
+ * @param[in] pre visitor called before a node's children, which returns false to skip them (or NULL)
+ * @param[in] post visitor called after a node's children (or NULL), which may free the node
+ * @param[in] param value made available to the visitors as w->param
+ * @returns the data the visitors left in the root's frame
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/tree_spec.h testTreeWalk
+ */
+void *_t_walk(T *t,TreeVisitor pre,TreeVisitor post,void *param) {
+    TreeWalk w;
+    TreeWalkFrame *f = w.frames = w.stack;
+    w.size = TREE_WALK_STACK;
+    w.depth = 0;
+    w.param = param;
+
+    f->t = t;
+    f->i = 0;
+    f->data = NULL;
+    f->c = (!pre || (*pre)(&w,f)) ? _t_children(t) : 0;
+    while(1) {
+        if (f->i < f->c) {
+            T *k = _t_child(f->t,++f->i);
+            if (++w.depth == w.size) {
+                w.size *= 2;
+                if (w.frames == w.stack) {
+                    w.frames = malloc(sizeof(TreeWalkFrame)*w.size);
+                    memcpy(w.frames,w.stack,sizeof(w.stack));
+                }
+                else w.frames = realloc(w.frames,sizeof(TreeWalkFrame)*w.size);
+            }
+            f = &w.frames[w.depth];
+            f->t = k;
+            f->i = 0;
+            f->data = NULL;
+            f->c = (!pre || (*pre)(&w,f)) ? _t_children(k) : 0;
+        }
+        else {
+            if (post) (*post)(&w,f);
+            if (!w.depth) break;
+            f = &w.frames[--w.depth];
+        }
+    }
+    void *result = f->data;
+    if (w.frames != w.stack) free(w.frames);
+    return result;
+}
 
 /*****************  Tree path based accesses */
 /**
@@ -1393,7 +2111,7 @@ int * _t_get_path(T *t) {
     for(n=t;n;) {
         p[i] = _t_node_index(n);
         n =_t_parent(n);
-        if (++i >= s) {
+        if (++i >= s/sizeof(int)) {
             s*=2;p=realloc(p,s);} // realloc array if tree too deep
     }
     if (i > 2) {
@@ -1600,11 +2318,96 @@ T *_t_path_walk(T *t,int **pathP,int *lenP ) {
 
 /*****************  Tree hashing utilities */
 
+#define HASH_STACK_CHILDREN 32
+
+struct hash_walk {
+    SemTable *sem;
+    bool cached;            ///< if set, reuse and store the hashes cached in the nodes
+    TreeHash *hashes;       ///< hashes of the visited nodes whose parents haven't been hashed yet
+    int count;
+    int size;
+    TreeHash stack[HASH_STACK_CHILDREN];
+};
+
+TreeHash __t_hash(SemTable *sem,T *t,bool cached);
+
+void __t_hash_push(struct hash_walk *hw,TreeHash h) {
+    if (hw->count == hw->size) {
+        hw->size *= 2;
+        if (hw->hashes == hw->stack) {
+            hw->hashes = malloc(sizeof(TreeHash)*hw->size);
+            memcpy(hw->hashes,hw->stack,sizeof(hw->stack));
+        }
+        else hw->hashes = realloc(hw->hashes,sizeof(TreeHash)*hw->size);
+    }
+    hw->hashes[hw->count++] = h;
+}
+
+// nodes whose cached hash is still good don't need their children rehashed, and
+// cached hashing doesn't descend into code shared by copy-on-write nodes
+bool __t_hash_pre(TreeWalk *w,TreeWalkFrame *f) {
+    return !(((struct hash_walk *)w->param)->cached && (f->t->context.flags & (TFLAG_HASHED+TFLAG_COW)));
+}
+
+// hash a node from its surface or from its children's hashes, which are on the top of the stack
+bool __t_hash_post(TreeWalk *w,TreeWalkFrame *f) {
+    struct hash_walk *hw = w->param;
+    T *t = f->t;
+    if (hw->cached && (t->context.flags & TFLAG_HASHED)) {
+        __t_hash_push(hw,t->context.hash);
+        return true;
+    }
+    TreeHash result;
+    if (hw->cached && (t->context.flags & TFLAG_COW)) {
+        // the node hashes the same as the code, which mustn't be written to
+        result = __t_hash(hw->sem,_t_cow_code(t),false);
+        t->context.hash = result;
+        t->context.flags |= TFLAG_HASHED;
+        __t_hash_push(hw,result);
+        return true;
+    }
+    int c = _t_children(t);
+    // the symbol seeds the hash, with leaves and branches seeded differently
+    uint64_t seed = 0;
+    memcpy(&seed,&t->contents.symbol,sizeof(Symbol));
+    if (c == 0) {
+        void *surface = _t_surface(t);
+        size_t l = _d_get_symbol_size(hw->sem,t->contents.symbol,surface);
+        result = hashfn64(surface,l,seed);
+    }
+    else {
+        hw->count -= c;
+        result = hashfn64(&hw->hashes[hw->count],sizeof(TreeHash)*c,~seed);
+    }
+    // only cached hashing writes to the nodes, so plain hashing is safe on shared trees
+    if (hw->cached) {
+        t->context.hash = result;
+        t->context.flags |= TFLAG_HASHED;
+    }
+    __t_hash_push(hw,result);
+    return true;
+}
+
+TreeHash __t_hash(SemTable *sem,T *t,bool cached) {
+    struct hash_walk hw;
+    hw.sem = sem;
+    hw.cached = cached;
+    hw.hashes = hw.stack;
+    hw.count = 0;
+    hw.size = HASH_STACK_CHILDREN;
+    _t_walk(t,__t_hash_pre,__t_hash_post,&hw);
+    TreeHash h = hw.hashes[0];
+    if (hw.hashes != hw.stack) free(hw.hashes);
+    return h;
+}
+
 /**
  * reduce a tree to a hash value
  *
- * @param[in] symbols declarations of symbols
- * @param[in] structures definitions of structures
+ * the hash is computed from scratch without writing anything into the nodes, so it's
+ * safe to use on trees shared between threads, like the definitions in the SemTable
+ *
+ * @param[in] sem the semantic table
  * @param[in] t the tree to hash
  * @returns TreeHash value
  *
@@ -1612,39 +2415,47 @@ T *_t_path_walk(T *t,int **pathP,int *lenP ) {
  * @snippet spec/tree_spec.h testTreeHash
  */
 TreeHash _t_hash(SemTable *sem,T *t) {
-    int i,c = _t_children(t);
-    TreeHash result;
-    if (c == 0) {
-        struct {Symbol s;TreeHash h;} h;
-        void *surface = _t_surface(t);
-        h.s = _t_symbol(t);
-        //@todo fix this so we don't have keep doing this on the recursive calls...
-        size_t l = _d_get_symbol_size(sem,h.s,surface);
-        if (l > 0)
-            h.h = hashfn((char *)surface,l);
-        else
-            h.h = 0;
-        result = hashfn((char *)&h,sizeof(h));
-    }
-    else {
-        size_t l = sizeof(TreeHash)*c+sizeof(Symbol);
-        TreeHash *h,*hashes = malloc(l);
-        h = hashes;
-        for(i=1;i<=c;i++) {
-            *(h++) = _t_hash(sem,_t_child(t,i));
-        }
-        (*(Symbol *)h) = _t_symbol(t);
-        result = hashfn((char *)hashes,l);
-        free(hashes);
-    }
-    return result;
+    return __t_hash(sem,t,false);
+}
+
+/**
+ * reduce a tree to a hash value re-using the hashes cached in unchanged nodes
+ *
+ * changing a tree through the tree api clears the cached hash of the changed node and
+ * its ancestors, so rehashing only revisits the paths that changed.  Code that writes
+ * into a node's surface directly must call _t_touch on the node before using this.
+ * Because it stores the hashes in the nodes, only use this on trees that no other
+ * thread can be hashing or changing at the same time (i.e. not on SemTable definitions).
+ *
+ * @param[in] sem the semantic table
+ * @param[in] t the tree to hash
+ * @returns TreeHash value (the same as _t_hash would give)
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/tree_spec.h testTreeHashCached
+ */
+TreeHash _t_hash_cached(SemTable *sem,T *t) {
+    return __t_hash(sem,t,true);
+}
+
+/**
+ * mark that a node's surface was changed in place so its cached hash is stale
+ *
+ * @note _t_set_surface and _t_set_symbol already do this, so it's only needed when something
+ * other than the tree api has changed a node
+ *
+ * @param[in] t the node
+ */
+void _t_touch(T *t) {
+    __t_unhash(t);
 }
 
 /**
  * comparison function for hash tree equality
  *
  * we have this because TreeHash may become a larger structure
- * not subject to direct equality testing.
+ * not subject to direct equality testing.  For now it's 64 bits, so the chance of two
+ * different trees colliding is small enough for scapes to treat equal hashes as equal keys
  */
 int _t_hash_equal(TreeHash h1,TreeHash h2) {
     return h1 == h2;
@@ -1652,12 +2463,15 @@ int _t_hash_equal(TreeHash h1,TreeHash h2) {
 
 // scaffolding for uuid generator
 // for now we just use the current time
+// UUIDs generated in the same microsecond are told apart by a sequence number
+static uint64_t G_uuid_seq = 0;
+
 UUIDt __uuid_gen() {
     UUIDt u;
     struct timespec c;
     clock_gettime(CLOCK_MONOTONIC, &c);
     u.time = ((c.tv_sec * (1000000)) + (c.tv_nsec / 1000));
-    u.data = 0;
+    u.data = __sync_fetch_and_add(&G_uuid_seq,1);
     return u;
 }
 
@@ -1666,11 +2480,84 @@ int __uuid_equal(UUIDt *u1,UUIDt *u2) {
 };
 /*****************  Tree serialization */
 
-/// macro to write data by type into *bufferP and increment offset by the size of the type
-#define SWRITE(type,value) type * type##P = (type *)(*bufferP +offset); *type##P=value;offset += sizeof(type);
+struct serialize_walk {
+    char *buf;
+    size_t offset;                                      ///< end of the data in buf
+    size_t size;                                        ///< size of buf
+    int compact;
+    ssize_t (*write)(void *dest,void *data,size_t len); ///< where to flush buf to when streaming
+    void *dest;
+    size_t total;                                       ///< bytes flushed so far
+    int err;
+};
+
+bool __t_serialized_size_pre(TreeWalk *w,TreeWalkFrame *f) {
+    struct serialize_walk *sw = w->param;
+    sw->offset += _t_size(f->t)+(sw->compact ? 0 : sizeof(Symbol)+sizeof(int));
+    return true;
+}
 
 /**
- * Serialize a tree by recursive descent.
+ * Calculate the exact number of bytes a tree will serialize to.
+ *
+ * @param[in] sem current semantic contexts
+ * @param[in] t tree to be measured
+ * @param[in] compact boolean to indicate whether symbols and child counts will be left out
+ * @returns the serialized length of the tree
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/tree_spec.h testTreeSerialize
+ */
+size_t _t_serialized_size(SemTable *sem,T *t,int compact) {
+    struct serialize_walk sw = {0};
+    sw.compact = compact;
+    _t_walk(t,__t_serialized_size_pre,NULL,&sw);
+    return sw.offset;
+}
+
+// flush what's been buffered so far out to the stream's destination
+void __t_serialize_flush(struct serialize_walk *sw,void *data,size_t len) {
+    size_t done = 0;
+    while (!sw->err && done < len) {
+        ssize_t n = sw->write(sw->dest,data+done,len-done);
+        if (n <= 0) sw->err = n ? errno : EIO;
+        else done += n;
+    }
+    sw->total += done;
+}
+
+void __t_serialize_put(struct serialize_walk *sw,void *data,size_t len) {
+    if (sw->write && sw->offset+len > sw->size) {
+        __t_serialize_flush(sw,sw->buf,sw->offset);
+        sw->offset = 0;
+        // surfaces too big for the buffer go straight out
+        if (len > sw->size) {
+            __t_serialize_flush(sw,data,len);
+            return;
+        }
+    }
+    memcpy(sw->buf+sw->offset,data,len);
+    sw->offset += len;
+}
+
+bool __t_serialize_pre(TreeWalk *w,TreeWalkFrame *f) {
+    struct serialize_walk *sw = w->param;
+    T *t = f->t;
+    if (!sw->compact) {
+        Symbol s = _t_symbol(t);
+        int c = _t_children(t);
+        __t_serialize_put(sw,&s,sizeof(Symbol));
+        __t_serialize_put(sw,&c,sizeof(int));
+    }
+    size_t l = _t_size(t);
+    if (l) __t_serialize_put(sw,_t_surface(t),l);
+    return !sw->err;
+}
+
+/**
+ * Serialize a tree by walking it depth first.
+ *
+ * The tree is measured first so the buffer is grown at most once, to exactly the size needed.
  *
  * @param[in] d definitions
  * @param[in] t tree to be serialized
@@ -1678,34 +2565,17 @@ int __uuid_equal(UUIDt *u1,UUIDt *u2) {
  * @param[in] offset current offset into buffer at which to put serialized data
  * @param[in] current_size size of buffer
  * @param[in] compact boolean to indicate whether to add in extra information
- * @returns the length that was added to the buffer
+ * @returns the offset of the end of the serialized data in the buffer
  *
  * @todo compact is really a shorthand for whether this is a fixed size tree or not
  * this should actually be determined on the fly by looking at the structure types.
  */
 size_t __t_serialize(SemTable *sem,T *t,void **bufferP,size_t offset,size_t current_size,int compact){
-    size_t cl =0,l = _t_size(t);
-    int i, c = _t_children(t);
-
-    //    printf("\ncurrent_size:%ld offset:%ld  size:%ld symbol:%s",current_size,offset,l,_sem_get_name(sem,_t_symbol(t)));
-    while ((offset+l+sizeof(Symbol)) > current_size) {
-        current_size*=2;
-        *bufferP = realloc(*bufferP,current_size);
-    }
-    if (!compact) {
-        Symbol s = _t_symbol(t);
-        SWRITE(Symbol,s);
-        SWRITE(int,c);
-    }
-    if (l) {
-        memcpy(*bufferP+offset,_t_surface(t),l);
-        offset += l;
-    }
-
-    for(i=1;i<=c;i++) {
-        offset = __t_serialize(sem,_t_child(t,i),bufferP,offset,current_size,compact);
-    }
-    return offset;
+    size_t size = offset+_t_serialized_size(sem,t,compact);
+    if (size > current_size) *bufferP = realloc(*bufferP,size);
+    struct serialize_walk sw = {*bufferP,offset,size,compact};
+    _t_walk(t,__t_serialize_pre,NULL,&sw);
+    return sw.offset;
 }
 
 
@@ -1721,10 +2591,63 @@ size_t __t_serialize(SemTable *sem,T *t,void **bufferP,size_t offset,size_t curr
  * @snippet spec/tree_spec.h testTreeSerialize
  */
 void _t_serialize(SemTable *sem,T *t,void **surfaceP,size_t *lengthP) {
-    size_t buf_size = 1000;
-    *surfaceP = malloc(buf_size);
-    *lengthP = __t_serialize(sem,t,surfaceP,0,buf_size,0);
-    *surfaceP = realloc(*surfaceP,*lengthP);
+    *surfaceP = NULL;
+    *lengthP = __t_serialize(sem,t,surfaceP,0,0,0);
+}
+
+ssize_t __t_serialize_write_fd(void *dest,void *data,size_t len) {
+    ssize_t n;
+    while ((n = write(*(int *)dest,data,len)) < 0 && errno == EINTR);
+    return n;
+}
+
+ssize_t __t_serialize_write_stream(void *dest,void *data,size_t len) {
+    return _st_write((Stream *)dest,data,len);
+}
+
+ssize_t __t_serialize_out(SemTable *sem,T *t,ssize_t (*write)(void *,void *,size_t),void *dest) {
+    char buf[SERIALIZE_BUFFER_SIZE];
+    struct serialize_walk sw = {buf,0,SERIALIZE_BUFFER_SIZE,0,write,dest};
+    _t_walk(t,__t_serialize_pre,NULL,&sw);
+    __t_serialize_flush(&sw,buf,sw.offset);
+    if (sw.err) {
+        errno = sw.err;
+        return -1;
+    }
+    return sw.total;
+}
+
+/**
+ * Serialize a tree out to a stream.
+ *
+ * The tree is written through a fixed size buffer, so no memory is allocated no matter how big the tree is.
+ * The output is the same as _t_serialize's and can be read back with _t_unserialize.
+ *
+ * @param[in] sem current semantic contexts
+ * @param[in] t tree to be serialized
+ * @param[in] stream the stream to write to
+ * @returns the number of bytes written, or -1 on error with errno set
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/tree_spec.h testTreeSerializeStream
+ */
+ssize_t _t_serialize_stream(SemTable *sem,T *t,Stream *stream) {
+    return __t_serialize_out(sem,t,__t_serialize_write_stream,stream);
+}
+
+/**
+ * Serialize a tree out to a file descriptor.
+ *
+ * @param[in] sem current semantic contexts
+ * @param[in] t tree to be serialized
+ * @param[in] fd the file descriptor to write to
+ * @returns the number of bytes written, or -1 on error with errno set
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/tree_spec.h testTreeSerializeStream
+ */
+ssize_t _t_serialize_fd(SemTable *sem,T *t,int fd) {
+    return __t_serialize_out(sem,t,__t_serialize_write_fd,&fd);
 }
 
 /// macro to read typed date from the surface and update length and surface values
@@ -1732,63 +2655,99 @@ void _t_serialize(SemTable *sem,T *t,void **surfaceP,size_t *lengthP) {
 /// macro to read typed date from the surface and update length and surface values (assumes variable has already been declared)
 #define _SREAD(type,var_name) var_name = *(type *)*surfaceP;*lengthP -= sizeof(type);*surfaceP += sizeof(type);
 
+// a node being unserialized and how many of its children are still to come
+struct unserialize_frame {
+    T *t;
+    int c;
+};
+
 T * _t_unserialize(SemTable *sem,void **surfaceP,size_t *lengthP,T *t) {
     size_t size;
+    struct unserialize_frame stack[TREE_WALK_STACK],*frames = stack;
+    int depth = -1,frames_size = TREE_WALK_STACK;
+    T *root = NULL;
 
-    SREAD(Symbol,s);
-    //    printf("\nSymbol:%s",_sem_get_name(sem,s));
+    do {
+        T *p = depth < 0 ? t : frames[depth].t;
+        SREAD(Symbol,s);
+        //    printf("\nSymbol:%s",_sem_get_name(sem,s));
 
-    SREAD(int,c);
+        SREAD(int,c);
 
-    Structure st = _sem_get_symbol_structure(sem,s);
+        Structure st = _sem_get_symbol_structure(sem,s);
 
-    if (is_sys_structure(st)) {
-        size = _sys_structure_size(st.id,*surfaceP);
-        if (size == -1) {raise_error("BANG!");}
-    }
-    else size = 0;
-    if (size > 0) {
-        //    printf(" reading: %ld bytes\n",size);
-        if (semeq(st,INTEGER))
-            t = _t_newi(t,s,*(int *)*surfaceP);
-        else
-            t = _t_new(t,s,*surfaceP,size);
-        *lengthP -= size;
-        *surfaceP += size;
-    }
-    else {
-        t = _t_newr(t,s);
-    }
+        if (is_sys_structure(st)) {
+            size = _sys_structure_size(st.id,*surfaceP);
+            if (size == -1) {raise_error("BANG!");}
+        }
+        else size = 0;
+        T *n;
+        if (size > 0) {
+            //    printf(" reading: %ld bytes\n",size);
+            if (semeq(st,INTEGER))
+                n = _t_newi(p,s,*(int *)*surfaceP);
+            else
+                n = _t_new(p,s,*surfaceP,size);
+            *lengthP -= size;
+            *surfaceP += size;
+        }
+        else {
+            n = _t_newr(p,s);
+        }
+        if (!root) root = n;
+        if (depth >= 0) frames[depth].c--;
+
+        // the node's children come next, so it becomes the parent until they're done
+        if (c > 0) {
+            if (++depth == frames_size) {
+                frames_size *= 2;
+                if (frames == stack) {
+                    frames = malloc(sizeof(struct unserialize_frame)*frames_size);
+                    memcpy(frames,stack,sizeof(stack));
+                }
+                else frames = realloc(frames,sizeof(struct unserialize_frame)*frames_size);
+            }
+            frames[depth].t = n;
+            frames[depth].c = c;
+        }
+        while (depth >= 0 && frames[depth].c == 0) depth--;
+    } while (depth >= 0);
 
-    int i;
-    for(i=1;i<=c;i++) {
-        _t_unserialize(sem,surfaceP,lengthP,t);
-    }
-    return t;
+    if (frames != stack) free(frames);
+    return root;
 }
 
 
 #define _add_char2buf(c,buf) *buf=c;buf++;*buf=0
 
 #define _add_sem(buf,s) sprintf(buf,"{ \"ctx\":%d,\"type\":%d,\"id\":%d }",s.context,s.semtype,s.id);
-/**
- * dump tree in raw JSON format
- *
- * @param[in] sem the semantic context
- * @param[in] t the tree to dump
- * @param[in] level current level used for recursion (call with 0)
- * @param[in,out] buf buffer to dump into
- *
- * <b>Examples (from test suite):</b>
- * @snippet spec/tree_spec.h testTreeJSON
- */
-char * _t2rawjson(SemTable *sem,T *t,int level,char *buf) {
-    char *result = buf;
-    if (!t) return "";
+struct json_walk {
+    SemTable *sem;
+    int level;
+    char *buf;                                          ///< the end of the output so far
+    char *(*node)(SemTable *sem,T *t,int level,char *buf);
+};
+
+bool __t2json_pre(TreeWalk *w,TreeWalkFrame *f) {
+    struct json_walk *jw = w->param;
+    if (f != w->frames && f[-1].i > 1) {_add_char2buf(',',jw->buf);}
+    int l = _t_walk_level(w,f);
+    jw->buf = jw->node(jw->sem,f->t,jw->level < 0 ? jw->level-l : jw->level+l,jw->buf);
+    return true;
+}
+
+bool __t2json_post(TreeWalk *w,TreeWalkFrame *f) {
+    struct json_walk *jw = w->param;
+    if (f->c > 0) {_add_char2buf(']',jw->buf);}
+    _add_char2buf('}',jw->buf);
+    return true;
+}
+
+// write the raw JSON for just the node t, up to the start of its children, returns the end of buf
+char *__t2rawjson_node(SemTable *sem,T *t,int level,char *buf) {
     Symbol s = _t_symbol(t);
     char b[255];
     char tbuf[2000];
-    int i;
     char *c,cr;
     Xaddr x;
     buf = _indent_line(level,buf);
@@ -1874,32 +2833,22 @@ char * _t2rawjson(SemTable *sem,T *t,int level,char *buf) {
                 }
             default:
                 // other structures are composed so work automatically
-                if (st.id > _t_children(__sem_get_defs(sem,SEM_TYPE_STRUCTURE,st.context)))
+                if (st.id && !_sem_get_def(sem,st))
                     raise_error("don't know how to convert surface of %s, structure id %d seems invalid",_sem_get_name(sem,s),st.id);
 
             }
         }
     }
     buf += strlen(buf);
-    int _c = _t_children(t);
-    if ( _c > 0) {
+    if (_t_children(t) > 0) {
         sprintf(buf,",\"children\":[");
         buf += strlen(buf);
-        for(i=1;i<=_c;i++){
-            _t2rawjson(sem,_t_child(t,i),level < 0 ? level-1 : level+1,buf);
-            buf += strlen(buf);
-            if (i<_c) {
-                _add_char2buf(',',buf);
-            }
-        }
-        _add_char2buf(']',buf);
     }
-    _add_char2buf('}',buf);
-    return result;
+    return buf;
 }
 
 /**
- * dump tree in JSON format
+ * dump tree in raw JSON format
  *
  * @param[in] sem the semantic context
  * @param[in] t the tree to dump
@@ -1909,13 +2858,18 @@ char * _t2rawjson(SemTable *sem,T *t,int level,char *buf) {
  * <b>Examples (from test suite):</b>
  * @snippet spec/tree_spec.h testTreeJSON
  */
-char * _t2json(SemTable *sem,T *t,int level,char *buf) {
-    char *result = buf;
+char * _t2rawjson(SemTable *sem,T *t,int level,char *buf) {
     if (!t) return "";
+    struct json_walk jw = {sem,level,buf,__t2rawjson_node};
+    _t_walk(t,__t2json_pre,__t2json_post,&jw);
+    return buf;
+}
+
+// write the JSON for just the node t, up to the start of its children, returns the end of buf
+char *__t2json_node(SemTable *sem,T *t,int level,char *buf) {
     Symbol s = _t_symbol(t);
     char b[255];
     char tbuf[2000];
-    int i;
     char *c,cr;
     Xaddr x;
     buf = _indent_line(level,buf);
@@ -2031,21 +2985,29 @@ char * _t2json(SemTable *sem,T *t,int level,char *buf) {
         }
     }
     buf += strlen(buf);
-    int _c = _t_children(t);
-    if ( _c > 0) {
+    if (_t_children(t) > 0) {
         sprintf(buf,",\"children\":[");
         buf += strlen(buf);
-        for(i=1;i<=_c;i++){
-            _t2json(sem,_t_child(t,i),level < 0 ? level-1 : level+1,buf);
-            buf += strlen(buf);
-            if (i<_c) {
-                _add_char2buf(',',buf);
-            }
-        }
-        _add_char2buf(']',buf);
     }
-    _add_char2buf('}',buf);
-    return result;
+    return buf;
+}
+
+/**
+ * dump tree in JSON format
+ *
+ * @param[in] sem the semantic context
+ * @param[in] t the tree to dump
+ * @param[in] level current level used for recursion (call with 0)
+ * @param[in,out] buf buffer to dump into
+ *
+ * <b>Examples (from test suite):</b>
+ * @snippet spec/tree_spec.h testTreeJSON
+ */
+char * _t2json(SemTable *sem,T *t,int level,char *buf) {
+    if (!t) return "";
+    struct json_walk jw = {sem,level,buf,__t2json_node};
+    _t_walk(t,__t2json_pre,__t2json_post,&jw);
+    return buf;
 }
 
 // assumes that t is a CSTRING structured tree
@@ -2061,7 +3023,7 @@ int __t_writeln(T *t,Stream *stream) {
  * @param[in] sem current semantic contexts
  * @param[in] t the tree to write out
  * @param[in] stream the stream to write to
- * @returns unix error code, or number of bytes written
+ * @returns number of bytes written, or -1 on error (with errno set)
  */
 int _t_write(SemTable *sem,T *t,Stream *stream) {
     int err;
@@ -2070,10 +3032,13 @@ int _t_write(SemTable *sem,T *t,Stream *stream) {
         err = __t_writeln(t,stream);
     }
     else if (semeq(sym,LINES)) {
-        DO_KIDS(t,
-                err = __t_writeln(_t_child(t,i),stream);
-                if (err == 0) return 0;
-            );
+        // all the lines go out together in one vectored write
+        int c = _t_children(t);
+        char *buf[STREAM_IOV_MAX/2];
+        char **lines = (c <= STREAM_IOV_MAX/2) ? buf : malloc(sizeof(char *)*c);
+        DO_KIDS(t,lines[i-1] = _t_surface(_t_child(t,i)));
+        err = _st_writelns(stream,lines,c);
+        if (lines != buf) free(lines);
     }
     else {
         char *str;
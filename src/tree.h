@@ -25,11 +25,33 @@
 #include "ceptr_types.h"
 #include "stream.h"
 
-#define TREE_CHILDREN_BLOCK 5
+#define TREE_CHILDREN_BLOCK 4  ///< slots in the smallest children array, one of which holds its header
 #define TREE_PATH_TERMINATOR 0xFFFFFFFF
 
 enum TreeSurfaceFlags {TFLAG_ALLOCATED=0x0001,TFLAG_SURFACE_IS_TREE=0x0002,TFLAG_SURFACE_IS_RECEPTOR = 0x0004,TFLAG_SURFACE_IS_SCAPE=0x0008,TFLAG_SURFACE_IS_CPTR=0x0010,TFLAG_DELETED=0x0020,TFLAG_RUN_NODE=0x0040,TFLAG_REFERENCE=0x8000};
 
+// flags describing where a node's memory came from (see the run-tree arena section of tree.c)
+enum TreeArenaFlags {TFLAG_ARENA_NODE=0x0080,TFLAG_ARENA_CHILDREN=0x0100,TFLAG_ESCAPED=0x0200,TFLAG_ARENA_MIXED=0x0400,TFLAG_ARENA_BELOW=0x0800};
+#define TFLAG_ARENA_MASK (TFLAG_ARENA_NODE+TFLAG_ARENA_CHILDREN+TFLAG_ESCAPED+TFLAG_ARENA_MIXED+TFLAG_ARENA_BELOW)
+
+// flag marking that the hash cached in a node is up to date (see _t_hash_cached)
+enum TreeCacheFlags {TFLAG_HASHED=0x1000};
+
+// flag marking a run node whose children are still shared with the code it was cloned
+// from, in which case structure.children points at that code node (see _t_rclone_cow),
+// and flags caching whether shared code has anything in it to reduce or any SLOTs to
+// fill (see __p_mark_inert)
+enum TreeShareFlags {TFLAG_COW=0x2000,TFLAG_INERT_KNOWN=0x4000,TFLAG_INERT=0x10000,TFLAG_SLOTS=0x40000};
+#define TFLAG_SHARE_MASK (TFLAG_COW+TFLAG_INERT_KNOWN+TFLAG_INERT+TFLAG_SLOTS)
+// flag marking a surface that is a slice of a stream's read buffer rather than an allocation
+// of its own, so it gets released back to the stream when the node is freed (see __t_new_slice)
+enum TreeSliceFlags {TFLAG_SLICE=0x20000};
+
+#define _t_cow_code(t) (((t)->context.flags & TFLAG_COW) ? (T *)(t)->structure.children : NULL)
+void __t_materialize(T *t);
+// copy-on-write nodes get copies of their children before anything changes them
+#define __t_cow(t) if ((t)->context.flags & TFLAG_COW) {__t_materialize(t);}
+
 /*****************  Node creation and deletion*/
 T *__t_new(T *t,Symbol symbol, void *surface, size_t size,bool is_run_node);
 #define _t_new(p,sy,su,s) __t_new(p,sy,su,s,0)
@@ -42,6 +64,8 @@ T *__t_newi64(T *parent,Symbol symbol,long surface,bool is_run_node);
 T *__t_news(T *parent,Symbol symbol,SemanticID surface,bool is_run_node);
 #define _t_news(parent,symbol,surface) __t_news(parent,symbol,surface,0)
 T *_t_newt(T *parent,Symbol symbol,T *t);
+T *__t_new_slice(T *parent,Symbol symbol,char *slice,size_t size,bool is_run_node);
+void __t_unslice(T *t);
 #define _t_new_str(parent,symbol,str) __t_new_str(parent,symbol,str,0)
 T *__t_new_str(T *parent,Symbol symbol,char *str,bool is_run_node);
 T *_t_new_root(Symbol symbol);
@@ -53,6 +77,7 @@ T *_t_new_cptr(T *parent,Symbol symbol,void *s);
 T *_t_newp(T *parent,Symbol symbol,Process surface);
 
 void _t_add(T *t,T *c);
+void _t_move_children(T *t,T *from);
 void _t_detach_by_ptr(T *t,T *c);
 T *_t_detach_by_idx(T *t,int i);
 void _t_replace(T *t,int i,T *r);
@@ -61,11 +86,24 @@ T *_t_swap(T *t,int i,T *r);
 void _t_insert_at(T *t, int *path, T *i);
 void _t_morph(T *dst,T *src);
 void __t_morph(T *t,Symbol s,void *surface,size_t length,int allocate);
+void _t_set_surface(T *t,void *surface,size_t size);
+void _t_set_symbol(T *t,Symbol s);
 void __t_free_children(T *t);
 void __t_free(T *t);
 void _t_free(T *t);
 T *_t_clone(T *t);
 T *_t_rclone(T *t);
+T *_t_rclone_cow(T *t);
+void _t_materialize(T *t);
+
+/*****************  Run-tree arenas */
+Arena *_t_new_arena();
+void _t_release_arena(Arena *a);
+Arena *_t_use_arena(Arena *a);
+void _t_escape(T *t);
+void _t_free_with_arena(T *t,Arena *a);
+void __t_absorb(T *t,T *r);
+void __t_surface_owned(T *t);
 
 T *_t_build(SemTable *sem,T *t,...);
 T *_t_build2(SemTable *sem,T *t,...);
@@ -90,6 +128,10 @@ int _t_node_index(T *t);
 #define _t_find(t,sym) __t_find(t,sym,1)
 T *__t_find(T *t,Symbol sym,int start_child);
 
+/*****************  Tree walking */
+void *_t_walk(T *t,TreeVisitor pre,TreeVisitor post,void *param);
+#define _t_walk_level(w,f) ((f)-(w)->frames)
+
 /*****************  Tree path based accesses */
 int _t_path_equal(int *p1,int *p2);
 int _t_path_depth(int *p);
@@ -103,6 +145,8 @@ T * _t_path_walk(T *t,int **pathP,int *lenP );
 
 /*****************  Tree hashing utilities */
 TreeHash _t_hash(SemTable *sem,T *t);
+TreeHash _t_hash_cached(SemTable *sem,T *t);
+void _t_touch(T *t);
 int _t_hash_equal(TreeHash h1,TreeHash h2);
 
 /*****************  UUID utilities */
@@ -110,8 +154,12 @@ UUIDt __uuid_gen();
 int __uuid_equal(UUIDt *u1,UUIDt *u2);
 
 /*****************  Tree serialization */
+#define SERIALIZE_BUFFER_SIZE 4096
+size_t _t_serialized_size(SemTable *sem,T *t,int compact);
 size_t __t_serialize(SemTable *sem,T *t,void **bufferP,size_t offset,size_t current_size,int compact);
 void _t_serialize(SemTable *sem,T *t,void **surfaceP,size_t *sizeP);
+ssize_t _t_serialize_stream(SemTable *sem,T *t,Stream *stream);
+ssize_t _t_serialize_fd(SemTable *sem,T *t,int fd);
 T * _t_unserialize(SemTable *sem,void **surfaceP,size_t *lengthP,T *t);
 
 char * _t2rawjson(SemTable *sem,T *t,int level,char *buf);
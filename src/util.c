@@ -7,6 +7,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <stdlib.h>
 #include "ceptr_error.h"
 
@@ -100,6 +101,39 @@ void *readFile(char *fn,size_t *size) {
     return buffer;
 }
 
+/**
+ * map a file read-only into memory
+ *
+ * Pages are only read from disk as they are touched, so this costs about the same whatever
+ * the size of the file.  Release the mapping with unmapFile.
+ */
+void *mapFile(char *fn,size_t *size) {
+    struct stat stbuf;
+    int fd;
+
+    fd = open(fn, O_RDONLY);
+    if (fd == -1) {
+        raise_error("unable to open: %s",fn);
+    }
+
+    if ((fstat(fd, &stbuf) != 0) || (!S_ISREG(stbuf.st_mode))) {
+        close(fd);
+        raise_error("not a regular file: %s",fn);
+    }
+
+    *size = stbuf.st_size;
+    void *data = mmap(NULL,*size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        raise_error("unable to map %s: %d",fn,errno);
+    }
+    return data;
+}
+
+void unmapFile(void *data,size_t size) {
+    munmap(data,size);
+}
+
 uint64_t diff_micro(struct timespec *start, struct timespec *end)
 {
     /* us */
@@ -107,6 +141,13 @@ uint64_t diff_micro(struct timespec *start, struct timespec *end)
         ((start->tv_sec * 1000000) + (start->tv_nsec / 1000));
 }
 
+// current value of the monotonic clock in nanoseconds
+uint64_t monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec*1000000000LL + now.tv_nsec;
+}
+
 #define MS_PER_NANO_SECOND  1000000L  // 1 millisecond = 1,000,000 Nanoseconds
 
 void sleepms(long milliseconds) {
@@ -22,7 +22,10 @@ void hexDump(char *desc, void *addr, int len);
 int strcicmp(char const *a, char const *b);
 void writeFile(char *fn,void *data,size_t size);
 void *readFile(char *fn,size_t *size);
+void *mapFile(char *fn,size_t *size);
+void unmapFile(void *data,size_t size);
 uint64_t diff_micro(struct timespec *start, struct timespec *end);
+uint64_t monotonic_ns();
 void sleepms(long milliseconds);
 #define sleepns(ns) nanosleep((const struct timespec[]){{0, ns}}, NULL);
 void bin_to_strhex(unsigned char *bin, unsigned int binsz, char **result);
@@ -12,6 +12,8 @@
 #include "tree.h"
 #include "accumulator.h"
 #include "debug.h"
+#include "util.h"
+#include <errno.h>
 /******************  create and destroy virtual machine */
 
 
@@ -25,6 +27,16 @@ VMHost *__v_init(Receptor *r,SemTable *sem) {
     v->vm_thread.state = 0;
     v->clock_thread.state = 0;
     v->sem = sem;
+
+    Scheduler *s = &v->scheduler;
+    memset(s,0,sizeof(Scheduler));
+    pthread_mutex_init(&s->mutex, NULL);
+    pthread_cond_init(&s->cv, NULL);
+    s->workers = VMHOST_DEFAULT_WORKERS;
+    s->quantum = VMHOST_DEFAULT_QUANTUM_US;
+    // the vmhost's own receptor is scheduled too, so that signals sent with _v_send
+    // get delivered, and so that killing it wakes the workers
+    r->q->scheduler = s;
     return v;
 }
 
@@ -73,6 +85,10 @@ void _v_free(VMHost *v) {
     _s_free(v->installed_receptors);
     _t_free(_t_root(v->sem->stores[0].definitions));
     _sem_free(v->sem);
+    int i;
+    for(i=0;i<MAX_WORKERS;i++) free(v->scheduler.deques[i].qs);
+    pthread_mutex_destroy(&v->scheduler.mutex);
+    pthread_cond_destroy(&v->scheduler.cv);
     free(v);
 }
 
@@ -110,7 +126,7 @@ Xaddr _v_install_r(VMHost *v,Xaddr package,T *bindings,char *label) {
     raise_error("not implemented");
     T *p;// = _r_get_instance(v->c,package);
     T *id = _t_child(p,2);
-    TreeHash h = _t_hash(v->r->sem,id);
+    TreeHash h = _t_hash_cached(v->r->sem,id);
 
     // make sure we aren't re-installing an already installed receptor
     Xaddr x = _s_get(v->installed_receptors,h);
@@ -178,6 +194,12 @@ void _v_activate(VMHost *v, Xaddr x) {
     int c = v->active_receptor_count++;
     v->active_receptors[c].r=r;
     v->active_receptors[c].x=x;
+    // posters check for a scheduler under the inbox lock, so set it under that lock too
+    pthread_mutex_lock(&r->inbox_mutex);
+    r->q->scheduler = &v->scheduler;
+    pthread_mutex_unlock(&r->inbox_mutex);
+    // the receptor may already have work queued up from before it was activated
+    __p_mark_runnable(r->q);
 
     // handle special cases
     if (semeq(x.symbol,CLOCK_RECEPTOR)) {
@@ -229,6 +251,34 @@ void _v_send_signals(VMHost *v,T *signals) {
 /*     return result; */
 /* } */
 
+// find the receptor a signal is addressed to, fixing up any "self" addresses in the signal
+Receptor *__v_get_destination(VMHost *v, Receptor *sender, T *s) {
+    T *head = _t_getv(s,SignalMessageIdx,MessageHeadIdx,TREE_PATH_TERMINATOR);
+
+    T *to = _t_child(_t_child(head,HeadToIdx),1);
+    T *from = _t_child(_t_child(head,HeadFromIdx),1);
+    ReceptorAddress *toP = (ReceptorAddress *)_t_surface(to);
+    ReceptorAddress *fromP = (ReceptorAddress *)_t_surface(from);
+
+    // if the from or to address is "self" (-1) we find the senders self
+    // fix the values in the signal we are about to deliver.
+
+    if (fromP->addr == SELF_RECEPTOR_ADDR) {
+        ReceptorAddress self = __r_get_self_address(sender);
+        _t_set_surface(from,&self,sizeof(ReceptorAddress));
+    }
+
+    if (toP->addr == SELF_RECEPTOR_ADDR) {
+        ReceptorAddress self = __r_get_self_address(sender);
+        _t_set_surface(to,&self,sizeof(ReceptorAddress));
+        return sender;
+    }
+    if (toP->addr >= v->receptor_count) {
+        raise_error("to address: %d doesn't exist!",toP->addr);
+    }
+    return v->routing_table[toP->addr].r;
+}
+
 /**
  * scaffolding function for signal delivery
  */
@@ -237,67 +287,272 @@ void _v_deliver_signals(VMHost *v, Receptor *sender) {
 
     while(_t_children(signals)>0) {
         T *s = _t_detach_by_idx(signals,1);
-        T *head = _t_getv(s,SignalMessageIdx,MessageHeadIdx,TREE_PATH_TERMINATOR);
+        Receptor *r = __v_get_destination(v,sender,s);
+        Error err = _r_deliver(r,s);
+        if (err) {
+            raise_error("delivery error: %d",err);
+        }
+    }
+}
 
-        ReceptorAddress *toP = (ReceptorAddress *)_t_surface(_t_child(_t_child(head,HeadToIdx),1));
-        ReceptorAddress *fromP = (ReceptorAddress *)_t_surface(_t_child(_t_child(head,HeadFromIdx),1));
+/**
+ * hand a receptor's pending signals over to the receptors they are addressed to
+ *
+ * signals are left in the destination's inbox and the destination is marked runnable,
+ * so that the actual delivery happens on whichever worker owns the destination
+ * (receptors that haven't been activated are delivered to directly as no worker
+ * will ever own them, but under the inbox lock so that posters from different workers
+ * don't deliver to the same receptor at once)
+ */
+void __v_post_signals(VMHost *v, Receptor *sender) {
+    T *signals = sender->pending_signals;
 
-        // if the from or to address is "self" (-1) we find the senders self
-        // fix the values in the signal we are about to deliver.
+    while(_t_children(signals)>0) {
+        T *s = _t_detach_by_idx(signals,1);
+        Receptor *r = __v_get_destination(v,sender,s);
+        pthread_mutex_lock(&r->inbox_mutex);
+        if (!r->q->scheduler) {
+            Error err = _r_deliver(r,s);
+            pthread_mutex_unlock(&r->inbox_mutex);
+            if (err) {
+                raise_error("delivery error: %d",err);
+            }
+            continue;
+        }
+        _t_add(r->inbox,s);
+        pthread_mutex_unlock(&r->inbox_mutex);
+        __p_mark_runnable(r->q);
+    }
+}
 
-        if (fromP->addr == SELF_RECEPTOR_ADDR) {
-            *fromP = __r_get_self_address(sender);
+// deliver the signals waiting in a receptor's inbox, must be called by the worker owning the receptor
+void __v_deliver_inbox(Receptor *r) {
+    T *signals = _t_new_root(PENDING_SIGNALS);
+    pthread_mutex_lock(&r->inbox_mutex);
+    while(_t_children(r->inbox)>0) {
+        // take the whole inbox so senders aren't held up while we deliver
+        _t_move_children(signals,r->inbox);
+        pthread_mutex_unlock(&r->inbox_mutex);
+        while(_t_children(signals)>0) {
+            T *s = _t_detach_by_idx(signals,1);
+            Error err = _r_deliver(r,s);
+            if (err) {
+                raise_error("delivery error: %d",err);
+            }
         }
+        pthread_mutex_lock(&r->inbox_mutex);
+    }
+    pthread_mutex_unlock(&r->inbox_mutex);
+    _t_free(signals);
+}
+
+/**
+ * set the number of worker threads that will reduce receptors' queues in parallel
+ *
+ * must be called before the vmhost is started
+ *
+ * @param[in] v the VMHost
+ * @param[in] count number of workers (1 to MAX_WORKERS)
+ */
+void _v_set_workers(VMHost *v,int count) {
+    if (v->vm_thread.state) raise_error("can't change worker count of a running vmhost");
+    if (count < 1 || count > MAX_WORKERS) raise_error("worker count must be between 1 and %d",MAX_WORKERS);
+    v->scheduler.workers = count;
+}
 
-        Receptor *r;
-        if (toP->addr == SELF_RECEPTOR_ADDR) {
-            *toP = __r_get_self_address(sender);
+/**
+ * set the time slice a worker spends reducing a receptor's queue before moving on to the next
+ *
+ * each receptor gets its queue's weight times this quantum per turn
+ *
+ * @param[in] v the VMHost
+ * @param[in] quantum time slice in microseconds (0 to reduce each queue until it has no active processes)
+ */
+void _v_set_quantum(VMHost *v,uint64_t quantum) {
+    v->scheduler.quantum = quantum;
+}
+
+/**
+ * set the scheduling priority of a receptor
+ *
+ * @param[in] r the receptor
+ * @param[in] weight number of quanta the receptor gets per turn (at least 1)
+ */
+void _v_set_weight(Receptor *r,int weight) {
+    if (weight < 1) raise_error("weight must be at least 1");
+    r->q->weight = weight;
+}
+
+// check if a queue has processes to reduce or clean up (under the q's lock as other threads unblock its processes)
+bool __v_has_work(Q *q) {
+    pthread_mutex_lock(&q->mutex);
+    bool work = q->contexts_count > 0 || q->completed;
+    pthread_mutex_unlock(&q->mutex);
+    return work;
+}
+
+// mark runnable any active receptor that has work, in case a notification was missed
+void __v_sweep(VMHost *v) {
+    int i;
+    for (i=0;i<v->active_receptor_count;i++) {
+        Receptor *r = v->active_receptors[i].r;
+        pthread_mutex_lock(&r->inbox_mutex);
+        bool signals = _t_children(r->inbox) > 0;
+        pthread_mutex_unlock(&r->inbox_mutex);
+        if (signals || __v_has_work(r->q) || _t_children(r->pending_signals))
+            __p_mark_runnable(r->q);
+    }
+}
+
+/**
+ * get the next queue for a worker to run, blocking if there is none
+ *
+ * the worker first takes from its own deque, and if that's empty steals from the
+ * others.  If there's nothing anywhere it sleeps on the scheduler's condition
+ * variable (using no cpu) for at most SCHEDULER_WATCHDOG_MS, after which the
+ * first worker sweeps the active receptors for any work whose notification was missed.
+ *
+ * @param[in] v the VMHost
+ * @param[in] id the worker's index
+ * @returns the queue (now owned by the worker) or NULL if the wait timed out or the vmhost is dying
+ */
+Q *__v_next_runnable(VMHost *v,int id) {
+    Scheduler *s = &v->scheduler;
+    Q *q = NULL;
+    int i,timed_out = 0;
+
+    pthread_mutex_lock(&s->mutex);
+    if (!s->queued && __r_alive(v->r)) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += SCHEDULER_WATCHDOG_MS / 1000;
+        deadline.tv_nsec += (SCHEDULER_WATCHDOG_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
         }
-        else  {
-            if (toP->addr >= v->receptor_count) {
-                raise_error("to address: %d doesn't exist!",toP->addr);
+        s->idle_waits++;
+        while (!s->queued && __r_alive(v->r)) {
+            if (pthread_cond_timedwait(&s->cv, &s->mutex, &deadline) == ETIMEDOUT) {
+                timed_out = 1;
+                break;
             }
-            r = v->routing_table[toP->addr].r;
         }
+    }
+    if (s->queued && __r_alive(v->r)) {
+        q = __p_deque_take(&s->deques[id]);
+        for (i=1;!q && i<s->workers;i++) {
+            q = __p_deque_steal(&s->deques[(id+i)%s->workers]);
+            if (q) s->steals++;
+        }
+        if (q) {
+            uint64_t latency = monotonic_ns() - q->runnable_at;
+            s->queued--;
+            s->wakeups++;
+            s->deques[id].runs++;
+            s->total_latency += latency;
+            if (latency > s->max_latency) s->max_latency = latency;
+            q->sched_state = QRunning;
+        }
+    }
+    pthread_mutex_unlock(&s->mutex);
 
-        Error err = _r_deliver(r,s);
-        if (err) {
-            raise_error("delivery error: %d",err);
+    if (timed_out && id == 0) __v_sweep(v);
+    return q;
+}
+
+/**
+ * give up ownership of a queue after running it
+ *
+ * if the queue was marked runnable while it was being run, it goes back onto the
+ * end of the worker's deque
+ */
+void __v_release(VMHost *v,int id,Q *q) {
+    Scheduler *s = &v->scheduler;
+    pthread_mutex_lock(&s->mutex);
+    if (q->sched_state == QRerun) {
+        q->sched_state = QQueued;
+        q->runnable_at = monotonic_ns();
+        __p_deque_push(&s->deques[id],q);
+        s->queued++;
+        pthread_cond_signal(&s->cv);
+    }
+    else q->sched_state = QIdle;
+    pthread_mutex_unlock(&s->mutex);
+}
+
+/**
+ * do all the pending work of a receptor: deliver its incoming signals, reduce its
+ * processes, send on the signals they generated and clean up completed run-trees.
+ */
+void __v_run_receptor(VMHost *v,Receptor *r) {
+    Q *q = r->q;
+    __v_deliver_inbox(r);
+    __p_reduceq(q,v->scheduler.quantum*q->weight);
+
+    // send any signals generated by the reduction
+    __v_post_signals(v,r);
+
+    // cleanup any fully reduced run-trees (only this worker adds to the completed list)
+    if (q->completed) _p_cleanup(q);
+
+    // if the time slice ran out before the processes did, go to the back of the line
+    if (__v_has_work(q)) {
+        __p_mark_runnable(q);
+        __sync_add_and_fetch(&v->scheduler.preemptions,1);
+    }
+}
+
+/**
+ * main loop for a worker thread of the vmhost's pool
+ */
+void *__v_worker(void *arg) {
+    Worker *w = (Worker *) arg;
+    VMHost *v = w->v;
+    G_worker = w->id;
+
+    while(__r_alive(v->r)) {
+        Q *q = __v_next_runnable(v,w->id);
+        if (q) {
+            __v_run_receptor(v,q->r);
+            __v_release(v,w->id,q);
         }
     }
+    return NULL;
 }
 
 /**
  * this is the VMhost main monitoring and execution thread
+ *
+ * it starts up the pool of worker threads and then itself acts as worker 0.  Workers
+ * pull runnable receptors' queues from their own deques or steal them from each other,
+ * and sleep when there's nothing to do.  Receptors' queues become runnable when
+ * processes are added or unblocked, or when signals are sent to or from them.
  */
 void *__v_process(void *arg) {
     VMHost *v = (VMHost *) arg;
-    int c,i;
-
-    while(v->r->state == Alive) {
-        // make sure everybody's doing the right thing...
-        // reallocate threads as necessary...
-        // do edge-receptor type stuff..
-        // what ever other watchdoggy type things are necessary...
-        //        printf ("something\n");
-        //    sleep(1);
-
-        // for now we will check all receptors for any active contexts and
-        // we will reduce them here.  Really this should be a thread pool manager
-        // where we put allocate receptor's queues for processing according to
-        // priority/etc...
-
-        for (i=0;v->r->state == Alive && i<v->active_receptor_count;i++) {
-            Receptor *r = v->active_receptors[i].r;
-            if (r->q && r->q->contexts_count > 0) {
-                _p_reduceq(r->q);
-            }
-            // send any signals generated by the reduction
-            _v_deliver_signals(v,r);
+    Scheduler *s = &v->scheduler;
+    int i,j;
+
+    // queues that became runnable before we started have been waiting on us, not on the
+    // scheduler, so restart their clocks to keep the latency stats meaningful
+    pthread_mutex_lock(&s->mutex);
+    uint64_t now = monotonic_ns();
+    for (i=0;i<s->workers;i++) {
+        RunDeque *d = &s->deques[i];
+        for (j=0;j<d->count;j++) d->qs[(d->head+j)%d->size]->runnable_at = now;
+    }
+    pthread_mutex_unlock(&s->mutex);
 
-            // cleanup any fully reduced run-trees
-            if (r->q->completed) _p_cleanup(r->q);
-        }
+    for (i=0;i<s->workers;i++) {
+        v->workers[i].v = v;
+        v->workers[i].id = i;
+        v->workers[i].thread.state = 0;
+        if (i) _v_start_thread(&v->workers[i].thread,__v_worker,&v->workers[i]);
+    }
+    __v_worker(&v->workers[0]);
+    for (i=1;i<s->workers;i++) {
+        _v_join_thread(&v->workers[i].thread);
     }
 
     // close down all receptors
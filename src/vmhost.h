@@ -34,6 +34,22 @@ typedef struct ReceptorRoute {
 
 #define MAX_ACTIVE_RECEPTORS 1000
 #define MAX_RECEPTORS 1000
+
+/// longest time the scheduler sleeps without a notification before re-checking the receptors
+#define SCHEDULER_WATCHDOG_MS 1000
+/// number of worker threads reducing receptors unless changed with _v_set_workers
+#define VMHOST_DEFAULT_WORKERS 1
+/// time slice (in microseconds) a worker reduces a receptor for before moving on to the next one
+#define VMHOST_DEFAULT_QUANTUM_US 5000
+
+typedef struct VMHost VMHost;
+
+// a worker thread of the vmhost's pool
+typedef struct Worker {
+    VMHost *v;
+    int id;                     ///< index of the worker, and of its deque in the scheduler
+    thread thread;
+} Worker;
 /**
  * VMHost holds all the data for an active virtual machine host
  */
@@ -49,8 +65,9 @@ struct VMHost {
     thread clock_thread;
     int process_state;
     char *dir;
+    Scheduler scheduler;        ///< run deques for the worker pool, notified by the receptors' queues
+    Worker workers[MAX_WORKERS];
 };
-typedef struct VMHost VMHost;
 
 /******************  create and destroy virtual machine */
 VMHost *__v_init(Receptor *r,SemTable *sem);
@@ -66,6 +83,17 @@ void _v_send_signals(VMHost *v,T *signals);
 
 void _v_deliver_signals(VMHost *v, Receptor *sender);
 
+void _v_set_workers(VMHost *v,int count);
+void _v_set_quantum(VMHost *v,uint64_t quantum);
+void _v_set_weight(Receptor *r,int weight);
+Receptor *__v_get_destination(VMHost *v, Receptor *sender, T *s);
+void __v_post_signals(VMHost *v, Receptor *sender);
+void __v_deliver_inbox(Receptor *r);
+bool __v_has_work(Q *q);
+Q *__v_next_runnable(VMHost *v,int id);
+void __v_release(VMHost *v,int id,Q *q);
+void __v_run_receptor(VMHost *v,Receptor *r);
+void *__v_worker(void *arg);
 void * __v_process(void *arg);
 
 void _v_instantiate_builtins(VMHost *v);